@@ -0,0 +1,786 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the blake3.h API following the BLAKE3 specification and
+ * its reference implementation's incremental tree hashing.
+ *
+ * Input is added to the tree as the largest power of 2 number of chunks that
+ * keeps the tree aligned, these subtrees are hashed by subtree_cv() which
+ * splits them in half, handing one half to a new thread while there are
+ * threads left, and hashes 16 chunks at a time in SIMD lanes at the bottom.
+ * The chaining values of finished subtrees wait on a stack and are merged
+ * lazily since the last node must be finalized as the root.
+ */
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blake3.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * number of chunks compressed side by side
+ */
+#define LANES 16
+
+
+/**
+ * bytes in a block, 16 blocks to a chunk
+ */
+#define BLOCK_LEN 64
+
+
+/**
+ * bytes in a chaining value
+ */
+#define CV_LEN 32
+
+
+/**
+ * domain separation flags
+ */
+#define CHUNK_START 1
+#define CHUNK_END   2
+#define PARENT      4
+#define ROOT        8
+
+
+/**
+ * smallest subtree worth handing to another thread
+ */
+#define PARALLEL_MIN (1024 * 1024)
+
+
+/**
+ * cloned compression functions need an x86 GCC, @see digest_mb.c
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+        && !defined(__clang__)
+#define MB_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define MB_CLONES
+#endif
+
+
+#define ROTR(_x, _n) (((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+
+/**
+ * the quarter round, works on both scalars and vectors
+ */
+#define G(_v, _a, _b, _c, _d, _x, _y)                                          \
+    do {                                                                       \
+        (_v)[_a] = (_v)[_a] + (_v)[_b] + (_x);                                 \
+        (_v)[_d] = ROTR((_v)[_d] ^ (_v)[_a], 16);                              \
+        (_v)[_c] = (_v)[_c] + (_v)[_d];                                        \
+        (_v)[_b] = ROTR((_v)[_b] ^ (_v)[_c], 12);                              \
+        (_v)[_a] = (_v)[_a] + (_v)[_b] + (_y);                                 \
+        (_v)[_d] = ROTR((_v)[_d] ^ (_v)[_a], 8);                               \
+        (_v)[_c] = (_v)[_c] + (_v)[_d];                                        \
+        (_v)[_b] = ROTR((_v)[_b] ^ (_v)[_c], 7);                               \
+    } while (0)
+
+
+/**
+ * one round mixing the columns then the diagonals with message schedule `_s`
+ */
+#define ROUND(_v, _m, _s)                                                      \
+    do {                                                                       \
+        G(_v, 0, 4,  8, 12, (_m)[(_s)[0]],  (_m)[(_s)[1]]);                    \
+        G(_v, 1, 5,  9, 13, (_m)[(_s)[2]],  (_m)[(_s)[3]]);                    \
+        G(_v, 2, 6, 10, 14, (_m)[(_s)[4]],  (_m)[(_s)[5]]);                    \
+        G(_v, 3, 7, 11, 15, (_m)[(_s)[6]],  (_m)[(_s)[7]]);                    \
+        G(_v, 0, 5, 10, 15, (_m)[(_s)[8]],  (_m)[(_s)[9]]);                    \
+        G(_v, 1, 6, 11, 12, (_m)[(_s)[10]], (_m)[(_s)[11]]);                   \
+        G(_v, 2, 7,  8, 13, (_m)[(_s)[12]], (_m)[(_s)[13]]);                   \
+        G(_v, 3, 4,  9, 14, (_m)[(_s)[14]], (_m)[(_s)[15]]);                   \
+    } while (0)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * one 32 bit word from each of the chunks hashed side by side
+ */
+typedef uint32_t vec_t __attribute__((vector_size(LANES * sizeof(uint32_t))));
+
+
+/**
+ * everything needed to compress a node, chunk or parent, for either its
+ * chaining value or as the root
+ */
+struct output {
+    uint32_t cv[8];             /**< input chaining value */
+    uint8_t block[BLOCK_LEN];   /**< last block, zero padded */
+    uint64_t counter;           /**< chunk index, 0 for parents */
+    uint32_t len;               /**< # of valid bytes in block */
+    uint32_t flags;             /**< domain separation flags */
+};
+
+
+/**
+ * half of a subtree hashed by another thread
+ */
+struct task {
+    const uint8_t *input;       /**< first byte of the subtree */
+    size_t len;                 /**< # of bytes in the subtree */
+    uint64_t counter;           /**< index of the subtree's first chunk */
+    int depth;                  /**< # of times the subtree may be split */
+    uint8_t cv[CV_LEN];         /**< resulting chaining value */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * compress `block` into the chaining value `cv` in place
+ */
+static void compress(uint32_t cv[8], const uint8_t *block, uint64_t counter,
+        uint32_t len, uint32_t flags);
+
+
+/**
+ * compress one block of each lane, `cv` and `w` are rows of LANES words
+ */
+static void compress_lanes(uint32_t *cv, const uint32_t *w,
+        const uint32_t *lo, const uint32_t *hi, uint32_t flags);
+
+
+/**
+ * chaining values of LANES consecutive full chunks
+ */
+static void chunks_cv(const uint8_t *input, uint64_t counter, uint8_t *cvs);
+
+
+/**
+ * chaining value of a single full chunk
+ */
+static void chunk_cv(const uint8_t *input, uint64_t counter, uint8_t *cv);
+
+
+/**
+ * chaining value of the parent of 2 nodes
+ */
+static void parent_cv(const uint8_t *left, const uint8_t *right, uint8_t *cv);
+
+
+/**
+ * chaining value of the subtree of `len` bytes, a power of 2 number of chunks
+ */
+static void subtree_cv(const uint8_t *input, size_t len, uint64_t counter,
+        int depth, uint8_t *cv);
+
+
+/**
+ * chaining values of both halves of a subtree, the left half is hashed by a
+ * new thread when `depth` allows and the subtree is large enough
+ */
+static void subtree_halves(const uint8_t *input, size_t len, uint64_t counter,
+        int depth, uint8_t *cvs);
+
+
+/**
+ * pthread entry point for struct task
+ */
+static void *subtree_task(void *task);
+
+
+/**
+ * add bytes to the tree, the same as the reference blake3_hasher_update
+ */
+static void tree_update(blake3_ctx_t *ctx, const uint8_t *input, size_t len);
+
+
+/**
+ * add bytes to the current chunk, never more than completes it
+ */
+static void chunk_update(blake3_ctx_t *ctx, const uint8_t *input, size_t len);
+
+
+/**
+ * @return the output node of the current chunk
+ */
+static struct output chunk_output(const blake3_ctx_t *ctx);
+
+
+/**
+ * start the chunk with index `counter`
+ */
+static void chunk_reset(blake3_ctx_t *ctx, uint64_t counter);
+
+
+/**
+ * merge completed subtrees, then push `cv` onto the stack
+ */
+static void push_cv(blake3_ctx_t *ctx, const uint8_t *cv, uint64_t chunks);
+
+
+/**
+ * merge subtrees until the stack holds one per bit set in `chunks`
+ */
+static void merge_stack(blake3_ctx_t *ctx, uint64_t chunks);
+
+
+/**
+ * @return the number of times subtrees may be split between threads
+ */
+static int thread_depth(void);
+
+
+static uint32_t load32(const uint8_t *p);
+static void store32(uint8_t *p, uint32_t w);
+static void store_cv(uint8_t *dest, const uint32_t cv[8]);
+
+
+/* Private Variables **********************************************************/
+
+
+static const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+
+/**
+ * message word order of each round, the permutation applied repeatedly
+ */
+static const uint8_t SCHEDULE[7][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    {  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+    {  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+    { 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+    { 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+    {  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+    { 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 }
+};
+
+
+/**
+ * max threads per hash, 0 until set or looked up
+ */
+static size_t THREADS = 0;
+
+
+/* Public Impl ****************************************************************/
+
+
+void blake3_set_threads(size_t threads)
+{
+    THREADS = threads > 0? threads : 1;
+}
+
+
+void blake3_init(blake3_ctx_t *ctx)
+{
+    chunk_reset(ctx, 0);
+    ctx->stack_len = 0;
+    ctx->total = 0;
+    ctx->stage = NULL;
+    ctx->stage_len = 0;
+}
+
+
+void blake3_update(blake3_ctx_t *ctx, const void *data, size_t len)
+{
+    const uint8_t *input;
+    size_t n;
+
+    input = data;
+
+    /* without threads there is nothing to gain from collecting bytes */
+    if (thread_depth() == 0)
+    {
+        tree_update(ctx, input, len);
+        return;
+    }
+
+    while (len > 0)
+    {
+        if (ctx->stage == NULL)
+        {
+            /* small files are hashed as they come, no memory is allocated */
+            if (ctx->total < BLAKE3_STAGE_SIZE)
+            {
+                n = BLAKE3_STAGE_SIZE - ctx->total < len?
+                        BLAKE3_STAGE_SIZE - ctx->total : len;
+                tree_update(ctx, input, n);
+                ctx->total += n;
+                input += n;
+                len -= n;
+                continue;
+            }
+
+            if ((ctx->stage = malloc(BLAKE3_STAGE_SIZE)) == NULL)
+            {
+                tree_update(ctx, input, len);
+                ctx->total += len;
+                return;
+            }
+        }
+
+        /* large updates need not be copied */
+        if (ctx->stage_len == 0 && len >= BLAKE3_STAGE_SIZE)
+            n = BLAKE3_STAGE_SIZE;
+        else
+        {
+            n = BLAKE3_STAGE_SIZE - ctx->stage_len < len?
+                    BLAKE3_STAGE_SIZE - ctx->stage_len : len;
+            memcpy(ctx->stage + ctx->stage_len, input, n);
+            ctx->stage_len += n;
+        }
+
+        if (ctx->stage_len == 0)
+            tree_update(ctx, input, n);
+        else if (ctx->stage_len == BLAKE3_STAGE_SIZE)
+        {
+            tree_update(ctx, ctx->stage, ctx->stage_len);
+            ctx->stage_len = 0;
+        }
+
+        ctx->total += n;
+        input += n;
+        len -= n;
+    }
+}
+
+
+void blake3_final(blake3_ctx_t *ctx, unsigned char *md)
+{
+    struct output out;
+    uint8_t block[BLOCK_LEN];
+    size_t remaining;
+
+    if (ctx->stage_len > 0)
+        tree_update(ctx, ctx->stage, ctx->stage_len);
+    blake3_cleanup(ctx);
+
+    /* merge the current chunk with every subtree on the stack, right to left,
+     * without a partial chunk the last 2 subtrees form the rightmost node */
+    if (ctx->stack_len == 0 || ctx->buf_len > 0 || ctx->blocks > 0)
+    {
+        out = chunk_output(ctx);
+        remaining = ctx->stack_len;
+    }
+    else
+    {
+        remaining = ctx->stack_len - 2;
+        memcpy(out.cv, IV, sizeof(out.cv));
+        memcpy(out.block, ctx->stack + remaining * CV_LEN, BLOCK_LEN);
+        out.counter = 0;
+        out.len = BLOCK_LEN;
+        out.flags = PARENT;
+    }
+
+    while (remaining > 0)
+    {
+        remaining--;
+        memcpy(block, ctx->stack + remaining * CV_LEN, CV_LEN);
+        compress(out.cv, out.block, out.counter, out.len, out.flags);
+        store_cv(block + CV_LEN, out.cv);
+
+        memcpy(out.cv, IV, sizeof(out.cv));
+        memcpy(out.block, block, BLOCK_LEN);
+        out.counter = 0;
+        out.len = BLOCK_LEN;
+        out.flags = PARENT;
+    }
+
+    /* the root is always compressed with a counter of 0 */
+    compress(out.cv, out.block, 0, out.len, out.flags | ROOT);
+    store_cv(md, out.cv);
+}
+
+
+void blake3_cleanup(blake3_ctx_t *ctx)
+{
+    free(ctx->stage);
+    ctx->stage = NULL;
+    ctx->stage_len = 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void tree_update(blake3_ctx_t *ctx, const uint8_t *input, size_t len)
+{
+    struct output out;
+    uint8_t cvs[2 * CV_LEN];
+    size_t take, sublen;
+    uint64_t chunks;
+
+    if (len == 0)
+        return;
+
+    /* finish a partial chunk first */
+    if (ctx->buf_len > 0 || ctx->blocks > 0)
+    {
+        take = BLAKE3_CHUNK_LEN - (ctx->blocks * BLOCK_LEN + ctx->buf_len);
+        take = take < len? take : len;
+        chunk_update(ctx, input, take);
+        input += take;
+        len -= take;
+        if (len == 0)
+            return;
+
+        /* the chunk is full and more is coming, it cannot be the root */
+        out = chunk_output(ctx);
+        compress(out.cv, out.block, out.counter, out.len, out.flags);
+        store_cv(cvs, out.cv);
+        push_cv(ctx, cvs, ctx->counter);
+        chunk_reset(ctx, ctx->counter + 1);
+    }
+
+    /* hash whole subtrees while there is more than one chunk, the last chunk
+     * stays in the chunk state in case it is the root */
+    while (len > BLAKE3_CHUNK_LEN)
+    {
+        sublen = (size_t) 1 << (63 - __builtin_clzll(len));
+        while (((sublen - 1) & (ctx->counter * BLAKE3_CHUNK_LEN)) != 0)
+            sublen /= 2;
+        chunks = sublen / BLAKE3_CHUNK_LEN;
+
+        if (chunks == 1)
+        {
+            chunk_cv(input, ctx->counter, cvs);
+            push_cv(ctx, cvs, ctx->counter);
+        }
+        else
+        {
+            subtree_halves(input, sublen, ctx->counter, thread_depth(), cvs);
+            push_cv(ctx, cvs, ctx->counter);
+            push_cv(ctx, cvs + CV_LEN, ctx->counter + chunks / 2);
+        }
+
+        ctx->counter += chunks;
+        input += sublen;
+        len -= sublen;
+    }
+
+    if (len > 0)
+    {
+        chunk_update(ctx, input, len);
+        merge_stack(ctx, ctx->counter);
+    }
+}
+
+
+void chunk_update(blake3_ctx_t *ctx, const uint8_t *input, size_t len)
+{
+    size_t take;
+
+    if (ctx->buf_len > 0)
+    {
+        take = (size_t) (BLOCK_LEN - ctx->buf_len);
+        take = take < len? take : len;
+        memcpy(ctx->buf + ctx->buf_len, input, take);
+        ctx->buf_len += take;
+        input += take;
+        len -= take;
+
+        if (len > 0)
+        {
+            compress(ctx->cv, ctx->buf, ctx->counter, BLOCK_LEN,
+                    ctx->blocks == 0? CHUNK_START : 0);
+            ctx->blocks++;
+            ctx->buf_len = 0;
+            memset(ctx->buf, 0, BLOCK_LEN);
+        }
+    }
+
+    while (len > BLOCK_LEN)
+    {
+        compress(ctx->cv, input, ctx->counter, BLOCK_LEN,
+                ctx->blocks == 0? CHUNK_START : 0);
+        ctx->blocks++;
+        input += BLOCK_LEN;
+        len -= BLOCK_LEN;
+    }
+
+    memcpy(ctx->buf + ctx->buf_len, input, len);
+    ctx->buf_len += len;
+}
+
+
+struct output chunk_output(const blake3_ctx_t *ctx)
+{
+    struct output out;
+
+    memcpy(out.cv, ctx->cv, sizeof(out.cv));
+    memcpy(out.block, ctx->buf, BLOCK_LEN);
+    out.counter = ctx->counter;
+    out.len = ctx->buf_len;
+    out.flags = CHUNK_END | (ctx->blocks == 0? CHUNK_START : 0);
+    return out;
+}
+
+
+void chunk_reset(blake3_ctx_t *ctx, uint64_t counter)
+{
+    memcpy(ctx->cv, IV, sizeof(ctx->cv));
+    ctx->counter = counter;
+    memset(ctx->buf, 0, BLOCK_LEN);
+    ctx->buf_len = 0;
+    ctx->blocks = 0;
+}
+
+
+void push_cv(blake3_ctx_t *ctx, const uint8_t *cv, uint64_t chunks)
+{
+    merge_stack(ctx, chunks);
+    memcpy(ctx->stack + ctx->stack_len * CV_LEN, cv, CV_LEN);
+    ctx->stack_len++;
+}
+
+
+void merge_stack(blake3_ctx_t *ctx, uint64_t chunks)
+{
+    uint8_t *top;
+
+    while (ctx->stack_len > (size_t) __builtin_popcountll(chunks))
+    {
+        top = ctx->stack + (ctx->stack_len - 2) * CV_LEN;
+        parent_cv(top, top + CV_LEN, top);
+        ctx->stack_len--;
+    }
+}
+
+
+void subtree_cv(const uint8_t *input, size_t len, uint64_t counter, int depth,
+        uint8_t *cv)
+{
+    uint8_t cvs[LANES * CV_LEN];
+    size_t n, i;
+
+    if (len == BLAKE3_CHUNK_LEN)
+        chunk_cv(input, counter, cv);
+
+    /* the bottom of the tree, hash the chunks in lanes and merge them */
+    else if (len == LANES * BLAKE3_CHUNK_LEN)
+    {
+        chunks_cv(input, counter, cvs);
+        for (n = LANES; n > 1; n /= 2)
+            for (i = 0; i < n / 2; i++)
+                parent_cv(cvs + 2 * i * CV_LEN, cvs + (2 * i + 1) * CV_LEN,
+                        cvs + i * CV_LEN);
+        memcpy(cv, cvs, CV_LEN);
+    }
+
+    else
+    {
+        subtree_halves(input, len, counter, depth, cvs);
+        parent_cv(cvs, cvs + CV_LEN, cv);
+    }
+}
+
+
+void subtree_halves(const uint8_t *input, size_t len, uint64_t counter,
+        int depth, uint8_t *cvs)
+{
+    struct task left;
+    pthread_t thread;
+    size_t half;
+    int threaded;
+
+    half = len / 2;
+    left.input = input;
+    left.len = half;
+    left.counter = counter;
+    left.depth = depth > 0? depth - 1 : 0;
+
+    threaded = depth > 0 && len >= PARALLEL_MIN &&
+            pthread_create(&thread, NULL, &subtree_task, &left) == 0;
+    if (!threaded)
+        subtree_task(&left);
+
+    subtree_cv(input + half, half, counter + half / BLAKE3_CHUNK_LEN,
+            left.depth, cvs + CV_LEN);
+
+    if (threaded)
+        pthread_join(thread, NULL);
+    memcpy(cvs, left.cv, CV_LEN);
+}
+
+
+void *subtree_task(void *task)
+{
+    struct task *t = task;
+
+    subtree_cv(t->input, t->len, t->counter, t->depth, t->cv);
+    return NULL;
+}
+
+
+void chunk_cv(const uint8_t *input, uint64_t counter, uint8_t *cv)
+{
+    uint32_t h[8];
+    int i;
+
+    memcpy(h, IV, sizeof(h));
+    for (i = 0; i < BLAKE3_CHUNK_LEN / BLOCK_LEN; i++)
+        compress(h, input + i * BLOCK_LEN, counter, BLOCK_LEN,
+                (i == 0? CHUNK_START : 0) |
+                (i == BLAKE3_CHUNK_LEN / BLOCK_LEN - 1? CHUNK_END : 0));
+    store_cv(cv, h);
+}
+
+
+void chunks_cv(const uint8_t *input, uint64_t counter, uint8_t *cvs)
+{
+    uint32_t h[8 * LANES];
+    uint32_t w[16 * LANES];
+    uint32_t lo[LANES];
+    uint32_t hi[LANES];
+    const uint8_t *p;
+    size_t b, j, k;
+
+    for (j = 0; j < LANES; j++)
+    {
+        for (k = 0; k < 8; k++)
+            h[k * LANES + j] = IV[k];
+        lo[j] = (uint32_t) (counter + j);
+        hi[j] = (uint32_t) ((counter + j) >> 32);
+    }
+
+    for (b = 0; b < BLAKE3_CHUNK_LEN / BLOCK_LEN; b++)
+    {
+        /* gather block `b` of every chunk, one word per row */
+        for (j = 0; j < LANES; j++)
+        {
+            p = input + j * BLAKE3_CHUNK_LEN + b * BLOCK_LEN;
+            for (k = 0; k < 16; k++)
+                w[k * LANES + j] = load32(p + k * 4);
+        }
+
+        compress_lanes(h, w, lo, hi, (b == 0? CHUNK_START : 0) |
+                (b == BLAKE3_CHUNK_LEN / BLOCK_LEN - 1? CHUNK_END : 0));
+    }
+
+    for (j = 0; j < LANES; j++)
+        for (k = 0; k < 8; k++)
+            store32(cvs + j * CV_LEN + k * 4, h[k * LANES + j]);
+}
+
+
+void parent_cv(const uint8_t *left, const uint8_t *right, uint8_t *cv)
+{
+    uint8_t block[BLOCK_LEN];
+    uint32_t h[8];
+
+    memcpy(block, left, CV_LEN);
+    memcpy(block + CV_LEN, right, CV_LEN);
+    memcpy(h, IV, sizeof(h));
+    compress(h, block, 0, BLOCK_LEN, PARENT);
+    store_cv(cv, h);
+}
+
+
+void compress(uint32_t cv[8], const uint8_t *block, uint64_t counter,
+        uint32_t len, uint32_t flags)
+{
+    uint32_t m[16];
+    uint32_t v[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        m[i] = load32(block + i * 4);
+
+    memcpy(v, cv, 8 * sizeof(uint32_t));
+    memcpy(v + 8, IV, 4 * sizeof(uint32_t));
+    v[12] = (uint32_t) counter;
+    v[13] = (uint32_t) (counter >> 32);
+    v[14] = len;
+    v[15] = flags;
+
+    for (i = 0; i < 7; i++)
+        ROUND(v, m, SCHEDULE[i]);
+
+    for (i = 0; i < 8; i++)
+        cv[i] = v[i] ^ v[i + 8];
+}
+
+
+MB_CLONES
+void compress_lanes(uint32_t *cv, const uint32_t *w, const uint32_t *lo,
+        const uint32_t *hi, uint32_t flags)
+{
+    vec_t v[16];
+    vec_t m[16];
+    vec_t h[8];
+    vec_t zero = { 0 };
+    int i;
+
+    memcpy(h, cv, sizeof(h));
+    memcpy(m, w, sizeof(m));
+
+    for (i = 0; i < 8; i++)
+        v[i] = h[i];
+    for (i = 0; i < 4; i++)
+        v[i + 8] = zero + IV[i];
+    memcpy(&v[12], lo, sizeof(vec_t));
+    memcpy(&v[13], hi, sizeof(vec_t));
+    v[14] = zero + BLOCK_LEN;
+    v[15] = zero + flags;
+
+#pragma GCC unroll 7
+    for (i = 0; i < 7; i++)
+        ROUND(v, m, SCHEDULE[i]);
+
+    for (i = 0; i < 8; i++)
+        h[i] = v[i] ^ v[i + 8];
+    memcpy(cv, h, sizeof(h));
+}
+
+
+int thread_depth(void)
+{
+    long n;
+    int depth;
+
+    if (THREADS == 0)
+    {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        THREADS = n > 0? (size_t) n : 1;
+    }
+
+    for (depth = 0; ((size_t) 1 << depth) < THREADS; depth++)
+        ;
+    return depth;
+}
+
+
+uint32_t load32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+            ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+void store32(uint8_t *p, uint32_t w)
+{
+    p[0] = (uint8_t) w;
+    p[1] = (uint8_t) (w >> 8);
+    p[2] = (uint8_t) (w >> 16);
+    p[3] = (uint8_t) (w >> 24);
+}
+
+
+void store_cv(uint8_t *dest, const uint32_t cv[8])
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+        store32(dest + i * 4, cv[i]);
+}
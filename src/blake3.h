@@ -0,0 +1,125 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * BLAKE3 hash API. BLAKE3 splits its input into 1 KiB chunks that form the
+ * leaves of a binary tree, subtrees can be hashed independently of each other.
+ * This implementation uses that in two ways:
+ *
+ *  - 16 chunks are compressed side by side in SIMD lanes (AVX-512, AVX2 or
+ *    generic vectors picked at runtime)
+ *  - once a file is larger than BLAKE3_STAGE_SIZE its bytes are collected and
+ *    the subtrees are split between worker threads
+ *
+ * Small files never allocate memory or start threads.
+ */
+#ifndef BLAKE3_H__
+#define BLAKE3_H__
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * number of bytes in a BLAKE3 digest
+ */
+#define BLAKE3_DIGEST_LENGTH 32
+
+
+/**
+ * number of bytes in a leaf of the tree
+ */
+#define BLAKE3_CHUNK_LEN 1024
+
+
+/**
+ * bytes collected before the subtrees are handed to the worker threads, also
+ * the number of bytes hashed before a file is considered large
+ */
+#define BLAKE3_STAGE_SIZE (8 * 1024 * 1024)
+
+
+/**
+ * deepest the tree can get, 2^54 chunks is the 2^64 byte input limit
+ */
+#define BLAKE3_MAX_DEPTH 54
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * state of an in progress BLAKE3 hash
+ */
+typedef struct {
+    uint32_t cv[8];         /**< chaining value of the current chunk */
+    uint64_t counter;       /**< index of the current chunk */
+    uint8_t buf[64];        /**< partial block of the current chunk */
+    uint8_t buf_len;        /**< # of valid bytes in buf */
+    uint8_t blocks;         /**< # of blocks compressed in the current chunk */
+
+    uint8_t stack[(BLAKE3_MAX_DEPTH + 1) * 32]; /**< subtree chaining values */
+    uint8_t stack_len;      /**< # of chaining values on the stack */
+
+    uint64_t total;         /**< # of bytes given to blake3_update */
+    unsigned char *stage;   /**< bytes waiting for the worker threads */
+    size_t stage_len;       /**< # of valid bytes in stage */
+} blake3_ctx_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Set the number of threads used to hash large files. By default this is the
+ * number of online processors.
+ *
+ * @param threads   max threads per hash, 1 disables threading
+ */
+void blake3_set_threads(size_t threads);
+
+
+/**
+ * Prepare `ctx` for a new hash.
+ *
+ * @param ctx       the state to initialize
+ */
+void blake3_init(blake3_ctx_t *ctx);
+
+
+/**
+ * Add `len` bytes at `data` to the hash.
+ *
+ * @param ctx       an initialized state
+ * @param data      bytes to hash
+ * @param len       number of bytes in data
+ */
+void blake3_update(blake3_ctx_t *ctx, const void *data, size_t len);
+
+
+/**
+ * Finish the hash writing BLAKE3_DIGEST_LENGTH bytes to `md` and release any
+ * resources held by `ctx`.
+ *
+ * @param ctx       the state to finish
+ * @param md        where to write the digest
+ */
+void blake3_final(blake3_ctx_t *ctx, unsigned char *md);
+
+
+/**
+ * Release any resources held by a `ctx` that will not be finalized.
+ *
+ * @param ctx       the state to clean up
+ */
+void blake3_cleanup(blake3_ctx_t *ctx);
+
+
+#endif
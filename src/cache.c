@@ -0,0 +1,149 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the cache.h API using an anonymous mmap'ed region.
+ */
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * size of a hugepage on x86_64, explicit hugepage mappings must be a multiple
+ */
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+
+/**
+ * every reservation begins on a cache line boundary
+ */
+#define CACHE_ALIGN 64
+
+
+/**
+ * round `_n` up to the next multiple of `_m`, `_m` must be a power of 2
+ */
+#define ROUND_UP(_n, _m) (((_n) + ((_m) - 1)) & ~((size_t) (_m) - 1))
+
+
+/* Type Defs ******************************************************************/
+
+
+struct cache {
+    unsigned char *base;    /**< first byte of the mapped region */
+    size_t length;          /**< # of bytes mapped */
+    size_t used;            /**< # of bytes claimed with cache_commit */
+};
+
+
+/* Public Impl ****************************************************************/
+
+
+int cache_create(cache_t **cache, size_t capacity)
+{
+    struct cache *c;
+    size_t length;
+    void *base;
+
+    if (cache == NULL || capacity == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((c = malloc(sizeof(*c))) == NULL)
+        return -1;
+
+    /* explicit hugepages only succeed if the admin reserved them, do not
+     * bother when the cache is smaller than a single hugepage */
+    base = MAP_FAILED;
+    length = ROUND_UP(capacity, HUGEPAGE_SIZE);
+    if (capacity >= HUGEPAGE_SIZE)
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (base == MAP_FAILED)
+    {
+        if (capacity < HUGEPAGE_SIZE)
+            length = ROUND_UP(capacity, sysconf(_SC_PAGESIZE));
+
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            free(c);
+            return -1;
+        }
+
+        /* hint to the kernel to back it with transparent hugepages, kernels
+         * without THP support reject the hint which is not an error */
+        madvise(base, length, MADV_HUGEPAGE);
+    }
+
+    c->base = base;
+    c->length = length;
+    c->used = 0;
+    *cache = c;
+    return 0;
+}
+
+
+void cache_free(cache_t *cache)
+{
+    if (cache != NULL)
+    {
+        munmap(cache->base, cache->length);
+        free(cache);
+    }
+}
+
+
+size_t cache_capacity(const cache_t *cache)
+{
+    return cache->length;
+}
+
+
+size_t cache_available(const cache_t *cache)
+{
+    return cache->length - cache->used;
+}
+
+
+void *cache_base(const cache_t *cache)
+{
+    return cache->base;
+}
+
+
+void *cache_reserve(cache_t *cache, size_t len)
+{
+    if (len > cache->length - cache->used)
+        return NULL;
+    return cache->base + cache->used;
+}
+
+
+void cache_commit(cache_t *cache, size_t len)
+{
+    cache->used = ROUND_UP(cache->used + len, CACHE_ALIGN);
+    if (cache->used > cache->length)
+        cache->used = cache->length;
+}
+
+
+void cache_reset(cache_t *cache)
+{
+    cache->used = 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * API for the memory dcp sets aside to cache file contents. The cache is a
+ * single region of memory backed by hugepages when the kernel allows it, either
+ * explicit (MAP_HUGETLB) or transparent (MADV_HUGEPAGE), falling back to
+ * regular pages otherwise.
+ *
+ * Space is handed out from the front of the region, allowing the contents of
+ * several small files to sit in the cache at the same time. Once the cached
+ * files have been processed the cache is reset and the space reused.
+ */
+#ifndef CACHE_H__
+#define CACHE_H__
+
+
+#include <stddef.h>
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the cache type created and maintained by this API
+ */
+typedef struct cache cache_t;
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Map a new cache of at least `capacity` bytes. Explicit hugepages are tried
+ * first, then transparent hugepages, then regular pages.
+ *
+ * @param cache     pointer to the cache to initialize
+ * @param capacity  minimum number of bytes the cache must hold
+ *
+ * @return          0 on success, -1 on failure with errno set
+ */
+int cache_create(cache_t **cache, size_t capacity);
+
+
+/**
+ * Unmap the cache's memory and reclaim all resources dedicated to it.
+ *
+ * @param cache     the cache to deallocate, ignored if NULL
+ */
+void cache_free(cache_t *cache);
+
+
+/**
+ * @param cache     cache to ask for its size
+ *
+ * @return          total number of bytes the cache can hold
+ */
+size_t cache_capacity(const cache_t *cache);
+
+
+/**
+ * @param cache     cache to ask for its free space
+ *
+ * @return          number of bytes that can still be reserved
+ */
+size_t cache_available(const cache_t *cache);
+
+
+/**
+ * @param cache     cache to get the memory region of
+ *
+ * @return          pointer to the first byte of the cache
+ */
+void *cache_base(const cache_t *cache);
+
+
+/**
+ * Get a pointer to the next `len` unused bytes in the cache. The bytes are not
+ * claimed until cache_commit() is called, allowing a caller to reserve room
+ * for the largest possible read and only keep what was actually read.
+ *
+ * @param cache     the cache to reserve space in
+ * @param len       number of bytes needed
+ *
+ * @return          pointer to `len` bytes, NULL if not enough space is left
+ */
+void *cache_reserve(cache_t *cache, size_t len);
+
+
+/**
+ * Claim `len` bytes starting at the pointer last returned by cache_reserve().
+ * Bytes are kept 64 byte aligned so each cached file begins on a cache line.
+ *
+ * @param cache     the cache to claim space in
+ * @param len       number of bytes to claim, must be <= the reserved amount
+ */
+void cache_commit(cache_t *cache, size_t len);
+
+
+/**
+ * Release every claimed byte making the whole cache available again.
+ *
+ * @param cache     the cache to empty
+ */
+void cache_reset(cache_t *cache);
+
+
+#endif
@@ -0,0 +1,169 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the crc32c.h API. The SSE4.2 version is compiled with a
+ * target attribute so the rest of dcp does not require SSE4.2, the CPU is
+ * checked once at runtime before using it.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * the crc32 instruction only exists on x86
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_SSE42 1
+#else
+#define HAVE_SSE42 0
+#endif
+
+
+/**
+ * reversed Castagnoli polynomial
+ */
+#define POLY 0x82f63b78
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * byte at a time crc32c using TABLE
+ */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t len);
+
+
+#if HAVE_SSE42
+/**
+ * crc32c using the SSE4.2 crc32 instruction
+ */
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t len);
+#endif
+
+
+/**
+ * @return non zero if the crc32 instruction can be used
+ */
+static int use_hw(void);
+
+
+/* Private Variables **********************************************************/
+
+
+/**
+ * crc of each byte value, filled in on first use by crc32c_sw
+ */
+static uint32_t TABLE[256];
+
+
+/* Public Impl ****************************************************************/
+
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len)
+{
+#if HAVE_SSE42
+    if (use_hw())
+        return crc32c_hw(crc, data, len);
+#endif
+    return crc32c_sw(crc, data, len);
+}
+
+
+const char *crc32c_name(void)
+{
+    return use_hw()? "sse4.2" : "table";
+}
+
+
+uint32_t crc32c_update_table(uint32_t crc, const void *data, size_t len)
+{
+    return crc32c_sw(crc, data, len);
+}
+
+
+uint32_t crc32c_update_sse42(uint32_t crc, const void *data, size_t len)
+{
+    return crc32c_update(crc, data, len);
+}
+
+
+int crc32c_has_sse42(void)
+{
+    return use_hw();
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int use_hw(void)
+{
+#if HAVE_SSE42
+    static int hw = -1;
+
+    if (hw == -1)
+    {
+        __builtin_cpu_init();
+        hw = __builtin_cpu_supports("sse4.2");
+    }
+    return hw;
+#else
+    return 0;
+#endif
+}
+
+
+uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t len)
+{
+    uint32_t c;
+    int i, j;
+
+    if (TABLE[1] == 0)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            c = i;
+            for (j = 0; j < 8; j++)
+                c = c & 1? (c >> 1) ^ POLY : c >> 1;
+            TABLE[i] = c;
+        }
+    }
+
+    while (len-- > 0)
+        crc = TABLE[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+
+#if HAVE_SSE42
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t len)
+{
+#if defined(__x86_64__)
+    uint64_t c, w;
+
+    c = crc;
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        memcpy(&w, data, 8);
+        c = __builtin_ia32_crc32di(c, w);
+    }
+    crc = (uint32_t) c;
+#endif
+
+    for (; len > 0; data++, len--)
+        crc = __builtin_ia32_crc32qi(crc, *data);
+    return crc;
+}
+#endif
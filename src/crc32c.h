@@ -0,0 +1,73 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * CRC32C (Castagnoli) checksum. On x86 CPUs with SSE4.2 the crc32 instruction
+ * processes 8 bytes at a time, other CPUs use a lookup table one byte at a
+ * time. The checksum is only suitable to detect changes, not to prove two
+ * files are the same.
+ */
+#ifndef CRC32C_H__
+#define CRC32C_H__
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * number of bytes in a finalized crc32c
+ */
+#define CRC32C_DIGEST_LENGTH 4
+
+
+/**
+ * value to start the running checksum with
+ */
+#define CRC32C_INIT 0xffffffff
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Update the running checksum `crc` with `len` bytes at `data`. The checksum
+ * starts as CRC32C_INIT and is finalized by inverting all the bits.
+ *
+ * @param crc       the running checksum
+ * @param data      bytes to add to the checksum
+ * @param len       number of bytes in data
+ *
+ * @return          the updated running checksum
+ */
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+
+
+/**
+ * @return          name of the implementation used on this CPU
+ */
+const char *crc32c_name(void);
+
+
+/**
+ * crc32c_update() forced to the lookup table or the SSE4.2 instruction, used
+ * by the digest backends to pick and compare implementations.
+ * crc32c_update_sse42() falls back to the table without SSE4.2.
+ */
+uint32_t crc32c_update_table(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_update_sse42(uint32_t crc, const void *data, size_t len);
+
+
+/**
+ * @return          non zero if the CPU has the SSE4.2 crc32 instruction
+ */
+int crc32c_has_sse42(void);
+
+
+#endif
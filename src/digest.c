@@ -5,42 +5,370 @@
  *
  * @section DESCRIPTION
  *
- * Implementation of the digest.h API. Backed by OpenSSL we can calculate
- * different digests using a unified API.
+ * Implementation of the digest.h API. Backed by OpenSSL, blake3.c, xxHash and
+ * crc32c.c we can calculate different digests using a unified API.
+ *
+ * xxHash is used as a header only library, XXH_INLINE_ALL lets the compiler
+ * inline XXH3 into the update loops and exposes the size of its state.
+ *
+ * All the state lives in digesterset_t, a digester_t is a set with a single
+ * digest in it. Nothing is allocated unless a digester_t is created.
+ *
+ * Each algorithm's implementations are listed in BACKENDS and every set uses
+ * the ones in SELECTED. When an algorithm has more than one the fastest on
+ * this CPU is measured once, before the first set is created. The low level
+ * OpenSSL backends and XXH3 are called directly from the fused updates, the
+ * others through pointers.
  */
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <openssl/evp.h>
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+#include "blake3.h"
+#include "crc32c.h"
 #include "digest.h"
+#include "digest_mb.h"
 #include "logging.h"
 
 
+/* MACROS *********************************************************************/
+
+
+/**
+ * max number of sets handed to digest_mb() at once
+ */
+#define DIGEST_MANY_CHUNK 64
+
+
+/**
+ * digesterset_update() runs every digest over one tile of the buffer before
+ * moving to the next, sized to stay in L1 while the digests take turns
+ */
+#define DIGEST_TILE_SIZE (16 * 1024)
+
+
+/**
+ * # of bytes each candidate backend hashes when the defaults are measured,
+ * the best of SELECT_ROUNDS is kept
+ */
+#define SELECT_PROBE_SIZE (128 * 1024)
+#define SELECT_ROUNDS 4
+
+
+/**
+ * a backend only replaces one listed before it when it takes less than this
+ * share of its time, so backends that are as fast do not flip between runs
+ */
+#define SELECT_MARGIN 0.9
+
+
+/**
+ * the XXH3 state kept in a digesterset_t
+ */
+#define XXH3_STATE(_set) ((XXH3_state_t *) (_set)->ctx.xxh3)
+
+
+/**
+ * number of digest types, each type is a single bit
+ */
+#define DGST_COUNT 7
+
+
+/**
+ * index of the digest type `_type` in SELECTED and ctx.evp
+ */
+#define TYPE_INDEX(_type) (__builtin_ctz(_type))
+
+
+/**
+ * Defines the init, update and final functions of a low level OpenSSL backend
+ * for the ctx member `_alg`.
+ */
+#define OPENSSL_BACKEND(_alg, _initf, _updatef, _finalf)                       \
+static void _alg##_init(digesterset_t *set)                                    \
+{                                                                              \
+    _initf(&set->ctx._alg);                                                    \
+}                                                                              \
+static void _alg##_update(digesterset_t *set, const void *bytes, size_t count) \
+{                                                                              \
+    _updatef(&set->ctx._alg, bytes, count);                                    \
+}                                                                              \
+static void _alg##_final(digesterset_t *set, unsigned char *md)                \
+{                                                                              \
+    _finalf(md, &set->ctx._alg);                                               \
+}
+
+
+/**
+ * Defines the init, update and final functions of an EVP backend for digest
+ * `_type` using `_md`.
+ */
+#define EVP_BACKEND(_alg, _type, _md)                                          \
+static void _alg##_evp_init(digesterset_t *set)                                \
+{                                                                              \
+    evp_init(set, _type, _md());                                               \
+}                                                                              \
+static void _alg##_evp_update(digesterset_t *set, const void *bytes,          \
+        size_t count)                                                          \
+{                                                                              \
+    EVP_DigestUpdate(set->ctx.evp[TYPE_INDEX(_type)], bytes, count);          \
+}                                                                              \
+static void _alg##_evp_final(digesterset_t *set, unsigned char *md)            \
+{                                                                              \
+    EVP_DigestFinal_ex(set->ctx.evp[TYPE_INDEX(_type)], md, NULL);            \
+}
+
+
+/**
+ * Defines the fused update for the set of low level OpenSSL digests in
+ * `_mask`. The mask is a constant so the compiler drops the digests not in it
+ * and the OpenSSL update functions are called directly. XXH3 runs at memory
+ * speed and is not worth a specialization, it is checked per tile. The
+ * digests in `others` are updated per tile through their backends.
+ */
+#define FUSED_UPDATE(_mask)                                                    \
+static void fused_update_##_mask(digesterset_t *set,                          \
+        const unsigned char *bytes, size_t count, int others)                  \
+{                                                                              \
+    size_t n;                                                                  \
+    int o;                                                                     \
+                                                                               \
+    for (; count > 0; bytes += n, count -= n)                                  \
+    {                                                                          \
+        n = count < DIGEST_TILE_SIZE? count : DIGEST_TILE_SIZE;                \
+        if (HAS_MD5(_mask))    MD5_Update(&set->ctx.md5, bytes, n);            \
+        if (HAS_SHA1(_mask))   SHA1_Update(&set->ctx.sha1, bytes, n);          \
+        if (HAS_SHA256(_mask)) SHA256_Update(&set->ctx.sha256, bytes, n);      \
+        if (HAS_SHA512(_mask)) SHA512_Update(&set->ctx.sha512, bytes, n);      \
+        if (HAS_XXH3(set->valid))                                              \
+            XXH3_128bits_update(XXH3_STATE(set), bytes, n);                    \
+        for (o = others; o != 0; o &= o - 1)                                   \
+            SELECTED[TYPE_INDEX(o)]->update(set, bytes, n);                    \
+    }                                                                          \
+}
+
+
 /* Type Defs ******************************************************************/
 
 
 /**
- * To simplify management of the different digests this pseudo object will
- * keep track of the digest contexts and the needed functions to update the
- * digest.
+ * One implementation of a digest, working on the digest's state in a set.
+ */
+struct backend {
+    const char *name;                       /* reported and selected by */
+    digest_t type;                          /* the digest implemented */
+    int fused;                              /* called by FUSED_UPDATE? */
+    int (*available)(void);                 /* NULL if always available */
+    void (*init)(digesterset_t *set);
+    void (*update)(digesterset_t *set, const void *bytes, size_t count);
+    void (*final)(digesterset_t *set, unsigned char *md);
+};
+
+
+/**
+ * A single digest, the set API does all the work.
  */
 struct digest {
-    int (*update)(void *c, const void *data, size_t len);  /* openssl func    */
-    int (*final)(unsigned char *md, void *c);              /* openssl func    */
-    union {                                                /* space for ctxs  */
-        MD5_CTX md5;
-        SHA_CTX sha1;
-        SHA256_CTX sha256;
-        SHA512_CTX sha512;
-    } ctx;
-    int finalized;                                         /* bytes valid?    */
-    size_t length;                                         /* digest length   */
-    unsigned char bytes[MAX_DIGEST_LENGTH];                /* space for value */
+    digest_t type;                  /* the only digest in set */
+    digesterset_t set;              /* state and value of the digest */
+};
+
+
+/**
+ * signature of the fused updates, @see FUSED_UPDATE
+ */
+typedef void (*fused_update_f)(digesterset_t *set, const unsigned char *bytes,
+        size_t count, int others);
+
+
+/**
+ * fails to compile when XXH3_STATE_SIZE in digest.h is too small
+ */
+typedef char xxh3_state_fits[sizeof(XXH3_state_t) <= XXH3_STATE_SIZE? 1 : -1];
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * @return where the value of `type` is stored in `set`, finalized or not
+ */
+static unsigned char *digesterset_value(digesterset_t *set, digest_t type);
+
+
+/**
+ * start every digest in the set's mask
+ */
+static void digesterset_init(digesterset_t *set);
+
+
+/**
+ * update a single digest of `set`
+ */
+static void update_one(digesterset_t *set, digest_t type, const void *bytes,
+        size_t count);
+
+
+/**
+ * finalize a single digest of `set` into its value
+ */
+static void finalize_one(digesterset_t *set, digest_t type);
+
+
+/**
+ * measure the available backends of every digest and select the fastest,
+ * run once through DEFAULTS_ONCE
+ */
+static void select_defaults(void);
+
+
+/**
+ * @return          seconds `b` takes to hash `len` bytes of `data`, the best
+ *                  of SELECT_ROUNDS
+ */
+static double time_backend(const struct backend *b, const unsigned char *data,
+        size_t len);
+
+
+/**
+ * start the EVP digest `md` for digest `type` of `set`
+ */
+static void evp_init(digesterset_t *set, digest_t type, const EVP_MD *md);
+
+
+/**
+ * backend functions, @see BACKENDS
+ */
+OPENSSL_BACKEND(md5, MD5_Init, MD5_Update, MD5_Final)
+OPENSSL_BACKEND(sha1, SHA1_Init, SHA1_Update, SHA1_Final)
+OPENSSL_BACKEND(sha256, SHA256_Init, SHA256_Update, SHA256_Final)
+OPENSSL_BACKEND(sha512, SHA512_Init, SHA512_Update, SHA512_Final)
+EVP_BACKEND(md5, DGST_MD5, EVP_md5)
+EVP_BACKEND(sha1, DGST_SHA1, EVP_sha1)
+EVP_BACKEND(sha256, DGST_SHA256, EVP_sha256)
+EVP_BACKEND(sha512, DGST_SHA512, EVP_sha512)
+static void xxh3_init(digesterset_t *set);
+static void xxh3_update(digesterset_t *set, const void *bytes, size_t count);
+static void xxh3_final(digesterset_t *set, unsigned char *md);
+static void crc32c_init(digesterset_t *set);
+static void crc32c_sse42_update(digesterset_t *set, const void *bytes,
+        size_t count);
+static void crc32c_table_update(digesterset_t *set, const void *bytes,
+        size_t count);
+static void crc32c_final(digesterset_t *set, unsigned char *md);
+static void blake3_digest_init(digesterset_t *set);
+static void blake3_digest_update(digesterset_t *set, const void *bytes,
+        size_t count);
+static void blake3_digest_final(digesterset_t *set, unsigned char *md);
+
+
+/* Private Variables **********************************************************/
+
+
+/**
+ * every backend, a digest's backends are listed in the order they are
+ * preferred in when they measure about as fast, @see SELECT_MARGIN
+ */
+static const struct backend BACKENDS[] = {
+    { "openssl", DGST_MD5,    1, NULL, &md5_init, &md5_update, &md5_final },
+    { "evp",     DGST_MD5,    0, NULL, &md5_evp_init, &md5_evp_update,
+            &md5_evp_final },
+    { "openssl", DGST_SHA1,   1, NULL, &sha1_init, &sha1_update,
+            &sha1_final },
+    { "evp",     DGST_SHA1,   0, NULL, &sha1_evp_init, &sha1_evp_update,
+            &sha1_evp_final },
+    { "openssl", DGST_SHA256, 1, NULL, &sha256_init, &sha256_update,
+            &sha256_final },
+    { "evp",     DGST_SHA256, 0, NULL, &sha256_evp_init, &sha256_evp_update,
+            &sha256_evp_final },
+    { "openssl", DGST_SHA512, 1, NULL, &sha512_init, &sha512_update,
+            &sha512_final },
+    { "evp",     DGST_SHA512, 0, NULL, &sha512_evp_init, &sha512_evp_update,
+            &sha512_evp_final },
+    { "xxhash",  DGST_XXH3,   1, NULL, &xxh3_init, &xxh3_update, &xxh3_final },
+    { "sse4.2",  DGST_CRC32C, 0, &crc32c_has_sse42, &crc32c_init,
+            &crc32c_sse42_update, &crc32c_final },
+    { "table",   DGST_CRC32C, 0, NULL, &crc32c_init, &crc32c_table_update,
+            &crc32c_final },
+    { "simd",    DGST_BLAKE3, 0, NULL, &blake3_digest_init,
+            &blake3_digest_update, &blake3_digest_final }
+};
+
+
+/**
+ * backend used for each digest, indexed by TYPE_INDEX
+ */
+static const struct backend *SELECTED[DGST_COUNT];
+
+
+/**
+ * fastest backend of each digest, indexed by TYPE_INDEX
+ */
+static const struct backend *DEFAULTS[DGST_COUNT];
+
+
+/**
+ * DEFAULTS and the selections are made once, by whichever thread creates the
+ * first set
+ */
+static pthread_once_t DEFAULTS_ONCE = PTHREAD_ONCE_INIT;
+
+
+/**
+ * mask of the digests whose selected backend is fused
+ */
+static int FUSED = 0;
+
+
+/**
+ * mask of the digests whose backend was picked with digest_backend_select(),
+ * they do not use the multi-buffer digests
+ */
+static int OVERRIDDEN = 0;
+
+
+/**
+ * one fused update for each combination of cryptographic digests
+ */
+FUSED_UPDATE(0)
+FUSED_UPDATE(1)
+FUSED_UPDATE(2)
+FUSED_UPDATE(3)
+FUSED_UPDATE(4)
+FUSED_UPDATE(5)
+FUSED_UPDATE(6)
+FUSED_UPDATE(7)
+FUSED_UPDATE(8)
+FUSED_UPDATE(9)
+FUSED_UPDATE(10)
+FUSED_UPDATE(11)
+FUSED_UPDATE(12)
+FUSED_UPDATE(13)
+FUSED_UPDATE(14)
+FUSED_UPDATE(15)
+
+
+/**
+ * fused updates indexed by digest mask
+ */
+static const fused_update_f FUSED_UPDATES[DGST_CRYPTO + 1] = {
+    &fused_update_0,    &fused_update_1,    &fused_update_2,
+    &fused_update_3,    &fused_update_4,    &fused_update_5,
+    &fused_update_6,    &fused_update_7,    &fused_update_8,
+    &fused_update_9,    &fused_update_10,   &fused_update_11,
+    &fused_update_12,   &fused_update_13,   &fused_update_14,
+    &fused_update_15
 };
 
 
@@ -49,130 +377,120 @@ struct digest {
 
 int digest(digest_t type, void *dest, const void *bytes, size_t len)
 {
-    struct digest *d;
+    digesterset_t set;
+
     assert(bytes != NULL);
-    d = digest_create(type);
-    digest_update(d, bytes, len);
-    digest_finalize(d);
-    digest_copy_value(d, dest);
-    digest_free(d);
+
+    /* one shot, the set lives on the stack */
+    digesterset_create(&set, type);
+    digesterset_update(&set, bytes, len);
+    digesterset_finalize(&set);
+    memcpy(dest, digesterset_value(&set, type), DIGEST_LENGTH(type));
+    digesterset_free(&set);
     return 0;
 }
 
 
 int digest_fd(digest_t type, void *dest, int fd)
 {
-    struct digest *d;
+    digesterset_t set;
     unsigned char *buf;
     ssize_t count;
 
     if ((buf = malloc(32768)) == NULL)
         return -1;
 
-    d = digest_create(type);
+    digesterset_create(&set, type);
     do {
         count = read(fd, buf, 32768);
         if (count < 0)
         {
             log_debug("read");
-            digest_free(d);
+            digesterset_free(&set);
             free(buf);
             return -1;
         }
-        digest_update(d, buf, count);
+        digesterset_update(&set, buf, count);
     } while (count > 0);
-    digest_finalize(d);
-    digest_copy_value(d, dest);
-    digest_free(d);
+    digesterset_finalize(&set);
+    memcpy(dest, digesterset_value(&set, type), DIGEST_LENGTH(type));
+    digesterset_free(&set);
+    free(buf);
     return 0;
 }
 
 
 digester_t *digest_create(digest_t type)
 {
+    void *digest;
+
     assert(type == DGST_MD5 || type == DGST_SHA1 || type == DGST_SHA256 ||
-            type == DGST_SHA512);
+            type == DGST_SHA512 || type == DGST_XXH3 || type == DGST_CRC32C ||
+            type == DGST_BLAKE3);
 
-    switch (type)
+    if (DIGEST_LENGTH(type) == 0)
     {
-    case DGST_MD5:    return digest_create_md5();
-    case DGST_SHA1:   return digester_create_sha1();
-    case DGST_SHA256: return digest_create_sha256();
-    case DGST_SHA512: return digest_create_sha512();
-    default:
         log_debugx("invalid digest type %d", type);
         return NULL;
     }
+
+    /* the XXH3 state is over aligned */
+    if (posix_memalign(&digest, __alignof__(struct digest),
+            sizeof(struct digest)) != 0)
+        return NULL;
+
+    ((struct digest *) digest)->type = type;
+    digesterset_create(&((struct digest *) digest)->set, type);
+    return digest;
 }
 
 
 digester_t *digest_create_md5(void)
 {
-    struct digest *digest;
-
-    digest = malloc(sizeof(*digest));
-
-    digest->length = MD5_DIGEST_LENGTH;
-    digest->update = (int (*)(void *, const void *, size_t)) &MD5_Update;
-    digest->final = (int (*)(unsigned char *md, void *c)) &MD5_Final;
-    MD5_Init((MD5_CTX *) &digest->ctx);
-    digest->finalized = 0;
-    return digest;
+    return digest_create(DGST_MD5);
 }
 
 
 digester_t *digester_create_sha1(void)
 {
-    struct digest *digest;
+    return digest_create(DGST_SHA1);
+}
 
-    digest = malloc(sizeof(*digest));
 
-    digest->length = SHA_DIGEST_LENGTH;
-    digest->update = (int (*)(void *, const void *, size_t)) &SHA1_Update;
-    digest->final = (int (*)(unsigned char *md, void *c)) &SHA1_Final;
-    SHA1_Init((SHA_CTX *) &digest->ctx);
-    digest->finalized = 0;
-    return digest;
+digester_t *digest_create_sha256(void)
+{
+    return digest_create(DGST_SHA256);
 }
 
 
-digester_t *digest_create_sha256(void)
+digester_t *digest_create_sha512(void)
 {
-    struct digest *digest;
+    return digest_create(DGST_SHA512);
+}
 
-    digest = malloc(sizeof(*digest));
 
-    digest->length = SHA256_DIGEST_LENGTH;
-    digest->update = (int (*)(void *, const void *, size_t)) &SHA256_Update;
-    digest->final = (int (*)(unsigned char *md, void *c)) &SHA256_Final;
-    SHA256_Init((SHA256_CTX *) &digest->ctx);
-    digest->finalized = 0;
-    return digest;
+digester_t *digest_create_xxh3(void)
+{
+    return digest_create(DGST_XXH3);
 }
 
 
-digester_t *digest_create_sha512(void)
+digester_t *digest_create_crc32c(void)
 {
-    struct digest *digest;
+    return digest_create(DGST_CRC32C);
+}
 
-    digest = malloc(sizeof(*digest));
 
-    digest->length = SHA512_DIGEST_LENGTH;
-    digest->update = (int (*)(void *, const void *, size_t)) &SHA512_Update;
-    digest->final = (int (*)(unsigned char *md, void *c)) &SHA512_Final;
-    SHA512_Init((SHA512_CTX *) &digest->ctx);
-    digest->finalized = 0;
-    return digest;
+digester_t *digest_create_blake3(void)
+{
+    return digest_create(DGST_BLAKE3);
 }
 
 
 int digest_finalize(digester_t *digest)
 {
     if (digest != NULL)
-    {
-        digest->final(digest->bytes, &digest->ctx);
-        digest->finalized = 1;
-    }
+        digesterset_finalize(&digest->set);
     return 0;
 }
 
@@ -180,13 +498,16 @@ int digest_finalize(digester_t *digest)
 void digest_free(digester_t *digest)
 {
     if (digest != NULL)
+    {
+        digesterset_free(&digest->set);
         free(digest);
+    }
 }
 
 
 size_t digest_get_length(const digester_t *digest)
 {
-    return digest->length;
+    return DIGEST_LENGTH(digest->type);
 }
 
 
@@ -198,6 +519,9 @@ const char *digest_name(digest_t digest)
     case DGST_SHA1:     return "sha1";
     case DGST_SHA256:   return "sha256";
     case DGST_SHA512:   return "sha512";
+    case DGST_XXH3:     return "xxh3";
+    case DGST_CRC32C:   return "crc32c";
+    case DGST_BLAKE3:   return "blake3";
     default:            return NULL;
     }
 }
@@ -205,85 +529,425 @@ const char *digest_name(digest_t digest)
 
 int digest_copy_value(const digester_t *digest, void *bytes)
 {
-    if (bytes != NULL && digest->finalized)
-        memcpy(bytes, digest->bytes, digest->length);
+    const void *value;
+
+    if (bytes != NULL && (value = digest_get_value(digest)) != NULL)
+        memcpy(bytes, value, DIGEST_LENGTH(digest->type));
     return 0;
 }
 
 
 const void *digest_get_value(const digester_t *digest)
 {
-    if (digest != NULL && digest->finalized)
-        return digest->bytes;
+    if (digest != NULL)
+        return digesterset_get_value((digesterset_t *) &digest->set,
+                digest->type);
     return NULL;
 }
 
 
 int digest_is_finalized(const digester_t *digest)
 {
-    return digest != NULL && digest->finalized;
+    return digest != NULL && digest->set.finalized != 0;
 }
 
 
 int digest_update(digester_t *digest, const void *bytes, size_t count)
 {
-    if (digest != NULL && bytes != NULL && count > 0)
-        digest->update(&digest->ctx, bytes, count);
+    if (digest != NULL)
+        digesterset_update(&digest->set, bytes, count);
     return 0;
 }
 
 
 int digesterset_create(digesterset_t *set, int mask)
 {
-    /* NULL out the digestset */
-    memset(set, 0, sizeof(*set));
-    if (HAS_MD5(mask))      set->md5    = digest_create_md5();
-    if (HAS_SHA1(mask))     set->sha1   = digester_create_sha1();
-    if (HAS_SHA256(mask))   set->sha256 = digest_create_sha256();
-    if (HAS_SHA512(mask))   set->sha512 = digest_create_sha512();
+    pthread_once(&DEFAULTS_ONCE, select_defaults);
+    set->valid = mask & DGST_ALL;
+    memset(set->ctx.evp, 0, sizeof(set->ctx.evp));
+    digesterset_init(set);
+    return 0;
+}
+
+
+int digesterset_reset(digesterset_t *set)
+{
+    /* an unfinished BLAKE3 hash may hold memory, EVP contexts are reused */
+    if (HAS_BLAKE3(set->valid) && !HAS_BLAKE3(set->finalized))
+        blake3_cleanup(&set->ctx.blake3);
+    digesterset_init(set);
     return 0;
 }
 
 
 int digesterset_update(digesterset_t *set, const void *bytes, size_t count)
 {
-    digest_update(set->md5,     bytes, count);
-    digest_update(set->sha1,    bytes, count);
-    digest_update(set->sha256,  bytes, count);
-    digest_update(set->sha512,  bytes, count);
+    int fused;
+
+    if (set->valid == 0 || bytes == NULL || count == 0)
+        return 0;
+
+    fused = set->valid & FUSED;
+    FUSED_UPDATES[fused & DGST_CRYPTO](set, bytes, count,
+            set->valid & ~fused & ~DGST_BLAKE3);
+
+    /* not tiled, BLAKE3 splits large buffers between threads itself */
+    if (HAS_BLAKE3(set->valid))
+        SELECTED[TYPE_INDEX(DGST_BLAKE3)]->update(set, bytes, count);
     return 0;
 }
 
 
 int digesterset_finalize(digesterset_t *set)
 {
-    digest_finalize(set->md5);
-    digest_finalize(set->sha1);
-    digest_finalize(set->sha256);
-    digest_finalize(set->sha512);
+    int type;
+
+    for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+        if ((set->valid & type) && !(set->finalized & type))
+            finalize_one(set, type);
+    return 0;
+}
+
+
+int digesterset_digest_many(digesterset_t *sets[], const void *data[],
+        const size_t lens[], size_t count)
+{
+    void *dests[DIGEST_MANY_CHUNK];
+    size_t i, j, n;
+    int type;
+
+    if (count == 0)
+        return 0;
+
+    for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+    {
+        if (!(sets[0]->valid & type))
+            continue;
+
+        /* no lanes for this digest, or another backend was asked for, stream
+         * each buffer on its own */
+        if (digest_mb_lanes(type) == 1 || (OVERRIDDEN & type))
+        {
+            for (i = 0; i < count; i++)
+            {
+                update_one(sets[i], type, data[i], lens[i]);
+                finalize_one(sets[i], type);
+            }
+            continue;
+        }
+
+        for (i = 0; i < count; i += n)
+        {
+            n = count - i < DIGEST_MANY_CHUNK? count - i : DIGEST_MANY_CHUNK;
+            for (j = 0; j < n; j++)
+                dests[j] = digesterset_value(sets[i + j], type);
+            digest_mb(type, dests, &data[i], &lens[i], n);
+            for (j = 0; j < n; j++)
+                sets[i + j]->finalized |= type;
+        }
+    }
     return 0;
 }
 
 
 int digesterset_free(digesterset_t *set)
 {
-    digest_free(set->md5);
-    digest_free(set->sha1);
-    digest_free(set->sha256);
-    digest_free(set->sha512);
+    size_t i;
+
+    /* a BLAKE3 hash of a large file holds memory until it is final */
+    if (HAS_BLAKE3(set->valid) && !HAS_BLAKE3(set->finalized))
+        blake3_cleanup(&set->ctx.blake3);
+
+    for (i = 0; i < sizeof(set->ctx.evp) / sizeof(set->ctx.evp[0]); i++)
+    {
+        EVP_MD_CTX_free(set->ctx.evp[i]);
+        set->ctx.evp[i] = NULL;
+    }
     return 0;
 }
 
 
 const void *digesterset_get_value(digesterset_t *set, digest_t type)
 {
-    switch (type)
+    if (!(set->finalized & type))
+        return NULL;
+    return digesterset_value(set, type);
+}
+
+
+int digesterset_set_value(digesterset_t *set, digest_t type, const void *value)
+{
+    if (!(set->valid & type))
+        return -1;
+
+    /* an unfinished BLAKE3 hash may hold memory, it is not finalized now */
+    if (type == DGST_BLAKE3 && !HAS_BLAKE3(set->finalized))
+        blake3_cleanup(&set->ctx.blake3);
+
+    memcpy(digesterset_value(set, type), value, DIGEST_LENGTH(type));
+    set->finalized |= type;
+    return 0;
+}
+
+
+int digest_backend_select(digest_t type, const char *name)
+{
+    const struct backend *b;
+    size_t i;
+
+    if (DIGEST_LENGTH(type) == 0)
+        return -1;
+
+    pthread_once(&DEFAULTS_ONCE, select_defaults);
+    if (name == NULL)
     {
-    case DGST_MD5: return digest_get_value(set->md5);
-    case DGST_SHA1: return digest_get_value(set->sha1);
-    case DGST_SHA256: return digest_get_value(set->sha256);
-    case DGST_SHA512: return digest_get_value(set->sha512);
-    default:
+        b = DEFAULTS[TYPE_INDEX(type)];
+        SELECTED[TYPE_INDEX(type)] = b;
+        FUSED = b->fused? FUSED | type : FUSED & ~type;
+        OVERRIDDEN &= ~type;
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(BACKENDS) / sizeof(BACKENDS[0]); i++)
+    {
+        b = &BACKENDS[i];
+        if (b->type != type || strcmp(b->name, name) != 0)
+            continue;
+        if (b->available != NULL && !b->available())
+            return -1;
+
+        SELECTED[TYPE_INDEX(type)] = b;
+        FUSED = b->fused? FUSED | type : FUSED & ~type;
+        OVERRIDDEN |= type;
+        return 0;
+    }
+    return -1;
+}
+
+
+const char *digest_backend_name(digest_t type)
+{
+    if (DIGEST_LENGTH(type) == 0)
         return NULL;
+
+    pthread_once(&DEFAULTS_ONCE, select_defaults);
+    return SELECTED[TYPE_INDEX(type)]->name;
+}
+
+
+size_t digest_backend_list(digest_t type, const char *names[], size_t max)
+{
+    const struct backend *b;
+    size_t i, count;
+
+    count = 0;
+    for (i = 0; i < sizeof(BACKENDS) / sizeof(BACKENDS[0]); i++)
+    {
+        b = &BACKENDS[i];
+        if (b->type != type || (b->available != NULL && !b->available()))
+            continue;
+        if (count < max)
+            names[count] = b->name;
+        count++;
     }
+    return count;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+unsigned char *digesterset_value(digesterset_t *set, digest_t type)
+{
+    switch (type)
+    {
+    case DGST_MD5:      return set->value.md5;
+    case DGST_SHA1:     return set->value.sha1;
+    case DGST_SHA256:   return set->value.sha256;
+    case DGST_SHA512:   return set->value.sha512;
+    case DGST_XXH3:     return set->value.xxh3;
+    case DGST_CRC32C:   return set->value.crc32c;
+    case DGST_BLAKE3:   return set->value.blake3;
+    default:            return NULL;
+    }
+}
+
+
+void digesterset_init(digesterset_t *set)
+{
+    int type;
+
+    set->finalized = 0;
+    for (type = set->valid; type != 0; type &= type - 1)
+        SELECTED[TYPE_INDEX(type)]->init(set);
+}
+
+
+void update_one(digesterset_t *set, digest_t type, const void *bytes,
+        size_t count)
+{
+    SELECTED[TYPE_INDEX(type)]->update(set, bytes, count);
+}
+
+
+void finalize_one(digesterset_t *set, digest_t type)
+{
+    SELECTED[TYPE_INDEX(type)]->final(set, digesterset_value(set, type));
+    set->finalized |= type;
+}
+
+
+void select_defaults(void)
+{
+    const struct backend *b;
+    unsigned char *data;
+    double times[DGST_COUNT];
+    double elapsed;
+    size_t i, t;
+
+    /* without a probe the first available backend is used */
+    if ((data = malloc(SELECT_PROBE_SIZE)) != NULL)
+        for (i = 0; i < SELECT_PROBE_SIZE; i++)
+            data[i] = i % 251;
+
+    for (i = 0; i < sizeof(BACKENDS) / sizeof(BACKENDS[0]); i++)
+    {
+        b = &BACKENDS[i];
+        if (b->available != NULL && !b->available())
+            continue;
+
+        /* a digest with a single backend is not timed */
+        t = TYPE_INDEX(b->type);
+        elapsed = data == NULL || digest_backend_list(b->type, NULL, 0) == 1?
+                0 : time_backend(b, data, SELECT_PROBE_SIZE);
+        if (DEFAULTS[t] == NULL || elapsed < times[t] * SELECT_MARGIN)
+        {
+            DEFAULTS[t] = b;
+            times[t] = elapsed;
+        }
+    }
+    free(data);
+
+    for (i = 0; i < DGST_COUNT; i++)
+    {
+        SELECTED[i] = DEFAULTS[i];
+        if (DEFAULTS[i]->fused)
+            FUSED |= DEFAULTS[i]->type;
+    }
+}
+
+
+double time_backend(const struct backend *b, const unsigned char *data,
+        size_t len)
+{
+    unsigned char md[MAX_DIGEST_LENGTH];
+    struct timespec start, end;
+    digesterset_t set;
+    double elapsed, best;
+    size_t round;
+
+    set.valid = b->type;
+    memset(set.ctx.evp, 0, sizeof(set.ctx.evp));
+
+    best = 0;
+    for (round = 0; round < SELECT_ROUNDS; round++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        b->init(&set);
+        b->update(&set, data, len);
+        b->final(&set, md);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        elapsed = (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    set.finalized = set.valid;
+    digesterset_free(&set);
+    return best;
+}
+
+
+void evp_init(digesterset_t *set, digest_t type, const EVP_MD *md)
+{
+    EVP_MD_CTX **ctx;
+
+    /* allocated once per set and reused by digesterset_reset() */
+    ctx = &set->ctx.evp[TYPE_INDEX(type)];
+    if (*ctx == NULL && (*ctx = EVP_MD_CTX_new()) == NULL)
+        log_critx(EXIT_FAILURE, "cannot allocate %s context",
+                digest_name(type));
+    EVP_DigestInit_ex(*ctx, md, NULL);
+}
+
+
+void xxh3_init(digesterset_t *set)
+{
+    XXH3_128bits_reset(XXH3_STATE(set));
+}
+
+
+void xxh3_update(digesterset_t *set, const void *bytes, size_t count)
+{
+    XXH3_128bits_update(XXH3_STATE(set), bytes, count);
+}
+
+
+void xxh3_final(digesterset_t *set, unsigned char *md)
+{
+    XXH128_canonical_t canonical;
+
+    XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(XXH3_STATE(set)));
+    memcpy(md, canonical.digest, XXH3_DIGEST_LENGTH);
+}
+
+
+void crc32c_init(digesterset_t *set)
+{
+    set->ctx.crc32c = CRC32C_INIT;
+}
+
+
+void crc32c_sse42_update(digesterset_t *set, const void *bytes, size_t count)
+{
+    set->ctx.crc32c = crc32c_update_sse42(set->ctx.crc32c, bytes, count);
+}
+
+
+void crc32c_table_update(digesterset_t *set, const void *bytes, size_t count)
+{
+    set->ctx.crc32c = crc32c_update_table(set->ctx.crc32c, bytes, count);
+}
+
+
+void crc32c_final(digesterset_t *set, unsigned char *md)
+{
+    uint32_t crc;
+
+    /* big endian so the hex matches the usual way of printing a crc */
+    crc = ~set->ctx.crc32c;
+    md[0] = crc >> 24;
+    md[1] = crc >> 16;
+    md[2] = crc >> 8;
+    md[3] = crc;
+}
+
+
+void blake3_digest_init(digesterset_t *set)
+{
+    blake3_init(&set->ctx.blake3);
+}
+
+
+void blake3_digest_update(digesterset_t *set, const void *bytes, size_t count)
+{
+    blake3_update(&set->ctx.blake3, bytes, count);
+}
+
+
+void blake3_digest_final(digesterset_t *set, unsigned char *md)
+{
+    blake3_final(&set->ctx.blake3, md);
 }
@@ -5,20 +5,33 @@
  *
  * @section DESCRIPTION
  *
- * Defines a generic Digest API to perform MD5, SHA1, SHA256 and SHA512
- * hashing algorithms.
+ * Defines a generic Digest API to perform MD5, SHA1, SHA256, SHA512 and
+ * BLAKE3 hashing algorithms, as well as the non cryptographic XXH3-128 and
+ * CRC32C.
  *
- * This code wraps the openssl implementations of the above algorithms and
- * provides a unified api for creating these digests.
+ * This code wraps the openssl implementations of the cryptographic algorithms,
+ * blake3.h, xxHash's XXH3 and crc32c.h, providing a unified api for creating
+ * these digests.
+ *
+ * An algorithm can have more than one implementation, called a backend. The
+ * backends the CPU supports are timed once, before the first set is created,
+ * and the fastest is used unless digest_backend_select() picks another.
+ * digest_selftest() and digest_benchmark() check and compare them.
  */
 #ifndef DIGEST_H__
 #define DIGEST_H__
 
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <openssl/evp.h>
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 
+#include "blake3.h"
+#include "crc32c.h"
+
 
 /* MACROS *********************************************************************/
 
@@ -47,17 +60,57 @@
 #define HAS_SHA512(_d)  ((_d) & DGST_SHA512)
 
 
+/**
+ * Checks if the mask has the xxh3 flag
+ */
+#define HAS_XXH3(_d)    ((_d) & DGST_XXH3)
+
+
+/**
+ * Checks if the mask has the crc32c flag
+ */
+#define HAS_CRC32C(_d)  ((_d) & DGST_CRC32C)
+
+
+/**
+ * Checks if the mask has the blake3 flag
+ */
+#define HAS_BLAKE3(_d)  ((_d) & DGST_BLAKE3)
+
+
+/**
+ * Mask of the cryptographic digests backed by OpenSSL
+ */
+#define DGST_CRYPTO (DGST_MD5 | DGST_SHA1 | DGST_SHA256 | DGST_SHA512)
+
+
 /**
  * Mask of all digests
  */
-#define DGST_ALL (DGST_MD5 | DGST_SHA1 | DGST_SHA256 | DGST_SHA512)
+#define DGST_ALL (DGST_CRYPTO | DGST_XXH3 | DGST_CRC32C | DGST_BLAKE3)
+
+
+/**
+ * number of bytes in a XXH3-128 digest
+ */
+#define XXH3_DIGEST_LENGTH 16
+
+
+/**
+ * bytes reserved for an XXH3_state_t, xxHash is only included by digest.c
+ * which fails to compile if the state does not fit
+ */
+#define XXH3_STATE_SIZE 576
 
 
 #define DIGEST_LENGTH(_type)                                                   \
     ( (_type) == DGST_MD5? MD5_DIGEST_LENGTH :                                 \
-            (_type) == DGST_SHA1? SHA_DIGEST_LENGTH :                          \
-                    (_type) == DGST_SHA256? SHA256_DIGEST_LENGTH :             \
-                            (_type) == DGST_SHA512? SHA512_DIGEST_LENGTH : 0   \
+      (_type) == DGST_SHA1? SHA_DIGEST_LENGTH :                                \
+      (_type) == DGST_SHA256? SHA256_DIGEST_LENGTH :                           \
+      (_type) == DGST_SHA512? SHA512_DIGEST_LENGTH :                           \
+      (_type) == DGST_XXH3? XXH3_DIGEST_LENGTH :                               \
+      (_type) == DGST_CRC32C? CRC32C_DIGEST_LENGTH :                           \
+      (_type) == DGST_BLAKE3? BLAKE3_DIGEST_LENGTH : 0                         \
     )
 
 
@@ -77,7 +130,10 @@ typedef enum {
     DGST_MD5    = 1, /**< MD5 128 bit Checksum*/
     DGST_SHA1   = 2, /**< SHA1 160 bit Checksum */
     DGST_SHA256 = 4, /**< SHA256 256 bit Checksum */
-    DGST_SHA512 = 8  /**< SHA512 512 bit Checksum */
+    DGST_SHA512 = 8, /**< SHA512 512 bit Checksum */
+    DGST_XXH3   = 16,/**< XXH3 128 bit non cryptographic hash */
+    DGST_CRC32C = 32,/**< CRC32C 32 bit Checksum */
+    DGST_BLAKE3 = 64 /**< BLAKE3 256 bit Checksum */
 } digest_t;
 
 
@@ -89,24 +145,96 @@ typedef struct digest digester_t;
 
 /**
  * Struct to simplify the juggling of multiple digesters when some can be
- * invalid.
+ * invalid. Every context is stored by value so a set can live on the stack or
+ * be reused with digesterset_reset() without touching the heap.
  */
 typedef struct {
     int valid;              /**< mask of the digest_alg_t's that we use */
-    digester_t *md5;        /**< place to store the md5 digester */
-    digester_t *sha1;       /**< place to store the sha1 digester */
-    digester_t *sha256;     /**< place to store the sha256 digester */
-    digester_t *sha512;     /**< place to store the sha512 digester */
+    int finalized;          /**< mask of the digests with a valid value */
+
+    struct {
+        /** XXH3_state_t, @see XXH3_STATE_SIZE */
+        unsigned char xxh3[XXH3_STATE_SIZE] __attribute__((aligned(64)));
+        MD5_CTX md5;
+        SHA_CTX sha1;
+        SHA256_CTX sha256;
+        SHA512_CTX sha512;
+        uint32_t crc32c;
+        blake3_ctx_t blake3;
+        EVP_MD_CTX *evp[4]; /**< md5 ... sha512 with the evp backend */
+    } ctx;                  /**< state of the digests being calculated */
+
+    struct {
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        unsigned char sha1[SHA_DIGEST_LENGTH];
+        unsigned char sha256[SHA256_DIGEST_LENGTH];
+        unsigned char sha512[SHA512_DIGEST_LENGTH];
+        unsigned char xxh3[XXH3_DIGEST_LENGTH];
+        unsigned char crc32c[CRC32C_DIGEST_LENGTH];
+        unsigned char blake3[BLAKE3_DIGEST_LENGTH];
+    } value;                /**< the finalized digests */
 } digesterset_t;
 
 
 int digesterset_create(digesterset_t *set, int mask);
+
+
+/**
+ * Start the digests in `set` over keeping its mask, one set can digest file
+ * after file this way.
+ *
+ * @param set       a set initialized by digesterset_create()
+ *
+ * @return          0 on success
+ */
+int digesterset_reset(digesterset_t *set);
+
+
 int digesterset_update(digesterset_t *set, const void *bytes, size_t count);
 int digesterset_finalize(digesterset_t *set);
 const void *digesterset_get_value(digesterset_t *set, digest_t alg);
+
+
+/**
+ * Give the `alg` digest of `set` a value calculated earlier instead of
+ * finalizing it, digesterset_get_value() returns it until the set is reset.
+ *
+ * @param set       a set created with `alg` in its mask
+ * @param value     DIGEST_LENGTH(alg) bytes to copy
+ *
+ * @return          0 on success, -1 if `alg` is not in the set
+ */
+int digesterset_set_value(digesterset_t *set, digest_t alg, const void *value);
+
+
+/**
+ * Release what the digests in `set` hold outside of it, the set's own memory
+ * belongs to the caller.
+ *
+ * @param set       the set to clean up
+ *
+ * @return          0 on success
+ */
 int digesterset_free(digesterset_t *set);
 
 
+/**
+ * Digest `count` independent buffers, buffer `i` into `sets[i]`, and finalize
+ * every set. All sets must have been created with the same mask. Digests with
+ * a multi-buffer implementation (see digest_mb.h) hash the buffers side by
+ * side, the others stream them one at a time.
+ *
+ * @param sets      freshly created digester sets, one per buffer
+ * @param data      the buffers to digest
+ * @param lens      number of bytes in each buffer
+ * @param count     number of buffers and sets
+ *
+ * @return          0 on success
+ */
+int digesterset_digest_many(digesterset_t *sets[], const void *data[],
+        const size_t lens[], size_t count);
+
+
 /* Public API *****************************************************************/
 
 
@@ -153,6 +281,31 @@ digester_t *digest_create_sha256(void);
 digester_t *digest_create_sha512(void);
 
 
+/**
+ * Create a new digest object which uses the XXH3 128 bit algorithm.
+ *
+ * @return          digest_t that is waiting for bytes to update
+ */
+digester_t *digest_create_xxh3(void);
+
+
+/**
+ * Create a new digest object which calculates a CRC32C.
+ *
+ * @return          digest_t that is waiting for bytes to update
+ */
+digester_t *digest_create_crc32c(void);
+
+
+/**
+ * Create a new digest object which uses the BLAKE3 algorithm. Large inputs are
+ * hashed by several threads, @see blake3_set_threads().
+ *
+ * @return          digest_t that is waiting for bytes to update
+ */
+digester_t *digest_create_blake3(void);
+
+
 /**
  * Copy the digest bytes to the given buffer. Buffer must point to an
  * area of memory with at least digest_get_length() space.
@@ -261,4 +414,67 @@ int digest_fd(digest_t alg, void *dest, int fd);
 
 const char *digest_name(digest_t digest);
 
+
+/* Backend API ****************************************************************/
+
+
+/**
+ * Use the backend `name` for every digest of type `alg`. Must not be called
+ * while a digest of type `alg` is in progress. Picking a backend turns off the
+ * multi-buffer digests of digest_mb.h for `alg`.
+ *
+ * @param alg       the digest type
+ * @param name      name of the backend, @see digest_backend_list(), or NULL
+ *                  for the default
+ *
+ * @return          0 on success, -1 if `alg` has no such backend or the CPU
+ *                  does not support it
+ */
+int digest_backend_select(digest_t alg, const char *name);
+
+
+/**
+ * @param alg       the digest type
+ *
+ * @return          name of the backend used for `alg`
+ */
+const char *digest_backend_name(digest_t alg);
+
+
+/**
+ * List the backends of `alg` the CPU supports.
+ *
+ * @param alg       the digest type
+ * @param names     where to store the backend names
+ * @param max       # of entries in names
+ *
+ * @return          # of backends, may be more than `max`
+ */
+size_t digest_backend_list(digest_t alg, const char *names[], size_t max);
+
+
+/**
+ * Check every backend of every digest against known answers, and against each
+ * other on inputs large enough to use tiling, threads and SIMD lanes. Results
+ * are written to `out`. Every digest is left on its default backend.
+ *
+ * @param out       where to write the results, NULL for none
+ *
+ * @return          0 if every backend passed, -1 otherwise
+ */
+int digest_selftest(FILE *out);
+
+
+/**
+ * Write the throughput of every backend of every digest to `out`, as well as
+ * the multi-buffer digests of digest_mb.h. The selected backend of each
+ * digest is marked with a '*', every digest is left on its default backend.
+ *
+ * @param out       where to write the results
+ * @param size      # of bytes hashed by each update
+ *
+ * @return          0 on success
+ */
+int digest_benchmark(FILE *out, size_t size);
+
 #endif
@@ -0,0 +1,502 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the digest_mb.h API. MD5, SHA1 and SHA256 work on 32 bit
+ * words, 16 buffers are interleaved so word `k` of every buffer sits in one
+ * 512 bit vector. The compression functions are written once with GCC's vector
+ * extensions and cloned for AVX-512 and AVX2, the loader picks the clone
+ * matching the CPU.
+ *
+ * Buffers are fed through the lanes as jobs, when a lane finishes its buffer
+ * the next waiting job takes its place so lanes only idle once the queue is
+ * empty.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "digest.h"
+#include "digest_mb.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * number of buffers interleaved by the compression functions
+ */
+#define LANES DIGEST_MB_MAX_LANES
+
+
+/**
+ * digests work on 64 byte blocks of 16 32 bit words
+ */
+#define BLOCK_SIZE 64
+
+
+/**
+ * max number of jobs prepared at once, bounds stack usage
+ */
+#define QUEUE_SIZE 64
+
+
+/**
+ * multi-buffer implementations only exist for x86 with a compiler that can
+ * build the AVX clones
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+        && !defined(__clang__)
+#define HAVE_MB 1
+#define MB_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define HAVE_MB 0
+#define MB_CLONES
+#endif
+
+
+#define ROTL(_x, _n) (((_x) << (_n)) | ((_x) >> (32 - (_n))))
+#define ROTR(_x, _n) (((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * one 32 bit word from each of the interleaved buffers
+ */
+typedef uint32_t vec_t __attribute__((vector_size(LANES * sizeof(uint32_t))));
+
+
+/**
+ * a buffer waiting to be digested. Full blocks are read straight from `data`,
+ * the remaining bytes and the padding are copied to `tail`.
+ */
+struct job {
+    const unsigned char *data;      /**< bytes to digest */
+    unsigned char *dest;            /**< where to write the digest */
+    size_t full;                    /**< # of full blocks in data */
+    size_t blocks;                  /**< # of blocks including padding */
+    unsigned char tail[2 * BLOCK_SIZE]; /**< last partial block + padding */
+};
+
+
+/**
+ * describes one algorithm to the job scheduler
+ */
+struct alg {
+    size_t words;                   /**< # of 32 bit words of state */
+    const uint32_t *iv;             /**< initial state */
+    int bigendian;                  /**< byte order of words and length */
+    void (*compress)(uint32_t *state, const uint32_t *w); /**< see below */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Compression functions. `state` is `words` rows of LANES words, `w` is 16 rows
+ * of LANES words, row `k` holding message word `k` of each lane's block.
+ */
+static void md5_compress(uint32_t *state, const uint32_t *w);
+static void sha1_compress(uint32_t *state, const uint32_t *w);
+static void sha256_compress(uint32_t *state, const uint32_t *w);
+
+
+/**
+ * pad the buffer and prepare it to be fed to the lanes
+ */
+static void job_init(struct job *job, const void *data, size_t len,
+        void *dest, int bigendian);
+
+
+/**
+ * feed all jobs through the lanes writing each digest to its job's dest
+ */
+static void run(const struct alg *alg, struct job *jobs, size_t count);
+
+
+/**
+ * @return the multi-buffer description of `alg`, NULL if there is none
+ */
+static const struct alg *lookup(digest_t alg);
+
+
+/**
+ * Decide if the SIMD clones beat hashing each buffer on its own. MD5 always
+ * wins with AVX2 or better. OpenSSL's scalar SHA1 and SHA256 use the SHA
+ * extensions when present, which only AVX-512 outperforms.
+ *
+ * @return non zero if `alg` should be digested in lanes on this CPU
+ */
+static int use_simd(digest_t alg);
+
+
+/* Private Variables **********************************************************/
+
+
+static const uint32_t MD5_IV[4] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
+
+static const uint32_t SHA1_IV[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+
+static const uint32_t SHA256_IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+
+static const uint32_t MD5_K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+
+static const unsigned char MD5_S[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+static const struct alg MD5_ALG    = { 4, MD5_IV,    0, &md5_compress    };
+static const struct alg SHA1_ALG   = { 5, SHA1_IV,   1, &sha1_compress   };
+static const struct alg SHA256_ALG = { 8, SHA256_IV, 1, &sha256_compress };
+
+
+/* Public Impl ****************************************************************/
+
+
+int digest_mb(digest_t type, void *dests[], const void *data[],
+        const size_t lens[], size_t count)
+{
+    const struct alg *alg;
+    struct job jobs[QUEUE_SIZE];
+    size_t i, j, n;
+
+    /* a single buffer gains nothing from the lanes */
+    if ((alg = lookup(type)) == NULL || count < 2 || !use_simd(type))
+    {
+        for (i = 0; i < count; i++)
+            digest(type, dests[i], data[i], lens[i]);
+        return 0;
+    }
+
+    for (i = 0; i < count; i += n)
+    {
+        n = count - i < QUEUE_SIZE? count - i : QUEUE_SIZE;
+        for (j = 0; j < n; j++)
+            job_init(&jobs[j], data[i + j], lens[i + j], dests[i + j],
+                    alg->bigendian);
+        run(alg, jobs, n);
+    }
+    return 0;
+}
+
+
+size_t digest_mb_lanes(digest_t alg)
+{
+    return lookup(alg) != NULL && use_simd(alg)? LANES : 1;
+}
+
+
+const char *digest_mb_name(digest_t alg)
+{
+    if (lookup(alg) == NULL || !use_simd(alg))
+        return "scalar";
+#if HAVE_MB
+    if (__builtin_cpu_supports("avx512f"))
+        return "avx512";
+#endif
+    return "avx2";
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+const struct alg *lookup(digest_t alg)
+{
+    switch (alg)
+    {
+    case DGST_MD5:      return &MD5_ALG;
+    case DGST_SHA1:     return &SHA1_ALG;
+    case DGST_SHA256:   return &SHA256_ALG;
+    default:            return NULL;
+    }
+}
+
+
+int use_simd(digest_t alg)
+{
+#if HAVE_MB
+    static int init = 0;
+    static int avx2, avx512, sha;
+
+    if (!init)
+    {
+        __builtin_cpu_init();
+        avx2   = __builtin_cpu_supports("avx2");
+        avx512 = __builtin_cpu_supports("avx512f");
+        sha    = __builtin_cpu_supports("sha");
+        init   = 1;
+    }
+
+    if (alg == DGST_MD5)
+        return avx2 || avx512;
+    return avx512 || (avx2 && !sha);
+#else
+    (void) alg;
+    return 0;
+#endif
+}
+
+
+void job_init(struct job *job, const void *data, size_t len, void *dest,
+        int bigendian)
+{
+    size_t rem;
+    size_t tailblocks;
+    uint64_t bits;
+    unsigned char *end;
+    int i;
+
+    job->data = data;
+    job->dest = dest;
+    job->full = len / BLOCK_SIZE;
+    rem = len % BLOCK_SIZE;
+
+    /* message, a single 1 bit, zeros then the 64 bit length in bits */
+    memset(job->tail, 0, sizeof(job->tail));
+    if (rem > 0)
+        memcpy(job->tail, job->data + job->full * BLOCK_SIZE, rem);
+    job->tail[rem] = 0x80;
+
+    tailblocks = rem + 1 + 8 <= BLOCK_SIZE? 1 : 2;
+    job->blocks = job->full + tailblocks;
+
+    bits = (uint64_t) len * 8;
+    end = job->tail + tailblocks * BLOCK_SIZE - 8;
+    for (i = 0; i < 8; i++)
+        end[bigendian? 7 - i : i] = (unsigned char) (bits >> (i * 8));
+}
+
+
+void run(const struct alg *alg, struct job *jobs, size_t count)
+{
+    uint32_t state[8 * LANES];
+    uint32_t w[16 * LANES];
+    struct job *lane[LANES];
+    size_t block[LANES];
+    size_t next, active;
+    size_t j, k;
+    const unsigned char *p;
+    uint32_t v;
+
+    next = 0;
+    active = 0;
+    for (j = 0; j < LANES; j++)
+    {
+        lane[j] = next < count? &jobs[next++] : NULL;
+        block[j] = 0;
+        for (k = 0; k < alg->words; k++)
+            state[k * LANES + j] = alg->iv[k];
+        if (lane[j] != NULL)
+            active++;
+    }
+
+    while (active > 0)
+    {
+        /* gather the next block of every lane, one word per row */
+        for (j = 0; j < LANES; j++)
+        {
+            if (lane[j] == NULL)
+                continue;
+
+            p = block[j] < lane[j]->full?
+                    lane[j]->data + block[j] * BLOCK_SIZE :
+                    lane[j]->tail + (block[j] - lane[j]->full) * BLOCK_SIZE;
+
+            for (k = 0; k < 16; k++, p += 4)
+                w[k * LANES + j] = alg->bigendian?
+                        ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+                        ((uint32_t) p[2] << 8)  | p[3] :
+                        ((uint32_t) p[3] << 24) | ((uint32_t) p[2] << 16) |
+                        ((uint32_t) p[1] << 8)  | p[0];
+        }
+
+        alg->compress(state, w);
+
+        /* retire finished lanes and refill them from the queue */
+        for (j = 0; j < LANES; j++)
+        {
+            if (lane[j] == NULL || ++block[j] < lane[j]->blocks)
+                continue;
+
+            for (k = 0; k < alg->words; k++)
+            {
+                v = state[k * LANES + j];
+                if (alg->bigendian)
+                    v = __builtin_bswap32(v);
+                memcpy(lane[j]->dest + k * 4, &v, 4);
+                state[k * LANES + j] = alg->iv[k];
+            }
+
+            block[j] = 0;
+            if ((lane[j] = next < count? &jobs[next++] : NULL) == NULL)
+                active--;
+        }
+    }
+}
+
+
+MB_CLONES
+void md5_compress(uint32_t *state, const uint32_t *w)
+{
+    vec_t a, b, c, d, f, t;
+    vec_t m[16];
+    vec_t in[4];
+    int i, g;
+
+    memcpy(in, state, sizeof(in));
+    memcpy(m, w, sizeof(m));
+    a = in[0]; b = in[1]; c = in[2]; d = in[3];
+
+#pragma GCC unroll 64
+    for (i = 0; i < 64; i++)
+    {
+        if (i < 16)      { f = d ^ (b & (c ^ d)); g = i;                }
+        else if (i < 32) { f = c ^ (d & (b ^ c)); g = (5 * i + 1) % 16; }
+        else if (i < 48) { f = b ^ c ^ d;         g = (3 * i + 5) % 16; }
+        else             { f = c ^ (b | ~d);      g = (7 * i) % 16;     }
+
+        t = a + f + MD5_K[i] + m[g];
+        a = d;
+        d = c;
+        c = b;
+        b = b + ROTL(t, MD5_S[i]);
+    }
+
+    in[0] += a; in[1] += b; in[2] += c; in[3] += d;
+    memcpy(state, in, sizeof(in));
+}
+
+
+MB_CLONES
+void sha1_compress(uint32_t *state, const uint32_t *w)
+{
+    vec_t a, b, c, d, e, f, t;
+    vec_t m[16];
+    vec_t in[5];
+    uint32_t k;
+    int i;
+
+    memcpy(in, state, sizeof(in));
+    memcpy(m, w, sizeof(m));
+    a = in[0]; b = in[1]; c = in[2]; d = in[3]; e = in[4];
+
+#pragma GCC unroll 80
+    for (i = 0; i < 80; i++)
+    {
+        if (i >= 16)
+        {
+            t = m[(i - 3) & 15] ^ m[(i - 8) & 15] ^ m[(i - 14) & 15] ^
+                    m[i & 15];
+            m[i & 15] = ROTL(t, 1);
+        }
+
+        if (i < 20)      { f = d ^ (b & (c ^ d));       k = 0x5a827999; }
+        else if (i < 40) { f = b ^ c ^ d;               k = 0x6ed9eba1; }
+        else if (i < 60) { f = (b & c) | (d & (b | c)); k = 0x8f1bbcdc; }
+        else             { f = b ^ c ^ d;               k = 0xca62c1d6; }
+
+        t = ROTL(a, 5) + f + e + k + m[i & 15];
+        e = d;
+        d = c;
+        c = ROTL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    in[0] += a; in[1] += b; in[2] += c; in[3] += d; in[4] += e;
+    memcpy(state, in, sizeof(in));
+}
+
+
+MB_CLONES
+void sha256_compress(uint32_t *state, const uint32_t *w)
+{
+    vec_t a, b, c, d, e, f, g, h, s0, s1, t1, t2;
+    vec_t m[16];
+    vec_t in[8];
+    int i;
+
+    memcpy(in, state, sizeof(in));
+    memcpy(m, w, sizeof(m));
+    a = in[0]; b = in[1]; c = in[2]; d = in[3];
+    e = in[4]; f = in[5]; g = in[6]; h = in[7];
+
+#pragma GCC unroll 64
+    for (i = 0; i < 64; i++)
+    {
+        if (i >= 16)
+        {
+            s0 = m[(i - 15) & 15];
+            s0 = ROTR(s0, 7) ^ ROTR(s0, 18) ^ (s0 >> 3);
+            s1 = m[(i - 2) & 15];
+            s1 = ROTR(s1, 17) ^ ROTR(s1, 19) ^ (s1 >> 10);
+            m[i & 15] += s0 + m[(i - 7) & 15] + s1;
+        }
+
+        t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+                (g ^ (e & (f ^ g))) + SHA256_K[i] + m[i & 15];
+        t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+                ((a & b) | (c & (a | b)));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    in[0] += a; in[1] += b; in[2] += c; in[3] += d;
+    in[4] += e; in[5] += f; in[6] += g; in[7] += h;
+    memcpy(state, in, sizeof(in));
+}
@@ -0,0 +1,73 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Multi-buffer digest API. Hashing a small file is dominated by the per call
+ * overhead and the serial dependency chain of a single digest. Instead many
+ * independent buffers are hashed at the same time, one buffer per SIMD lane,
+ * so a single instruction advances the digest of every buffer.
+ *
+ * Implementations are chosen at runtime from what the CPU supports, AVX-512
+ * (16 lanes) then AVX2 (8 lanes). When neither is available, or the algorithm
+ * has no multi-buffer implementation, each buffer is hashed on its own with
+ * the digest.h API.
+ */
+#ifndef DIGEST_MB_H__
+#define DIGEST_MB_H__
+
+
+#include <stddef.h>
+
+#include "digest.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * max number of buffers any implementation digests at the same time
+ */
+#define DIGEST_MB_MAX_LANES 16
+
+
+/* Public API *****************************************************************/
+
+
+/**
+ * Calculate the digest `alg` of `count` independent buffers. Buffer `i` is
+ * `lens[i]` bytes at `data[i]` and its digest is written to `dests[i]`, which
+ * must have room for DIGEST_LENGTH(alg) bytes.
+ *
+ * @param alg       what digest to calculate
+ * @param dests     where to store each buffer's digest
+ * @param data      the buffers to digest
+ * @param lens      number of bytes in each buffer
+ * @param count     number of buffers
+ *
+ * @return          0 on success
+ */
+int digest_mb(digest_t alg, void *dests[], const void *data[],
+        const size_t lens[], size_t count);
+
+
+/**
+ * @param alg       the digest to ask about
+ *
+ * @return          number of buffers digested at the same time on this CPU,
+ *                  1 when buffers are digested one at a time
+ */
+size_t digest_mb_lanes(digest_t alg);
+
+
+/**
+ * @param alg       the digest to ask about
+ *
+ * @return          name of the implementation used on this CPU for `alg`
+ */
+const char *digest_mb_name(digest_t alg);
+
+
+#endif
@@ -0,0 +1,335 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of digest_selftest() and digest_benchmark() from digest.h.
+ * Both only use the public digest API, switching backends with
+ * digest_backend_select(), so they test exactly what a copy would run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blake3.h"
+#include "digest.h"
+#include "digest_mb.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * max backends of a single digest
+ */
+#define MAX_BACKENDS 8
+
+
+/**
+ * bytes in the buffer the backends are compared on, large enough for BLAKE3
+ * to stage and split it between threads
+ */
+#define CROSS_SIZE (BLAKE3_STAGE_SIZE + 1000003)
+
+
+/**
+ * # of buffers given to digesterset_digest_many(), more than the widest SIMD
+ */
+#define MANY_COUNT 40
+
+
+/**
+ * seconds each benchmark runs for
+ */
+#define BENCH_SECONDS 0.25
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * known answer for the digest of "abc"
+ */
+struct kat {
+    digest_t type;
+    const char *hex;
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * digest `len` bytes at `data` with `type` in uneven updates
+ */
+static void digest_pieces(digest_t type, unsigned char *md,
+        const unsigned char *data, size_t len);
+
+
+/**
+ * digest buffers of many lengths with digesterset_digest_many() and compare to
+ * digest()
+ *
+ * @return          0 if they match
+ */
+static int check_many(digest_t type, const unsigned char *data);
+
+
+/**
+ * @return          seconds since an arbitrary point
+ */
+static double now(void);
+
+
+/**
+ * write `len` bytes at `md` as hex to `hex`
+ */
+static void to_hex(char *hex, const unsigned char *md, size_t len);
+
+
+/* Private Variables **********************************************************/
+
+
+/**
+ * every digest type
+ */
+static const digest_t TYPES[] = {
+    DGST_MD5, DGST_SHA1, DGST_SHA256, DGST_SHA512, DGST_XXH3, DGST_CRC32C,
+    DGST_BLAKE3
+};
+
+
+/**
+ * the digests of "abc"
+ */
+static const struct kat KATS[] = {
+    { DGST_MD5,    "900150983cd24fb0d6963f7d28e17f72" },
+    { DGST_SHA1,   "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { DGST_SHA256, "ba7816bf8f01cfea414140de5dae2223"
+                   "b00361a396177a9cb410ff61f20015ad" },
+    { DGST_SHA512, "ddaf35a193617abacc417349ae204131"
+                   "12e6fa4e89a97ea20a9eeee64b55d39a"
+                   "2192992a274fc1a836ba3c23a3feebbd"
+                   "454d4423643ce80e2a9ac94fa54ca49f" },
+    { DGST_XXH3,   "06b05ab6733a618578af5f94892f3950" },
+    { DGST_CRC32C, "364b3fb7" },
+    { DGST_BLAKE3, "6437b3ac38465133ffb63b75273a8db5"
+                   "48c558465d79db03fd359c6cd5bd9d85" }
+};
+
+
+/* Public Impl ****************************************************************/
+
+
+int digest_selftest(FILE *out)
+{
+    const char *names[MAX_BACKENDS];
+    unsigned char md[MAX_DIGEST_LENGTH];
+    unsigned char first[MAX_DIGEST_LENGTH];
+    char hex[2 * MAX_DIGEST_LENGTH + 1];
+    unsigned char *data;
+    size_t i, j, n;
+    digest_t type;
+    int ret, kat, cross;
+
+    if ((data = malloc(CROSS_SIZE)) == NULL)
+        return -1;
+    for (i = 0; i < CROSS_SIZE; i++)
+        data[i] = i % 251;
+
+    ret = 0;
+    for (i = 0; i < sizeof(KATS) / sizeof(KATS[0]); i++)
+    {
+        type = KATS[i].type;
+        n = digest_backend_list(type, names, MAX_BACKENDS);
+        for (j = 0; j < n && j < MAX_BACKENDS; j++)
+        {
+            digest_backend_select(type, names[j]);
+
+            digest(type, md, "abc", 3);
+            to_hex(hex, md, DIGEST_LENGTH(type));
+            kat = strcmp(hex, KATS[i].hex) == 0;
+
+            /* every backend must agree with the first on a large input */
+            digest_pieces(type, md, data, CROSS_SIZE);
+            if (j == 0)
+                memcpy(first, md, DIGEST_LENGTH(type));
+            cross = memcmp(first, md, DIGEST_LENGTH(type)) == 0;
+
+            if (out != NULL)
+                fprintf(out, "%-8s %-10s known answer %s, large input %s\n",
+                        digest_name(type), names[j], kat? "ok" : "FAILED",
+                        cross? "ok" : "FAILED");
+            if (!kat || !cross)
+                ret = -1;
+        }
+
+        /* back to the default, which multi-buffer digests are used with */
+        digest_backend_select(type, NULL);
+        if (check_many(type, data) != 0)
+        {
+            ret = -1;
+            if (out != NULL)
+                fprintf(out, "%-8s %-10s multi-buffer FAILED\n",
+                        digest_name(type), digest_mb_name(type));
+        }
+        else if (out != NULL)
+            fprintf(out, "%-8s %-10s multi-buffer ok\n",
+                    digest_name(type), digest_mb_name(type));
+    }
+
+    free(data);
+    return ret;
+}
+
+
+int digest_benchmark(FILE *out, size_t size)
+{
+    const char *names[MAX_BACKENDS];
+    void *dests[DIGEST_MB_MAX_LANES];
+    const void *bufs[DIGEST_MB_MAX_LANES];
+    size_t lens[DIGEST_MB_MAX_LANES];
+    unsigned char mds[DIGEST_MB_MAX_LANES][MAX_DIGEST_LENGTH];
+    digesterset_t set;
+    unsigned char *data;
+    const char *selected;
+    size_t i, j, k, n, lanes;
+    double start, elapsed, bytes;
+
+    if (size == 0 || (data = malloc(size)) == NULL)
+        return -1;
+    for (i = 0; i < size; i++)
+        data[i] = i % 251;
+
+    fprintf(out, "%-8s %-10s %12s  (%zu bytes per update)\n", "digest",
+            "backend", "MB/s", size);
+    for (i = 0; i < sizeof(TYPES) / sizeof(TYPES[0]); i++)
+    {
+        selected = digest_backend_name(TYPES[i]);
+        n = digest_backend_list(TYPES[i], names, MAX_BACKENDS);
+        for (j = 0; j < n && j < MAX_BACKENDS; j++)
+        {
+            digest_backend_select(TYPES[i], names[j]);
+
+            bytes = 0;
+            start = now();
+            digesterset_create(&set, TYPES[i]);
+            do {
+                digesterset_update(&set, data, size);
+                bytes += size;
+            } while ((elapsed = now() - start) < BENCH_SECONDS);
+            digesterset_finalize(&set);
+            digesterset_free(&set);
+
+            fprintf(out, "%-8s %-10s %12.1f%s\n", digest_name(TYPES[i]),
+                    names[j], bytes / elapsed / 1e6,
+                    strcmp(names[j], selected) == 0? "  *" : "");
+        }
+        digest_backend_select(TYPES[i], NULL);
+
+        /* the small file batches hash one file per lane */
+        if ((lanes = digest_mb_lanes(TYPES[i])) == 1)
+            continue;
+
+        for (k = 0; k < lanes; k++)
+        {
+            dests[k] = mds[k];
+            bufs[k] = data;
+            lens[k] = size;
+        }
+
+        bytes = 0;
+        start = now();
+        do {
+            digest_mb(TYPES[i], dests, bufs, lens, lanes);
+            bytes += size * lanes;
+        } while ((elapsed = now() - start) < BENCH_SECONDS);
+
+        fprintf(out, "%-8s %-10s %12.1f  (%zu buffers)\n",
+                digest_name(TYPES[i]), digest_mb_name(TYPES[i]),
+                bytes / elapsed / 1e6, lanes);
+    }
+
+    free(data);
+    return 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void digest_pieces(digest_t type, unsigned char *md, const unsigned char *data,
+        size_t len)
+{
+    digesterset_t set;
+    size_t n, piece;
+
+    digesterset_create(&set, type);
+    for (piece = 1; len > 0; data += n, len -= n, piece = piece * 7 + 13)
+    {
+        n = piece % (3 * 1024 * 1024);
+        n = n < len? n : len;
+        digesterset_update(&set, data, n);
+    }
+    digesterset_finalize(&set);
+    memcpy(md, digesterset_get_value(&set, type), DIGEST_LENGTH(type));
+    digesterset_free(&set);
+}
+
+
+int check_many(digest_t type, const unsigned char *data)
+{
+    digesterset_t *sets[MANY_COUNT];
+    const void *bufs[MANY_COUNT];
+    size_t lens[MANY_COUNT];
+    unsigned char md[MAX_DIGEST_LENGTH];
+    size_t i;
+    int ret;
+
+    if (posix_memalign((void **) &sets[0], __alignof__(digesterset_t),
+            MANY_COUNT * sizeof(digesterset_t)) != 0)
+        return -1;
+
+    for (i = 0; i < MANY_COUNT; i++)
+    {
+        sets[i] = sets[0] + i;
+        bufs[i] = data + i;
+        lens[i] = i * i * 7;
+        digesterset_create(sets[i], type);
+    }
+    digesterset_digest_many(sets, bufs, lens, MANY_COUNT);
+
+    ret = 0;
+    for (i = 0; i < MANY_COUNT; i++)
+    {
+        digest(type, md, bufs[i], lens[i]);
+        if (memcmp(md, digesterset_get_value(sets[i], type),
+                DIGEST_LENGTH(type)) != 0)
+            ret = -1;
+        digesterset_free(sets[i]);
+    }
+
+    free(sets[0]);
+    return ret;
+}
+
+
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void to_hex(char *hex, const unsigned char *md, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        sprintf(hex + 2 * i, "%02x", md[i]);
+}
@@ -46,6 +46,9 @@ typedef struct {
     uint8_t *sha1;
     uint8_t *sha256;
     uint8_t *sha512;
+    uint8_t *xxh3;
+    uint8_t *crc32c;
+    uint8_t *blake3;
 
     /* This struct is to store the bytes pointed to by the above pointers, only
      * code that creates entry_t structures should use this. Reading or checking
@@ -55,6 +58,9 @@ typedef struct {
         uint8_t sha1[SHA_DIGEST_LENGTH];        /**< space for SHA1         */
         uint8_t sha256[SHA256_DIGEST_LENGTH];   /**< space for SHA256       */
         uint8_t sha512[SHA512_DIGEST_LENGTH];   /**< space for SHA512       */
+        uint8_t xxh3[XXH3_DIGEST_LENGTH];       /**< space for XXH3         */
+        uint8_t crc32c[CRC32C_DIGEST_LENGTH];   /**< space for CRC32C       */
+        uint8_t blake3[BLAKE3_DIGEST_LENGTH];   /**< space for BLAKE3       */
     } _digest_bytes;    /**< private struct to store the digests */
 
     /* file attributes */
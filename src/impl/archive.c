@@ -0,0 +1,616 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the archive from process.h, a pax (POSIX.1-2001) tar
+ * stream written in place of a destination tree. Every entry is a 512 byte
+ * ustar header followed by its bytes padded to a whole block. An entry whose
+ * path, link target, size or owner does not fit its ustar field is preceded
+ * by a pax extended header that carries it instead, so any path and size can
+ * be archived while other entries stay readable by plain ustar readers.
+ *
+ * Output is gathered in a large buffer so the stream is written with a few
+ * big sequential appends however small the files are.
+ *
+ * An archive made to be sent to another dcp follows each file with a pax
+ * global header holding its digests, "DCP.md5=HEX" and so on, that the
+ * receiving end checks its copy against. An archive of several sources starts
+ * with one holding their number, "DCP.sources=N", so that dcp reads it as the
+ * copy of several sources. Tar ignores the keys it does not know so the
+ * stream can still be listed or extracted with it.
+ */
+
+ /* for F_SETPIPE_SZ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../fd.h"
+#include "../io/pack.h"
+#include "../logging.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * size of a tar block, headers and every entry's bytes are padded to it
+ */
+#define TAR_BLOCK 512
+
+
+/**
+ * # of bytes gathered before they are written to the stream
+ */
+#define ARCHIVE_BUFFER (1024 * 1024)
+
+
+/**
+ * largest value each octal ustar field can hold, larger ones go in the pax
+ * header
+ */
+#define USTAR_MAX_SIZE 077777777777LL
+#define USTAR_MAX_ID   07777777
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * a ustar header block
+ */
+struct ustar {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+
+/**
+ * the stream being written, @see process.h
+ */
+struct archive {
+    int fd;                         /**< where the stream is written */
+    int owned;                      /**< `fd` is closed with the archive */
+    unsigned char *buf;             /**< bytes not written to `fd` yet */
+    size_t len;                     /**< # of valid bytes in `buf` */
+    off_t size;                     /**< # of bytes the open file declared */
+    off_t written;                  /**< # of bytes of it written so far */
+    int failed;                     /**< the stream could not be written */
+    int sums;                       /**< files are followed by their digests */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Write the headers of an entry, a pax extended header first if a value
+ * does not fit the ustar header.
+ *
+ * @param type      ustar typeflag of the entry
+ * @param linkname  NULL or the target of a link
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int header(struct archive *archive, const char *path, char type,
+        const struct stat *st, off_t size, const char *linkname, uid_t uid,
+        gid_t gid);
+
+
+/**
+ * Write a pax global header named `name` holding `len` bytes of `records`.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int global(struct archive *archive, const char *name,
+        const char *records, size_t len);
+
+
+/**
+ * Append the pax record "LEN key=value\n" to `records`, LEN counting itself.
+ *
+ * @return          new # of bytes in `records`, which is reallocated
+ */
+static size_t pax_record(char **records, size_t len, const char *key,
+        const char *value);
+
+
+/**
+ * Split `path` into the ustar name and prefix fields.
+ *
+ * @return          0 if it fits, -1 if it must be in a pax header
+ */
+static int split_path(struct ustar *hdr, const char *path);
+
+
+/**
+ * Copy `str` to the text `field`, NUL terminated only if it is shorter.
+ */
+static void text(char *field, size_t len, const char *str);
+
+
+/**
+ * Write `value` as a NUL terminated octal number filling `field`.
+ */
+static void octal(char *field, size_t len, uintmax_t value);
+
+
+/**
+ * Fill in the checksum of `hdr`, its other fields must be set.
+ */
+static void checksum(struct ustar *hdr);
+
+
+/**
+ * Append `len` bytes to the stream.
+ *
+ * @return          0 on success, -1 if the stream cannot be written
+ */
+static int put(struct archive *archive, const void *data, size_t len);
+
+
+/**
+ * Append zeros up to the next block boundary after `len` bytes.
+ */
+static int pad(struct archive *archive, off_t len);
+
+
+/**
+ * Write the buffered bytes to the stream.
+ */
+static int flush(struct archive *archive);
+
+
+/* Public Impl ****************************************************************/
+
+
+struct archive *archive_create(const char *path, int sums, size_t sources)
+{
+    struct archive *archive;
+    char *records;
+    char count[32];
+    size_t len;
+
+    if ((archive = calloc(1, sizeof(*archive))) == NULL ||
+            (archive->buf = malloc(ARCHIVE_BUFFER)) == NULL)
+    {
+        free(archive);
+        return NULL;
+    }
+
+    /* "-" is the conventional name for standard output, a pipe is made as
+     * large as a write so the reader is never more than one write behind */
+    archive->sums = sums;
+    if (strcmp(path, "-") == 0)
+    {
+        archive->fd = STDOUT_FILENO;
+        fcntl(archive->fd, F_SETPIPE_SZ, ARCHIVE_BUFFER);
+    }
+    else if ((archive->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666))
+            == -1)
+    {
+        log_error("cannot create archive '%s'", path);
+        free(archive->buf);
+        free(archive);
+        return NULL;
+    }
+    else
+        archive->owned = 1;
+
+    /* the members are under the names of the sources, not of a single one */
+    if (sources > 1)
+    {
+        records = NULL;
+        snprintf(count, sizeof(count), "%zu", sources);
+        len = pax_record(&records, 0, "DCP.sources", count);
+        global(archive, "GlobalHead/dcp.sources", records, len);
+        free(records);
+    }
+
+    return archive;
+}
+
+
+int archive_add(struct archive *archive, const char *path,
+        const struct stat *st, const char *target, uid_t uid, gid_t gid)
+{
+    char *dir;
+    int r;
+
+    if (S_ISDIR(st->st_mode))
+    {
+        /* directories are told apart by the trailing slash too */
+        if ((dir = malloc(strlen(path) + 2)) == NULL)
+            return -1;
+        strcat(strcpy(dir, path), "/");
+        r = header(archive, dir, '5', st, 0, NULL, uid, gid);
+        free(dir);
+        return r;
+    }
+
+    if (S_ISREG(st->st_mode) && target != NULL)
+        return header(archive, path, '1', st, 0, target, uid, gid);
+    if (S_ISLNK(st->st_mode))
+        return header(archive, path, '2', st, 0, target, uid, gid);
+    if (S_ISCHR(st->st_mode))
+        return header(archive, path, '3', st, 0, NULL, uid, gid);
+    if (S_ISBLK(st->st_mode))
+        return header(archive, path, '4', st, 0, NULL, uid, gid);
+    if (S_ISFIFO(st->st_mode))
+        return header(archive, path, '6', st, 0, NULL, uid, gid);
+
+    log_errorx("cannot archive '%s', tar has no sockets", path);
+    return -1;
+}
+
+
+int archive_begin(struct archive *archive, const char *path,
+        const struct stat *st, off_t size, uid_t uid, gid_t gid)
+{
+    archive->size    = size;
+    archive->written = 0;
+    return header(archive, path, '0', st, size, NULL, uid, gid);
+}
+
+
+int archive_write(struct archive *archive, const void *buf, size_t len)
+{
+    off_t left;
+    int r;
+
+    /* the header is written, bytes past its size cannot be archived */
+    left = archive->size - archive->written;
+    if (left < 0)
+        left = 0;
+    r = put(archive, buf, (off_t) len < left? len : (size_t) left);
+    archive->written += len;
+    return r;
+}
+
+
+int archive_end(struct archive *archive)
+{
+    static const unsigned char zeros[TAR_BLOCK];
+    off_t left;
+
+    /* the file shrank, the rest of the entry is zeros to keep the stream
+     * readable */
+    for (left = archive->size - archive->written; left > 0; left -= TAR_BLOCK)
+        put(archive, zeros, left < TAR_BLOCK? left : TAR_BLOCK);
+
+    if (pad(archive, archive->size) != 0)
+        return -1;
+
+    if (archive->written != archive->size)
+    {
+        log_errorx("file changed size while it was archived");
+        return -1;
+    }
+    return 0;
+}
+
+
+int archive_sums(struct archive *archive, digesterset_t *set)
+{
+    static const digest_t types[] = { DGST_MD5, DGST_SHA1, DGST_SHA256,
+        DGST_SHA512, DGST_XXH3, DGST_CRC32C, DGST_BLAKE3 };
+    char hex[2 * MAX_DIGEST_LENGTH + 1];
+    char key[32];
+    const void *value;
+    char *records;
+    size_t len;
+    size_t i;
+    int r;
+
+    if (!archive->sums || set->valid == 0)
+        return 0;
+
+    records = NULL;
+    len = 0;
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        if ((value = digesterset_get_value(set, types[i])) == NULL)
+            continue;
+        unpack(hex, value, DIGEST_LENGTH(types[i]));
+        snprintf(key, sizeof(key), "DCP.%s", digest_name(types[i]));
+        len = pax_record(&records, len, key, hex);
+    }
+
+    r = global(archive, "GlobalHead/dcp.sums", records, len);
+    free(records);
+    return r;
+}
+
+
+int archive_close(struct archive *archive)
+{
+    static const unsigned char zeros[2 * TAR_BLOCK];
+    int r;
+
+    if (archive == NULL)
+        return 0;
+
+    /* two zero blocks mark the end of the archive */
+    r = put(archive, zeros, sizeof(zeros)) | flush(archive);
+    if (archive->owned && close(archive->fd) != 0)
+    {
+        log_error("closing the archive failed, possible data loss");
+        r = -1;
+    }
+
+    free(archive->buf);
+    free(archive);
+    return r == 0? 0 : -1;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int header(struct archive *archive, const char *path, char type,
+        const struct stat *st, off_t size, const char *linkname, uid_t uid,
+        gid_t gid)
+{
+    struct ustar hdr, ext;
+    const char *base;
+    char number[32];
+    char *records;
+    size_t len;
+    int r;
+
+    memset(&hdr, 0, sizeof(hdr));
+    records = NULL;
+    len = 0;
+
+    if (split_path(&hdr, path) != 0)
+    {
+        len = pax_record(&records, len, "path", path);
+        base = strrchr(path, '/') == NULL? path : strrchr(path, '/') + 1;
+        text(hdr.name, sizeof(hdr.name), base);
+    }
+
+    if (linkname != NULL && strlen(linkname) > sizeof(hdr.linkname))
+        len = pax_record(&records, len, "linkpath", linkname);
+    else if (linkname != NULL)
+        text(hdr.linkname, sizeof(hdr.linkname), linkname);
+
+    if (size > USTAR_MAX_SIZE)
+    {
+        snprintf(number, sizeof(number), "%jd", (intmax_t) size);
+        len = pax_record(&records, len, "size", number);
+        size = 0;
+    }
+    if (uid > USTAR_MAX_ID)
+    {
+        snprintf(number, sizeof(number), "%ju", (uintmax_t) uid);
+        len = pax_record(&records, len, "uid", number);
+        uid = 0;
+    }
+    if (gid > USTAR_MAX_ID)
+    {
+        snprintf(number, sizeof(number), "%ju", (uintmax_t) gid);
+        len = pax_record(&records, len, "gid", number);
+        gid = 0;
+    }
+
+    octal(hdr.mode, sizeof(hdr.mode), st->st_mode & 07777);
+    octal(hdr.uid, sizeof(hdr.uid), uid);
+    octal(hdr.gid, sizeof(hdr.gid), gid);
+    octal(hdr.size, sizeof(hdr.size), size);
+    octal(hdr.mtime, sizeof(hdr.mtime), st->st_mtim.tv_sec < 0? 0 :
+            (uintmax_t) st->st_mtim.tv_sec);
+    hdr.typeflag = type;
+    memcpy(hdr.magic, "ustar", 6);
+    memcpy(hdr.version, "00", 2);
+    if (type == '3' || type == '4')
+    {
+        octal(hdr.devmajor, sizeof(hdr.devmajor), major(st->st_rdev));
+        octal(hdr.devminor, sizeof(hdr.devminor), minor(st->st_rdev));
+    }
+
+    /* the values that did not fit go first, in an entry of their own */
+    r = 0;
+    if (len != 0)
+    {
+        ext = hdr;
+        memset(ext.name, 0, sizeof(ext.name));
+        memset(ext.prefix, 0, sizeof(ext.prefix));
+        memset(ext.linkname, 0, sizeof(ext.linkname));
+        snprintf(ext.name, sizeof(ext.name), "PaxHeaders/%.80s", hdr.name);
+        octal(ext.size, sizeof(ext.size), len);
+        ext.typeflag = 'x';
+        checksum(&ext);
+
+        r = put(archive, &ext, sizeof(ext)) | put(archive, records, len) |
+                pad(archive, len);
+        free(records);
+    }
+
+    checksum(&hdr);
+    return (r | put(archive, &hdr, sizeof(hdr))) == 0? 0 : -1;
+}
+
+
+int global(struct archive *archive, const char *name, const char *records,
+        size_t len)
+{
+    struct ustar hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    snprintf(hdr.name, sizeof(hdr.name), "%s", name);
+    octal(hdr.mode, sizeof(hdr.mode), 0644);
+    octal(hdr.uid, sizeof(hdr.uid), 0);
+    octal(hdr.gid, sizeof(hdr.gid), 0);
+    octal(hdr.size, sizeof(hdr.size), len);
+    octal(hdr.mtime, sizeof(hdr.mtime), 0);
+    hdr.typeflag = 'g';
+    memcpy(hdr.magic, "ustar", 6);
+    memcpy(hdr.version, "00", 2);
+    checksum(&hdr);
+
+    return (put(archive, &hdr, sizeof(hdr)) | put(archive, records, len) |
+            pad(archive, len)) == 0? 0 : -1;
+}
+
+
+size_t pax_record(char **records, size_t len, const char *key,
+        const char *value)
+{
+    char *grown;
+    size_t n, total;
+    int digits;
+
+    /* the length counts its own digits */
+    n = strlen(key) + strlen(value) + 3;
+    digits = snprintf(NULL, 0, "%zu", n);
+    total = n + digits;
+    if (snprintf(NULL, 0, "%zu", total) > digits)
+        total++;
+
+    if ((grown = realloc(*records, len + total + 1)) == NULL)
+        return len;
+    *records = grown;
+    snprintf(*records + len, total + 1, "%zu %s=%s\n", total, key, value);
+    return len + total;
+}
+
+
+int split_path(struct ustar *hdr, const char *path)
+{
+    const char *slash;
+    size_t len;
+
+    len = strlen(path);
+    if (len <= sizeof(hdr->name))
+    {
+        text(hdr->name, sizeof(hdr->name), path);
+        return 0;
+    }
+
+    /* the prefix is everything before a slash, the name what is after */
+    for (slash = strchr(path, '/'); slash != NULL;
+            slash = strchr(slash + 1, '/'))
+    {
+        if ((size_t) (slash - path) > sizeof(hdr->prefix))
+            break;
+        if (len - (slash - path) - 1 <= sizeof(hdr->name) && slash[1] != '\0')
+        {
+            memcpy(hdr->prefix, path, slash - path);
+            text(hdr->name, sizeof(hdr->name), slash + 1);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+void text(char *field, size_t len, const char *str)
+{
+    size_t n;
+
+    n = strlen(str);
+    memcpy(field, str, n < len? n : len);
+}
+
+
+void octal(char *field, size_t len, uintmax_t value)
+{
+    /* zero padded from the right, callers keep values within the field */
+    field[--len] = '\0';
+    while (len > 0)
+    {
+        field[--len] = '0' + (value & 7);
+        value >>= 3;
+    }
+}
+
+
+void checksum(struct ustar *hdr)
+{
+    const unsigned char *bytes;
+    unsigned sum;
+    size_t i;
+
+    /* taken with the checksum field as spaces */
+    memset(hdr->chksum, ' ', sizeof(hdr->chksum));
+    bytes = (const unsigned char *) hdr;
+    for (sum = 0, i = 0; i < sizeof(*hdr); i++)
+        sum += bytes[i];
+    snprintf(hdr->chksum, sizeof(hdr->chksum), "%06o", sum);
+    hdr->chksum[7] = ' ';
+}
+
+
+int put(struct archive *archive, const void *data, size_t len)
+{
+    size_t n;
+
+    for (; len > 0 && !archive->failed; len -= n)
+    {
+        if (archive->len == ARCHIVE_BUFFER && flush(archive) != 0)
+            break;
+
+        n = ARCHIVE_BUFFER - archive->len < len?
+                ARCHIVE_BUFFER - archive->len : len;
+        memcpy(archive->buf + archive->len, data, n);
+        archive->len += n;
+        data = (const unsigned char *) data + n;
+    }
+    return archive->failed? -1 : 0;
+}
+
+
+int pad(struct archive *archive, off_t len)
+{
+    static const unsigned char zeros[TAR_BLOCK];
+
+    if (len % TAR_BLOCK == 0)
+        return archive->failed? -1 : 0;
+    return put(archive, zeros, TAR_BLOCK - len % TAR_BLOCK);
+}
+
+
+int flush(struct archive *archive)
+{
+    if (archive->failed)
+        return -1;
+
+    if (fd_write_full(archive->fd, archive->buf, archive->len) == -1)
+    {
+        log_error("cannot write the archive");
+        archive->failed = 1;
+        return -1;
+    }
+    archive->len = 0;
+    return 0;
+}
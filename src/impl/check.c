@@ -0,0 +1,303 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of dcp_check from dcp.h. The walk queues each regular file
+ * for a hasher, @see process.h, so many files are read at once and the digests
+ * use every core. Finished files are judged in the order they were queued by
+ * the walk's thread, which is the only one to touch the index or call the
+ * callback.
+ */
+
+ /* for asprintf */
+#define _GNU_SOURCE
+#include <stdio.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dcp.h"
+#include "process.h"
+#include "../digest.h"
+#include "../entry.h"
+#include "../index/index.h"
+#include "../io/io_entry.h"
+#include "../logging.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the manifest being checked and the threads reading the tree
+ */
+struct check {
+    index_t *index;                         /**< the manifest's entries */
+    digest_t type;                          /**< the index's key digest */
+    struct hasher *hasher;                  /**< reads and reports the files */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * queue a regular file for the threads, waiting for room if needed
+ */
+static void check_submit(struct check *check, const FTSENT *ent,
+        const char *dapath);
+
+
+/**
+ * compare a hashed file with the index, @see hasher_judge_f
+ */
+static dcp_state_t check_judge(const struct hashjob *job, void *check);
+
+
+/**
+ * send every manifest entry still in the index to the callback as missing
+ *
+ * @return          0 on success, -1 if the manifest cannot be read
+ */
+static int check_missing(struct check *check, const char *manifest);
+
+
+/**
+ * @return          the entry's `type` digest, NULL if it has none
+ */
+static const void *entry_digest(const entry_t *entry, digest_t type);
+
+
+/* Public Impl ****************************************************************/
+
+
+int dcp_check(const char *path, const char *manifest,
+        struct dcp_options *opts, dcp_callback_f callback, void *ctx)
+{
+    struct check check;
+    char *root;
+    char *paths[2];
+    char *dapath;
+    const char *failed_path;
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];
+    size_t rootlen;
+    size_t failed;
+    size_t differ;
+    FTS *fts;
+    FTSENT *ent;
+
+    /* fts does not repeat trailing slashes, neither can our root */
+    if ((root = strdup(path)) == NULL)
+    {
+        log_error("cannot check '%s'", path);
+        return -1;
+    }
+    for (rootlen = strlen(root); rootlen > 1 && root[rootlen - 1] == '/';)
+        root[--rootlen] = '\0';
+    if (strcmp(root, "/") == 0)
+        rootlen = 0;
+
+    check.index = opts->index;
+    check.type  = index_get_digest_type(opts->index);
+
+    if (opts->bufsize == 0)
+        opts->bufsize = (8 * 4096);
+
+    if ((check.hasher = hasher_create(check.type, 1, opts->threads,
+            opts->bufsize, check_judge, &check, callback, ctx)) == NULL)
+    {
+        free(root);
+        return -1;
+    }
+
+    paths[0] = root;
+    paths[1] = NULL;
+    fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    while ((ent = fts_read(fts)) != NULL)
+    {
+        switch (ent->fts_info)
+        {
+        case FTS_F:
+            /* like a copy to a new path the root is renamed, a single file is
+             * reported by its name */
+            if (ent->fts_level != 0)
+                check_submit(&check, ent, ent->fts_path + rootlen);
+            else if (asprintf(&dapath, "/%s", ent->fts_name) >= 0)
+            {
+                check_submit(&check, ent, dapath);
+                free(dapath);
+            }
+            break;
+
+        case FTS_ERR:
+        case FTS_NS:
+        case FTS_DNR:
+            errno = ent->fts_errno;
+            log_error("cannot check '%s'", ent->fts_path);
+            failed_path = ent->fts_level == 0? "/" : ent->fts_path + rootlen;
+            digest(DGST_MD5, pathmd5, failed_path, strlen(failed_path));
+            hasher_report(check.hasher, DCP_FAILED, pathmd5, failed_path,
+                    NULL, NULL, NULL, -1);
+            break;
+
+        /* only regular files are in the index */
+        default: {}
+        }
+
+        /* report what has been hashed so far */
+        hasher_drain(check.hasher, 0);
+    }
+    fts_close(fts);
+
+    hasher_drain(check.hasher, 1);
+
+    /* what is left in the index was not found */
+    failed = check_missing(&check, manifest) != 0;
+
+    failed += hasher_count(check.hasher, DCP_FAILED);
+    differ = hasher_count(check.hasher, DCP_CHECK_MISMATCHED) +
+            hasher_count(check.hasher, DCP_CHECK_MISSING) +
+            hasher_count(check.hasher, DCP_CHECK_EXTRA);
+    if (failed + differ != 0)
+        log_errorx("%zu matched, %zu mismatched, %zu missing, %zu extra and "
+                "%zu failed", hasher_count(check.hasher, DCP_CHECK_MATCHED),
+                hasher_count(check.hasher, DCP_CHECK_MISMATCHED),
+                hasher_count(check.hasher, DCP_CHECK_MISSING),
+                hasher_count(check.hasher, DCP_CHECK_EXTRA), failed);
+
+    hasher_free(check.hasher);
+    free(root);
+    return failed + differ == 0? 0 : -1;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void check_submit(struct check *check, const FTSENT *ent, const char *dapath)
+{
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];
+    const char *accpath;
+    int dirfd;
+
+    digest(DGST_MD5, pathmd5, dapath, strlen(dapath));
+    accpath = ent->fts_accpath;
+    dirfd = AT_FDCWD;
+    if (hasher_submit(check->hasher, &dirfd, &accpath, dapath, pathmd5,
+            ent->fts_statp) != 0)
+        hasher_report(check->hasher, DCP_FAILED, pathmd5, dapath,
+                ent->fts_statp, ent->fts_accpath, NULL, -1);
+}
+
+
+dcp_state_t check_judge(const struct hashjob *job, void *arg)
+{
+    const struct hashed *file;
+    struct check *check;
+    dcp_state_t state;
+
+    check = arg;
+    file = &job->files[0];
+    if (file->err != 0 || !file->regular)
+    {
+        errno = file->err != 0? file->err : EISDIR;
+        log_error("cannot read '%s'", file->path);
+        return DCP_FAILED;
+    }
+
+    switch (index_lookup(check->index, job->pathmd5, file->digest))
+    {
+    case INDEX_SUCCESS:
+        state = DCP_CHECK_MATCHED;
+        break;
+
+    case INDEX_NO_ENTRY:
+        switch (index_lookup_path(check->index, job->pathmd5, NULL))
+        {
+        case INDEX_SUCCESS:  state = DCP_CHECK_MISMATCHED; break;
+        case INDEX_NO_ENTRY: state = DCP_CHECK_EXTRA;      break;
+        default:             state = DCP_FAILED;
+        }
+        break;
+
+    default:
+        state = DCP_FAILED;
+    }
+
+    /* the path has been seen, anything left in the index is missing */
+    if (state == DCP_CHECK_MATCHED || state == DCP_CHECK_MISMATCHED)
+        index_remove_path(check->index, job->pathmd5);
+
+    if (state == DCP_CHECK_MISMATCHED)
+        log_errorx("'%s' does not match the manifest", file->path);
+    return state;
+}
+
+int check_missing(struct check *check, const char *manifest)
+{
+    FILE *stream;
+    entry_t entry;
+    struct stat st;
+    char path[PATH_MAX];
+    const void *digest;
+    size_t line;
+
+    if ((stream = fopen(manifest, "r")) == NULL)
+    {
+        log_error("cannot open '%s'", manifest);
+        return -1;
+    }
+
+    line = 0;
+    while (io_entry_read_path(&entry, path, sizeof(path), stream, &line) == 0)
+    {
+        if (!S_ISREG(entry.mode) ||
+                (digest = entry_digest(&entry, check->type)) == NULL ||
+                index_lookup(check->index, entry.pathmd5, digest) !=
+                INDEX_SUCCESS)
+            continue;
+
+        /* report what the manifest knew about the file */
+        memset(&st, 0, sizeof(st));
+        st.st_mode = entry.mode;
+        st.st_size = entry.size;
+        st.st_atim = entry.atime;
+        st.st_mtim = entry.mtime;
+        st.st_ctim = entry.ctime;
+
+        log_errorx("'%s' is missing", path);
+        hasher_report(check->hasher, DCP_CHECK_MISSING, entry.pathmd5, path,
+                &st, NULL, digest, -1);
+
+        /* only once, even if it is in the manifest again */
+        index_remove_path(check->index, entry.pathmd5);
+    }
+
+    fclose(stream);
+    return 0;
+}
+
+
+const void *entry_digest(const entry_t *entry, digest_t type)
+{
+    switch (type)
+    {
+    case DGST_MD5:    return entry->md5;
+    case DGST_SHA1:   return entry->sha1;
+    case DGST_SHA256: return entry->sha256;
+    case DGST_SHA512: return entry->sha512;
+    case DGST_XXH3:   return entry->xxh3;
+    case DGST_CRC32C: return entry->crc32c;
+    case DGST_BLAKE3: return entry->blake3;
+    default:          return NULL;
+    }
+}
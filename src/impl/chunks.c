@@ -0,0 +1,421 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the chunk store from process.h. Files are cut into
+ * variable size chunks with FastCDC, a rolling Gear hash whose cut points
+ * depend on the content so an edit only changes the chunks around it. Each
+ * chunk is stored once in the store by its blake3 digest
+ *
+ *      STORE/ab/cdef...
+ *
+ * and the copy of a file is a recipe listing its chunks in order
+ *
+ *      dcpchunks1 blake3 SIZE
+ *      HEX LENGTH
+ *      ...
+ *
+ * which chunks_restore turns back into the file.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../fd.h"
+#include "../io/pack.h"
+#include "../logging.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * no cut is made before this many bytes of a chunk
+ */
+#define CHUNK_MIN (2 * 1024)
+
+
+/**
+ * size chunks are normalized around, the harder mask is used before it and
+ * the easier one after
+ */
+#define CHUNK_AVG (8 * 1024)
+
+
+/**
+ * a chunk is cut here if the content has not cut it sooner
+ */
+#define CHUNK_MAX (64 * 1024)
+
+
+/**
+ * FastCDC's masks for CHUNK_AVG, 15 and 11 bits spread over the hash
+ */
+#define CHUNK_MASK_S 0x0003590703530000ULL
+#define CHUNK_MASK_L 0x0000d90003530000ULL
+
+
+/**
+ * digest chunks are named by, wide enough that two chunks never share one
+ */
+#define CHUNK_DIGEST DGST_BLAKE3
+
+
+/**
+ * version tag at the start of every recipe
+ */
+#define CHUNK_TAG "dcpchunks1"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the chunk store and the file being cut, @see process.h
+ */
+struct chunker {
+    int store;                      /**< fd of the store's root */
+    uint64_t gear[256];             /**< random value for each byte */
+    unsigned char buf[CHUNK_MAX];   /**< bytes not cut into a chunk yet */
+    size_t len;                     /**< # of valid bytes in `buf` */
+    char *recipe;                   /**< recipe of the file so far */
+    size_t rlen;                    /**< # of bytes in `recipe` */
+    size_t rcap;                    /**< # of bytes allocated for `recipe` */
+    off_t size;                     /**< # of bytes in the file so far */
+    int failed;                     /**< a chunk of the file was not stored */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * @return          # of bytes of the next chunk at the start of `buf`
+ */
+static size_t cut(const struct chunker *chunker, const unsigned char *buf,
+        size_t len);
+
+
+/**
+ * Store the chunk `data` unless it is already and add it to the recipe.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int put_chunk(struct chunker *chunker, const void *data, size_t len);
+
+
+/**
+ * Write the path of the chunk with digest `value` to `obj`, "ab/cdef...".
+ *
+ * @param obj       at least 2 * MAX_DIGEST_LENGTH + 2 bytes
+ */
+static void chunk_path(char *obj, const void *value);
+
+
+/* Public Impl ****************************************************************/
+
+
+struct chunker *chunker_create(const char *path, int create)
+{
+    struct chunker *chunker;
+    uint64_t x, z;
+    char dir[3];
+    int i;
+
+    if (create && mkdir(path, 0777) != 0 && errno != EEXIST)
+    {
+        log_error("cannot create chunk store '%s'", path);
+        return NULL;
+    }
+
+    if ((chunker = calloc(1, sizeof(*chunker))) == NULL)
+        return NULL;
+
+    if ((chunker->store = open(path, O_RDONLY | O_DIRECTORY)) == -1)
+    {
+        log_error("cannot open chunk store '%s'", path);
+        free(chunker);
+        return NULL;
+    }
+
+    /* every chunk's directory is made up front rather than per chunk */
+    for (i = 0; create && i < 256; i++)
+    {
+        snprintf(dir, sizeof(dir), "%02x", i);
+        if (mkdirat(chunker->store, dir, 0777) != 0 && errno != EEXIST)
+        {
+            log_error("cannot create '%s' in chunk store '%s'", dir, path);
+            chunker_free(chunker);
+            return NULL;
+        }
+    }
+
+    /* the table must never change or old recipes cut differently, splitmix64
+     * from a fixed seed fills it */
+    x = 0x6463706368756e6bULL;
+    for (i = 0; i < 256; i++)
+    {
+        z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        chunker->gear[i] = z ^ (z >> 31);
+    }
+
+    return chunker;
+}
+
+
+void chunker_reset(struct chunker *chunker)
+{
+    chunker->len = 0;
+    chunker->rlen = 0;
+    chunker->size = 0;
+    chunker->failed = 0;
+}
+
+
+int chunker_update(struct chunker *chunker, const void *data, size_t len)
+{
+    const unsigned char *bytes;
+    size_t want, n;
+
+    bytes = data;
+    chunker->size += len;
+    while (len > 0)
+    {
+        want = CHUNK_MAX - chunker->len < len? CHUNK_MAX - chunker->len : len;
+        memcpy(chunker->buf + chunker->len, bytes, want);
+        chunker->len += want;
+        bytes += want;
+        len -= want;
+
+        /* a full window always has a cut, the rest waits for more bytes */
+        if (chunker->len < CHUNK_MAX)
+            break;
+
+        n = cut(chunker, chunker->buf, chunker->len);
+        if (put_chunk(chunker, chunker->buf, n) != 0)
+            chunker->failed = 1;
+        memmove(chunker->buf, chunker->buf + n, chunker->len - n);
+        chunker->len -= n;
+    }
+    return chunker->failed? -1 : 0;
+}
+
+
+int chunker_finish(struct chunker *chunker, int fd)
+{
+    char header[64];
+    size_t n;
+    int hlen;
+
+    /* the last bytes are cut as they would be were more to come */
+    while (chunker->len > 0)
+    {
+        n = cut(chunker, chunker->buf, chunker->len);
+        if (put_chunk(chunker, chunker->buf, n) != 0)
+            chunker->failed = 1;
+        memmove(chunker->buf, chunker->buf + n, chunker->len - n);
+        chunker->len -= n;
+    }
+
+    if (chunker->failed)
+        return -1;
+
+    hlen = snprintf(header, sizeof(header), CHUNK_TAG " %s %jd\n",
+            digest_name(CHUNK_DIGEST), (intmax_t) chunker->size);
+    if (fd_write_full(fd, header, hlen) == -1 ||
+            fd_write_full(fd, chunker->recipe, chunker->rlen) == -1)
+    {
+        log_debug("cannot write recipe");
+        return -1;
+    }
+    return 0;
+}
+
+
+ssize_t chunks_restore(struct chunker *chunker, FILE *recipe, int fd,
+        digesterset_t *set)
+{
+    char line[2 * MAX_DIGEST_LENGTH + 64];
+    char name[32];
+    char hex[2 * MAX_DIGEST_LENGTH + 1];
+    char obj[2 * MAX_DIGEST_LENGTH + 2];
+    unsigned char value[MAX_DIGEST_LENGTH];
+    unsigned char check[MAX_DIGEST_LENGTH];
+    intmax_t size;
+    size_t len;
+    off_t total;
+    ssize_t n;
+    int c;
+
+    if (fgets(line, sizeof(line), recipe) == NULL ||
+            sscanf(line, CHUNK_TAG " %31s %jd", name, &size) != 2 ||
+            strcmp(name, digest_name(CHUNK_DIGEST)) != 0)
+    {
+        log_errorx("not a recipe");
+        return -1;
+    }
+
+    total = 0;
+    while (fgets(line, sizeof(line), recipe) != NULL)
+    {
+        if (sscanf(line, "%128s %zu", hex, &len) != 2 ||
+                strlen(hex) != 2 * DIGEST_LENGTH(CHUNK_DIGEST) ||
+                pack(value, hex, 0) != 0 || len > CHUNK_MAX)
+        {
+            log_errorx("damaged recipe line '%s'", line);
+            return -1;
+        }
+
+        chunk_path(obj, value);
+        if ((c = openat(chunker->store, obj, O_RDONLY)) == -1)
+        {
+            log_error("cannot open chunk '%s'", obj);
+            return -1;
+        }
+        n = fd_read_full(c, chunker->buf, len);
+        close(c);
+
+        /* a chunk that is not what the recipe says is never written */
+        if (n != (ssize_t) len ||
+                digest(CHUNK_DIGEST, check, chunker->buf, len) != 0 ||
+                memcmp(check, value, DIGEST_LENGTH(CHUNK_DIGEST)) != 0)
+        {
+            log_errorx("chunk '%s' is damaged", obj);
+            return -1;
+        }
+
+        digesterset_update(set, chunker->buf, len);
+        if (fd_write_full(fd, chunker->buf, len) == -1)
+        {
+            log_debug("fd_write");
+            return -1;
+        }
+        total += len;
+    }
+
+    if (ferror(recipe) || total != size)
+    {
+        log_errorx("recipe is %jd bytes short", size - (intmax_t) total);
+        return -1;
+    }
+    return total;
+}
+
+
+void chunker_free(struct chunker *chunker)
+{
+    if (chunker == NULL)
+        return;
+
+    close(chunker->store);
+    free(chunker->recipe);
+    free(chunker);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+size_t cut(const struct chunker *chunker, const unsigned char *buf, size_t len)
+{
+    uint64_t fp;
+    size_t normal;
+    size_t i;
+
+    if (len <= CHUNK_MIN)
+        return len;
+    if (len > CHUNK_MAX)
+        len = CHUNK_MAX;
+    normal = len < CHUNK_AVG? len : CHUNK_AVG;
+
+    /* cuts are harder to find before the average size and easier after */
+    fp = 0;
+    for (i = CHUNK_MIN; i < normal; i++)
+    {
+        fp = (fp << 1) + chunker->gear[buf[i]];
+        if (!(fp & CHUNK_MASK_S))
+            return i;
+    }
+    for (; i < len; i++)
+    {
+        fp = (fp << 1) + chunker->gear[buf[i]];
+        if (!(fp & CHUNK_MASK_L))
+            return i;
+    }
+    return i;
+}
+
+
+int put_chunk(struct chunker *chunker, const void *data, size_t len)
+{
+    unsigned char value[MAX_DIGEST_LENGTH];
+    char hex[2 * MAX_DIGEST_LENGTH + 1];
+    char obj[2 * MAX_DIGEST_LENGTH + 2];
+    char tmp[2 * MAX_DIGEST_LENGTH + 8];
+    struct stat st;
+    size_t need;
+    char *grown;
+    int d;
+
+    digest(CHUNK_DIGEST, value, data, len);
+    unpack(hex, value, DIGEST_LENGTH(CHUNK_DIGEST));
+
+    /* the recipe line, written whether or not the chunk is new */
+    need = strlen(hex) + 32;
+    if (chunker->rlen + need > chunker->rcap)
+    {
+        if ((grown = realloc(chunker->recipe, 2 * chunker->rcap + need))
+                == NULL)
+            return -1;
+        chunker->recipe = grown;
+        chunker->rcap = 2 * chunker->rcap + need;
+    }
+    chunker->rlen += snprintf(chunker->recipe + chunker->rlen,
+            chunker->rcap - chunker->rlen, "%s %zu\n", hex, len);
+
+    chunk_path(obj, value);
+    if (fstatat(chunker->store, obj, &st, 0) == 0 &&
+            st.st_size == (off_t) len)
+        return 0;
+
+    /* a chunk is only ever seen whole, it is renamed in once written */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", obj);
+    if ((d = openat(chunker->store, tmp, O_WRONLY | O_CREAT | O_TRUNC,
+            0444)) == -1)
+    {
+        log_error("cannot create chunk '%s'", obj);
+        return -1;
+    }
+    if ((fd_write_full(d, data, len) == -1) | (close(d) != 0) ||
+            renameat(chunker->store, tmp, chunker->store, obj) != 0)
+    {
+        log_error("cannot write chunk '%s'", obj);
+        unlinkat(chunker->store, tmp, 0);
+        return -1;
+    }
+    return 0;
+}
+
+
+void chunk_path(char *obj, const void *value)
+{
+    char hex[2 * MAX_DIGEST_LENGTH + 1];
+
+    unpack(hex, value, DIGEST_LENGTH(CHUNK_DIGEST));
+    memcpy(obj, hex, 2);
+    obj[2] = '/';
+    strcpy(obj + 3, hex + 2);
+}
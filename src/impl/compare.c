@@ -0,0 +1,300 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the comparer from process.h. Each regular file the walk
+ * finds is queued once for a hasher with two lanes, one reads and digests the
+ * source and the other the path it would have been copied to, so both trees
+ * are read at the same time with their own requests in flight.
+ */
+
+/* for asprintf and fdopendir */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../logging.h"
+#include "dcp.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * the sides of a comparison, each is a lane of the hasher
+ */
+#define SIDE_SRC  0
+#define SIDE_DEST 1
+#define SIDES     2
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the threads reading both sides and the digest they are compared by
+ */
+struct comparer {
+    digest_t type;                          /**< digest that is compared */
+    struct hasher *hasher;                  /**< reads and reports the files */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * compare both sides of a job, @see hasher_judge_f
+ */
+static dcp_state_t compare_judge(const struct hashjob *job, void *comparer);
+
+
+/**
+ * send every regular file under `path` to the callback as extra
+ *
+ * @param dapath    the DAPath of `path`
+ */
+static void compare_extra_tree(struct comparer *comparer, const char *path,
+        const char *dapath);
+
+
+/**
+ * qsort and bsearch comparison of two c strings
+ */
+static int namecmp(const void *a, const void *b);
+
+
+/* Public Impl ****************************************************************/
+
+
+struct comparer *comparer_create(digest_t type, size_t threads, size_t bufsize,
+        dcp_callback_f callback, void *ctx)
+{
+    struct comparer *comparer;
+
+    if ((comparer = malloc(sizeof(*comparer))) == NULL)
+        return NULL;
+
+    comparer->type = type;
+    if ((comparer->hasher = hasher_create(type, SIDES, threads, bufsize,
+            compare_judge, comparer, callback, ctx)) == NULL)
+    {
+        free(comparer);
+        return NULL;
+    }
+    return comparer;
+}
+
+
+int comparer_submit(struct comparer *comparer, const file_t *newdir,
+        const char *newpath, const char *oldpath, const struct stat *oldst,
+        const char *dapath, const void *pathmd5)
+{
+    const char *paths[SIDES];
+    int dirfds[SIDES];
+
+    dirfds[SIDE_SRC]  = AT_FDCWD;
+    paths[SIDE_SRC]   = oldpath;
+    dirfds[SIDE_DEST] = newdir->fd;
+    paths[SIDE_DEST]  = newpath;
+    return hasher_submit(comparer->hasher, dirfds, paths, dapath, pathmd5,
+            oldst);
+}
+
+
+void comparer_extras(struct comparer *comparer, FTS *fts,
+        const file_t *newdir, const char *newpath, const char *dapath)
+{
+    const char **names;
+    const char *name;
+    char *path;
+    char *extra;
+    char *full;
+    size_t count;
+    struct dirent *dent;
+    struct stat st;
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];
+    FTSENT *children, *child;
+    DIR *dir;
+    int fd;
+
+    /* the destination directory missing is reported by its files */
+    if ((fd = openat(newdir->fd, newpath, O_RDONLY | O_DIRECTORY)) == -1)
+        return;
+
+    if ((dir = fdopendir(fd)) == NULL)
+    {
+        close(fd);
+        return;
+    }
+    path = strdup(pathstr(newdir, newpath));
+
+    /* fts reads the source directory once, for us and then its walk */
+    children = fts_children(fts, 0);
+    count = 0;
+    for (child = children; child != NULL; child = child->fts_link)
+        count++;
+
+    names = calloc(count + 1, sizeof(*names));
+    count = 0;
+    for (child = children; child != NULL && names != NULL;
+            child = child->fts_link)
+        names[count++] = child->fts_name;
+    if (names != NULL)
+        qsort(names, count, sizeof(*names), namecmp);
+
+    while (names != NULL && path != NULL && (dent = readdir(dir)) != NULL)
+    {
+        name = dent->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+                bsearch(&name, names, count, sizeof(*names), namecmp) != NULL)
+            continue;
+
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+
+        if (asprintf(&extra, "%s/%s", strcmp(dapath, "/") == 0? "" : dapath,
+                name) < 0)
+            break;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            if (asprintf(&full, "%s/%s", path, name) >= 0)
+            {
+                compare_extra_tree(comparer, full, extra);
+                free(full);
+            }
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            digest(DGST_MD5, pathmd5, extra, strlen(extra));
+            log_errorx("'%s/%s' is not in the source", path, name);
+            hasher_report(comparer->hasher, DCP_CHECK_EXTRA, pathmd5, extra,
+                    &st, NULL, NULL, -1);
+        }
+        free(extra);
+    }
+
+    if (names == NULL || path == NULL)
+        log_errorx("cannot list extra files of '%s'", pathstr(newdir, newpath));
+
+    closedir(dir);
+    free(names);
+    free(path);
+}
+
+
+size_t comparer_drain(struct comparer *comparer, int wait)
+{
+    hasher_drain(comparer->hasher, wait);
+    return hasher_count(comparer->hasher, DCP_FAILED) +
+            hasher_count(comparer->hasher, DCP_CHECK_MISMATCHED) +
+            hasher_count(comparer->hasher, DCP_CHECK_MISSING) +
+            hasher_count(comparer->hasher, DCP_CHECK_EXTRA);
+}
+
+
+void comparer_free(struct comparer *comparer)
+{
+    if (comparer == NULL)
+        return;
+
+    hasher_free(comparer->hasher);
+    free(comparer);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+dcp_state_t compare_judge(const struct hashjob *job, void *arg)
+{
+    const struct hashed *src, *dest;
+    struct comparer *comparer;
+
+    comparer = arg;
+    src  = &job->files[SIDE_SRC];
+    dest = &job->files[SIDE_DEST];
+
+    if (src->err != 0)
+    {
+        errno = src->err;
+        log_error("cannot read '%s'", src->path);
+        return DCP_FAILED;
+    }
+    else if (dest->err == ENOENT || dest->err == ENOTDIR)
+    {
+        log_errorx("'%s' is missing", dest->path);
+        return DCP_CHECK_MISSING;
+    }
+    else if (dest->err != 0)
+    {
+        errno = dest->err;
+        log_error("cannot read '%s'", dest->path);
+        return DCP_FAILED;
+    }
+    else if (!src->regular || !dest->regular || memcmp(src->digest,
+            dest->digest, DIGEST_LENGTH(comparer->type)) != 0)
+    {
+        log_errorx("'%s' does not match '%s'", dest->path, src->path);
+        return DCP_CHECK_MISMATCHED;
+    }
+    return DCP_CHECK_MATCHED;
+}
+
+
+void compare_extra_tree(struct comparer *comparer, const char *path,
+        const char *dapath)
+{
+    char *paths[2];
+    char *extra;
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];
+    size_t rootlen;
+    FTS *fts;
+    FTSENT *ent;
+
+    if ((paths[0] = strdup(path)) == NULL)
+        return;
+    paths[1] = NULL;
+    rootlen = strlen(path);
+
+    fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    while (fts != NULL && (ent = fts_read(fts)) != NULL)
+    {
+        if (ent->fts_info != FTS_F)
+            continue;
+
+        if (asprintf(&extra, "%s%s", dapath, ent->fts_path + rootlen) < 0)
+            break;
+        digest(DGST_MD5, pathmd5, extra, strlen(extra));
+        log_errorx("'%s' is not in the source", ent->fts_path);
+        hasher_report(comparer->hasher, DCP_CHECK_EXTRA, pathmd5, extra,
+                ent->fts_statp, NULL, NULL, -1);
+        free(extra);
+    }
+
+    if (fts != NULL)
+        fts_close(fts);
+    free(paths[0]);
+}
+
+
+int namecmp(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
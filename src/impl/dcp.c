@@ -24,6 +24,7 @@
 #include <unistd.h>
 
 #include "dcp.h"
+#include "../cache.h"
 #include "../index/index.h"
 #include "../logging.h"
 
@@ -54,12 +55,54 @@ static inline void process(file_t *newdir, const char *newpath, FTSENT *ent,
         int verbose);
 
 
+/**
+ * set up the paths to copy to `newpath`, into it if it is an existing
+ * directory. If `renamed` is set a single source is always copied to
+ * `newpath` itself, as though it did not exist.
+ */
 static int initdestandpaths(file_t *dest, char *path, const char **destpath,
-        const char **dapath, const char *newpath, size_t src_count);
+        const char **dapath, const char *newpath, size_t src_count,
+        int renamed);
+
+
+/**
+ * set up the paths to report items relative to their source when there is no
+ * destination, as if `src` were copied to a path that does not exist
+ */
+static void initsrcpaths(file_t *dest, char *path, const char **destpath,
+        const char **dapath, const char *src[], size_t src_count);
 
 
-static inline int do_append(FTSENT *ent, const file_t *destroot,
-        const char *newpath);
+/**
+ * open every other destination in `opts->mirrors` the way the first was, into
+ * it if it is an existing directory or as `renamed` otherwise, and start
+ * writing to them
+ *
+ * @param skip      length of the first destination's name for the sources
+ *
+ * @return          the fan-out, NULL on failure
+ */
+static struct fanout *open_mirrors(const struct dcp_options *opts,
+        size_t skip, size_t src_count, int renamed, dcp_callback_f callback,
+        void *ctx);
+
+
+static inline int do_append(FTSENT *ent, int renamed);
+
+
+/**
+ * pick the digest in `digests` to verify or compare copies with, the fastest
+ */
+static digest_t verify_type(int digests);
+
+
+/**
+ * pick the digest in `digests` files are taken to be identical by, one that
+ * no one can make two files share: blake3, sha512 or sha256
+ *
+ * @return          the digest, 0 if there is none of them
+ */
+static digest_t content_type(int digests);
 
 
 static inline int do_unappend(FTSENT *ent);
@@ -78,6 +121,17 @@ const char *dcp_strstate(dcp_state_t state)
     case DCP_SYMLINK_CREATED: return "SYMLINK_CREATED";
     case DCP_SPECIAL_CREATED: return "SPECIAL_CREATED";
     case DCP_DIR_FAILED:      return "DIR_FAILED";
+    case DCP_PROFILED:        return "PROFILED";
+    case DCP_FILE_VERIFIED:   return "FILE_VERIFIED";
+    case DCP_VERIFY_FAILED:   return "VERIFY_FAILED";
+    case DCP_CHECK_MATCHED:   return "MATCHED";
+    case DCP_CHECK_MISMATCHED:return "MISMATCHED";
+    case DCP_CHECK_MISSING:   return "MISSING";
+    case DCP_CHECK_EXTRA:     return "EXTRA";
+    case DCP_LINK_CREATED:    return "LINK_CREATED";
+    case DCP_FILE_MOVED:      return "MOVED";
+    case DCP_MIRROR_COPIED:   return "MIRROR_COPIED";
+    case DCP_MIRROR_FAILED:   return "MIRROR_FAILED";
     default: return "";
     }
 }
@@ -91,7 +145,23 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
     const char **paths;     /* fts expects a NULL terminated list of c strs */
     FTS *fts;               /* pointer to the fts library's handle */
     FTSENT *ent;            /* entry in the walk returned by fts_read */
-    void *buf;              /* pointer to the buffer to use to cache files */
+    void *buf;              /* pointer to the buffer to use for reads */
+    cache_t *cache;         /* memory to hold whole files in */
+    struct batch *batch;    /* small files waiting in the cache */
+    digesterset_t dgstset;  /* digests of the file being copied */
+    struct verifier *verifier; /* rereads copies behind the walk */
+    struct comparer *comparer; /* hashes existing copies with the walk */
+    struct chunker *chunker;   /* NULL or the chunk store */
+    struct fanout *fanout;     /* NULL or the other destinations */
+    struct archive *archive;   /* NULL or the stream copied to instead */
+    struct metadata *metadata; /* NULL or set on items after their dir */
+    size_t failed;          /* # of copies that did not verify */
+    size_t differ;          /* # of files that do not match their copy */
+    size_t mirrored;        /* # of items not created at other destinations */
+    digest_t contentkey;    /* digest identical copies are found by */
+    int undeduped;          /* the destination cannot share copies */
+    struct stat storest;    /* the store must be on the destination's ... */
+    struct stat destst;     /* ... file system */
     char dapathmd5[MD5_DIGEST_LENGTH];
 
     /* dapath is the reported path, destpath is the path to the new file */
@@ -105,41 +175,142 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
 
     file_t destroot;
     char *sanitized;
+    int renamed;            /* the sources are not copied into destroot */
 
     /* allow paths upto this max, kernel will error before we reach it */
     enum { MAX_LENGTH = PATH_MAX * 2 };
 
     assert(srcc != 0);
 
-    sanitized = strdup(newpath);
-    REMOVE_TRAILING_SLASHES(sanitized);
-    newpath = sanitized;
-
     /* allocate the buffer to build our dest and dapaths in */
     path = malloc(MAX_LENGTH);
     dapath = NULL;
     destpath = NULL;
+    sanitized = NULL;
 
     /*
      * dest is the directory to clone every entry in, if newpath is an
      * existing directory dest represents that, otherwise it is the parent
-     * of the file/directory to create
+     * of the file/directory to create. A comparison maps paths the same way,
+     * nothing is created at either.
      */
-    if (initdestandpaths(&destroot,path,&destpath,&dapath,sanitized,srcc) != 0)
+    if ((opts->mode == DCP_MODE_COPY && opts->tar == NULL) ||
+            opts->mode == DCP_MODE_COMPARE)
+    {
+        sanitized = strdup(newpath);
+        REMOVE_TRAILING_SLASHES(sanitized);
+
+        /* an archive's members are copied into newpath, @see process_archive */
+        if (opts->untar && mkdir(sanitized, 0777) != 0 && errno != EEXIST)
+        {
+            log_error("cannot create dir '%s'", sanitized);
+            free(path);
+            free(sanitized);
+            return -1;
+        }
+
+        /* a copy already exists, a single source was copied to newpath */
+        if (initdestandpaths(&destroot, path, &destpath, &dapath, sanitized,
+                srcc, opts->mode == DCP_MODE_COMPARE && srcc == 1) != 0)
+        {
+            free(path);
+            free(sanitized);
+            return -1;
+        }
+        renamed = strcmp(destroot.path, sanitized) != 0;
+    }
+    else
     {
+        /* an archive holds the sources by name, like tar does */
+        initsrcpaths(&destroot, path, &destpath, &dapath, src, srcc);
+        renamed = srcc == 1;
+    }
+
+    /* the copies are recipes, or the sources are, there is no going without */
+    chunker = NULL;
+    if (opts->chunks != NULL && opts->mode == DCP_MODE_COPY &&
+            (chunker = chunker_create(opts->chunks, !opts->unchunk)) == NULL)
+    {
+        log_errorx("cannot use the chunk store '%s'", opts->chunks);
+        if (destroot.fd != -1)
+            close(destroot.fd);
+        free(destroot.path);
         free(path);
         free(sanitized);
         return -1;
     }
 
-    /* setup the buffer to use, default if 0 */
+    /* every destination must get every item or the copies would differ */
+    fanout = NULL;
+    if (opts->mirrorc != 0 && opts->mode == DCP_MODE_COPY &&
+            (fanout = open_mirrors(opts, strlen(path), srcc, renamed,
+            callback, ctx)) == NULL)
+    {
+        chunker_free(chunker);
+        close(destroot.fd);
+        free(destroot.path);
+        free(path);
+        free(sanitized);
+        return -1;
+    }
+
+    /* setup the buffer and cache to use, default if 0 */
     if (opts->bufsize == 0)
         opts->bufsize = (8 * 4096);
 
-    if ((buf = malloc(opts->bufsize)) == NULL)
+    if (opts->cachesize < opts->bufsize)
+        opts->cachesize = opts->bufsize;
+
+    buf = NULL;
+    cache = NULL;
+    batch = NULL;
+    if ((buf = malloc(opts->bufsize)) == NULL ||
+            cache_create(&cache, opts->cachesize) != 0 ||
+            (batch = batch_create()) == NULL)
     {
-        log_error("cannot allocate buffer of size %zu bytes", opts->bufsize);
-        close(destroot.fd);
+        log_error("cannot allocate buffer of size %zu bytes and cache of size "
+                "%zu bytes", opts->bufsize, opts->cachesize);
+        fanout_free(fanout);
+        chunker_free(chunker);
+        batch_free(batch);
+        cache_free(cache);
+        free(buf);
+        if (destroot.fd != -1)
+            close(destroot.fd);
+        free(destroot.path);
+        free(path);
+        free(sanitized);
+        return -1;
+    }
+
+    /* the stream is the whole copy, there is no going without */
+    archive = NULL;
+    if (opts->tar != NULL && opts->mode == DCP_MODE_COPY &&
+            (archive = archive_create(opts->tar, opts->send, srcc))
+            == NULL)
+    {
+        batch_free(batch);
+        cache_free(cache);
+        free(buf);
+        free(destroot.path);
+        free(path);
+        free(sanitized);
+        return -1;
+    }
+
+    /* owners, and modes and times if preserved, are set after each dir */
+    metadata = NULL;
+    if (opts->mode == DCP_MODE_COPY && archive == NULL &&
+            (metadata = metadata_create(opts->preserve, opts->uid, opts->gid))
+            == NULL)
+    {
+        fanout_free(fanout);
+        chunker_free(chunker);
+        batch_free(batch);
+        cache_free(cache);
+        free(buf);
+        if (destroot.fd != -1)
+            close(destroot.fd);
         free(destroot.path);
         free(path);
         free(sanitized);
@@ -152,22 +323,131 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
         paths[i] = src[i];
 
     /* put static parameters into the process_opts struct */
+    popts.mode         = opts->mode;
     popts.buffer       = buf;
     popts.buffer_size  = opts->bufsize;
+    popts.cache        = cache;
+    popts.batch        = chunker == NULL? batch : NULL;
+    popts.dgstset      = &dgstset;
     popts.digests      = opts->digests;
     popts.uid          = opts->uid;
     popts.gid          = opts->gid;
     popts.index        = opts->index;
     popts.callback     = callback;
     popts.callback_ctx = ctx;
+    popts.digest_xattr = opts->digest_xattr;
+    popts.links        = NULL;
+    undeduped          = 0;
+    popts.linkdest     = -1;
+    popts.dedup        = NULL;
+    popts.dedup_policy = opts->dedup;
+    popts.undeduped    = &undeduped;
+    popts.store        = -1;
+    popts.chunker      = chunker;
+    popts.unchunk      = chunker != NULL && opts->unchunk;
+    popts.fanout       = fanout;
+    popts.archive      = archive;
+    popts.metadata     = metadata;
+
+    /* the walk creates items with their owner rather than chowning each,
+     * unless a store shared with other runs would be owned too */
+    popts.owned        = metadata != NULL && opts->store == NULL &&
+            opts->chunks == NULL && metadata_own(metadata) == 0;
+    popts.fresh        = opts->fresh;
+
+    /* one set for every file, reset each time, with the index's key */
+    digesterset_create(&dgstset, opts->digests | (opts->index == NULL? 0 :
+            index_get_digest_type(opts->index)));
+
+    /* without digests there is nothing to save but the copy */
+    if (opts->hardlinks && (opts->mode == DCP_MODE_COPY ||
+            opts->mode == DCP_MODE_PROFILE) &&
+            (popts.links = links_create()) == NULL)
+        log_errorx("cannot keep track of hard links, continuing without");
+
+    /* files skipped since the last run are linked from its copies */
+    if (opts->linkdest != NULL && opts->mode == DCP_MODE_COPY &&
+            (popts.linkdest = open(opts->linkdest, O_RDONLY | O_DIRECTORY))
+            == -1)
+        log_error("cannot open link dest '%s', continuing without",
+                opts->linkdest);
+
+    /* identical copies are found by a digest no source can make collide, one
+     * file is never linked in place of another */
+    contentkey = content_type(dgstset.valid);
+    if (opts->dedup != DCP_DEDUP_NONE && opts->mode == DCP_MODE_COPY &&
+            (contentkey == 0 ||
+            index_create(&popts.dedup, contentkey) != INDEX_SUCCESS ||
+            index_track_content(popts.dedup) != INDEX_SUCCESS))
+    {
+        log_errorx("cannot dedup without a blake3, sha256 or sha512 digest, "
+                "continuing without");
+        index_free(popts.dedup);
+        popts.dedup = NULL;
+    }
+
+    /* like dedup, objects are named by a digest that cannot be made to
+     * collide, every later snapshot links to them, and they can only be
+     * linked on the destination's file system */
+    popts.store_type = contentkey;
+    if (opts->store != NULL && opts->mode == DCP_MODE_COPY &&
+            (popts.store_type == 0 ||
+            (popts.store = store_open(opts->store, popts.store_type)) == -1 ||
+            fstat(popts.store, &storest) != 0 ||
+            fstat(destroot.fd, &destst) != 0 ||
+            storest.st_dev != destst.st_dev))
+    {
+        log_errorx("cannot use the store '%s' for the destination, copying "
+                "in full", opts->store);
+        if (popts.store != -1)
+            close(popts.store);
+        popts.store = -1;
+    }
+
+    verifier = NULL;
+    if (opts->verify && opts->mode == DCP_MODE_COPY &&
+            (verifier = verifier_create(verify_type(dgstset.valid),
+            opts->bufsize, callback, ctx)) == NULL)
+        log_errorx("cannot verify copies, continuing without");
+    popts.verifier = verifier;
+
+    comparer = NULL;
+    if (opts->mode == DCP_MODE_COMPARE &&
+            (comparer = comparer_create(verify_type(dgstset.valid),
+            opts->threads, opts->bufsize, callback, ctx)) == NULL)
+    {
+        log_errorx("cannot start comparing");
+        digesterset_free(&dgstset);
+        fanout_free(fanout);
+        batch_free(batch);
+        cache_free(cache);
+        free(buf);
+        close(destroot.fd);
+        free(destroot.path);
+        free(path);
+        free(paths);
+        free(sanitized);
+        return -1;
+    }
+    popts.comparer = comparer;
 
     r = 0;
+    failed = 0;
+    differ = 0;
+    mirrored = 0;
+    /* an archive is read in place of the walk, its members are the items */
+    fts = NULL;
+    if (opts->untar)
+        r = process_archive(&destroot, src[0], &popts);
+
     /* begin the directory walk - physical so links are not followed */
-    fts = fts_open((char * const *) paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
-    while ((ent = fts_read(fts)) != NULL)
+    else
+        fts = fts_open((char * const *) paths, FTS_PHYSICAL | FTS_NOCHDIR,
+                NULL);
+    while (fts != NULL && (ent = fts_read(fts)) != NULL)
     {
         /* update the destination path for this entry */
-        if (do_append(ent, &destroot, sanitized))
+        if (do_append(ent, renamed))
             strcat(strcat(path, "/"), ent->fts_name);
 
         /*
@@ -188,10 +468,23 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
             reported_dapath = (char *) dapath;
 
 
+        /* the copy's directory may have files the source does not */
+        if (comparer != NULL && ent->fts_info == FTS_D)
+            comparer_extras(comparer, fts, &destroot, destpath,
+                    reported_dapath);
+
         digest(DGST_MD5, dapathmd5, reported_dapath, strlen(reported_dapath));
         process(&destroot, destpath, ent, reported_dapath, dapathmd5, &popts,
                 opts->verbose);
 
+        /* report the copies verified or compared so far */
+        if (verifier != NULL)
+            verifier_drain(verifier, 0);
+        if (comparer != NULL)
+            comparer_drain(comparer, 0);
+        if (fanout != NULL)
+            fanout_drain(fanout, 0);
+
         /* check pointers, no need to check string contents */
         if (reported_dapath != dapath)
             free(reported_dapath);
@@ -205,7 +498,77 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
                 *path = '\0';
         }
     }
-    close(destroot.fd);
+
+    /* write out any small files still waiting in the cache */
+    process_regular_flush(&destroot, &popts);
+
+    /* a copied file or an archive's items are in no directory walked */
+    metadata_flush(metadata, &destroot);
+
+    /* and wait for the last copies to be verified */
+    if (verifier != NULL)
+    {
+        failed = verifier_drain(verifier, 1);
+        verifier_free(verifier);
+    }
+
+    if (comparer != NULL)
+    {
+        differ = comparer_drain(comparer, 1);
+        comparer_free(comparer);
+    }
+
+    /* and for the other destinations to catch up */
+    if (fanout != NULL)
+    {
+        mirrored = fanout_drain(fanout, 1);
+        fanout_free(fanout);
+    }
+
+    if (failed != 0)
+    {
+        log_errorx("%zu file(s) did not match their source when reread",
+                failed);
+        r = -1;
+    }
+
+    if (differ != 0)
+    {
+        log_errorx("%zu file(s) differ between the source and destination",
+                differ);
+        r = -1;
+    }
+
+    if (mirrored != 0)
+    {
+        log_errorx("%zu item(s) could not be created at the other "
+                "destinations", mirrored);
+        r = -1;
+    }
+
+    /* the end of the archive must be written for it to be read */
+    if (archive_close(archive) != 0)
+    {
+        log_errorx("cannot finish the archive '%s'", opts->tar);
+        r = -1;
+    }
+
+    if (fts != NULL)
+        fts_close(fts);
+    if (destroot.fd != -1)
+        close(destroot.fd);
+    digesterset_free(&dgstset);
+    links_free(popts.links);
+    index_free(popts.dedup);
+    chunker_free(chunker);
+    metadata_free(metadata);
+    if (popts.linkdest != -1)
+        close(popts.linkdest);
+    if (popts.store != -1)
+        close(popts.store);
+    batch_free(batch);
+    cache_free(cache);
+    free(buf);
     free(destroot.path);
     free(path);
     free(paths);
@@ -218,7 +581,8 @@ int dcp(const char *newpath, const char *src[], size_t srcc,
 
 
 int initdestandpaths(file_t *dest, char *path, const char **destpath,
-        const char **dapath, const char *newpath, size_t src_count)
+        const char **dapath, const char *newpath, size_t src_count,
+        int renamed)
 {
     int fd;
     char *real;
@@ -226,7 +590,7 @@ int initdestandpaths(file_t *dest, char *path, const char **destpath,
     char *delim;
 
     /* newpath is a directory that exists */
-    if ((fd = open(newpath, O_RDONLY | O_DIRECTORY)) != -1)
+    if (!renamed && (fd = open(newpath, O_RDONLY | O_DIRECTORY)) != -1)
     {
         tmp = strdup(newpath);
         REMOVE_TRAILING_SLASHES(tmp);
@@ -239,7 +603,7 @@ int initdestandpaths(file_t *dest, char *path, const char **destpath,
     }
 
     /* if dest does not exist open its parent directory */
-    if (errno == ENOENT)
+    if (renamed || errno == ENOENT)
     {
         if (src_count > 1)
         {
@@ -337,11 +701,96 @@ int initdestandpaths(file_t *dest, char *path, const char **destpath,
 }
 
 
-int do_append(FTSENT *ent, const file_t *destroot, const char *newpath)
+void initsrcpaths(file_t *dest, char *path, const char **destpath,
+        const char **dapath, const char *src[], size_t src_count)
+{
+    const char *name;
+    size_t len;
+
+    dest->fd = -1;
+    dest->path = calloc(sizeof(char), 1);
+
+    /* several sources are reported under their names like a copy into a dir */
+    if (src_count > 1)
+    {
+        strcpy(path, "");
+        *destpath = path + 1;
+        *dapath = path;
+        return;
+    }
+
+    /* a single source is renamed, its name is never part of the dapath */
+    for (len = strlen(src[0]); len > 1 && src[0][len - 1] == '/'; len--) {}
+    for (name = src[0] + len; name > src[0] && name[-1] != '/'; name--) {}
+    len -= name - src[0];
+
+    memcpy(path, name, len);
+    path[len] = '\0';
+    *destpath = path;
+    *dapath = path + len;
+}
+
+
+struct fanout *open_mirrors(const struct dcp_options *opts, size_t skip,
+        size_t src_count, int renamed, dcp_callback_f callback, void *ctx)
+{
+    struct fanout *fanout;
+    file_t root;
+    const char *destpath;
+    const char *dapath;
+    char *sanitized;
+    char *path;
+    size_t i;
+    int r;
+
+    if ((fanout = fanout_create(opts->mirrorc, skip, opts->uid, opts->gid,
+            opts->fresh, callback, ctx)) == NULL)
+        return NULL;
+
+    if ((path = malloc(PATH_MAX * 2)) == NULL)
+    {
+        fanout_free(fanout);
+        return NULL;
+    }
+
+    r = 0;
+    for (i = 0; i < opts->mirrorc && r == 0; i++)
+    {
+        sanitized = strdup(opts->mirrors[i]);
+        REMOVE_TRAILING_SLASHES(sanitized);
+
+        /* paths are only rewritten by the name of the top of the copy */
+        if ((r = initdestandpaths(&root, path, &destpath, &dapath, sanitized,
+                src_count, renamed)) == 0 && !renamed &&
+                strcmp(root.path, sanitized) != 0)
+        {
+            log_errorx("`%s' is not a directory like the first destination",
+                    opts->mirrors[i]);
+            close(root.fd);
+            free(root.path);
+            r = -1;
+        }
+
+        if (r == 0)
+            r = fanout_add(fanout, &root, path, opts->mirrors[i]);
+        free(sanitized);
+    }
+
+    free(path);
+    if (r != 0)
+    {
+        fanout_free(fanout);
+        return NULL;
+    }
+    return fanout;
+}
+
+
+int do_append(FTSENT *ent, int renamed)
 {
     /* if newpath is not the destroot then we are renaming so don't append at
      * root level */
-    if (ent->fts_level == 0 && strcmp(destroot->path, newpath) != 0)
+    if (ent->fts_level == 0 && renamed)
         return 0;
 
     /* no append for directory postorder */
@@ -349,6 +798,31 @@ int do_append(FTSENT *ent, const file_t *destroot, const char *newpath)
 }
 
 
+digest_t verify_type(int digests)
+{
+    digest_t type;
+
+    /* same order the index picks its key in */
+    if (  !(type = digests & DGST_XXH3)   && !(type = digests & DGST_BLAKE3) &&
+          !(type = digests & DGST_MD5)    && !(type = digests & DGST_SHA1)   &&
+          !(type = digests & DGST_SHA256) && !(type = digests & DGST_SHA512))
+        type = digests & DGST_CRC32C;
+    return type;
+}
+
+
+digest_t content_type(int digests)
+{
+    digest_t type;
+
+    /* xxh3 and crc32c are not made against collisions, md5 and sha1 have
+     * known ones */
+    if (!(type = digests & DGST_BLAKE3) && !(type = digests & DGST_SHA512))
+        type = digests & DGST_SHA256;
+    return type;
+}
+
+
 int do_unappend(FTSENT *ent)
 {
     /* no unappend for dir preorder */
@@ -361,38 +835,72 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
         int verbose)
 {
     dcp_state_t state;
+    int r;
     switch (ent->fts_info)
     {
 
     case FTS_D:                                 /* PREORDER DIRECTORY     */
     {
-        if (preprocess(newdir,newpath,ent->fts_path,ent->fts_statp,verbose)!=0)
+        /* only regular files are compared */
+        if (popts->mode == DCP_MODE_COMPARE)
             break;
 
-        /* directory existing is not an error */
-        state = DCP_DIR_CREATED;
-        if (mkdirat(newdir->fd, newpath, 0777) != 0 && errno != EEXIST)
+        if (popts->mode != DCP_MODE_COPY)
         {
-            log_error("cannot create dir '%s/%s'", newdir->path, newpath);
-            state  = DCP_DIR_FAILED;
+            popts->callback(DCP_PROFILED, pathmd5, dapath, ent->fts_statp,
+                    ent->fts_accpath, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                    NULL, -1, popts->callback_ctx);
+            break;
         }
 
+        /* in a fresh destination what is in the way is found by creating */
+        if (popts->archive == NULL && (!popts->fresh || verbose) &&
+                preprocess(newdir, newpath, ent->fts_path, ent->fts_statp,
+                verbose) != 0)
+            break;
+
+        /* in a fresh destination what is in the way is only refused now */
+        state = DCP_DIR_CREATED;
+        if ((r = dest_create(newdir, newpath, NULL, ent->fts_statp, popts))
+                == DEST_REFUSED)
+            break;
+        if (r != 0)
+            state  = DCP_DIR_FAILED;
+        else if (popts->fanout != NULL)
+            fanout_create_item(popts->fanout, newpath, NULL, dapath, pathmd5,
+                    ent->fts_statp);
+
         popts->callback(state, pathmd5, dapath, ent->fts_statp,
-                ent->fts_accpath, NULL, NULL, NULL, NULL, NULL, -1,
-                popts->callback_ctx);
+                ent->fts_accpath, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                NULL, -1, popts->callback_ctx);
         break;
     }
 
     case FTS_DP:                                /* POSTORDER DIRECTORY    */
     {
-        process_directory(newdir, newpath, ent->fts_accpath, ent->fts_statp,
-                dapath, pathmd5, popts);
+        /* the directory's batched files must be written before it is done */
+        process_regular_flush(newdir, popts);
+        if (popts->mode == DCP_MODE_COPY)
+            process_directory(newdir, newpath, ent->fts_accpath,
+                    ent->fts_statp, dapath, pathmd5, popts);
         break;
     }
 
     case FTS_F:                                 /* REGULAR FILE           */
     {
-        if (preprocess(newdir,newpath,ent->fts_path,ent->fts_statp,verbose)!=0)
+        if (popts->mode == DCP_MODE_COMPARE)
+        {
+            if (comparer_submit(popts->comparer, newdir, newpath,
+                    ent->fts_accpath, ent->fts_statp, dapath, pathmd5) != 0)
+                popts->callback(DCP_FAILED, pathmd5, dapath, ent->fts_statp,
+                        ent->fts_accpath, NULL, NULL, NULL, NULL, NULL, NULL,
+                        NULL, NULL, -1, popts->callback_ctx);
+            break;
+        }
+
+        if (popts->mode == DCP_MODE_COPY && popts->archive == NULL &&
+                (!popts->fresh || verbose) && preprocess(newdir, newpath,
+                ent->fts_path, ent->fts_statp, verbose) != 0)
             break;
         process_regular(newdir, newpath, ent->fts_accpath, ent->fts_statp,
                 dapath, pathmd5, popts);
@@ -401,7 +909,11 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
 
     case FTS_SL:                                /* SYMLINK                */
     {
-        if (preprocess(newdir,newpath,ent->fts_path,ent->fts_statp,verbose)!=0)
+        if (popts->mode == DCP_MODE_COMPARE)
+            break;
+        if (popts->mode == DCP_MODE_COPY && popts->archive == NULL &&
+                (!popts->fresh || verbose) && preprocess(newdir, newpath,
+                ent->fts_path, ent->fts_statp, verbose) != 0)
             break;
         process_symlink(newdir, newpath, ent->fts_accpath, ent->fts_statp,
                 dapath, pathmd5, popts);
@@ -410,7 +922,11 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
 
     case FTS_DEFAULT:                           /* SPECIAL TYPES          */
     {
-        if (preprocess(newdir,newpath,ent->fts_path,ent->fts_statp,verbose)!=0)
+        if (popts->mode == DCP_MODE_COMPARE)
+            break;
+        if (popts->mode == DCP_MODE_COPY && popts->archive == NULL &&
+                (!popts->fresh || verbose) && preprocess(newdir, newpath,
+                ent->fts_path, ent->fts_statp, verbose) != 0)
             break;
         process_special(newdir, newpath, ent->fts_accpath, ent->fts_statp,
                 dapath, pathmd5, popts);
@@ -421,7 +937,7 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
     case FTS_ERR:
     {
         popts->callback(DCP_FAILED, pathmd5, dapath, NULL, NULL, NULL, NULL,
-                NULL, NULL, NULL, -1, popts->callback_ctx);
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, popts->callback_ctx);
         errno = ent->fts_errno;
         log_error("fts_read '%s'", ent->fts_path);
         break;
@@ -430,7 +946,7 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
     case FTS_NS:
     {
         popts->callback(DCP_FAILED, pathmd5, dapath, NULL, NULL, NULL, NULL,
-                NULL, NULL, NULL, -1, popts->callback_ctx);
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, popts->callback_ctx);
         errno = ent->fts_errno;
         log_error("cannot stat '%s'", ent->fts_path);
         break;
@@ -439,7 +955,7 @@ void process(file_t *newdir, const char *newpath, FTSENT *ent,
     case FTS_DNR:
     {
         popts->callback(DCP_FAILED, pathmd5, dapath, NULL, NULL, NULL, NULL,
-                NULL, NULL, NULL, -1, popts->callback_ctx);
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, popts->callback_ctx);
         errno = ent->fts_errno;
         log_error("cannot read dir '%s'", ent->fts_path);
         break;
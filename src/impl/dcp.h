@@ -42,10 +42,59 @@ typedef enum {
     DCP_DIR_CREATED,      /**< successfully created directory */
     DCP_SYMLINK_CREATED,  /**< successfully created a symlink */
     DCP_SPECIAL_CREATED,  /**< successfully created a fifo,blk,chr,sock dev */
-    DCP_DIR_FAILED        /**< failed to create the directory */
+    DCP_DIR_FAILED,       /**< failed to create the directory */
+    DCP_PROFILED,         /**< recorded without creating a destination */
+    DCP_FILE_VERIFIED,    /**< copied, reread and the digests matched */
+    DCP_VERIFY_FAILED,    /**< copied but the reread did not match */
+    DCP_CHECK_MATCHED,    /**< checked file matches the manifest or copy */
+    DCP_CHECK_MISMATCHED, /**< checked file differs from the manifest or copy */
+    DCP_CHECK_MISSING,    /**< in the manifest or source but not the other */
+    DCP_CHECK_EXTRA,      /**< in the checked tree or destination only */
+    DCP_LINK_CREATED,     /**< linked to the copy of an earlier hard link, of
+                               the file in the link dest or of an identical
+                               file */
+    DCP_FILE_MOVED,       /**< in the index under another path, linked from its
+                               copy there if there is a link dest */
+    DCP_MIRROR_COPIED,    /**< created at another destination, reported with
+                               the item's dapath and that destination as its
+                               accesspath */
+    DCP_MIRROR_FAILED     /**< failed to create at another destination */
 } dcp_state_t;
 
 
+/**
+ * what dcp does with each file system item it walks
+ */
+typedef enum {
+    DCP_MODE_COPY,        /**< copy to the destination while profiling */
+    DCP_MODE_PROFILE,     /**< read and digest files, nothing is written */
+    DCP_MODE_STAT,        /**< only stat, files are neither read nor written */
+    DCP_MODE_COMPARE      /**< digest files and their existing copies */
+} dcp_mode_t;
+
+
+/**
+ * which file the digests of a regular file are cached on, @see
+ * dcp_options.digest_xattr
+ */
+typedef enum {
+    DCP_XATTR_NONE,       /**< digests are always calculated, never stored */
+    DCP_XATTR_SOURCE,     /**< stored on the source */
+    DCP_XATTR_DEST        /**< stored on the copy */
+} dcp_xattr_t;
+
+
+/**
+ * how a copy whose content was already written this run is created, @see
+ * dcp_options.dedup
+ */
+typedef enum {
+    DCP_DEDUP_NONE,       /**< every copy is written in full */
+    DCP_DEDUP_REFLINK,    /**< it shares the blocks of the earlier copy */
+    DCP_DEDUP_HARDLINK    /**< it is a hard link to the earlier copy */
+} dcp_dedup_t;
+
+
 /**
  * callback function for dcp to call once a file has finished being processed
  * The callback will be provided with the file's stat information, where the
@@ -56,6 +105,7 @@ typedef int (*dcp_callback_f)(dcp_state_t state, const void *pathmd5,
         const char *dapath, const struct stat *sstat, const char *accesspath,
         const char *symlinkpath, const void *md5,
         const void *sha1, const void *sha256, const void *sha512,
+        const void *xxh3, const void *crc32c, const void *blake3,
         unsigned long process_time, void *context);
 
 
@@ -63,13 +113,51 @@ typedef int (*dcp_callback_f)(dcp_state_t state, const void *pathmd5,
  * run options to tell dcp how to perform the copy
  */
 struct dcp_options {
-    size_t bufsize;     /**< amount of memory to set aside to cache files */
-    uid_t uid;          /**< owner of copied files */
-    gid_t gid;          /**< group of copied files */
+    size_t bufsize;     /**< # of bytes requested with each read and write */
+    size_t cachesize;   /**< amount of memory to set aside to cache files */
+    uid_t uid;          /**< owner of copied files, -1 for the source's */
+    gid_t gid;          /**< group of copied files, -1 for the source's */
     int digests;        /**< mask of @see digest_alg_t's specifying what hashes
                              to calc */
     index_t *index;     /**< if not NULL do not copy any file in the index */
     int verbose;        /**< should we output explanation of what is going on */
+    dcp_mode_t mode;    /**< copy or only profile the sources */
+    int verify;         /**< reread every copied file and compare digests */
+    size_t threads;     /**< # of files hashed at once by dcp_check, or on
+                             each side by DCP_MODE_COMPARE, 0 for the # of
+                             online processors */
+    dcp_xattr_t digest_xattr; /**< unless DCP_XATTR_NONE digests cached in a
+                             source's xattr are used while it is unchanged,
+                             new ones are stored on the source or copy */
+    int hardlinks;      /**< files linked more than once are only read once,
+                             their copies are linked the same way */
+    const char *linkdest; /**< NULL or the destination of a previous run, files
+                             found in `index` are linked from their copy there
+                             so the new destination is complete */
+    dcp_dedup_t dedup;  /**< unless DCP_DEDUP_NONE files identical to one
+                             copied earlier in the run are linked to it */
+    const char *store;  /**< NULL or a content-addressed store on the
+                             destination's file system, each unique file body
+                             is kept there once and copies are links to it */
+    const char *chunks; /**< NULL or a chunk store, files are cut into chunks
+                             kept there once and each copy is a recipe */
+    int unchunk;        /**< the sources are recipes, files are rebuilt from
+                             `chunks` */
+    const char **mirrors; /**< NULL or other destinations every item is
+                             created at too, mapped like `newpath` */
+    size_t mirrorc;     /**< # of `mirrors` */
+    const char *tar;    /**< NULL or where a pax tar stream of the copy is
+                             written instead of `newpath`, "-" for stdout */
+    int untar;          /**< the single source is a tar archive, "-" for
+                             stdin, read in place of the walk */
+    int send;           /**< `tar` is sent to a receiving dcp, each file is
+                             followed by its digests */
+    int preserve;       /**< copies are given the mode and times of their
+                             source, set with their owner once the
+                             directory they are in is done */
+    int fresh;          /**< the destinations are expected to be empty, items
+                             are created without checking what is there and
+                             only what is found in the way is removed */
 };
 
 
@@ -77,11 +165,42 @@ struct dcp_options {
 
 
 /**
- * TODO write description
+ * Walk every path in `src` sending each item found to `callback`. Unless
+ * `opts->mode` is DCP_MODE_COPY nothing is created and `newpath` is ignored,
+ * it may be NULL, the items are reported relative to their source as though
+ * they were copied to a destination that does not exist.
+ *
+ * In DCP_MODE_COMPARE `newpath` is where a copy already exists. Each regular
+ * file is hashed along with the path it would be copied to and sent to
+ * `callback` in one of the DCP_CHECK_* states, nothing else is reported. The
+ * fastest digest of `opts->digests` is compared.
+ *
+ * With `opts->untar` the members of the archive `src[0]` are the items, they
+ * are copied into the directory `newpath`, made if it does not exist.
+ *
+ * @return          0 on success, -1 on failure or if any file did not match
  */
 int dcp(const char *newpath, const char *src[], size_t srcc,
         struct dcp_options *opts, dcp_callback_f callback, void *ctx);
 
+/**
+ * Rehash every regular file under `path` and compare it with `manifest`, the
+ * output of an earlier run, without writing anything. `opts->index` must hold
+ * the manifest's entries keyed by the digest to compare, entries are removed
+ * as their files are found. Files are hashed by `opts->threads` threads.
+ *
+ * Each file is sent to `callback` in the DCP_CHECK_MATCHED,
+ * DCP_CHECK_MISMATCHED or DCP_CHECK_EXTRA state, or DCP_FAILED if it cannot be
+ * read. Once the walk is done the manifest entries that were not found are
+ * sent in the DCP_CHECK_MISSING state. Paths are relative to `path`, the same
+ * as a copy to a destination that does not exist.
+ *
+ * @return          0 if every file matched, -1 otherwise
+ */
+int dcp_check(const char *path, const char *manifest,
+        struct dcp_options *opts, dcp_callback_f callback, void *ctx);
+
+
 /**
  * provides a string representation of each of the possible states defined in
  * dcp_state_t.
@@ -0,0 +1,199 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the destination interface from process.h. The process_*
+ * functions create every item through it, and it creates them in the
+ * destination tree or, if there is one, appends them to `opts->archive`
+ * instead. Bytes written to the tree are queued for the other destinations
+ * of `opts->fanout` too. What is created in the tree is queued in
+ * `opts->metadata` to be given its owner once its directory is done.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../fd.h"
+#include "../logging.h"
+
+
+/* Public Impl ****************************************************************/
+
+
+int dest_open(file_t *newdir, const char *newpath, const struct stat *oldst,
+        off_t size, const struct process_opts *opts)
+{
+    int d;
+
+    /* an archived owner of -1 is the source's, as it is for a tree */
+    if (opts->archive != NULL)
+        return archive_begin(opts->archive, newpath, oldst, size,
+                opts->uid == (uid_t) -1? oldst->st_uid : opts->uid,
+                opts->gid == (gid_t) -1? oldst->st_gid : opts->gid);
+
+    /* create/truncate the dest file. If files are created owned or the
+     * destination is fresh it is created new, in a fresh destination what
+     * is in the way is only removed now, else a file that is there is
+     * chowned as it is truncated. */
+    if (!opts->owned && !opts->fresh)
+        d = openat(newdir->fd, newpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    else if ((d = openat(newdir->fd, newpath, O_WRONLY | O_CREAT | O_EXCL,
+            0666)) == -1 && errno == EEXIST)
+    {
+        if (opts->fresh && preprocess(newdir, newpath, NULL, oldst, 0) != 0)
+            return DEST_REFUSED;
+        if (opts->fresh)
+            d = openat(newdir->fd, newpath, O_WRONLY | O_CREAT | O_EXCL,
+                    0666);
+        else if ((d = openat(newdir->fd, newpath, O_WRONLY | O_TRUNC)) != -1
+                && fchown(d, opts->uid, opts->gid) == -1)
+            log_debug("fchown");
+    }
+
+    if (d == -1)
+    {
+        log_debug("openat '%s'", newpath);
+        return -1;
+    }
+
+    if (opts->fanout != NULL && fanout_open(opts->fanout, newpath) != 0)
+    {
+        close(d);
+        return -1;
+    }
+    return d;
+}
+
+
+int dest_write(int d, const void *buf, size_t len,
+        const struct process_opts *opts)
+{
+    if (opts->archive != NULL)
+        return archive_write(opts->archive, buf, len);
+
+    if (fd_write_full(d, buf, len) == -1)
+    {
+        log_debug("fd_write");
+        return -1;
+    }
+    return opts->fanout == NULL? 0 : fanout_write(opts->fanout, buf, len);
+}
+
+
+int dest_close(int d, const char *newpath, const struct stat *oldst,
+        int failed, const struct process_opts *opts)
+{
+    if (opts->archive != NULL)
+        return archive_end(opts->archive) == 0 && !failed? 0 : -1;
+
+    if (failed)
+    {
+        close(d);
+        return -1;
+    }
+
+    /* do not report success here because there can be data loss */
+    if (close(d) == -1)
+    {
+        log_error("closing '%s' failed, possible data loss", newpath);
+        return -1;
+    }
+    return metadata_add(opts->metadata, newpath, oldst, opts->owned);
+}
+
+
+int dest_create(file_t *newdir, const char *newpath, const char *target,
+        const struct stat *oldst, const struct process_opts *opts)
+{
+    int r;
+
+    if (opts->archive != NULL)
+        return archive_add(opts->archive, newpath, oldst, target,
+                opts->uid == (uid_t) -1? oldst->st_uid : opts->uid,
+                opts->gid == (gid_t) -1? oldst->st_gid : opts->gid);
+
+    /* directory existing is not an error, it is chowned */
+    if (S_ISDIR(oldst->st_mode))
+    {
+        if ((r = mkdirat(newdir->fd, newpath, 0777)) != 0 && errno != EEXIST)
+        {
+            log_error("cannot create dir '%s/%s'", newdir->path, newpath);
+            return -1;
+        }
+
+        /* in a fresh destination what is there was not checked yet */
+        if (r != 0 && opts->fresh &&
+                preprocess(newdir, newpath, NULL, oldst, 0) != 0)
+            return DEST_REFUSED;
+        return metadata_add(opts->metadata, newpath, oldst,
+                r == 0 && opts->owned);
+    }
+
+    /* another link of a file already copied, in a fresh destination what is
+     * in the way is only removed now */
+    if (S_ISREG(oldst->st_mode))
+    {
+        if ((r = linkat(newdir->fd, target, newdir->fd, newpath, 0)) != 0 &&
+                errno == EEXIST && opts->fresh)
+        {
+            if (preprocess(newdir, newpath, NULL, oldst, 0) != 0)
+                return DEST_REFUSED;
+            r = linkat(newdir->fd, target, newdir->fd, newpath, 0);
+        }
+        if (r != 0)
+        {
+            log_debug("cannot link '%s' to '%s'", newpath, target);
+            return -1;
+        }
+        return 0;
+    }
+
+    /* create the symlink, unlinking an existing file if it exists, in a
+     * fresh destination what is in the way is only checked now */
+    if (S_ISLNK(oldst->st_mode))
+    {
+        while ((r = symlinkat(target, newdir->fd, newpath)) == -1)
+        {
+            if (errno != EEXIST)
+            {
+                log_error("cannot create symlink '%s'",
+                        pathstr(newdir, newpath));
+                break;
+            }
+            if (opts->fresh)
+            {
+                if (preprocess(newdir, newpath, NULL, oldst, 0) != 0)
+                    return DEST_REFUSED;
+            }
+            else if ((r = unlinkat(newdir->fd, newpath, 0)) == -1)
+            {
+                log_error("cannot unlink '%s'", pathstr(newdir, newpath));
+                break;
+            }
+        }
+        return r == 0? metadata_add(opts->metadata, newpath, oldst,
+                opts->owned) : r;
+    }
+
+    if ((r = mknodat(newdir->fd, newpath, (oldst->st_mode & S_IFMT) | 0666,
+            oldst->st_rdev)) != 0 && errno == EEXIST && opts->fresh)
+    {
+        if (preprocess(newdir, newpath, NULL, oldst, 0) != 0)
+            return DEST_REFUSED;
+        r = mknodat(newdir->fd, newpath, (oldst->st_mode & S_IFMT) | 0666,
+                oldst->st_rdev);
+    }
+    if (r != 0)
+    {
+        log_error("cannot create special file '%s'", pathstr(newdir, newpath));
+        return -1;
+    }
+
+    return metadata_add(opts->metadata, newpath, oldst, opts->owned);
+}
@@ -0,0 +1,206 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the digest xattr from process.h. A file's digests are
+ * kept in a single text attribute so they are replaced all at once:
+ *
+ *      dcp1 SIZE MTIME CTIME INODE WRITTEN md5:HEX xxh3:HEX ...
+ *
+ * where the times are SECONDS.NANOSECONDS. The record is only used while the
+ * size, mtime, inode and ctime are still what they were when it was written.
+ * Setting the attribute moves the file's ctime itself, so a ctime that is not
+ * the recorded one is accepted if it is no later than WRITTEN, when the record
+ * was made, plus DIGEST_XATTR_SLACK.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../io/pack.h"
+#include "../logging.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * name of the attribute, in the user namespace so the owner can set it
+ */
+#define DIGEST_XATTR_NAME "user.dcp.digests"
+
+
+/**
+ * version tag at the start of every record
+ */
+#define DIGEST_XATTR_TAG "dcp1"
+
+
+/**
+ * max bytes of a record, every digest in hex with its name and the stat
+ */
+#define DIGEST_XATTR_MAX 1024
+
+
+/**
+ * seconds after a record was written that its own change to ctime can land
+ */
+#define DIGEST_XATTR_SLACK 1
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * @return          `a` - `b` in nanoseconds, anything further apart than
+ *                  DIGEST_XATTR_SLACK is clamped to just past it
+ */
+static long long ts_diff(const struct timespec *a, const struct timespec *b);
+
+
+/* Public Impl ****************************************************************/
+
+
+int digest_xattr_get(const char *path, const struct stat *st,
+        digesterset_t *set)
+{
+    char record[DIGEST_XATTR_MAX];
+    unsigned char value[MAX_DIGEST_LENGTH];
+    struct timespec mtime, ctime, written;
+    intmax_t size;
+    uintmax_t ino;
+    ssize_t len;
+    char *token, *save, *hex;
+    int type, found;
+
+    if ((len = lgetxattr(path, DIGEST_XATTR_NAME, record,
+            sizeof(record) - 1)) <= 0)
+        return -1;
+    record[len] = '\0';
+
+    if (sscanf(record, DIGEST_XATTR_TAG " %jd %ld.%ld %ld.%ld %ju %ld.%ld",
+            &size, &mtime.tv_sec, &mtime.tv_nsec, &ctime.tv_sec,
+            &ctime.tv_nsec, &ino, &written.tv_sec, &written.tv_nsec) != 8)
+    {
+        log_debugx("ignoring unknown digest record of '%s'", path);
+        return -1;
+    }
+
+    /* the file has changed since it was hashed */
+    if (size != (intmax_t) st->st_size || ino != (uintmax_t) st->st_ino ||
+            ts_diff(&st->st_mtim, &mtime) != 0)
+        return -1;
+
+    /* or its inode has, other than by setting the record */
+    if (ts_diff(&st->st_ctim, &ctime) < 0 || ts_diff(&st->st_ctim, &written) >
+            DIGEST_XATTR_SLACK * 1000000000LL)
+        return -1;
+
+    /* the set must end up with every digest it was created for */
+    digesterset_reset(set);
+    found = 0;
+    token = strtok_r(record, " ", &save);
+    for (; token != NULL; token = strtok_r(NULL, " ", &save))
+    {
+        if ((hex = strchr(token, ':')) == NULL)
+            continue;
+        *hex++ = '\0';
+
+        for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+        {
+            if (!(set->valid & type) || strcmp(token, digest_name(type)) != 0)
+                continue;
+            if (strlen(hex) != 2 * (size_t) DIGEST_LENGTH(type) ||
+                    pack(value, hex, 0) != 0)
+                return -1;
+            digesterset_set_value(set, type, value);
+            found |= type;
+        }
+    }
+
+    return found == set->valid? 0 : -1;
+}
+
+
+int digest_xattr_put(int dirfd, const char *path, const struct stat *st,
+        digesterset_t *set)
+{
+    char record[DIGEST_XATTR_MAX];
+    char hex[2 * MAX_DIGEST_LENGTH + 1];
+    struct timespec written;
+    struct stat now;
+    const void *value;
+    size_t len;
+    int type;
+    int fd;
+    int r;
+
+    if ((fd = openat(dirfd, path, O_RDONLY | O_NOFOLLOW)) == -1)
+    {
+        log_debug("cannot open '%s' to store its digests", path);
+        return -1;
+    }
+
+    /* do not vouch for bytes that changed while they were hashed */
+    if (fstat(fd, &now) != 0 || (st != NULL &&
+            (now.st_size != st->st_size || now.st_ino != st->st_ino ||
+            ts_diff(&now.st_mtim, &st->st_mtim) != 0)))
+    {
+        log_debugx("'%s' changed while it was hashed", path);
+        close(fd);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &written);
+    len = snprintf(record, sizeof(record),
+            DIGEST_XATTR_TAG " %jd %ld.%09ld %ld.%09ld %ju %ld.%09ld",
+            (intmax_t) now.st_size, now.st_mtim.tv_sec, now.st_mtim.tv_nsec,
+            now.st_ctim.tv_sec, now.st_ctim.tv_nsec, (uintmax_t) now.st_ino,
+            written.tv_sec, written.tv_nsec);
+
+    for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+    {
+        if ((value = digesterset_get_value(set, type)) == NULL)
+            continue;
+        unpack(hex, value, DIGEST_LENGTH(type));
+        len += snprintf(record + len, sizeof(record) - len, " %s:%s",
+                digest_name(type), hex);
+    }
+
+    /* not every file system or file allows user attributes, not an error */
+    if ((r = fsetxattr(fd, DIGEST_XATTR_NAME, record, len, 0)) != 0)
+        log_debug("cannot store the digests of '%s'", path);
+
+    close(fd);
+    return r == 0? 0 : -1;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+long long ts_diff(const struct timespec *a, const struct timespec *b)
+{
+    long long sec;
+
+    /* more than the slack apart is all that matters past here */
+    sec = (long long) a->tv_sec - b->tv_sec;
+    if (sec > DIGEST_XATTR_SLACK)
+        return (DIGEST_XATTR_SLACK + 1) * 1000000000LL;
+    if (sec < -DIGEST_XATTR_SLACK)
+        return -(DIGEST_XATTR_SLACK + 1) * 1000000000LL;
+    return sec * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
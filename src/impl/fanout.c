@@ -0,0 +1,608 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the fan-out from process.h. The walk reads and hashes each
+ * file once and its bytes are written to every other destination as well as
+ * the first. Each other destination has a thread and a queue of operations of
+ * its own, so a slow one only holds up the walk once its queue is full and
+ * never holds up the others. The bytes of a write are shared by every queue
+ * and freed by whichever thread is done with them last.
+ *
+ * Paths are given as they are at the first destination and are rewritten for
+ * each of the others, which only differ in the name given to the top of the
+ * copy. Only the walk's thread calls the callback, entries are handed back to
+ * it by fanout_drain with the item's dapath as their path and the destination
+ * as given as their accesspath.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../fd.h"
+#include "../logging.h"
+#include "dcp.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * max number of operations waiting for a destination or to be drained
+ */
+#define FANOUT_QUEUE 128
+
+
+/**
+ * writes are split into blocks no larger than this, bounding the memory a
+ * destination can fall behind by to FANOUT_QUEUE of them
+ */
+#define FANOUT_BLOCK (512 * 1024)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * what an operation does at a destination
+ */
+enum kind {
+    OP_OPEN,                                /**< create the file to write */
+    OP_WRITE,                               /**< append `block` to it */
+    OP_CLOSE,                               /**< close it, it is complete */
+    OP_MKDIR,                               /**< create a directory */
+    OP_SYMLINK,                             /**< create a symlink to `target` */
+    OP_MKNOD,                               /**< create a special file */
+    OP_LINK                                 /**< hard link `target` */
+};
+
+
+/**
+ * bytes written to every destination, freed once the last is done with them
+ */
+struct block {
+    size_t refs;                            /**< # of queues it is in */
+    size_t len;                             /**< # of bytes in `data` */
+    unsigned char data[];
+};
+
+
+/**
+ * an operation waiting for a destination's thread
+ */
+struct op {
+    enum kind kind;                         /**< what to do */
+    char *path;                             /**< relative to the dest's root */
+    char *target;                           /**< NULL, symlink or link target */
+    struct block *block;                    /**< NULL or the bytes to write */
+    char *dapath;                           /**< NULL or reported when done */
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];/**< md5 of `dapath` */
+    struct stat st;                         /**< the source's stat struct */
+    dcp_state_t state;                      /**< set once done */
+};
+
+
+/**
+ * one of the other destinations, ops are a ring like the verifier's jobs.
+ * [head, next) are done and waiting to be drained, [next, tail) are waiting
+ * for the thread.
+ */
+struct mirror {
+    struct fanout *fanout;                  /**< the fan-out it belongs to */
+    file_t root;                            /**< where paths are relative to */
+    char *name;                             /**< name of the top of the copy */
+    const char *dest;                       /**< the destination as given */
+    int file;                               /**< -1 or the file being written */
+    int failed;                             /**< writing `file` failed */
+
+    pthread_t thread;                       /**< applies the ops */
+    pthread_mutex_t lock;                   /**< protects the counters */
+    pthread_cond_t changed;                 /**< a counter or `stop` changed */
+    int stop;                               /**< thread exits when idle */
+    size_t head;                            /**< next op to drain */
+    size_t next;                            /**< next op to apply */
+    size_t tail;                            /**< next free op */
+    struct op ops[FANOUT_QUEUE];
+};
+
+
+/**
+ * every other destination, @see process.h
+ */
+struct fanout {
+    size_t skip;                            /**< length of the first dest's
+                                                 name for the top of the copy */
+    uid_t uid;                              /**< who owns the copies */
+    gid_t gid;                              /**< what group owns the copies */
+    int fresh;                              /**< nothing is removed first */
+    dcp_callback_f callback;                /**< where finished ops go */
+    void *callback_ctx;                     /**< provided to `callback` */
+    size_t failed;                          /**< # drained that failed */
+    size_t count;                           /**< # of valid `mirrors` */
+    struct mirror *mirrors[];
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Queue an operation like `op` for every destination, with its paths
+ * rewritten for each one and a reference to its block.
+ *
+ * @param newpath   path of the item at the first destination
+ * @param target    NULL or the symlink's contents or first destination's path
+ *                  of the file to link to, which is rewritten too
+ *
+ * @return          0 on success, -1 if it could not be queued everywhere
+ */
+static int submit(struct fanout *fanout, const struct op *op,
+        const char *newpath, const char *target);
+
+
+/**
+ * @return          `newpath` at the first destination rewritten for `mirror`
+ */
+static char *rewrite_path(const struct mirror *mirror, const char *newpath);
+
+
+/**
+ * apply queued ops until stopped
+ */
+static void *mirror_thread(void *mirror);
+
+
+/**
+ * apply `op` to the destination
+ *
+ * @return          state to report the op in
+ */
+static dcp_state_t apply(struct mirror *mirror, struct op *op);
+
+
+/**
+ * report the ops before `done` and free them
+ */
+static void mirror_drain(struct fanout *fanout, struct mirror *mirror,
+        int wait);
+
+
+/**
+ * release one reference to `block`, freeing it with the last
+ */
+static void block_put(struct block *block);
+
+
+/* Public Impl ****************************************************************/
+
+
+struct fanout *fanout_create(size_t count, size_t skip, uid_t uid, gid_t gid,
+        int fresh, dcp_callback_f callback, void *ctx)
+{
+    struct fanout *fanout;
+
+    if ((fanout = malloc(sizeof(*fanout) + count * sizeof(struct mirror *)))
+            == NULL)
+        return NULL;
+
+    fanout->skip         = skip;
+    fanout->uid          = uid;
+    fanout->gid          = gid;
+    fanout->fresh        = fresh;
+    fanout->callback     = callback;
+    fanout->callback_ctx = ctx;
+    fanout->failed       = 0;
+    fanout->count        = 0;
+    return fanout;
+}
+
+
+int fanout_add(struct fanout *fanout, file_t *root, const char *name,
+        const char *dest)
+{
+    struct mirror *mirror;
+
+    if ((mirror = malloc(sizeof(*mirror))) == NULL)
+    {
+        close(root->fd);
+        free(root->path);
+        return -1;
+    }
+
+    mirror->fanout = fanout;
+    mirror->root   = *root;
+    mirror->name   = strdup(name);
+    mirror->dest   = dest;
+    mirror->file   = -1;
+    mirror->failed = 0;
+    mirror->stop   = 0;
+    mirror->head   = 0;
+    mirror->next   = 0;
+    mirror->tail   = 0;
+    pthread_mutex_init(&mirror->lock, NULL);
+    pthread_cond_init(&mirror->changed, NULL);
+
+    if (mirror->name == NULL ||
+            pthread_create(&mirror->thread, NULL, mirror_thread, mirror) != 0)
+    {
+        log_errorx("cannot start writing to '%s'", root->path);
+        close(root->fd);
+        free(root->path);
+        pthread_cond_destroy(&mirror->changed);
+        pthread_mutex_destroy(&mirror->lock);
+        free(mirror->name);
+        free(mirror);
+        return -1;
+    }
+
+    /* the root is the mirror's from here on */
+    fanout->mirrors[fanout->count++] = mirror;
+    return 0;
+}
+
+
+int fanout_open(struct fanout *fanout, const char *newpath)
+{
+    struct op op = { .kind = OP_OPEN };
+
+    return submit(fanout, &op, newpath, NULL);
+}
+
+
+int fanout_write(struct fanout *fanout, const void *buf, size_t len)
+{
+    struct op op = { .kind = OP_WRITE };
+    const unsigned char *bytes;
+    size_t n;
+    int r;
+
+    r = 0;
+    for (bytes = buf; len > 0 && r == 0; bytes += n, len -= n)
+    {
+        n = len < FANOUT_BLOCK? len : FANOUT_BLOCK;
+        if ((op.block = malloc(sizeof(*op.block) + n)) == NULL)
+            return -1;
+        op.block->refs = fanout->count;
+        op.block->len  = n;
+        memcpy(op.block->data, bytes, n);
+        r = submit(fanout, &op, NULL, NULL);
+    }
+    return r;
+}
+
+
+int fanout_close(struct fanout *fanout, const char *newpath,
+        const char *dapath, const void *pathmd5, const struct stat *oldst)
+{
+    struct op op = { .kind = OP_CLOSE };
+
+    op.dapath = (char *) dapath;
+    memcpy(op.pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+    op.st = *oldst;
+    return submit(fanout, &op, newpath, NULL);
+}
+
+
+int fanout_create_item(struct fanout *fanout, const char *newpath,
+        const char *target, const char *dapath, const void *pathmd5,
+        const struct stat *oldst)
+{
+    struct op op;
+
+    memset(&op, 0, sizeof(op));
+    if (S_ISDIR(oldst->st_mode))
+        op.kind = OP_MKDIR;
+    else if (S_ISLNK(oldst->st_mode))
+        op.kind = OP_SYMLINK;
+    else if (S_ISREG(oldst->st_mode))
+        op.kind = OP_LINK;
+    else
+        op.kind = OP_MKNOD;
+
+    op.dapath = (char *) dapath;
+    memcpy(op.pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+    op.st = *oldst;
+
+    return submit(fanout, &op, newpath, target);
+}
+
+
+size_t fanout_drain(struct fanout *fanout, int wait)
+{
+    size_t i;
+
+    for (i = 0; i < fanout->count; i++)
+        mirror_drain(fanout, fanout->mirrors[i], wait);
+    return fanout->failed;
+}
+
+
+void fanout_free(struct fanout *fanout)
+{
+    struct mirror *mirror;
+    size_t i;
+
+    if (fanout == NULL)
+        return;
+
+    for (i = 0; i < fanout->count; i++)
+    {
+        mirror = fanout->mirrors[i];
+        pthread_mutex_lock(&mirror->lock);
+        mirror->stop = 1;
+        pthread_cond_broadcast(&mirror->changed);
+        pthread_mutex_unlock(&mirror->lock);
+        pthread_join(mirror->thread, NULL);
+
+        /* a file the walk gave up on is left as it is at the first dest */
+        if (mirror->file != -1)
+            close(mirror->file);
+
+        pthread_cond_destroy(&mirror->changed);
+        pthread_mutex_destroy(&mirror->lock);
+        close(mirror->root.fd);
+        free(mirror->root.path);
+        free(mirror->name);
+        free(mirror);
+    }
+    free(fanout);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int submit(struct fanout *fanout, const struct op *op, const char *newpath,
+        const char *target)
+{
+    struct mirror *mirror;
+    struct op *queued;
+    size_t i;
+    int r;
+
+    r = 0;
+    for (i = 0; i < fanout->count; i++)
+    {
+        mirror = fanout->mirrors[i];
+
+        /* queue is full, wait for the oldest op and report what is done */
+        if (mirror->tail - mirror->head == FANOUT_QUEUE)
+        {
+            pthread_mutex_lock(&mirror->lock);
+            while (mirror->next == mirror->head)
+                pthread_cond_wait(&mirror->changed, &mirror->lock);
+            pthread_mutex_unlock(&mirror->lock);
+            mirror_drain(fanout, mirror, 0);
+        }
+
+        /* the thread does not look at the op until tail moves past it */
+        queued = &mirror->ops[mirror->tail % FANOUT_QUEUE];
+        *queued = *op;
+        queued->path   = newpath == NULL? NULL : rewrite_path(mirror, newpath);
+        /* a hard link's target is a path at the destination too */
+        queued->target = target == NULL? NULL : op->kind == OP_LINK?
+                rewrite_path(mirror, target) : strdup(target);
+        queued->dapath = op->dapath == NULL? NULL : strdup(op->dapath);
+        if ((newpath != NULL && queued->path == NULL) ||
+                (target != NULL && queued->target == NULL) ||
+                (op->dapath != NULL && queued->dapath == NULL))
+        {
+            free(queued->path);
+            free(queued->target);
+            free(queued->dapath);
+            if (op->block != NULL)
+                block_put(op->block);
+            r = -1;
+            continue;
+        }
+
+        pthread_mutex_lock(&mirror->lock);
+        mirror->tail++;
+        pthread_cond_broadcast(&mirror->changed);
+        pthread_mutex_unlock(&mirror->lock);
+    }
+    return r;
+}
+
+
+char *rewrite_path(const struct mirror *mirror, const char *newpath)
+{
+    const char *rest;
+    char *path;
+
+    rest = newpath + mirror->fanout->skip;
+    if ((path = malloc(strlen(mirror->name) + strlen(rest) + 1)) == NULL)
+        return NULL;
+    return strcat(strcpy(path, mirror->name), rest);
+}
+
+
+void *mirror_thread(void *arg)
+{
+    struct mirror *mirror;
+    struct op *op;
+
+    mirror = arg;
+
+    pthread_mutex_lock(&mirror->lock);
+    for (;;)
+    {
+        while (!mirror->stop && mirror->next == mirror->tail)
+            pthread_cond_wait(&mirror->changed, &mirror->lock);
+
+        if (mirror->next == mirror->tail)
+            break;
+
+        /* the op is ours until next moves past it */
+        op = &mirror->ops[mirror->next % FANOUT_QUEUE];
+        pthread_mutex_unlock(&mirror->lock);
+
+        op->state = apply(mirror, op);
+        if (op->block != NULL)
+        {
+            block_put(op->block);
+            op->block = NULL;
+        }
+
+        pthread_mutex_lock(&mirror->lock);
+        mirror->next++;
+        pthread_cond_broadcast(&mirror->changed);
+    }
+    pthread_mutex_unlock(&mirror->lock);
+
+    return NULL;
+}
+
+
+dcp_state_t apply(struct mirror *mirror, struct op *op)
+{
+    struct fanout *fanout;
+    int dirfd;
+    int flags;
+    int r;
+
+    fanout = mirror->fanout;
+    dirfd = mirror->root.fd;
+
+    /* like preprocess, whatever is in the way of a new item is removed, in a
+     * fresh destination only once creating it finds something there */
+    if (!fanout->fresh && (op->kind == OP_OPEN || op->kind == OP_SYMLINK ||
+            op->kind == OP_MKNOD || op->kind == OP_LINK))
+        unlinkat(dirfd, op->path, 0);
+
+    switch (op->kind)
+    {
+    case OP_OPEN:
+        /* the walk gave up on the last file without closing it */
+        if (mirror->file != -1)
+            close(mirror->file);
+        flags = O_WRONLY | O_CREAT | (fanout->fresh? O_EXCL : O_TRUNC);
+        if ((mirror->file = openat(dirfd, op->path, flags, 0666)) == -1 &&
+                errno == EEXIST && unlinkat(dirfd, op->path, 0) == 0)
+            mirror->file = openat(dirfd, op->path, flags, 0666);
+        if (mirror->file == -1)
+            log_error("cannot create '%s' in '%s'", op->path,
+                    mirror->root.path);
+        mirror->failed = mirror->file == -1;
+        return DCP_MIRROR_FAILED;
+
+    case OP_WRITE:
+        if (!mirror->failed &&
+                fd_write_full(mirror->file, op->block->data, op->block->len)
+                == -1)
+        {
+            log_debug("fd_write");
+            mirror->failed = 1;
+        }
+        return DCP_MIRROR_FAILED;
+
+    case OP_CLOSE:
+        if (mirror->file == -1)
+            return DCP_MIRROR_FAILED;
+        if (fchown(mirror->file, fanout->uid, fanout->gid) == -1)
+            log_debug("fchown");
+        /* do not report success here because there can be data loss */
+        if (close(mirror->file) == -1)
+        {
+            log_error("closing '%s' failed, possible data loss", op->path);
+            mirror->failed = 1;
+        }
+        mirror->file = -1;
+        return mirror->failed? DCP_MIRROR_FAILED : DCP_MIRROR_COPIED;
+
+    case OP_MKDIR:
+        /* directory existing is not an error */
+        r = mkdirat(dirfd, op->path, 0777);
+        if (r != 0 && errno == EEXIST)
+            r = 0;
+        break;
+
+    case OP_SYMLINK:
+        if ((r = symlinkat(op->target, dirfd, op->path)) != 0 &&
+                errno == EEXIST && unlinkat(dirfd, op->path, 0) == 0)
+            r = symlinkat(op->target, dirfd, op->path);
+        break;
+
+    case OP_MKNOD:
+        if ((r = mknodat(dirfd, op->path, (op->st.st_mode & S_IFMT) | 0666,
+                op->st.st_rdev)) != 0 && errno == EEXIST &&
+                unlinkat(dirfd, op->path, 0) == 0)
+            r = mknodat(dirfd, op->path, (op->st.st_mode & S_IFMT) | 0666,
+                    op->st.st_rdev);
+        break;
+
+    case OP_LINK:
+        if ((r = linkat(dirfd, op->target, dirfd, op->path, 0)) != 0 &&
+                errno == EEXIST && unlinkat(dirfd, op->path, 0) == 0)
+            r = linkat(dirfd, op->target, dirfd, op->path, 0);
+        return r == 0? DCP_MIRROR_COPIED : DCP_MIRROR_FAILED;
+
+    default:
+        return DCP_MIRROR_FAILED;
+    }
+
+    if (r != 0)
+    {
+        log_error("cannot create '%s' in '%s'", op->path, mirror->root.path);
+        return DCP_MIRROR_FAILED;
+    }
+
+    if (fchownat(dirfd, op->path, fanout->uid, fanout->gid,
+            AT_SYMLINK_NOFOLLOW) != 0)
+        log_debug("cannot chown '%s'", op->path);
+    return DCP_MIRROR_COPIED;
+}
+
+
+void mirror_drain(struct fanout *fanout, struct mirror *mirror, int wait)
+{
+    struct op *op;
+    size_t done;
+
+    pthread_mutex_lock(&mirror->lock);
+    while (wait && mirror->next != mirror->tail)
+        pthread_cond_wait(&mirror->changed, &mirror->lock);
+    done = mirror->next;
+    pthread_mutex_unlock(&mirror->lock);
+
+    /* the thread is done with every op before `done` */
+    for (; mirror->head != done; mirror->head++)
+    {
+        op = &mirror->ops[mirror->head % FANOUT_QUEUE];
+
+        /* the copy is reported as the item it is of at the destination it
+         * is in, a failure was logged with where it is. Manifests are read
+         * without these entries, they only tell what became of an item at
+         * the other destinations. */
+        if (op->dapath != NULL)
+        {
+            fanout->callback(op->state, op->pathmd5, op->dapath, &op->st,
+                    mirror->dest, op->kind == OP_SYMLINK? op->target : NULL, NULL,
+                    NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                    fanout->callback_ctx);
+            if (op->state != DCP_MIRROR_COPIED)
+                fanout->failed++;
+        }
+
+        free(op->path);
+        free(op->target);
+        free(op->dapath);
+    }
+}
+
+
+void block_put(struct block *block)
+{
+    if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(block);
+}
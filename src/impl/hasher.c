@@ -0,0 +1,434 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the hasher from process.h, the pool of threads that
+ * --check and --compare read files with. Each file the walk queues has a copy
+ * for every lane and each lane has threads of its own, so the copies are read
+ * at the same time with their own requests in flight. Finished files are
+ * taken back in the order they were queued by the walk's thread, which is the
+ * only one to call the callback.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../fd.h"
+#include "../logging.h"
+#include "dcp.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * # of files that can be queued for each thread of a lane, enough that a
+ * thread never waits for the walk
+ */
+#define HASHER_QUEUE_PER_THREAD 16
+
+
+/* Type Defs ******************************************************************/
+
+
+struct worker;
+
+
+/**
+ * the queue of jobs is a ring, the counters only grow and are taken modulo
+ * `size`. Each lane takes jobs in order from its own `next`, [head, tail) are
+ * queued until every lane is done and the job is drained.
+ */
+struct hasher {
+    digest_t type;                          /**< digest that is calculated */
+    size_t lanes;                           /**< # of copies of each file */
+    hasher_judge_f judge;                   /**< picks each file's state */
+    void *judge_ctx;                        /**< provided to `judge` */
+    dcp_callback_f callback;                /**< where results are sent */
+    void *callback_ctx;                     /**< provided to `callback` */
+    size_t counts[DCP_CHECK_EXTRA + 1];     /**< # of files in each state */
+
+    pthread_mutex_t lock;                   /**< protects the counters, done */
+    pthread_cond_t changed;                 /**< a job, counter or `stop` */
+    int stop;                               /**< threads exit when idle */
+    size_t head;                            /**< next job to report */
+    size_t next[HASHER_LANES];              /**< next job for each lane */
+    size_t tail;                            /**< next free job */
+    size_t size;                            /**< # of jobs */
+    struct hashjob *jobs;
+
+    size_t threads;                         /**< # of `workers` */
+    struct worker *workers;
+};
+
+
+/**
+ * a thread reading one lane of files, each has its own digests and buffer
+ */
+struct worker {
+    digesterset_t set;                      /**< reset for every file */
+    void *buffer;                           /**< where files are read to */
+    size_t buffer_size;                     /**< # of bytes in `buffer` */
+    struct hasher *hasher;                  /**< where jobs come from */
+    size_t lane;                            /**< which copy of a job to read */
+    pthread_t thread;
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * free the paths of a job
+ */
+static void job_clear(struct hasher *hasher, struct hashjob *job);
+
+
+/**
+ * take jobs and hash a lane of them until stopped
+ */
+static void *worker_thread(void *worker);
+
+
+/**
+ * read and digest a lane of a job
+ */
+static void worker_hash(struct worker *worker, struct hashjob *job);
+
+
+/* Public Impl ****************************************************************/
+
+
+struct hasher *hasher_create(digest_t type, size_t lanes, size_t threads,
+        size_t bufsize, hasher_judge_f judge, void *jctx,
+        dcp_callback_f callback, void *ctx)
+{
+    struct hasher *hasher;
+    struct worker *worker;
+    long online;
+
+    if (threads == 0)
+        threads = (online = sysconf(_SC_NPROCESSORS_ONLN)) > 0? online : 1;
+
+    if ((hasher = calloc(1, sizeof(*hasher))) == NULL)
+    {
+        log_error("cannot allocate the hasher");
+        return NULL;
+    }
+
+    hasher->type         = type;
+    hasher->lanes        = lanes;
+    hasher->judge        = judge;
+    hasher->judge_ctx    = jctx;
+    hasher->callback     = callback;
+    hasher->callback_ctx = ctx;
+    hasher->size         = threads * HASHER_QUEUE_PER_THREAD;
+    if ((hasher->jobs = calloc(hasher->size, sizeof(struct hashjob))) == NULL)
+    {
+        log_error("cannot allocate the hasher queue");
+        free(hasher);
+        return NULL;
+    }
+
+    /* the digester sets hold over aligned XXH3 states */
+    if (posix_memalign((void **) &hasher->workers, __alignof__(struct worker),
+            lanes * threads * sizeof(struct worker)) != 0)
+    {
+        log_errorx("cannot allocate the hasher threads");
+        free(hasher->jobs);
+        free(hasher);
+        return NULL;
+    }
+
+    pthread_mutex_init(&hasher->lock, NULL);
+    pthread_cond_init(&hasher->changed, NULL);
+
+    /* alternate lanes so a failure leaves each with threads */
+    for (; hasher->threads < lanes * threads; hasher->threads++)
+    {
+        worker = &hasher->workers[hasher->threads];
+        worker->hasher = hasher;
+        worker->lane = hasher->threads % lanes;
+        worker->buffer_size = bufsize;
+        if ((worker->buffer = malloc(bufsize)) == NULL)
+            break;
+
+        digesterset_create(&worker->set, type);
+        if (pthread_create(&worker->thread, NULL, worker_thread, worker) != 0)
+        {
+            digesterset_free(&worker->set);
+            free(worker->buffer);
+            break;
+        }
+    }
+
+    if (hasher->threads < lanes)
+    {
+        log_errorx("cannot start the hashing threads");
+        hasher_free(hasher);
+        return NULL;
+    }
+
+    if (hasher->threads < lanes * threads)
+        log_warnx("hashing with %zu of %zu threads", hasher->threads,
+                lanes * threads);
+    return hasher;
+}
+
+
+int hasher_submit(struct hasher *hasher, const int *dirfds,
+        const char *const *paths, const char *dapath, const void *pathmd5,
+        const struct stat *st)
+{
+    struct hashjob *job;
+    size_t lane;
+
+    /* wait for the oldest to be read on every lane and report it */
+    if (hasher->tail - hasher->head == hasher->size)
+    {
+        job = &hasher->jobs[hasher->head % hasher->size];
+        pthread_mutex_lock(&hasher->lock);
+        while (job->done != hasher->lanes)
+            pthread_cond_wait(&hasher->changed, &hasher->lock);
+        pthread_mutex_unlock(&hasher->lock);
+        hasher_drain(hasher, 0);
+    }
+
+    /* no thread looks at the job until tail moves past it */
+    job = &hasher->jobs[hasher->tail % hasher->size];
+    memset(job, 0, sizeof(*job));
+    for (lane = 0; lane < hasher->lanes; lane++)
+    {
+        job->files[lane].dirfd = dirfds[lane];
+        if ((job->files[lane].path = strdup(paths[lane])) == NULL)
+            break;
+    }
+
+    if (lane < hasher->lanes || (job->dapath = strdup(dapath)) == NULL)
+    {
+        log_error("cannot queue '%s'", paths[0]);
+        job_clear(hasher, job);
+        return -1;
+    }
+
+    memcpy(job->pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+    memcpy(&job->st, st, sizeof(job->st));
+
+    pthread_mutex_lock(&hasher->lock);
+    hasher->tail++;
+    pthread_cond_broadcast(&hasher->changed);
+    pthread_mutex_unlock(&hasher->lock);
+    return 0;
+}
+
+
+void hasher_report(struct hasher *hasher, dcp_state_t state,
+        const void *pathmd5, const char *dapath, const struct stat *st,
+        const char *accpath, const void *digest, unsigned long ms)
+{
+    digest_t type;
+
+    type = hasher->type;
+    if (state <= DCP_CHECK_EXTRA)
+        hasher->counts[state]++;
+    hasher->callback(state, pathmd5, dapath, st, accpath, NULL,
+            type == DGST_MD5?    digest : NULL,
+            type == DGST_SHA1?   digest : NULL,
+            type == DGST_SHA256? digest : NULL,
+            type == DGST_SHA512? digest : NULL,
+            type == DGST_XXH3?   digest : NULL,
+            type == DGST_CRC32C? digest : NULL,
+            type == DGST_BLAKE3? digest : NULL,
+            ms, hasher->callback_ctx);
+}
+
+
+void hasher_drain(struct hasher *hasher, int wait)
+{
+    struct hashjob *job;
+    dcp_state_t state;
+    unsigned long ms;
+    size_t lane;
+    int ready;
+
+    for (;;)
+    {
+        job = &hasher->jobs[hasher->head % hasher->size];
+
+        pthread_mutex_lock(&hasher->lock);
+        while (wait && hasher->head != hasher->tail &&
+                job->done != hasher->lanes)
+            pthread_cond_wait(&hasher->changed, &hasher->lock);
+        ready = hasher->head != hasher->tail && job->done == hasher->lanes;
+        pthread_mutex_unlock(&hasher->lock);
+
+        if (!ready)
+            break;
+
+        /* the threads are done with the job */
+        state = hasher->judge(job, hasher->judge_ctx);
+        for (ms = 0, lane = 0; lane < hasher->lanes; lane++)
+            ms += job->files[lane].ms;
+        hasher_report(hasher, state, job->pathmd5, job->dapath, &job->st,
+                job->files[0].path,
+                state == DCP_FAILED? NULL : job->files[0].digest, ms);
+        job_clear(hasher, job);
+        hasher->head++;
+    }
+}
+
+
+size_t hasher_count(const struct hasher *hasher, dcp_state_t state)
+{
+    return state <= DCP_CHECK_EXTRA? hasher->counts[state] : 0;
+}
+
+
+void hasher_free(struct hasher *hasher)
+{
+    size_t i;
+
+    if (hasher == NULL)
+        return;
+
+    pthread_mutex_lock(&hasher->lock);
+    hasher->stop = 1;
+    pthread_cond_broadcast(&hasher->changed);
+    pthread_mutex_unlock(&hasher->lock);
+
+    for (i = 0; i < hasher->threads; i++)
+    {
+        pthread_join(hasher->workers[i].thread, NULL);
+        digesterset_free(&hasher->workers[i].set);
+        free(hasher->workers[i].buffer);
+    }
+
+    pthread_cond_destroy(&hasher->changed);
+    pthread_mutex_destroy(&hasher->lock);
+    free(hasher->workers);
+    free(hasher->jobs);
+    free(hasher);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void job_clear(struct hasher *hasher, struct hashjob *job)
+{
+    size_t lane;
+
+    for (lane = 0; lane < hasher->lanes; lane++)
+    {
+        free(job->files[lane].path);
+        job->files[lane].path = NULL;
+    }
+    free(job->dapath);
+    job->dapath = NULL;
+}
+
+
+void *worker_thread(void *arg)
+{
+    struct worker *worker;
+    struct hasher *hasher;
+    struct hashjob *job;
+    size_t *next;
+
+    worker = arg;
+    hasher = worker->hasher;
+    next = &hasher->next[worker->lane];
+
+    pthread_mutex_lock(&hasher->lock);
+    for (;;)
+    {
+        while (!hasher->stop && *next == hasher->tail)
+            pthread_cond_wait(&hasher->changed, &hasher->lock);
+
+        if (*next == hasher->tail)
+            break;
+
+        /* the lane is ours until it is counted in done */
+        job = &hasher->jobs[(*next)++ % hasher->size];
+        pthread_mutex_unlock(&hasher->lock);
+
+        worker_hash(worker, job);
+
+        pthread_mutex_lock(&hasher->lock);
+        job->done++;
+        pthread_cond_broadcast(&hasher->changed);
+    }
+    pthread_mutex_unlock(&hasher->lock);
+
+    return NULL;
+}
+
+
+void worker_hash(struct worker *worker, struct hashjob *job)
+{
+    struct timespec start, end;
+    struct hashed *file;
+    struct stat st;
+    ssize_t count;
+    int fd;
+
+    /* only this thread's time, the others are reading other files */
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    file = &job->files[worker->lane];
+
+    if ((fd = openat(file->dirfd, file->path, O_RDONLY)) == -1)
+    {
+        file->err = errno;
+        return;
+    }
+
+    if (fstat(fd, &st) != 0)
+    {
+        file->err = errno;
+        close(fd);
+        return;
+    }
+
+    /* a copy that is not a file or of another size cannot match, leave the
+     * disk to the files that might */
+    file->regular = S_ISREG(st.st_mode) && (worker->lane == 0 ||
+            st.st_size == job->st.st_size);
+    if (!file->regular)
+    {
+        close(fd);
+        return;
+    }
+
+    /* causes the kernel to double its read ahead buffer for this file */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    digesterset_reset(&worker->set);
+    while ((count = fd_read(fd, worker->buffer, worker->buffer_size)) > 0)
+        digesterset_update(&worker->set, worker->buffer, count);
+    digesterset_finalize(&worker->set);
+
+    if (count == -1)
+        file->err = errno;
+    else
+        memcpy(file->digest, digesterset_get_value(&worker->set,
+                worker->hasher->type), DIGEST_LENGTH(worker->hasher->type));
+
+    /* each file is read once, leave the page cache to the rest of the tree */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    file->ms = (end.tv_sec - start.tv_sec) * 1000 +
+            (end.tv_nsec - start.tv_nsec) / 1000000;
+}
@@ -0,0 +1,194 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the hard link map from process.h. Regular files with more
+ * than one link are kept in a binary tree keyed by device and inode, with the
+ * digests of the first link and where it was copied to. An entry is removed
+ * once every one of its links has been found, so the tree only holds inodes
+ * that still have links to come.
+ */
+
+/* for tdestroy */
+#define _GNU_SOURCE
+#include <search.h>
+#undef _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "process.h"
+#include "../digest.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * the first link found of an inode
+ */
+struct link {
+    dev_t dev;                              /**< device of the inode */
+    ino_t ino;                              /**< the inode */
+    nlink_t nlink;                          /**< # of links the inode has */
+    nlink_t seen;                           /**< # of links found so far */
+    char *newpath;                          /**< NULL or its copy */
+    int valid;                              /**< mask of digests in `values` */
+    unsigned char values[];                 /**< the digests in type order */
+};
+
+
+/**
+ * every inode with links still to come, @see process.h
+ */
+struct links {
+    void *root;                             /**< tsearch tree of struct link */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * tsearch comparison of two links by device then inode
+ */
+static int linkcmp(const void *a, const void *b);
+
+
+/**
+ * free a link and its path
+ */
+static void link_free(void *link);
+
+
+/* Public Impl ****************************************************************/
+
+
+struct links *links_create(void)
+{
+    return calloc(1, sizeof(struct links));
+}
+
+
+int links_add(struct links *links, const struct stat *st, const char *newpath,
+        digesterset_t *set)
+{
+    struct link *link, **found;
+    const void *value;
+    size_t len;
+    int type;
+
+    len = 0;
+    for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+        if (digesterset_get_value(set, type) != NULL)
+            len += DIGEST_LENGTH(type);
+
+    if ((link = malloc(sizeof(*link) + len)) == NULL)
+        return -1;
+
+    link->dev = st->st_dev;
+    link->ino = st->st_ino;
+    if ((found = tsearch(link, &links->root, linkcmp)) == NULL)
+    {
+        free(link);
+        return -1;
+    }
+
+    /* a later link that had to be copied becomes the one to link to */
+    if (*found != link)
+    {
+        free(link);
+        if ((*found)->newpath == NULL && newpath != NULL)
+            (*found)->newpath = strdup(newpath);
+        return 0;
+    }
+
+    link->nlink   = st->st_nlink;
+    link->seen    = 1;
+    link->newpath = newpath == NULL? NULL : strdup(newpath);
+    link->valid   = 0;
+    len = 0;
+    for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+    {
+        if ((value = digesterset_get_value(set, type)) == NULL)
+            continue;
+        memcpy(link->values + len, value, DIGEST_LENGTH(type));
+        len += DIGEST_LENGTH(type);
+        link->valid |= type;
+    }
+    return 0;
+}
+
+
+int links_find(struct links *links, const struct stat *st, digesterset_t *set,
+        char **newpath)
+{
+    struct link key, *link, **found;
+    size_t len;
+    int type;
+
+    key.dev = st->st_dev;
+    key.ino = st->st_ino;
+    if ((found = tfind(&key, &links->root, linkcmp)) == NULL)
+        return -1;
+    link = *found;
+
+    /* the set is given every digest it is for, which the first link has */
+    digesterset_reset(set);
+    len = 0;
+    for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+    {
+        if (!(link->valid & type))
+            continue;
+        if (set->valid & type)
+            digesterset_set_value(set, type, link->values + len);
+        len += DIGEST_LENGTH(type);
+    }
+
+    *newpath = link->newpath == NULL? NULL : strdup(link->newpath);
+
+    /* no more links of the inode to find */
+    if (++link->seen >= link->nlink)
+    {
+        tdelete(&key, &links->root, linkcmp);
+        link_free(link);
+    }
+    return 0;
+}
+
+
+void links_free(struct links *links)
+{
+    if (links == NULL)
+        return;
+
+    tdestroy(links->root, link_free);
+    free(links);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int linkcmp(const void *a, const void *b)
+{
+    const struct link *la = a, *lb = b;
+
+    if (la->dev != lb->dev)
+        return la->dev < lb->dev? -1 : 1;
+    if (la->ino != lb->ino)
+        return la->ino < lb->ino? -1 : 1;
+    return 0;
+}
+
+
+void link_free(void *link)
+{
+    free(((struct link *) link)->newpath);
+    free(link);
+}
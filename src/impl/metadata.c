@@ -0,0 +1,341 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the deferred metadata from process.h. Items are queued as
+ * they are created and their owner, with `preserve` their mode and times too,
+ * is set once the walk leaves the directory they are in, when nothing more is
+ * written to them or to it. A walk is depth first so the items of a directory
+ * are the last ones queued when it is done, and they are set through one
+ * descriptor of it, each call resolving a single name instead of the whole
+ * path.
+ *
+ * When the walk creates items with the owner they are to have, see
+ * metadata_own, they are only chowned where a set-group-ID directory gave
+ * them its group, which one fstat of the directory tells.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/capability.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fsuid.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../logging.h"
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * an item created whose directory is not done
+ */
+struct item {
+    char *path;                 /**< relative to the destination root */
+    mode_t mode;                /**< type and permissions of the source */
+    uid_t uid;                  /**< who is to own it */
+    gid_t gid;                  /**< what group it is to belong to */
+    struct timespec times[2];   /**< its source's access and modify times */
+    int owned;                  /**< it was created with its owner */
+};
+
+
+struct metadata {
+    int preserve;               /**< set modes and times, not only owners */
+    uid_t uid;                  /**< who owns every item, -1 for the source's */
+    gid_t gid;                  /**< group of every item, -1 for the source's */
+    int owned;                  /**< items are created by `uid` and `gid` */
+    int switched;               /**< the file system identity was switched */
+    struct item *items;         /**< in the order they were created */
+    size_t count;               /**< # of `items` */
+    size_t size;                /**< # of `items` there is room for */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * set the metadata of `item`, found at `path` relative to `dirfd`
+ *
+ * @param setgid    the directory `item` is in may have given it its group
+ */
+static void apply(const struct metadata *metadata, const struct item *item,
+        int dirfd, const char *path, int setgid);
+
+
+/**
+ * switch the file system identity of the calling thread back to its own
+ */
+static void restore(void);
+
+
+/* Public Impl ****************************************************************/
+
+
+struct metadata *metadata_create(int preserve, uid_t uid, gid_t gid)
+{
+    struct metadata *metadata;
+
+    if ((metadata = calloc(1, sizeof(struct metadata))) == NULL)
+    {
+        log_error("calloc");
+        return NULL;
+    }
+
+    metadata->preserve = preserve;
+    metadata->uid      = uid;
+    metadata->gid      = gid;
+    return metadata;
+}
+
+
+int metadata_own(struct metadata *metadata)
+{
+    struct __user_cap_header_struct header;
+    struct __user_cap_data_struct data[_LINUX_CAPABILITY_U32S_3];
+    int i;
+
+    if (metadata->uid == (uid_t) -1 || metadata->gid == (gid_t) -1)
+        return -1;
+
+    /* the thread already creates what it owns, nothing to switch */
+    if (metadata->uid == geteuid() && metadata->gid == getegid())
+    {
+        metadata->owned = 1;
+        return 0;
+    }
+
+    if (geteuid() != 0)
+        return -1;
+
+    /* the group first, while the thread can still set anything */
+    setfsgid(metadata->gid);
+    setfsuid(metadata->uid);
+    if ((uid_t) setfsuid(-1) != metadata->uid ||
+            (gid_t) setfsgid(-1) != metadata->gid)
+    {
+        restore();
+        return -1;
+    }
+
+    /* a file system uid other than 0 drops root's file capabilities, they
+     * are raised again so the sources are read and the copies written as
+     * before */
+    memset(&header, 0, sizeof(header));
+    header.version = _LINUX_CAPABILITY_VERSION_3;
+    if (syscall(SYS_capget, &header, data) != 0)
+    {
+        log_error("capget");
+        restore();
+        return -1;
+    }
+
+    for (i = 0; i < _LINUX_CAPABILITY_U32S_3; i++)
+        data[i].effective = data[i].permitted;
+    if (syscall(SYS_capset, &header, data) != 0)
+    {
+        log_error("capset");
+        restore();
+        return -1;
+    }
+
+    metadata->owned    = 1;
+    metadata->switched = 1;
+    return 0;
+}
+
+
+int metadata_add(struct metadata *metadata, const char *newpath,
+        const struct stat *oldst, int owned)
+{
+    struct item *item;
+    size_t size;
+
+    /* symlinks are only given their source's owner and times */
+    if (metadata == NULL || (S_ISLNK(oldst->st_mode) && !metadata->preserve))
+        return 0;
+
+    if (metadata->count == metadata->size)
+    {
+        size = metadata->size == 0? 64 : metadata->size * 2;
+        if ((item = realloc(metadata->items, size * sizeof(struct item)))
+                == NULL)
+        {
+            log_error("cannot queue the metadata of '%s'", newpath);
+            return -1;
+        }
+        metadata->items = item;
+        metadata->size  = size;
+    }
+
+    item = metadata->items + metadata->count;
+    if ((item->path = strdup(newpath)) == NULL)
+    {
+        log_error("cannot queue the metadata of '%s'", newpath);
+        return -1;
+    }
+    item->mode     = oldst->st_mode;
+    item->uid      = metadata->uid == (uid_t) -1? oldst->st_uid : metadata->uid;
+    item->gid      = metadata->gid == (gid_t) -1? oldst->st_gid : metadata->gid;
+    item->times[0] = oldst->st_atim;
+    item->times[1] = oldst->st_mtim;
+    item->owned    = owned && metadata->owned;
+    metadata->count++;
+    return 0;
+}
+
+
+void metadata_drop(struct metadata *metadata, const char *newpath)
+{
+    struct item *item;
+
+    if (metadata == NULL || metadata->count == 0)
+        return;
+
+    item = metadata->items + metadata->count - 1;
+    if (strcmp(item->path, newpath) == 0)
+    {
+        free(item->path);
+        metadata->count--;
+    }
+}
+
+
+void metadata_apply(struct metadata *metadata, file_t *newdir,
+        const char *newpath)
+{
+    struct item *item;
+    struct stat st;
+    size_t first;
+    size_t len;
+    size_t i;
+    int dirfd;
+    int setgid;
+
+    if (metadata == NULL)
+        return;
+
+    /* the directory's items were queued after it, everything below them was
+     * set and dropped when its own directory was done */
+    len = strlen(newpath);
+    setgid = 1;
+    for (first = metadata->count; first > 0; first--)
+    {
+        item = metadata->items + first - 1;
+        if (strncmp(item->path, newpath, len) != 0 || item->path[len] != '/')
+            break;
+    }
+
+    if (first < metadata->count)
+    {
+        if ((dirfd = openat(newdir->fd, newpath, O_RDONLY | O_DIRECTORY |
+                O_NOFOLLOW)) == -1)
+            log_error("cannot open '%s' to set the metadata of its items",
+                    pathstr(newdir, newpath));
+
+        /* a set-group-ID directory gives what is created in it its group */
+        else if (metadata->owned && fstat(dirfd, &st) == 0)
+            setgid = (st.st_mode & S_ISGID) != 0;
+
+        for (i = first; i < metadata->count; i++)
+        {
+            item = metadata->items + i;
+            if (dirfd != -1)
+                apply(metadata, item, dirfd, item->path + len + 1, setgid);
+            free(item->path);
+        }
+
+        if (dirfd != -1)
+            close(dirfd);
+        metadata->count = first;
+    }
+
+    /* and the directory itself, now nothing is added to it. If it was made
+     * in a set-group-ID directory it is one too. */
+    if (first > 0 && strcmp(metadata->items[first - 1].path, newpath) == 0)
+    {
+        item = metadata->items + --metadata->count;
+        apply(metadata, item, newdir->fd, item->path, setgid);
+        free(item->path);
+    }
+}
+
+
+void metadata_flush(struct metadata *metadata, file_t *newdir)
+{
+    struct item *item;
+
+    if (metadata == NULL)
+        return;
+
+    /* an item's directory was created before it, it is set after */
+    while (metadata->count > 0)
+    {
+        item = metadata->items + --metadata->count;
+        apply(metadata, item, newdir->fd, item->path, 1);
+        free(item->path);
+    }
+}
+
+
+void metadata_free(struct metadata *metadata)
+{
+    size_t i;
+
+    if (metadata == NULL)
+        return;
+
+    if (metadata->switched)
+        restore();
+
+    for (i = 0; i < metadata->count; i++)
+        free(metadata->items[i].path);
+    free(metadata->items);
+    free(metadata);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void apply(const struct metadata *metadata, const struct item *item,
+        int dirfd, const char *path, int setgid)
+{
+    mode_t mode;
+
+    /* like cp, set-id bits are not kept for an owner that could not be */
+    mode = item->mode & 07777;
+    if ((!item->owned || setgid) &&
+            fchownat(dirfd, path, item->uid, item->gid, AT_SYMLINK_NOFOLLOW)
+            != 0)
+    {
+        log_debug("cannot chown '%s'", item->path);
+        mode &= ~(S_ISUID | S_ISGID);
+    }
+
+    if (!metadata->preserve)
+        return;
+
+    /* a symlink has no mode of its own */
+    if (!S_ISLNK(item->mode) && fchmodat(dirfd, path, mode, 0) != 0)
+        log_warn("cannot set the mode of '%s'", item->path);
+
+    if (utimensat(dirfd, path, item->times, AT_SYMLINK_NOFOLLOW) != 0)
+        log_warn("cannot set the times of '%s'", item->path);
+}
+
+
+void restore(void)
+{
+    setfsuid(geteuid());
+    setfsgid(getegid());
+}
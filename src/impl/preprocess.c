@@ -33,7 +33,8 @@ int preprocess(file_t *newdir, const char *newpath, const char *oldpath,
 {
     struct stat st;
 
-    if (fstatat(newdir->fd, newpath + 1, &st, 0) == -1)
+    /* a symlink in the way is removed, not followed */
+    if (fstatat(newdir->fd, newpath, &st, AT_SYMLINK_NOFOLLOW) == -1)
     {
         if (errno == ENOENT)
             goto cleanup;
@@ -53,8 +54,12 @@ int preprocess(file_t *newdir, const char *newpath, const char *oldpath,
             return 0;
 
         /* else error */
-        log_errorx("cannot overwrite non-directory `%s' with directory `%s'",
-                pathstr(newdir, newpath), oldpath);
+        if (oldpath == NULL)
+            log_errorx("cannot overwrite non-directory `%s' with a directory",
+                    pathstr(newdir, newpath));
+        else
+            log_errorx("cannot overwrite non-directory `%s' with directory "
+                    "`%s'", pathstr(newdir, newpath), oldpath);
         return -1;
     }
 
@@ -63,13 +68,18 @@ int preprocess(file_t *newdir, const char *newpath, const char *oldpath,
         /* old is not a directory but new exists and is a directory, error */
         if (S_ISDIR(st.st_mode))
         {
-            log_errorx("cannot overwrite directory `%s' with non-directory "
-                    "`%s'", pathstr(newdir, newpath), oldpath);
+            if (oldpath == NULL)
+                log_errorx("cannot overwrite directory `%s' with a "
+                        "non-directory", pathstr(newdir, newpath));
+            else
+                log_errorx("cannot overwrite directory `%s' with "
+                        "non-directory `%s'", pathstr(newdir, newpath),
+                        oldpath);
             return -1;
         }
 
         /* remove whatever is in new */
-        if (unlinkat(newdir->fd, newpath + 1, 0) == -1)
+        if (unlinkat(newdir->fd, newpath, 0) == -1)
         {
             log_error("cannot remove `%s'", pathstr(newdir, newpath));
             return -1;
@@ -83,7 +93,7 @@ int preprocess(file_t *newdir, const char *newpath, const char *oldpath,
     }
 
     cleanup:
-        if (verbose)
+        if (verbose && oldpath != NULL)
         {
             fprintf(stdout, "`%s' -> `%s'\n",oldpath,pathstr(newdir, newpath));
             fflush(stdout);
@@ -14,11 +14,14 @@
 
 
 #include <fcntl.h>
+#include <fts.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "../cache.h"
 #include "../digest.h"
 #include "../index/index.h"
 #include "dcp.h"
@@ -39,6 +42,20 @@
 #define UNUSED(_var) (void) _var
 
 
+/**
+ * most copies of a file a hasher reads, @see hasher_create
+ */
+#define HASHER_LANES 2
+
+
+/**
+ * returned by dest_open and dest_create when, in a fresh destination, what is
+ * in the way cannot be replaced. preprocess() logged why and like the walk
+ * does on its refusal the item is not reported.
+ */
+#define DEST_REFUSED -2
+
+
 /* Type Defs ******************************************************************/
 
 
@@ -48,16 +65,159 @@ typedef struct {
 } file_t;
 
 
+/**
+ * checks the final digests `set` of a file read from a stream against what
+ * the stream says they should be, @see process_stream
+ *
+ * @return          0 if they match or cannot be checked, -1 if not
+ */
+typedef int (*stream_check_f)(digesterset_t *set, void *ctx);
+
+
+/**
+ * a copy of a file queued for a hasher, read by the threads of its lane
+ */
+struct hashed {
+    int dirfd;                              /**< `path` is relative to this */
+    char *path;                             /**< where to read the file */
+    unsigned char digest[MAX_DIGEST_LENGTH];/**< digest that was calculated */
+    int err;                                /**< errno if it was not read */
+    int regular;                            /**< it was a regular file, of the
+                                                 walked file's size past the
+                                                 first lane, and was read */
+    unsigned long ms;                       /**< time spent hashing */
+};
+
+
+/**
+ * a file the walk found and its copies, one for each lane of a hasher
+ */
+struct hashjob {
+    struct hashed files[HASHER_LANES];      /**< what each lane read */
+    char *dapath;                           /**< @see dcp.h DEFINITIONS */
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];/**< md5 of `dapath` */
+    struct stat st;                         /**< the walked file's stat */
+    size_t done;                            /**< # of lanes done with it */
+};
+
+
+/**
+ * decides the state a file is reported in once every lane has read it,
+ * @see hasher_create
+ *
+ * @return          DCP_FAILED or one of the DCP_CHECK_* states
+ */
+typedef dcp_state_t (*hasher_judge_f)(const struct hashjob *job, void *ctx);
+
+
+/**
+ * small files that have been read completely into the cache and are waiting to
+ * be digested and written, @see process_regular_flush
+ */
+struct batch;
+
+
+/**
+ * files that have been written and are waiting to be reread and compared with
+ * the digests calculated during the copy, @see verifier_submit
+ */
+struct verifier;
+
+
+/**
+ * regular files being read and digested by a pool of threads, @see
+ * hasher_submit
+ */
+struct hasher;
+
+
+/**
+ * source files whose copies at the destination are being hashed and compared
+ * with them, @see comparer_submit
+ */
+struct comparer;
+
+
+/**
+ * regular files with more than one link whose first link has been processed,
+ * @see links_find
+ */
+struct links;
+
+
+/**
+ * a store of content-defined chunks and the file being cut into them, @see
+ * chunker_update
+ */
+struct chunker;
+
+
+/**
+ * the destinations every item is written to besides the first, each behind a
+ * queue of its own, @see fanout_open
+ */
+struct fanout;
+
+
+/**
+ * a pax tar stream every item is appended to in place of a destination tree,
+ * @see archive_create
+ */
+struct archive;
+
+
+/**
+ * the items created whose owner, mode and times are set once the directory
+ * they are in is done, @see metadata_apply
+ */
+struct metadata;
+
+
 /**
  * struct to hold static parameters that the following functions utilize.
  */
 struct process_opts {
+    dcp_mode_t mode;            /**< if not DCP_MODE_COPY nothing is written */
     int digests;                /**< mask of digest_alg_t for what hashes to
                                      compute */
     uid_t uid;                  /**< who owns the copied files */
     gid_t gid;                  /**< what group do copied files belong */
     void *buffer;               /**< preallocated memory to use for reading */
-    size_t buffer_size;         /**< # of bytes in `buffer` */
+    size_t buffer_size;         /**< # of bytes in `buffer`, the size of each
+                                     read and write request */
+    cache_t *cache;             /**< memory to hold whole files in */
+    struct batch *batch;        /**< NULL or small files held in `cache` */
+    digesterset_t *dgstset;     /**< reset for each file that is not batched */
+    struct verifier *verifier;  /**< NULL or rereads every copied file */
+    struct comparer *comparer;  /**< compares files in DCP_MODE_COMPARE */
+    dcp_xattr_t digest_xattr;   /**< where digests are cached, if anywhere */
+    struct links *links;        /**< NULL or files linked more than once */
+    int linkdest;               /**< -1 or the previous destination that files
+                                     found in `index` are linked from */
+    index_t *dedup;             /**< NULL or the content of every file copied
+                                     so far, mapped to its copy */
+    dcp_dedup_t dedup_policy;   /**< how copies found in `dedup` are made */
+    int *undeduped;             /**< set once the destination cannot make
+                                     copies the policy's way, after which
+                                     `dedup` is no longer looked in */
+    int store;                  /**< -1 or the content-addressed store every
+                                     copy is a hard link into */
+    digest_t store_type;        /**< the digest objects in `store` are named by */
+    struct chunker *chunker;    /**< NULL or the chunk store copies are cut
+                                     into, each copy is a recipe of chunks */
+    int unchunk;                /**< the sources are recipes to restore from
+                                     `chunker` */
+    struct fanout *fanout;      /**< NULL or the other destinations every
+                                     item created is created at too */
+    struct archive *archive;    /**< NULL or the stream items are appended
+                                     to instead of the destination */
+    struct metadata *metadata;  /**< NULL or the owners, modes and times set
+                                     on items after their directory */
+    int owned;                  /**< new items are created owned by `uid` and
+                                     `gid`, @see metadata_own */
+    int fresh;                  /**< nothing is checked before an item is
+                                     created, what is in the way is removed
+                                     only if creating it fails */
 
     index_t *index;             /**< NULL or files we should not copy */
     dcp_callback_f callback;    /**< callback to send processing info to */
@@ -97,7 +257,8 @@ int process_special(file_t *newdir, const char *newpath, const char *oldpath,
 /**
  * Process a new directory. Since dcp is written as a post-order or DFS style
  * walk we assume that the directory exists since for all its children to have
- * been processed already means the destination directory must exist.
+ * been processed already means the destination directory must exist. The
+ * metadata queued for its items and for it is set, @see metadata_apply.
  *
  * If `newpath` is relative, then it is interpreted relative to the directory
  * referred to by `newdirfd` rather than the process's cwd. If `newpath` is
@@ -119,10 +280,12 @@ int process_directory(file_t *newdir, const char *newpath, const char *oldpath,
  *                          the file is new or modified.
  *      2. Digests          as specified by the `opts.digests` mask, we will
  *                          calculate all the required digests for the file.
- *      3. Cacheing         if `opts.buffer` is large enough we will only read
+ *      3. Cacheing         if `opts.cache` is large enough we will only read
  *                          the file into memory once. Eliminating duplicate IO.
- *                          Even if buffer is too small we will use it over
- *                          and over to eliminate redundant allocations.
+ *                          Files smaller than `opts.buffer_size` are read with
+ *                          a single request into the cache and added to
+ *                          `opts.batch`, they are digested and written when
+ *                          the batch is flushed.
  *
  * If `newpath` is relative, then it is interpreted relative to the directory
  * referred to by `newdirfd` rather than the process's cwd. If `newpath` is
@@ -144,6 +307,663 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
         const struct process_opts *opts);
 
 
+/**
+ * Process a regular file whose `oldst->st_size` bytes are the next in the
+ * stream `fd`, like a member of an archive. They are digested as they are read
+ * and written to `newpath` like a file that is not batched. The bytes are
+ * read even if the copy fails so the stream can go on. It has no access path
+ * to report, NULL is sent in its place.
+ *
+ * @param check     NULL or called with `ctx` once the file is digested and
+ *                  before it is reported, a file it fails is removed and
+ *                  reported in the DCP_VERIFY_FAILED state instead
+ *
+ * @return          0 on success, -1 if the stream ended first
+ */
+int process_stream(file_t *newdir, const char *newpath, int fd,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        stream_check_f check, void *ctx, const struct process_opts *opts);
+
+
+/**
+ * Digest and write every file waiting in the batch, sending each to the
+ * callback, then empty the batch and its cache. Must be called before the
+ * batched files' parent directory is finished and once the walk is complete.
+ *
+ * @return          0 on success, -1 if any of the files failed
+ */
+int process_regular_flush(file_t *newdir, const struct process_opts *opts);
+
+
+/**
+ * Allocate an empty batch for small files to wait in before being processed.
+ *
+ * @return          the new batch, NULL on failure
+ */
+struct batch *batch_create(void);
+
+
+/**
+ * Reclaim all resources of a batch, the batch must have been flushed.
+ *
+ * @param batch     the batch to free, ignored if NULL
+ */
+void batch_free(struct batch *batch);
+
+
+/**
+ * Start a thread that rereads copied files from disk, bypassing the page cache,
+ * and compares them with the `type` digest calculated during the copy.
+ *
+ * @param type      digest used to compare, must be calculated for every file
+ * @param bufsize   # of bytes requested with each read
+ * @param callback  where verified files are sent, @see verifier_drain
+ * @param ctx       provided pointer to send to `callback`
+ *
+ * @return          the new verifier, NULL on failure
+ */
+struct verifier *verifier_create(digest_t type, size_t bufsize,
+        dcp_callback_f callback, void *ctx);
+
+
+/**
+ * Queue a copied file to be verified. Its entry is sent to the callback by
+ * verifier_drain once the check is done, in the FILE_VERIFIED or VERIFY_FAILED
+ * state. If the queue is full this waits for the oldest file to be verified.
+ *
+ * @param set       the finalized digests calculated during the copy
+ * @param ms        milliseconds spent copying the file
+ *
+ * @return          0 on success, -1 if the file cannot be queued
+ */
+int verifier_submit(struct verifier *verifier, const file_t *newdir,
+        const char *newpath, const char *oldpath, const struct stat *oldst,
+        const char *dapath, const void *pathmd5, digesterset_t *set,
+        unsigned long ms);
+
+
+/**
+ * Send every file that has been verified to the callback, from the calling
+ * thread. If `wait` is set first wait for every queued file to be verified.
+ *
+ * @return          # of files drained so far that failed verification
+ */
+size_t verifier_drain(struct verifier *verifier, int wait);
+
+
+/**
+ * Stop the thread and reclaim all resources, the verifier must be drained
+ * with `wait` set first.
+ *
+ * @param verifier  the verifier to free, ignored if NULL
+ */
+void verifier_free(struct verifier *verifier);
+
+
+/**
+ * Start the threads that read and digest queued files. Each of the `lanes`
+ * copies of a file is read by threads of its own so the copies are read at
+ * the same time. Files are judged and sent to the callback in the order they
+ * were queued, only from the thread calling hasher_submit or hasher_drain.
+ *
+ * @param type      digest calculated for every copy
+ * @param lanes     # of copies of each file, at most HASHER_LANES
+ * @param threads   # of threads for each lane, 0 for the # of online cpus
+ * @param bufsize   # of bytes requested with each read
+ * @param judge     picks the state of each file once it has been read
+ * @param jctx      provided pointer to send to `judge`
+ * @param callback  where files are sent, @see hasher_report
+ * @param ctx       provided pointer to send to `callback`
+ *
+ * @return          the new hasher, NULL on failure
+ */
+struct hasher *hasher_create(digest_t type, size_t lanes, size_t threads,
+        size_t bufsize, hasher_judge_f judge, void *jctx,
+        dcp_callback_f callback, void *ctx);
+
+
+/**
+ * Queue a regular file the walk found, to be read from `paths`[i] relative to
+ * `dirfds`[i] on each lane i. Copies past the first lane are only read if they
+ * are regular files of the size in `st`. If the queue is full this waits for
+ * the oldest file and reports it.
+ *
+ * @return          0 on success, -1 if the file cannot be queued
+ */
+int hasher_submit(struct hasher *hasher, const int *dirfds,
+        const char *const *paths, const char *dapath, const void *pathmd5,
+        const struct stat *st);
+
+
+/**
+ * Send a file to the callback with `digest` as the hasher's type and count it
+ * in `state`.
+ */
+void hasher_report(struct hasher *hasher, dcp_state_t state,
+        const void *pathmd5, const char *dapath, const struct stat *st,
+        const char *accpath, const void *digest, unsigned long ms);
+
+
+/**
+ * Judge and report every file that has been read on every lane, from the
+ * calling thread. If `wait` is set first wait for every queued file.
+ */
+void hasher_drain(struct hasher *hasher, int wait);
+
+
+/**
+ * @return          # of files reported so far in `state`
+ */
+size_t hasher_count(const struct hasher *hasher, dcp_state_t state);
+
+
+/**
+ * Stop the threads and reclaim all resources, the hasher must be drained
+ * with `wait` set first.
+ *
+ * @param hasher    the hasher to free, ignored if NULL
+ */
+void hasher_free(struct hasher *hasher);
+
+
+/**
+ * Start the threads that hash source files and the paths they would be copied
+ * to. Half of the threads read each side so both are read at the same time.
+ *
+ * @param type      digest used to compare
+ * @param threads   # of threads for each side, 0 for the # of online cpus
+ * @param bufsize   # of bytes requested with each read
+ * @param callback  where compared files are sent, @see comparer_drain
+ * @param ctx       provided pointer to send to `callback`
+ *
+ * @return          the new comparer, NULL on failure
+ */
+struct comparer *comparer_create(digest_t type, size_t threads, size_t bufsize,
+        dcp_callback_f callback, void *ctx);
+
+
+/**
+ * Queue a regular file to be compared with `newdir`/`newpath`. Its entry is
+ * sent to the callback by comparer_drain in the DCP_CHECK_MATCHED,
+ * DCP_CHECK_MISMATCHED or DCP_CHECK_MISSING state, or DCP_FAILED if either
+ * cannot be read. If the queue is full this waits for the oldest file.
+ *
+ * @return          0 on success, -1 if the file cannot be queued
+ */
+int comparer_submit(struct comparer *comparer, const file_t *newdir,
+        const char *newpath, const char *oldpath, const struct stat *oldst,
+        const char *dapath, const void *pathmd5);
+
+
+/**
+ * Send the regular files in the directory `newdir`/`newpath`, and under its
+ * subdirectories, that are not in the source directory `fts` just returned in
+ * preorder to the callback in the DCP_CHECK_EXTRA state.
+ *
+ * @param dapath    the DAPath of the directory
+ */
+void comparer_extras(struct comparer *comparer, FTS *fts,
+        const file_t *newdir, const char *newpath, const char *dapath);
+
+
+/**
+ * Send every file that has been compared to the callback, from the calling
+ * thread. If `wait` is set first wait for every queued file to be compared.
+ *
+ * @return          # of files sent so far, extras included, that did not match
+ */
+size_t comparer_drain(struct comparer *comparer, int wait);
+
+
+/**
+ * Stop the threads and reclaim all resources, the comparer must be drained
+ * with `wait` set first.
+ *
+ * @param comparer  the comparer to free, ignored if NULL
+ */
+void comparer_free(struct comparer *comparer);
+
+
+/**
+ * Allocate an empty hard link map.
+ *
+ * @return          the new map, NULL on failure
+ */
+struct links *links_create(void);
+
+
+/**
+ * Remember the first link found of the inode `st` describes, with the
+ * finalized digests of `set` and where it was copied to. If the inode is
+ * already known and was not copied `newpath` becomes its copy.
+ *
+ * @param newpath   the copy relative to the destination root, NULL if the
+ *                  file was not copied
+ *
+ * @return          0 on success, -1 on failure
+ */
+int links_add(struct links *links, const struct stat *st, const char *newpath,
+        digesterset_t *set);
+
+
+/**
+ * Look for an earlier link of the inode `st` describes. If there is one `set`
+ * is given its digests and `newpath` is set to a copy of where it was copied
+ * to, or NULL if it was not, which must be freed. The inode is forgotten once
+ * all of its links have been found.
+ *
+ * @return          0 if an earlier link was found, -1 otherwise
+ */
+int links_find(struct links *links, const struct stat *st, digesterset_t *set,
+        char **newpath);
+
+
+/**
+ * Reclaim all resources of a hard link map.
+ *
+ * @param links     the map to free, ignored if NULL
+ */
+void links_free(struct links *links);
+
+
+/**
+ * Fill `set` with the digests cached in the xattr of `path`, if the record is
+ * for the file `st` describes as it is now and has every digest in the set.
+ *
+ * @return          0 if `set` was filled, -1 if it must be calculated
+ */
+int digest_xattr_get(const char *path, const struct stat *st,
+        digesterset_t *set);
+
+
+/**
+ * Cache the finalized digests of `set` in the xattr of `dirfd`/`path`, along
+ * with the stat they are valid for. If `st` is not NULL nothing is stored when
+ * the file no longer has its size, inode or mtime.
+ *
+ * @return          0 on success, -1 if the digests were not stored
+ */
+int digest_xattr_put(int dirfd, const char *path, const struct stat *st,
+        digesterset_t *set);
+
+
+/**
+ * Create or open the content-addressed store at `path` and its directory of
+ * objects keyed by `type`, creating both if needed.
+ *
+ * @return          fd of the directory of objects, -1 on failure
+ */
+int store_open(const char *path, digest_t type);
+
+
+/**
+ * Create `dirfd`/`newpath` as a hard link to the object in `store` with the
+ * digest of type `type` in `set`, if there is one and it is `size` bytes.
+ *
+ * @return          0 if it was linked, -1 if it must be copied
+ */
+int store_link(int store, digest_t type, digesterset_t *set, off_t size,
+        int dirfd, const char *newpath);
+
+
+/**
+ * Make the copy `dirfd`/`newpath` the object in `store` for the digest of
+ * type `type` in `set`, unless there already is one.
+ *
+ * @return          0 on success, -1 if it could not be linked into the store
+ */
+int store_add(int store, digest_t type, digesterset_t *set, int dirfd,
+        const char *newpath);
+
+
+/**
+ * Open the chunk store at `path`, creating it if asked to.
+ *
+ * @param create    create the store and its directories if needed
+ *
+ * @return          the chunker, NULL on failure
+ */
+struct chunker *chunker_create(const char *path, int create);
+
+
+/**
+ * Start cutting a new file.
+ */
+void chunker_reset(struct chunker *chunker);
+
+
+/**
+ * Cut the next `len` bytes of the file into chunks, storing each one that is
+ * not in the store yet. Bytes after the last cut wait for the next call.
+ *
+ * @return          0 on success, -1 if a chunk of the file was not stored
+ */
+int chunker_update(struct chunker *chunker, const void *data, size_t len);
+
+
+/**
+ * Cut and store the last bytes of the file, then write its recipe to `fd`.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int chunker_finish(struct chunker *chunker, int fd);
+
+
+/**
+ * Rebuild a file from its recipe, writing it to `fd` and updating `set` with
+ * its bytes. Every chunk is checked against its digest first.
+ *
+ * @return          # of bytes written, -1 on failure
+ */
+ssize_t chunks_restore(struct chunker *chunker, FILE *recipe, int fd,
+        digesterset_t *set);
+
+
+/**
+ * Reclaim all resources of a chunker.
+ *
+ * @param chunker   the chunker to free, ignored if NULL
+ */
+void chunker_free(struct chunker *chunker);
+
+
+/**
+ * Start the fan-out to `count` other destinations, @see fanout_add.
+ *
+ * @param skip      # of bytes at the start of every path that are the name the
+ *                  first destination gives the top of the copy, "" when the
+ *                  sources are copied into it
+ * @param fresh     what is in the way of an item is only removed if creating
+ *                  it fails, rather than first
+ * @param callback  where items created are sent, @see fanout_drain
+ * @param ctx       provided pointer to send to `callback`
+ *
+ * @return          the new fan-out, NULL on failure
+ */
+struct fanout *fanout_create(size_t count, size_t skip, uid_t uid, gid_t gid,
+        int fresh, dcp_callback_f callback, void *ctx);
+
+
+/**
+ * Start a thread writing to another destination. Paths at the first
+ * destination are rewritten for it by replacing their first `skip` bytes with
+ * `name`. The fan-out owns `root` from here on, even on failure. Items
+ * created there are reported with `dest` as their accesspath, it is not
+ * copied and must outlive the fan-out.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int fanout_add(struct fanout *fanout, file_t *root, const char *name,
+        const char *dest);
+
+
+/**
+ * Queue the creation of the copy `newpath` at every other destination. Its
+ * bytes are given with fanout_write and it is finished by fanout_close, a
+ * file that is opened again first is left as it is. If a queue is full this
+ * waits for its destination to catch up.
+ *
+ * @param newpath   the copy at the first destination
+ *
+ * @return          0 on success, -1 if it could not be queued everywhere
+ */
+int fanout_open(struct fanout *fanout, const char *newpath);
+
+
+/**
+ * Queue the next `len` bytes of the file opened last for every other
+ * destination, they are copied and `buf` can be reused.
+ *
+ * @return          0 on success, -1 if they could not be queued everywhere
+ */
+int fanout_write(struct fanout *fanout, const void *buf, size_t len);
+
+
+/**
+ * Queue the end of the file opened last, which is `newpath`. It is sent to the
+ * callback in the DCP_MIRROR_COPIED state or DCP_MIRROR_FAILED if any of it
+ * could not be written.
+ *
+ * @return          0 on success, -1 if it could not be queued everywhere
+ */
+int fanout_close(struct fanout *fanout, const char *newpath,
+        const char *dapath, const void *pathmd5, const struct stat *oldst);
+
+
+/**
+ * Queue the creation of the item `oldst` describes, by its type a directory, a
+ * symlink to `target`, a special file or, for a regular file, a hard link to
+ * the copy `target` at the first destination. It is sent to the callback
+ * like a file once done.
+ *
+ * @return          0 on success, -1 if it could not be queued everywhere
+ */
+int fanout_create_item(struct fanout *fanout, const char *newpath,
+        const char *target, const char *dapath, const void *pathmd5,
+        const struct stat *oldst);
+
+
+/**
+ * Send every item that has been created to the callback, from the calling
+ * thread, with the path of the item at its destination. If `wait` is set
+ * first wait for every destination to catch up.
+ *
+ * @return          # of items drained so far that failed
+ */
+size_t fanout_drain(struct fanout *fanout, int wait);
+
+
+/**
+ * Stop the threads and reclaim all resources, the fan-out must be drained
+ * with `wait` set first.
+ *
+ * @param fanout    the fan-out to free, ignored if NULL
+ */
+void fanout_free(struct fanout *fanout);
+
+
+/**
+ * Open a tar stream in the pax format to write to `path`, "-" for stdout.
+ *
+ * @param sums      each file is to be followed by its digests, @see
+ *                  archive_sums
+ * @param sources   # of sources archived, the archive of several is marked
+ *                  so that process_archive keeps their names in the paths
+ *
+ * @return          the new archive, NULL on failure
+ */
+struct archive *archive_create(const char *path, int sums, size_t sources);
+
+
+/**
+ * Append an entry without content to the archive, a directory, a symlink to
+ * `target`, a special file or, for a regular file, a hard link to the entry
+ * `target` archived before.
+ *
+ * @param st        the source's stat struct, its type, mode and times are
+ *                  archived
+ * @param uid       who owns the entry
+ * @param gid       what group the entry belongs to
+ *
+ * @return          0 on success, -1 on failure
+ */
+int archive_add(struct archive *archive, const char *path,
+        const struct stat *st, const char *target, uid_t uid, gid_t gid);
+
+
+/**
+ * Append the header of the regular file `path` of `size` bytes, which must be
+ * given with archive_write before archive_end.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int archive_begin(struct archive *archive, const char *path,
+        const struct stat *st, off_t size, uid_t uid, gid_t gid);
+
+
+/**
+ * Append the next `len` bytes of the file begun last. Bytes past the size it
+ * was begun with are dropped and fail archive_end.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int archive_write(struct archive *archive, const void *buf, size_t len);
+
+
+/**
+ * End the file begun last. If fewer bytes were written than it was begun with
+ * the rest are zeros, so the stream stays readable, and it fails.
+ *
+ * @return          0 on success, -1 if the file changed size or on failure
+ */
+int archive_end(struct archive *archive);
+
+
+/**
+ * Append the digests of the file ended last for the receiving end to check
+ * its copy against, if the archive was created to carry them.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int archive_sums(struct archive *archive, digesterset_t *set);
+
+
+/**
+ * Write the end of the archive and reclaim all resources.
+ *
+ * @param archive   the archive to close, ignored if NULL
+ *
+ * @return          0 on success, -1 if any of the stream could not be written
+ */
+int archive_close(struct archive *archive);
+
+
+/**
+ * Start queueing the metadata of items as they are created.
+ *
+ * @param preserve  set the mode and times of the source too, not only owners
+ * @param uid       who owns every item, (uid_t) -1 for its source's owner
+ * @param gid       what group every item belongs to, (gid_t) -1 for its
+ *                  source's
+ *
+ * @return          the new queue, NULL on failure
+ */
+struct metadata *metadata_create(int preserve, uid_t uid, gid_t gid);
+
+
+/**
+ * Have what the calling thread creates from now on owned by the queue's `uid`
+ * and `gid`, so items it creates need no chown. Unless the thread already is
+ * them this needs root, its file system identity is switched to them and
+ * root's file capabilities are kept, so it reads and writes what it did
+ * before. metadata_free switches it back.
+ *
+ * @return          0 on success, -1 if the items are to be chowned
+ */
+int metadata_own(struct metadata *metadata);
+
+
+/**
+ * Queue the item `newpath`, relative to the destination root, to be given the
+ * metadata of `oldst` when its directory is done. Without `preserve` symlinks
+ * are not queued.
+ *
+ * @param metadata  the queue, if NULL nothing is done
+ * @param owned     it was created by the thread metadata_own was called on,
+ *                  or chowned, it is only chowned again if its directory is
+ *                  set-group-ID
+ *
+ * @return          0 on success, -1 on failure
+ */
+int metadata_add(struct metadata *metadata, const char *newpath,
+        const struct stat *oldst, int owned);
+
+
+/**
+ * Drop the item `newpath` if it was the last queued, it was removed again.
+ *
+ * @param metadata  the queue, if NULL nothing is done
+ */
+void metadata_drop(struct metadata *metadata, const char *newpath);
+
+
+/**
+ * The directory `newpath` is done, set the metadata of the items queued in it
+ * through one descriptor of it, then its own.
+ *
+ * @param metadata  the queue, if NULL nothing is done
+ */
+void metadata_apply(struct metadata *metadata, file_t *newdir,
+        const char *newpath);
+
+
+/**
+ * Set the metadata of every item still queued, the last queued first, for
+ * items that are in no directory the walk finished.
+ *
+ * @param metadata  the queue, if NULL nothing is done
+ */
+void metadata_flush(struct metadata *metadata, file_t *newdir);
+
+
+/**
+ * Reclaim all resources, items still queued are dropped. The file system
+ * identity of the thread metadata_own switched is switched back.
+ *
+ * @param metadata  the queue to free, ignored if NULL
+ */
+void metadata_free(struct metadata *metadata);
+
+
+/**
+ * Create the copy `newpath` of a regular file at the destination. Its bytes
+ * are given with dest_write and it is finished by dest_close. The
+ * destination is `opts->archive` if there is one, else the tree `newdir` and
+ * the others of `opts->fanout`.
+ *
+ * @param size      # of bytes that will be written
+ *
+ * @return          the handle to give dest_write and dest_close, -1 on
+ *                  failure, DEST_REFUSED if what is in the way is kept
+ */
+int dest_open(file_t *newdir, const char *newpath, const struct stat *oldst,
+        off_t size, const struct process_opts *opts);
+
+
+/**
+ * Write the next `len` bytes of the copy `d`.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int dest_write(int d, const void *buf, size_t len,
+        const struct process_opts *opts);
+
+
+/**
+ * Finish the copy `d` and, unless `failed` is set, queue its owner, mode and
+ * times from `oldst` in `opts->metadata`.
+ *
+ * @param failed    the copy is incomplete, it is only closed
+ *
+ * @return          0 on success, -1 if `failed` or closing failed
+ */
+int dest_close(int d, const char *newpath, const struct stat *oldst,
+        int failed, const struct process_opts *opts);
+
+
+/**
+ * Create the item `oldst` describes at the destination, by its type a
+ * directory, a symlink to `target`, a special file or, for a regular file, a
+ * hard link to the copy `target`. A directory that exists is not an error.
+ * All but a hard link are queued in `opts->metadata`.
+ *
+ * @return          0 on success, -1 on failure, DEST_REFUSED if what is in
+ *                  the way is kept
+ */
+int dest_create(file_t *newdir, const char *newpath, const char *target,
+        const struct stat *oldst, const struct process_opts *opts);
+
+
 /**
  * Process a symlink. By copying its contents to a new symlink.
  *
@@ -167,11 +987,45 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
         const struct process_opts *opts);
 
 
+/**
+ * Process a symlink to `target`, known without reading it from `oldpath`.
+ * The same as process_symlink after it has read the link. `oldpath` is only
+ * reported and may be NULL.
+ *
+ * @return          0 on success, -1 on failure
+ */
+int process_symlink_target(file_t *newdir, const char *newpath,
+        const char *target, const char *oldpath, const struct stat *oldst,
+        const char *dapath, const void *pathmd5,
+        const struct process_opts *opts);
+
+
+/**
+ * Process every member of the tar archive `oldpath`, "-" for stdin, as
+ * though it were an item found by the walk, reading the archive once from
+ * start to end. Members are named by their path in the archive, relative to
+ * `newdir` and reported with a leading "/". A first directory is `newdir`
+ * itself and left out of the names of the members in it, unless the archive
+ * is marked as one of several sources. Any directories a member is in
+ * that the archive does not hold are made. A file followed by the digests it
+ * was sent with, @see archive_sums, is checked against them before it is
+ * sent to the callback, if it does not match its copy is removed and it is
+ * sent in the DCP_VERIFY_FAILED state.
+ *
+ * @return          0 on success, -1 if the archive could not be read to its
+ *                  end or a file did not match its digests
+ */
+int process_archive(file_t *newdir, const char *oldpath,
+        const struct process_opts *opts);
+
+
 /**
  * Performs two tasks. First if there is an existing entry in the copy
  * destination then it is unlinked if possible and secondly if the verbose flag
  * was set will output the required messages.
  *
+ * @param oldpath   the source, NULL if it is only `newpath` being cleared for
+ *                  a copy that found it in the way
  */
 int preprocess(file_t *newdir, const char *newpath, const char *oldpath,
         const struct stat *oldst, int verbose);
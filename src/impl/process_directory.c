@@ -32,9 +32,12 @@ int process_directory(file_t *newdir, const char *newpath, const char *oldpath,
     UNUSED(dapath);
     UNUSED(pathmd5);
 
-    if (fchownat(newdir->fd, newpath, opts->uid, opts->gid, 0) == -1)
-        log_warn("cannot chown '%s'", pathstr(newdir, newpath));
+    /* the owner was archived with the directory */
+    if (opts->archive != NULL)
+        return 0;
 
+    /* nothing more is written into it, its times can be set last */
+    metadata_apply(opts->metadata, newdir, newpath);
     return 0;
 }
 
@@ -22,14 +22,32 @@
 #include <malloc.h>
 #include <sys/xattr.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 
 #include "process.h"
+#include "../cache.h"
 #include "../digest.h"
 #include "../fd.h"
 #include "../index/index.h"
 #include "../logging.h"
 #include "dcp.h"
 
+/* Macros *********************************************************************/
+
+
+/**
+ * max number of small files that can wait in the cache at once
+ */
+#define BATCH_MAX_FILES 1024
+
+
+/**
+ * number of batched files digested side by side, @see digest_mb.h
+ */
+#define BATCH_DIGEST_CHUNK 64
+
+
 /* Type Defs ******************************************************************/
 
 
@@ -50,13 +68,40 @@ struct stream {
 };
 
 
+/**
+ * a small file whose contents have been read completely into the cache and is
+ * waiting for its batch to be flushed.
+ */
+struct pending {
+    char *newpath;                          /**< where to create the copy */
+    char *oldpath;                          /**< where the bytes came from */
+    char *dapath;                           /**< @see dcp.h DEFINITIONS */
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];/**< md5 of `dapath` */
+    struct stat st;                         /**< the source's stat struct */
+    void *bytes;                            /**< file contents in the cache */
+    size_t count;                           /**< # of bytes in `bytes` */
+    clock_t ticks;                          /**< clock ticks spent so far */
+    digesterset_t dgstset;                  /**< digests of `bytes` */
+};
+
+
+/**
+ * small files waiting in the cache, @see process.h
+ */
+struct batch {
+    size_t count;                           /**< # of valid `files` */
+    struct pending files[BATCH_MAX_FILES];  /**< files waiting to be written */
+};
+
+
 /**
  * copy function signature that the copy_regular function utilizes. To simplify
  * the code this function allows input to be provided as an inmem buffer or a
  * file descriptor. @see copy_fd and @see copy_mem for implementations.
  */
-typedef int (*copy_f)(int dirfd, const char *pathname, struct stream *stream,
-        uid_t uid, gid_t gid);
+typedef int (*copy_f)(file_t *newdir, const char *newpath,
+        const struct stat *oldst, struct stream *stream,
+        const struct process_opts *opts);
 
 
 /* Private API ****************************************************************/
@@ -66,32 +111,34 @@ typedef int (*copy_f)(int dirfd, const char *pathname, struct stream *stream,
  * We were able to store the entire file in the buffer so write the buffer's
  * contents to disk.
  *
- * @param dirfd     fd to the parent directory of pathname
- * @param pathname  file to create copying the bytes from stream
+ * @param newdir    the destination @see dest_open
+ * @param newpath   file to create copying the bytes from stream
+ * @param oldst     the source's stat struct
  * @param stream    holds the buffer and number of valid bytes in it
- * @param uid       who will own the new file
- * @param gid       what group the new file will belong to
  *
- * @return          0 on success, -1 on failure with errno set
+ * @return          0 on success, -1 on failure with errno set, DEST_REFUSED
+ *                  @see dest_open
  */
-static int copy_mem(int dirfd, const char *pathname, struct stream *stream,
-        uid_t uid, gid_t gid);
+static int copy_mem(file_t *newdir, const char *newpath,
+        const struct stat *oldst, struct stream *stream,
+        const struct process_opts *opts);
 
 
 /**
  * file was too big to be cached in the buffer, therefore reset the fd to
  * beginning of the file and read all bytes from it
  *
- * @param dirfd     fd to the parent directory of pathname
- * @param pathname  file to create copying the bytes from stream
+ * @param newdir    the destination @see dest_open
+ * @param newpath   file to create copying the bytes from stream
+ * @param oldst     the source's stat struct
  * @param stream    the file descriptor and buffer to use
- * @param uid       who will own the new file
- * @param gid       what group the new file will belong to
  *
- * @return          0 on success, -1 on failure with errno set
+ * @return          0 on success, -1 on failure with errno set, DEST_REFUSED
+ *                  @see dest_open
  */
-static int copy_fd(int dirfd, const char *pathname, struct stream *stream,
-        uid_t uid, gid_t gid);
+static int copy_fd(file_t *newdir, const char *newpath,
+        const struct stat *oldst, struct stream *stream,
+        const struct process_opts *opts);
 
 
 /**
@@ -103,29 +150,188 @@ static int copy_fd(int dirfd, const char *pathname, struct stream *stream,
  * @param fd        the file descriptor to read the bytes from till the end
  * @param buf       a preallocated buffer to use to read the bytes
  * @param blen      number of bytes in the buffer
+ * @param chunk     max number of bytes to request with each read
  *
  * @return          number of bytes that are valid in buf, -1 on error
  */
 static ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf,
-        size_t blen);
+        size_t blen, size_t chunk);
+
+
+/**
+ * Read a small file completely into the cache and add it to the batch. If the
+ * batch or cache is full it is flushed first.
+ *
+ * @param fd        open file descriptor of the source, at the beginning
+ * @param start     clock when processing of the file started
+ *
+ * @return          0 if the file was added, 1 if it cannot be batched (it is
+ *                  larger than the cache, grew since stat or its names cannot
+ *                  be kept), -1 on error
+ */
+static int batch_add(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        int fd, clock_t start, const struct process_opts *opts);
+
+
+/**
+ * Digest every file in the batch, the files are hashed side by side in
+ * chunks so multi-buffer digests can fill their lanes.
+ */
+static void batch_digest(struct batch *batch, int mask);
+
+
+/**
+ * Take a digested file from the batch, check it against the index and write it
+ * to its destination. The result is sent to the callback.
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int batch_deliver(file_t *newdir, struct pending *file,
+        const struct process_opts *opts);
+
 
 /**
  * Read from the FD using the provided buffer, update all the digests, finally
- * write the bytes to the destination.
+ * write the bytes to the destination. With a chunker the bytes are cut into
+ * its store instead and the destination is the file's recipe.
  *
- * @param dirfd     fd to the parent directory of pathname
- * @param pathname  file to create copying the bytes from stream
- * @param uid       who will own the new file
- * @param gid       what group the new file will belong to
+ * `opts->buffer` is used to read the bytes and with `opts->chunker` the file
+ * is cut into it.
+ *
+ * @param newdir    the destination @see dest_open
+ * @param newpath   file to create copying the bytes from stream
+ * @param oldst     the source's stat struct
  * @param set       initialized digestset_t to update and finalize
  * @param fd        the file descriptor to read the bytes from till the end
- * @param buf       a preallocated buffer to use to read the bytes
- * @param blen      number of bytes in the buffer
  *
- * @return          number of bytes copied, -1 on error
+ * @return          number of bytes copied, -1 on error, DEST_REFUSED
+ *                  @see dest_open
+ */
+static ssize_t copy_n_digest(file_t *newdir, const char *newpath,
+        const struct stat *oldst, digesterset_t *set, int fd,
+        const struct process_opts *opts);
+
+
+/**
+ * Rebuild the file a recipe at `oldpath` was cut from.
+ *
+ * @param start     clock when processing of the file started
+ *
+ * @return          0 on success, -1 on failure
  */
-static ssize_t copy_n_digest(int dirfd, const char *pathname, uid_t uid,
-        gid_t gid, digesterset_t *set, int fd, void *buf, size_t blen);
+static int process_unchunk(file_t *newdir, const char *newpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, clock_t start, const struct process_opts *opts);
+
+
+/**
+ * Create newpath from the previous destination's copy at dapath, the path
+ * the file had in the previous run, a hard link if possible or else a reflink.
+ * The copy must still be a regular file the size of the source.
+ *
+ * @return          0 on success, -1 if it must be copied instead
+ */
+static int link_dest(file_t *newdir, const char *newpath, const char *dapath,
+        const struct stat *oldst, const struct process_opts *opts);
+
+
+/**
+ * Create newpath sharing the blocks of oldpath, a reflink.
+ *
+ * @return          0 on success, -1 on failure with errno set
+ */
+static int clone_at(int olddirfd, const char *oldpath, int newdirfd,
+        const char *newpath, const struct stat *oldst,
+        const struct process_opts *opts);
+
+
+/**
+ * Create newpath from the object in the store with the same content, or a file
+ * copied earlier in the run with it as the dedup policy says.
+ *
+ * @param set       the file's finalized digests
+ *
+ * @return          0 on success, -1 if it must be written in full
+ */
+static int dedup(file_t *newdir, const char *newpath, const struct stat *oldst,
+        digesterset_t *set, const struct process_opts *opts);
+
+
+/**
+ * A file was found in the index. It is skipped, or with a link dest it is
+ * linked to its copy from the previous run and reported with `set`.
+ *
+ * @param prevpath  the dapath the file had in the previous run
+ * @param state     DCP_LINK_CREATED if it is at the same path, which is only
+ *                  reported if it was linked, or DCP_FILE_MOVED
+ * @param ms        milliseconds spent processing the file
+ * @param cached    the digests came from the source's xattr or another link
+ *
+ * @return          0 if it is done, 1 if it could not be linked and must be
+ *                  copied
+ */
+static int process_seen(file_t *newdir, const char *newpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, const char *prevpath, dcp_state_t state,
+        digesterset_t *set, unsigned long ms, int cached,
+        const struct process_opts *opts);
+
+
+/**
+ * A file was not found in the index at its path, look for its content under
+ * another path, @see process_seen.
+ *
+ * @return          0 if it is done, 1 if it must be copied
+ */
+static int process_moved(file_t *newdir, const char *newpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, digesterset_t *set, unsigned long ms, int cached,
+        const struct process_opts *opts);
+
+
+/**
+ * Process a later link of a file, `set` has the digests of the first link. It
+ * is linked to the first link's copy instead of being read and copied again.
+ *
+ * @param linkpath  the first link's copy, NULL if it was not copied
+ * @param start     clock when processing of the file started
+ *
+ * @return          0 on success, -1 on failure, 1 if it must be processed as
+ *                  any other file
+ */
+static int process_link(file_t *newdir, const char *newpath,
+        const char *linkpath, const char *oldpath, const struct stat *oldst,
+        const char *dapath, const void *pathmd5, clock_t start,
+        const struct process_opts *opts);
+
+
+/**
+ * Process a file whose digests were cached in its xattr, it is only read if it
+ * must be copied.
+ *
+ * @param start     clock when processing of the file started
+ *
+ * @return          0 on success, -1 on failure
+ */
+static int process_cached(file_t *newdir, const char *newpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, clock_t start, const struct process_opts *opts);
+
+
+/**
+ * Send a processed file to the callback, unless it was copied and is to be
+ * verified, then it is queued with the verifier which reports it later. The
+ * digests are cached in an xattr first if asked to.
+ *
+ * @param set       the file's finalized digests
+ * @param ms        milliseconds spent processing the file
+ * @param cached    the digests came from the source's xattr
+ */
+static void report(dcp_state_t state, file_t *newdir, const char *newpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, digesterset_t *set, unsigned long ms, int cached,
+        const struct process_opts *opts);
 
 
 /* Public Impl ****************************************************************/
@@ -134,9 +340,22 @@ static ssize_t copy_n_digest(int dirfd, const char *pathname, uid_t uid,
 /*
  * Given a regular file do the following:
  *
- *      If index is not NULL
+ *      If only stat information is wanted
+ *          1. Report the file without opening it
+ *      else if the sources are chunk recipes
+ *          1. Rebuild the file from the chunk store
+ *      else if it is a later link of a file that has been processed
+ *          1. Link it to the first link's copy reusing its digests
+ *      else if its digests are cached in an xattr and it has not changed
+ *          1. Use them, the file is only read if it must be copied
+ *      else if the file is smaller than a single read request
+ *          1. Read the whole file into the cache and add it to the batch
+ *      else if index is not NULL or copies are deduped
  *          1. Digest the file caching it in memory if possible
- *          2. Look to see if the file is in the index, if not copy the file
+ *          2. Look to see if the file is in the index, if not copy the file,
+ *             if it is link it from the link dest if there is one
+ *          3. Link the copy to an identical one in the store or made
+ *             earlier instead of writing it, if there is one
  *      else
  *          1. Hash the file while copying it to the destination
  */
@@ -145,11 +364,15 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
         const struct process_opts *opts)
 {
     int ret;
+    int r;
     int s;
-    digesterset_t dgstset;
+    digesterset_t *dgstset;
     digest_t idxkeytype;
     ssize_t valid_len;
     struct stream datastream;
+    void *buf;
+    size_t blen;
+    char *linkpath;
 
     dcp_state_t state;
 
@@ -158,72 +381,163 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
 
     start = clock();
 
+    if (opts->mode == DCP_MODE_STAT)
+    {
+        opts->callback(DCP_PROFILED, pathmd5, dapath, oldst, oldpath, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                ((clock() - start) * 1000) / CLOCKS_PER_SEC,
+                opts->callback_ctx);
+        return 0;
+    }
+
+    if (opts->unchunk)
+        return process_unchunk(newdir, newpath, oldpath, oldst, dapath,
+                pathmd5, start, opts);
+
+    if (opts->links != NULL && oldst->st_nlink > 1 &&
+            links_find(opts->links, oldst, opts->dgstset, &linkpath) == 0)
+    {
+        ret = process_link(newdir, newpath, linkpath, oldpath, oldst, dapath,
+                pathmd5, start, opts);
+        free(linkpath);
+        if (ret != 1)
+            return ret;
+    }
+
+    if (opts->digest_xattr != DCP_XATTR_NONE &&
+            digest_xattr_get(oldpath, oldst, opts->dgstset) == 0)
+        return process_cached(newdir, newpath, oldpath, oldst, dapath,
+                pathmd5, start, opts);
+
     idxkeytype = opts->index == NULL? 0 : index_get_digest_type(opts->index);
 
     if ((s = open(oldpath, O_RDONLY)) == -1)
     {
         log_error("cannot open '%s'", oldpath);
         opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL, NULL,
-                NULL, NULL, NULL, -1, opts->callback_ctx);
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
         return -1;
     }
 
+    /* small files wait in the cache to be digested and written in a batch,
+     * unless a later link needs to find them right away */
+    if (opts->batch != NULL && oldst->st_size < (off_t) opts->buffer_size &&
+            (opts->links == NULL || oldst->st_nlink == 1))
+    {
+        switch (batch_add(newdir, newpath, oldpath, oldst, dapath, pathmd5, s,
+                start, opts))
+        {
+        case 0:
+            close(s);
+            return 0;
+
+        case -1:
+            log_debugx("cannot read '%s'", oldpath);
+            opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL,
+                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                    opts->callback_ctx);
+            close(s);
+            return -1;
+
+        /* could not be batched, process it like any other file */
+        default:
+            if (lseek(s, 0, SEEK_SET) == -1)
+            {
+                log_error("lseek '%s'", oldpath);
+                opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath,
+                        NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                        opts->callback_ctx);
+                close(s);
+                return -1;
+            }
+        }
+    }
+
     ret = 0;
 
-    /* ensure we create the hash needed for the and index */
-    digesterset_create(&dgstset, opts->digests | idxkeytype);
+    /* the set already has the hash needed for the index */
+    dgstset = opts->dgstset;
+    digesterset_reset(dgstset);
 
     /*
-     * there is no index to check against, just copy and digest at the same
-     * time
+     * there is no index or earlier copy to check against, just copy and digest
+     * at the same time, or only digest when profiling
      */
-    if (opts->index == NULL)
+    if (opts->index == NULL && opts->dedup == NULL && opts->store == -1)
     {
-        valid_len = copy_n_digest(newdir->fd, newpath, opts->uid, opts->gid,
-                &dgstset, s, opts->buffer, opts->buffer_size);
+        state = opts->mode == DCP_MODE_COPY? DCP_FILE_COPIED : DCP_PROFILED;
+        if (state == DCP_PROFILED)
+            valid_len = cache_n_digest(dgstset, s, opts->buffer,
+                    opts->buffer_size, opts->buffer_size);
+        else
+            valid_len = copy_n_digest(newdir, newpath, oldst, dgstset, s,
+                    opts);
+
+        /* kept as it would have been before the copy without --fresh */
+        if (valid_len == DEST_REFUSED)
+        {
+            ret = -1;
+            goto cleanup;
+        }
 
         if (valid_len < 0)
         {
             log_debugx("failed copying and hashing '%s'", oldpath);
             opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL,
-                    NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                    opts->callback_ctx);
             ret = -1;
             goto cleanup;
         }
 
-        digesterset_finalize(&dgstset);
+        digesterset_finalize(dgstset);
 
         /* calculate the number of milliseconds elapsed to process this file */
         diff = ((clock() - start) * 1000) / CLOCKS_PER_SEC;
 
         /* finally send the information to the file processor */
-        opts->callback(DCP_FILE_COPIED, pathmd5, dapath, oldst, oldpath, NULL,
-                digesterset_get_value(&dgstset, DGST_MD5),
-                digesterset_get_value(&dgstset, DGST_SHA1),
-                digesterset_get_value(&dgstset, DGST_SHA256),
-                digesterset_get_value(&dgstset, DGST_SHA512),
-                diff, opts->callback_ctx);
+        report(state, newdir, newpath, oldpath, oldst, dapath, pathmd5,
+                dgstset, diff, 0, opts);
         ret = 0;
     }
     else
     {
+        /*
+         * if the whole file fits in the cache use all of it, the batch must be
+         * flushed first since its files are stored there. Otherwise roll over
+         * the read buffer and reread the file for the copy
+         */
+        if (opts->mode == DCP_MODE_COPY && opts->cache != NULL &&
+                oldst->st_size <= (off_t) cache_capacity(opts->cache))
+        {
+            process_regular_flush(newdir, opts);
+            buf = cache_base(opts->cache);
+            blen = cache_capacity(opts->cache);
+        }
+        else
+        {
+            buf = opts->buffer;
+            blen = opts->buffer_size;
+        }
+
         /* read in the file and calculate the desired digests */
-        if ((valid_len = cache_n_digest(&dgstset, s, opts->buffer,
+        if ((valid_len = cache_n_digest(dgstset, s, buf, blen,
                 opts->buffer_size)) == -1)
         {
             log_debugx("cannot calculate hashes for '%s'", oldpath);
             opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL,
-                    NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                    opts->callback_ctx);
             ret = -1;
             goto cleanup;
         }
 
-        digesterset_finalize(&dgstset);
+        digesterset_finalize(dgstset);
 
         if (opts->index != NULL)
         {
             switch (index_lookup(opts->index, pathmd5,
-                    digesterset_get_value(&dgstset, idxkeytype)))
+                    digesterset_get_value(dgstset, idxkeytype)))
             {
             case INDEX_FAILED:
                 log_debugx("error looking up entry in file index");
@@ -232,11 +546,26 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
 
             /* we have seen this file, skip it */
             case INDEX_SUCCESS:
-                ret = 0;        /* set ret to success */
-                goto cleanup;
-
-            /* else continue with the copy */
-            case INDEX_NO_ENTRY: {}
+                if (process_seen(newdir, newpath, oldpath, oldst, dapath,
+                        pathmd5, dapath, DCP_LINK_CREATED, dgstset,
+                        ((clock() - start) * 1000) / CLOCKS_PER_SEC, 0,
+                        opts) == 0)
+                {
+                    ret = 0;    /* set ret to success */
+                    goto cleanup;
+                }
+                break;          /* it could not be linked, copy it */
+
+            /* else continue with the copy, unless it was only moved */
+            case INDEX_NO_ENTRY:
+                if (process_moved(newdir, newpath, oldpath, oldst, dapath,
+                        pathmd5, dgstset,
+                        ((clock() - start) * 1000) / CLOCKS_PER_SEC, 0,
+                        opts) == 0)
+                {
+                    ret = 0;
+                    goto cleanup;
+                }
             }
         }
 
@@ -245,117 +574,218 @@ int process_regular(file_t *newdir, const char *newpath, const char *oldpath,
          * we do not need to seek to the beginning of the fd and reread the
          * bytes
          */
-        if (valid_len == oldst->st_size)
+        r = 0;
+        if (opts->mode != DCP_MODE_COPY)
+            state = DCP_PROFILED;
+        else if (dedup(newdir, newpath, oldst, dgstset, opts) == 0)
+            state = DCP_LINK_CREATED;
+        else if (valid_len == oldst->st_size)
         {
-            datastream.bytes = opts->buffer;
+            datastream.bytes = buf;
             datastream.count = valid_len;
-            state = copy_mem(newdir->fd, newpath, &datastream, opts->uid,
-                    opts->gid);
+            r = copy_mem(newdir, newpath, oldst, &datastream, opts);
+            state = r == 0? DCP_FILE_COPIED : DCP_FAILED;
         }
         else
         {
             datastream.fd = s;
             datastream.bytes = opts->buffer;
             datastream.count = opts->buffer_size;
-            state = copy_fd(newdir->fd, newpath, &datastream, opts->uid,
-                    opts->gid);
+            r = copy_fd(newdir, newpath, oldst, &datastream, opts);
+            state = r == 0? DCP_FILE_COPIED : DCP_FAILED;
+        }
+
+        /* kept as it would have been before the copy without --fresh */
+        if (r == DEST_REFUSED)
+        {
+            ret = -1;
+            goto cleanup;
         }
 
         /* calculate the number of milliseconds elapsed to process this file */
         diff = ((clock() - start) * 1000) / CLOCKS_PER_SEC;
 
         /* finally send the information to the file processor */
-        opts->callback(state, pathmd5, dapath, oldst, oldpath, NULL,
-                digesterset_get_value(&dgstset, DGST_MD5),
-                digesterset_get_value(&dgstset, DGST_SHA1),
-                digesterset_get_value(&dgstset, DGST_SHA256),
-                digesterset_get_value(&dgstset, DGST_SHA512),
-                diff, opts->callback_ctx);
+        report(state, newdir, newpath, oldpath, oldst, dapath, pathmd5,
+                dgstset, diff, 0, opts);
 
         ret = (state == DCP_FAILED)? -1 : 0;
     }
 
     cleanup:
-        digesterset_free(&dgstset);
         close(s);
 
     return ret;
 }
 
 
-/* Private Impl ***************************************************************/
-
-
-int copy_fd(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
-        gid_t gid)
+int process_stream(file_t *newdir, const char *newpath, int fd,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        stream_check_f check, void *ctx, const struct process_opts *opts)
 {
+    digesterset_t *set;
+    dcp_state_t state;
+    clock_t start;
+    size_t want;
+    ssize_t n;
+    off_t left;
     int d;
 
-    /* ensure the fd is at beginning of file */
-    if (lseek(stream->fd, SEEK_SET, 0) == -1)
+    start = clock();
+    set = opts->dgstset;
+    digesterset_reset(set);
+
+    /* the bytes are read even if they cannot be written, the next item in
+     * the stream follows them */
+    d = -1;
+    state = opts->mode == DCP_MODE_COPY? DCP_FILE_COPIED : DCP_PROFILED;
+    if (state == DCP_FILE_COPIED &&
+            (d = dest_open(newdir, newpath, oldst, oldst->st_size, opts)) < 0)
+        state = DCP_FAILED;
+
+    for (left = oldst->st_size; left > 0; left -= n)
     {
-        log_debug("lseek");
-        return -1;
+        want = left < (off_t) opts->buffer_size? (size_t) left :
+                opts->buffer_size;
+        if ((n = fd_read_full(fd, opts->buffer, want)) != (ssize_t) want)
+            break;
+
+        if (opts->mode != DCP_MODE_STAT)
+            digesterset_update(set, opts->buffer, n);
+        if (state == DCP_FILE_COPIED && dest_write(d, opts->buffer, n, opts)
+                != 0)
+            state = DCP_FAILED;
     }
 
-    /* create/truncate the dest file and copy all the bytes */
-    if ((d = openat(dirfd, pathname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+    if (left != 0)
     {
-        log_debug("openat '%s'", pathname);
-        return -1;
+        log_errorx("the stream ends inside '%s'", newpath);
+        state = DCP_FAILED;
     }
 
-    /* copy all bytes from `fd` to `d` using `bytes` as a buffer to read to */
-    if (fd_pipe(d, stream->fd, stream->bytes, stream->count) == -1)
+    if (d >= 0 && dest_close(d, newpath, oldst, state == DCP_FAILED, opts)
+            != 0)
+        state = DCP_FAILED;
+
+    /* a member kept out by what is in the way is not reported */
+    if (state == DCP_FAILED)
     {
-        close(d);
-        log_debug("fd_pipe");
-        return -1;
+        if (d != DEST_REFUSED)
+            opts->callback(DCP_FAILED, pathmd5, dapath, oldst, NULL, NULL,
+                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                    opts->callback_ctx);
+        return left == 0? 0 : -1;
     }
 
-    if (fchown(d, uid, gid) == -1)
-        log_debug("fchown");
-
-    /* do not report success here because there can be data loss */
-    if (close(d) == -1)
+    /* a copy that is not what was sent is not left to pass for one */
+    digesterset_finalize(set);
+    if (check != NULL && check(set, ctx) != 0)
     {
-        log_debug("close");
-        return -1;
+        if (d != -1 && opts->archive == NULL)
+        {
+            if (unlinkat(newdir->fd, newpath, 0) != 0)
+                log_error("cannot remove '%s'", pathstr(newdir, newpath));
+            else
+                metadata_drop(opts->metadata, newpath);
+        }
+        state = DCP_VERIFY_FAILED;
     }
+
+    report(state, newdir, newpath, NULL, oldst, dapath, pathmd5, set,
+            ((clock() - start) * 1000) / CLOCKS_PER_SEC, 0, opts);
     return 0;
 }
 
 
-int copy_mem(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
-        gid_t gid)
+int process_regular_flush(file_t *newdir, const struct process_opts *opts)
 {
-    int d;
+    int ret;
+    size_t i;
+    struct batch *batch;
 
-    /* create/truncate the dest file and copy all the bytes */
-    if ((d = openat(dirfd, pathname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
-    {
-        log_debug("openat '%s'", pathname);
-        return -1;
-    }
+    if ((batch = opts->batch) == NULL)
+        return 0;
+
+    batch_digest(batch, opts->digests | (opts->index == NULL? 0 :
+            index_get_digest_type(opts->index)));
 
-    /* write all the bytes */
-    if (fd_write_full(d, stream->bytes, stream->count) == -1)
+    ret = 0;
+    for (i = 0; i < batch->count; i++)
     {
-        log_debug("fd_write");
-        close(d);
-        return -1;
+        if (batch_deliver(newdir, &batch->files[i], opts) != 0)
+            ret = -1;
+
+        free(batch->files[i].newpath);
+        free(batch->files[i].oldpath);
+        free(batch->files[i].dapath);
     }
 
-    if (fchown(d, uid, gid) == -1)
-        log_debug("fchown");
+    batch->count = 0;
+    cache_reset(opts->cache);
+    return ret;
+}
+
+
+struct batch *batch_create(void)
+{
+    struct batch *batch;
+
+    /* the digester sets hold over aligned XXH3 states */
+    if (posix_memalign((void **) &batch, __alignof__(struct batch),
+            sizeof(*batch)) != 0)
+        return NULL;
+    batch->count = 0;
+    return batch;
+}
+
+
+void batch_free(struct batch *batch)
+{
+    if (batch != NULL)
+        free(batch);
+}
+
 
-    /* do not report success here because there can be data loss */
-    if (close(d) == -1)
+/* Private Impl ***************************************************************/
+
+
+int copy_fd(file_t *newdir, const char *newpath, const struct stat *oldst,
+        struct stream *stream, const struct process_opts *opts)
+{
+    ssize_t n;
+    int d;
+
+    /* ensure the fd is at beginning of file */
+    if (lseek(stream->fd, SEEK_SET, 0) == -1)
     {
-        log_error("closing '%s' failed, possible data loss", pathname);
+        log_debug("lseek");
         return -1;
     }
-    return 0;
+
+    /* create/truncate the dest file and copy all the bytes */
+    if ((d = dest_open(newdir, newpath, oldst, oldst->st_size, opts)) < 0)
+        return d;
+
+    /* copy all bytes from `fd` to `d` using `bytes` as a buffer to read to */
+    while ((n = fd_read(stream->fd, stream->bytes, stream->count)) > 0 &&
+            dest_write(d, stream->bytes, n, opts) == 0)
+        ;
+
+    return dest_close(d, newpath, oldst, n != 0, opts);
+}
+
+
+int copy_mem(file_t *newdir, const char *newpath, const struct stat *oldst,
+        struct stream *stream, const struct process_opts *opts)
+{
+    int d;
+
+    /* create/truncate the dest file and write all the bytes */
+    if ((d = dest_open(newdir, newpath, oldst, stream->count, opts)) < 0)
+        return d;
+
+    return dest_close(d, newpath, oldst,
+            dest_write(d, stream->bytes, stream->count, opts) != 0, opts);
 }
 
 
@@ -370,10 +800,12 @@ int copy_mem(int dirfd, const char *pathname, struct stream *stream, uid_t uid,
  * the whole file into the buffer allowing it to be used later on instead of
  * needing to be reread from the kernel.
  */
-ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf, size_t blen)
+ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf, size_t blen,
+        size_t chunk)
 {
     ssize_t result;
     size_t total;
+    size_t len;
     unsigned char *pos;
 
     /* causes the kernel to double its read ahead buffer for this file */
@@ -386,8 +818,11 @@ ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf, size_t blen)
         if (blen == total)
             total = 0;
 
+        /* never ask the kernel for more than a chunk at a time */
+        len = blen - total < chunk? blen - total : chunk;
+
         pos = ((unsigned char *) buf) + total;
-        result = fd_read(fd, pos, blen - total);
+        result = fd_read(fd, pos, len);
 
         if (result < 0)     return -1;
         if (result == 0)    break;
@@ -400,9 +835,11 @@ ssize_t cache_n_digest(digesterset_t *set, int fd, void *buf, size_t blen)
 }
 
 
-ssize_t copy_n_digest(int dirfd, const char *pathname, uid_t uid, gid_t gid,
-        digesterset_t *set, int fd, void *buf, size_t blen)
+ssize_t copy_n_digest(file_t *newdir, const char *newpath,
+        const struct stat *oldst, digesterset_t *set, int fd,
+        const struct process_opts *opts)
 {
+    struct chunker *chunker;
     ssize_t result;
     size_t total;
     int d;
@@ -411,44 +848,604 @@ ssize_t copy_n_digest(int dirfd, const char *pathname, uid_t uid, gid_t gid,
     posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
     /* create/truncate the dest file and copy all the bytes */
-    if ((d = openat(dirfd, pathname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
-    {
-        log_debug("openat '%s'", pathname);
-        return -1;
-    }
+    if ((d = dest_open(newdir, newpath, oldst, oldst->st_size, opts)) < 0)
+        return d;
+
+    if ((chunker = opts->chunker) != NULL)
+        chunker_reset(chunker);
 
     total = 0;
     for (;;)
     {
-        result = fd_read(fd, buf, blen);
+        result = fd_read(fd, opts->buffer, opts->buffer_size);
 
-        if (result < 0)     return -1;
+        if (result < 0)     break;
         if (result == 0)    break;
 
         /* update the digests */
-        digesterset_update(set, buf, result);
+        digesterset_update(set, opts->buffer, result);
+
+        /* write all the bytes, or the chunks not stored yet */
+        if (chunker != NULL?
+                chunker_update(chunker, opts->buffer, result) == -1 :
+                dest_write(d, opts->buffer, result, opts) != 0)
+            break;
+
+        total += result;
+    }
+
+    /* the copy is the list of chunks */
+    if (result == 0 && chunker != NULL && chunker_finish(chunker, d) == -1)
+        result = -1;
+
+    if (dest_close(d, newpath, oldst, result != 0, opts) != 0)
+        return -1;
+    return total;
+}
 
-        /* write all the bytes */
-        if (fd_write_full(d, buf, result) == -1)
+
+int batch_add(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        int fd, clock_t start, const struct process_opts *opts)
+{
+    struct batch *batch;
+    struct pending *file;
+    void *pos;
+    size_t want;
+    ssize_t count;
+
+    batch = opts->batch;
+
+    /* ask for one more byte than stat reported to detect a file that grew */
+    want = oldst->st_size + 1;
+    if (want > cache_capacity(opts->cache))
+        return 1;
+
+    if (batch->count == BATCH_MAX_FILES ||
+            (pos = cache_reserve(opts->cache, want)) == NULL)
+    {
+        process_regular_flush(newdir, opts);
+        pos = cache_reserve(opts->cache, want);
+    }
+
+    if ((count = fd_read_full(fd, pos, want)) == -1)
+        return -1;
+
+    /* file grew since it was stat'ed, it will not fit in a single request */
+    if ((size_t) count == want)
+        return 1;
+
+    /* without its names it cannot wait, it is copied on its own */
+    file = &batch->files[batch->count];
+    file->newpath = strdup(newpath);
+    file->oldpath = strdup(oldpath);
+    file->dapath  = strdup(dapath);
+    if (file->newpath == NULL || file->oldpath == NULL ||
+            file->dapath == NULL)
+    {
+        log_error("cannot batch '%s'", oldpath);
+        free(file->newpath);
+        free(file->oldpath);
+        free(file->dapath);
+        return 1;
+    }
+
+    cache_commit(opts->cache, count);
+    batch->count++;
+    memcpy(file->pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+    memcpy(&file->st, oldst, sizeof(file->st));
+    file->bytes = pos;
+    file->count = count;
+    file->ticks = clock() - start;
+    return 0;
+}
+
+
+void batch_digest(struct batch *batch, int mask)
+{
+    digesterset_t *sets[BATCH_DIGEST_CHUNK];
+    const void *data[BATCH_DIGEST_CHUNK];
+    size_t lens[BATCH_DIGEST_CHUNK];
+    size_t i, j, n;
+    clock_t start, share;
+
+    for (i = 0; i < batch->count; i += n)
+    {
+        start = clock();
+
+        n = batch->count - i < BATCH_DIGEST_CHUNK?
+                batch->count - i : BATCH_DIGEST_CHUNK;
+        for (j = 0; j < n; j++)
         {
-            log_debug("fd_write");
-            close(d);
+            sets[j] = &batch->files[i + j].dgstset;
+            data[j] = batch->files[i + j].bytes;
+            lens[j] = batch->files[i + j].count;
+            digesterset_create(sets[j], mask);
+        }
+        digesterset_digest_many(sets, data, lens, n);
+
+        /* share the time spent hashing between the files */
+        share = (clock() - start) / n;
+        for (j = 0; j < n; j++)
+            batch->files[i + j].ticks += share;
+    }
+}
+
+
+int batch_deliver(file_t *newdir, struct pending *file,
+        const struct process_opts *opts)
+{
+    digesterset_t *dgstset;
+    digest_t idxkeytype;
+    struct stream datastream;
+    dcp_state_t state;
+    clock_t start;
+    unsigned long diff;
+    int r;
+
+    start = clock();
+
+    idxkeytype = opts->index == NULL? 0 : index_get_digest_type(opts->index);
+
+    dgstset = &file->dgstset;
+
+    if (opts->index != NULL)
+    {
+        switch (index_lookup(opts->index, file->pathmd5,
+                digesterset_get_value(dgstset, idxkeytype)))
+        {
+        case INDEX_FAILED:
+            log_debugx("error looking up entry in file index");
+            digesterset_free(dgstset);
             return -1;
+
+        /* we have seen this file, skip it */
+        case INDEX_SUCCESS:
+            if (process_seen(newdir, file->newpath, file->oldpath, &file->st,
+                    file->dapath, file->pathmd5, file->dapath,
+                    DCP_LINK_CREATED, dgstset,
+                    ((clock() - start + file->ticks) * 1000) / CLOCKS_PER_SEC,
+                    0, opts) == 0)
+            {
+                digesterset_free(dgstset);
+                return 0;
+            }
+            break;
+
+        /* else continue with the copy, unless it was only moved */
+        case INDEX_NO_ENTRY:
+            if (process_moved(newdir, file->newpath, file->oldpath, &file->st,
+                    file->dapath, file->pathmd5, dgstset,
+                    ((clock() - start + file->ticks) * 1000) / CLOCKS_PER_SEC,
+                    0, opts) == 0)
+            {
+                digesterset_free(dgstset);
+                return 0;
+            }
         }
+    }
 
-        total += result;
+    datastream.bytes = file->bytes;
+    datastream.count = file->count;
+    if (opts->mode != DCP_MODE_COPY)
+        state = DCP_PROFILED;
+    else if (dedup(newdir, file->newpath, &file->st, dgstset, opts) == 0)
+        state = DCP_LINK_CREATED;
+    else if ((r = copy_mem(newdir, file->newpath, &file->st, &datastream,
+            opts)) == DEST_REFUSED)
+    {
+        /* kept as it would have been before the copy without --fresh */
+        digesterset_free(dgstset);
+        return -1;
     }
+    else
+        state = r == 0? DCP_FILE_COPIED : DCP_FAILED;
+
+    /* calculate the number of milliseconds spent reading and writing */
+    diff = ((clock() - start + file->ticks) * 1000) / CLOCKS_PER_SEC;
+
+    report(state, newdir, file->newpath, file->oldpath, &file->st,
+            file->dapath, file->pathmd5, dgstset, diff, 0, opts);
+
+    digesterset_free(dgstset);
+    return state == DCP_FAILED? -1 : 0;
+}
 
-    if (fchown(d, uid, gid) == -1)
-        log_debug("fchown");
 
-    /* do not report success here because there can be data loss */
-    if (close(d) == -1)
+int link_dest(file_t *newdir, const char *newpath, const char *dapath,
+        const struct stat *oldst, const struct process_opts *opts)
+{
+    struct stat prev;
+    const char *rel;
+
+    /* dapath is relative to the root of the previous destination */
+    rel = dapath + strspn(dapath, "/");
+
+    if (fstatat(opts->linkdest, rel, &prev, AT_SYMLINK_NOFOLLOW) != 0 ||
+            !S_ISREG(prev.st_mode) || prev.st_size != oldst->st_size)
     {
-        log_error("closing '%s' failed, possible data loss", pathname);
+        log_debugx("no copy of '%s' in the link dest", dapath);
         return -1;
     }
 
-    return total;
+    /* too many links or another file system, share its blocks instead */
+    if (linkat(opts->linkdest, rel, newdir->fd, newpath, 0) != 0 &&
+            clone_at(opts->linkdest, rel, newdir->fd, newpath, oldst, opts)
+            != 0)
+    {
+        log_debug("cannot link '%s' from the link dest", dapath);
+        return -1;
+    }
+    return 0;
+}
+
+
+int clone_at(int olddirfd, const char *oldpath, int newdirfd,
+        const char *newpath, const struct stat *oldst,
+        const struct process_opts *opts)
+{
+    int r;
+#ifdef FICLONE
+    int s, d;
+
+    if ((s = openat(olddirfd, oldpath, O_RDONLY)) == -1)
+        return -1;
+    if ((d = openat(newdirfd, newpath, O_WRONLY | O_CREAT | O_TRUNC,
+            0666)) == -1)
+    {
+        close(s);
+        return -1;
+    }
+
+    r = ioctl(d, FICLONE, s);
+    if (close(d) != 0)
+        r = -1;
+    if (r != 0)
+        unlinkat(newdirfd, newpath, 0);
+    else
+        r = metadata_add(opts->metadata, newpath, oldst, 0);
+    close(s);
+#else
+    (void) olddirfd;
+    (void) oldpath;
+    (void) newdirfd;
+    (void) newpath;
+    (void) oldst;
+    (void) opts;
+    errno = EOPNOTSUPP;
+    r = -1;
+#endif
+    return r;
+}
+
+
+int dedup(file_t *newdir, const char *newpath, const struct stat *oldst,
+        digesterset_t *set, const struct process_opts *opts)
+{
+    char prevpath[PATH_MAX];
+    int r;
+
+    /* the store holds every copy made with it, run or not */
+    if (opts->store != -1 && store_link(opts->store, opts->store_type, set,
+            oldst->st_size, newdir->fd, newpath) == 0)
+        return 0;
+
+    if (opts->dedup == NULL || *opts->undeduped ||
+            index_lookup_content(opts->dedup, digesterset_get_value(set,
+            index_get_digest_type(opts->dedup)), oldst->st_size, prevpath,
+            sizeof(prevpath)) != INDEX_SUCCESS)
+        return -1;
+
+    if (opts->dedup_policy == DCP_DEDUP_HARDLINK)
+        r = linkat(newdir->fd, prevpath, newdir->fd, newpath, 0);
+    else
+        r = clone_at(newdir->fd, prevpath, newdir->fd, newpath, oldst, opts);
+
+    /* the file system cannot share them, this and every later file is
+     * written in full without trying again */
+    if (r != 0 && (errno == EOPNOTSUPP || errno == EXDEV || errno == EINVAL ||
+            errno == EPERM))
+    {
+        log_debug("cannot dedup '%s', writing copies in full", newpath);
+        *opts->undeduped = 1;
+    }
+    else if (r != 0)
+        log_debug("cannot link '%s' to identical '%s'", newpath, prevpath);
+    return r;
 }
 
+
+int process_seen(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        const char *prevpath, dcp_state_t state, digesterset_t *set,
+        unsigned long ms, int cached, const struct process_opts *opts)
+{
+    if (opts->digest_xattr == DCP_XATTR_SOURCE && !cached)
+        digest_xattr_put(AT_FDCWD, oldpath, oldst, set);
+
+    /* nothing is created, a move is still recorded with where it went */
+    if (opts->linkdest == -1)
+    {
+        if (opts->links != NULL && oldst->st_nlink > 1)
+            links_add(opts->links, oldst, NULL, set);
+        if (state == DCP_FILE_MOVED)
+            report(state, newdir, newpath, oldpath, oldst, dapath, pathmd5,
+                    set, ms, 1, opts);
+        return 0;
+    }
+
+    if (link_dest(newdir, newpath, prevpath, oldst, opts) != 0)
+        return 1;
+
+    /* later links of the file can link to this one */
+    if (opts->links != NULL && oldst->st_nlink > 1)
+        links_add(opts->links, oldst, newpath, set);
+
+    report(state, newdir, newpath, oldpath, oldst, dapath, pathmd5, set, ms, 1,
+            opts);
+    return 0;
+}
+
+
+int process_moved(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        digesterset_t *set, unsigned long ms, int cached,
+        const struct process_opts *opts)
+{
+    char prevpath[PATH_MAX];
+
+    switch (index_lookup_content(opts->index, digesterset_get_value(set,
+            index_get_digest_type(opts->index)), oldst->st_size, prevpath,
+            sizeof(prevpath)))
+    {
+    case INDEX_FAILED:
+        log_debugx("error looking up content in file index");
+        return 1;
+
+    case INDEX_NO_ENTRY:
+        return 1;
+
+    case INDEX_SUCCESS: {}
+    }
+
+    return process_seen(newdir, newpath, oldpath, oldst, dapath, pathmd5,
+            prevpath, DCP_FILE_MOVED, set, ms, cached, opts);
+}
+
+
+int process_link(file_t *newdir, const char *newpath, const char *linkpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, clock_t start, const struct process_opts *opts)
+{
+    dcp_state_t state;
+    int r;
+
+    if (opts->index != NULL)
+    {
+        switch (index_lookup(opts->index, pathmd5, digesterset_get_value(
+                opts->dgstset, index_get_digest_type(opts->index))))
+        {
+        case INDEX_FAILED:
+            log_debugx("error looking up entry in file index");
+            return -1;
+
+        /* we have seen this file, skip it without reading a byte */
+        case INDEX_SUCCESS:
+            if (process_seen(newdir, newpath, oldpath, oldst, dapath, pathmd5,
+                    dapath, DCP_LINK_CREATED, opts->dgstset,
+                    ((clock() - start) * 1000) / CLOCKS_PER_SEC, 1, opts) == 0)
+                return 0;
+            break;
+
+        /* else continue with the link, the first link's copy is closer */
+        case INDEX_NO_ENTRY: {}
+        }
+    }
+
+    if (opts->mode == DCP_MODE_COPY)
+    {
+        /* the first link was not copied, this one is copied in its place */
+        if (linkpath == NULL)
+            return 1;
+
+        /* too many links for the destination, or it does not link at all.
+         * What is in the way and kept is not copied over either */
+        if ((r = dest_create(newdir, newpath, linkpath, oldst, opts)) != 0)
+            return r == DEST_REFUSED? -1 : 1;
+        state = DCP_LINK_CREATED;
+
+        if (opts->fanout != NULL)
+            fanout_create_item(opts->fanout, newpath, linkpath, dapath,
+                    pathmd5, oldst);
+    }
+    else
+        state = DCP_PROFILED;
+
+    report(state, newdir, newpath, oldpath, oldst, dapath, pathmd5,
+            opts->dgstset, ((clock() - start) * 1000) / CLOCKS_PER_SEC, 1,
+            opts);
+    return 0;
+}
+
+
+int process_cached(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        clock_t start, const struct process_opts *opts)
+{
+    struct stream datastream;
+    dcp_state_t state;
+    int s;
+    int r;
+
+    if (opts->index != NULL)
+    {
+        switch (index_lookup(opts->index, pathmd5, digesterset_get_value(
+                opts->dgstset, index_get_digest_type(opts->index))))
+        {
+        case INDEX_FAILED:
+            log_debugx("error looking up entry in file index");
+            return -1;
+
+        /* we have seen this file, skip it without reading a byte */
+        case INDEX_SUCCESS:
+            if (process_seen(newdir, newpath, oldpath, oldst, dapath, pathmd5,
+                    dapath, DCP_LINK_CREATED, opts->dgstset,
+                    ((clock() - start) * 1000) / CLOCKS_PER_SEC, 1, opts) == 0)
+                return 0;
+            break;
+
+        /* else continue with the copy, unless it was only moved */
+        case INDEX_NO_ENTRY:
+            if (process_moved(newdir, newpath, oldpath, oldst, dapath, pathmd5,
+                    opts->dgstset, ((clock() - start) * 1000) / CLOCKS_PER_SEC,
+                    1, opts) == 0)
+                return 0;
+        }
+    }
+
+    state = DCP_PROFILED;
+    if (opts->mode == DCP_MODE_COPY &&
+            dedup(newdir, newpath, oldst, opts->dgstset, opts) == 0)
+        state = DCP_LINK_CREATED;
+    else if (opts->mode == DCP_MODE_COPY)
+    {
+        if ((s = open(oldpath, O_RDONLY)) == -1)
+        {
+            log_error("cannot open '%s'", oldpath);
+            opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL,
+                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                    opts->callback_ctx);
+            return -1;
+        }
+
+        /* nothing to hash, the bytes only pass through the buffer */
+        datastream.fd = s;
+        datastream.bytes = opts->buffer;
+        datastream.count = opts->buffer_size;
+        r = copy_fd(newdir, newpath, oldst, &datastream, opts);
+        close(s);
+
+        /* kept as it would have been before the copy without --fresh */
+        if (r == DEST_REFUSED)
+            return -1;
+        state = r == 0? DCP_FILE_COPIED : DCP_FAILED;
+    }
+
+    report(state, newdir, newpath, oldpath, oldst, dapath, pathmd5,
+            opts->dgstset, ((clock() - start) * 1000) / CLOCKS_PER_SEC, 1,
+            opts);
+    return state == DCP_FAILED? -1 : 0;
+}
+
+
+int process_unchunk(file_t *newdir, const char *newpath, const char *oldpath,
+        const struct stat *oldst, const char *dapath, const void *pathmd5,
+        clock_t start, const struct process_opts *opts)
+{
+    struct stat st;
+    FILE *recipe;
+    ssize_t size;
+    int d;
+
+    digesterset_reset(opts->dgstset);
+
+    if ((recipe = fopen(oldpath, "r")) == NULL)
+    {
+        log_error("cannot open '%s'", oldpath);
+        opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+        return -1;
+    }
+
+    size = -1;
+    if ((d = openat(newdir->fd, newpath, O_WRONLY | O_CREAT | O_TRUNC, 0666))
+            == -1)
+        log_debug("openat '%s'", newpath);
+    else
+    {
+        if ((size = chunks_restore(opts->chunker, recipe, d, opts->dgstset))
+                == -1)
+            log_errorx("cannot restore '%s'", oldpath);
+        if (close(d) == -1)
+        {
+            log_error("closing '%s' failed, possible data loss", newpath);
+            size = -1;
+        }
+
+        /* a file missing chunks is not left looking restored */
+        if (size == -1)
+            unlinkat(newdir->fd, newpath, 0);
+        else if (metadata_add(opts->metadata, newpath, oldst, 0) != 0)
+            size = -1;
+    }
+    fclose(recipe);
+
+    if (size == -1)
+    {
+        opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+        return -1;
+    }
+
+    /* the entry is for the file that was cut, not its recipe */
+    digesterset_finalize(opts->dgstset);
+    st = *oldst;
+    st.st_size = size;
+    report(DCP_FILE_COPIED, newdir, newpath, oldpath, &st, dapath, pathmd5,
+            opts->dgstset, ((clock() - start) * 1000) / CLOCKS_PER_SEC, 0,
+            opts);
+    return 0;
+}
+
+
+void report(dcp_state_t state, file_t *newdir, const char *newpath,
+        const char *oldpath, const struct stat *oldst, const char *dapath,
+        const void *pathmd5, digesterset_t *set, unsigned long ms, int cached,
+        const struct process_opts *opts)
+{
+    /* later links of the file will use these digests and copy */
+    if (opts->links != NULL && oldst->st_nlink > 1 &&
+            (state == DCP_FILE_COPIED || state == DCP_PROFILED ||
+            (state == DCP_LINK_CREATED && !cached)))
+        links_add(opts->links, oldst, state == DCP_PROFILED? NULL : newpath,
+                set);
+
+    /* later files with the same content will link to this copy */
+    if (opts->store != -1 && state == DCP_FILE_COPIED)
+        store_add(opts->store, opts->store_type, set, newdir->fd, newpath);
+    if (opts->dedup != NULL && state == DCP_FILE_COPIED &&
+            index_insert_content(opts->dedup, digesterset_get_value(set,
+            index_get_digest_type(opts->dedup)), oldst->st_size,
+            newpath) != INDEX_SUCCESS)
+        log_debugx("cannot remember the content of '%s'", newpath);
+
+    /* a copy is given its digests even if they were cached on its source */
+    if (opts->digest_xattr == DCP_XATTR_DEST && state == DCP_FILE_COPIED)
+        digest_xattr_put(newdir->fd, newpath, NULL, set);
+    else if (opts->digest_xattr == DCP_XATTR_SOURCE && !cached &&
+            state != DCP_FAILED)
+        digest_xattr_put(AT_FDCWD, oldpath, oldst, set);
+
+    /* the receiving end checks its copy against these */
+    if (opts->archive != NULL && state == DCP_FILE_COPIED)
+        archive_sums(opts->archive, set);
+
+    /* the other destinations' copies are reported once they are written */
+    if (opts->fanout != NULL && state == DCP_FILE_COPIED)
+        fanout_close(opts->fanout, newpath, dapath, pathmd5, oldst);
+
+    if (state == DCP_FILE_COPIED && opts->verifier != NULL &&
+            verifier_submit(opts->verifier, newdir, newpath, oldpath, oldst,
+            dapath, pathmd5, set, ms) == 0)
+        return;
+
+    opts->callback(state, pathmd5, dapath, oldst, oldpath, NULL,
+            digesterset_get_value(set, DGST_MD5),
+            digesterset_get_value(set, DGST_SHA1),
+            digesterset_get_value(set, DGST_SHA256),
+            digesterset_get_value(set, DGST_SHA512),
+            digesterset_get_value(set, DGST_XXH3),
+            digesterset_get_value(set, DGST_CRC32C),
+            digesterset_get_value(set, DGST_BLAKE3),
+            ms, opts->callback_ctx);
+}
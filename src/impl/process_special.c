@@ -29,19 +29,27 @@ int process_special(file_t *newdir, const char *newpath, const char *oldpath,
     int r;
     dcp_state_t state;
 
-    state = DCP_SPECIAL_CREATED;
-    if ((r = mknodat(newdir->fd, newpath,
-            (oldst->st_mode & S_IFMT) | 0666, oldst->st_rdev)) != 0)
+    /* nothing to create when only profiling */
+    if (opts->mode != DCP_MODE_COPY)
     {
-        log_error("cannot create special file '%s'", pathstr(newdir, newpath));
-        state = DCP_FAILED;
+        opts->callback(DCP_PROFILED, pathmd5, dapath, oldst, oldpath, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                opts->callback_ctx);
+        return 0;
     }
 
-    if (r == 0 && fchownat(newdir->fd, newpath, opts->uid, opts->gid, 0) != 0)
-        log_warn("cannot chown '%s'", pathstr(newdir, newpath));
+    state = DCP_SPECIAL_CREATED;
+    if ((r = dest_create(newdir, newpath, NULL, oldst, opts)) == DEST_REFUSED)
+        return -1;
+    if (r != 0)
+        state = DCP_FAILED;
+
+    if (r == 0 && opts->fanout != NULL)
+        fanout_create_item(opts->fanout, newpath, NULL, dapath, pathmd5,
+                oldst);
 
-    opts->callback(state, pathmd5, dapath, oldst, oldpath, NULL, NULL, NULL, NULL, NULL, -1,
-            opts->callback_ctx);
+    opts->callback(state, pathmd5, dapath, oldst, oldpath, NULL, NULL, NULL, NULL, NULL, NULL,
+            NULL, NULL, -1, opts->callback_ctx);
     return r;
 }
 
@@ -31,7 +31,6 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
     int r;
     void *buf;
     size_t bufsize;
-    dcp_state_t state;
 
     /* ensure the buffer is large enough */
     if (oldst->st_size < (off_t) (opts->buffer_size + 1))
@@ -45,37 +44,18 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
         bufsize = opts->buffer_size;
     }
 
-    state = DCP_SYMLINK_CREATED;
     if ((r = readlink(oldpath, buf, bufsize)) == -1)
     {
-        state = DCP_FAILED;
         log_error("cannot read symlink '%s'", oldpath);
+        opts->callback(DCP_FAILED, pathmd5, dapath, oldst, oldpath, NULL, NULL,
+                NULL, NULL, NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
     }
     else
     {
-        /* create the symlink, unlinking an existing file if it exists */
-        while ((r = symlinkat(buf, newdir->fd, newpath)) == -1)
-        {
-            if (errno == EEXIST)
-            {
-                if ((r = unlinkat(newdir->fd, newpath, 0)) == -1)
-                {
-                    state = DCP_FAILED;
-                    log_error("cannot unlink '%s'", pathstr(newdir, newpath));
-                    break;
-                }
-            }
-            else
-            {
-                state = DCP_FAILED;
-                log_error("cannot create symlink '%s'",
-                        pathstr(newdir, newpath));
-                break;
-            }
-        }
+        ((char *) buf)[(size_t) r < bufsize? (size_t) r : bufsize - 1] = '\0';
+        r = process_symlink_target(newdir, newpath, buf, oldpath, oldst,
+                dapath, pathmd5, opts);
     }
-    opts->callback(state, pathmd5, dapath, oldst, oldpath, buf, NULL, NULL, NULL, NULL, -1,
-            opts->callback_ctx);
 
     /* if we allocated a new buffer free it */
     if (buf != opts->buffer)
@@ -84,3 +64,29 @@ int process_symlink(file_t *newdir, const char *newpath, const char *oldpath,
     return r;
 }
 
+
+int process_symlink_target(file_t *newdir, const char *newpath,
+        const char *target, const char *oldpath, const struct stat *oldst,
+        const char *dapath, const void *pathmd5,
+        const struct process_opts *opts)
+{
+    dcp_state_t state;
+    int r;
+
+    r = 0;
+    state = DCP_SYMLINK_CREATED;
+    if (opts->mode != DCP_MODE_COPY)
+        state = DCP_PROFILED;
+    else if ((r = dest_create(newdir, newpath, target, oldst, opts)) ==
+            DEST_REFUSED)
+        return -1;
+    else if (r != 0)
+        state = DCP_FAILED;
+    else if (opts->fanout != NULL)
+        fanout_create_item(opts->fanout, newpath, target, dapath, pathmd5,
+                oldst);
+
+    opts->callback(state, pathmd5, dapath, oldst, oldpath, target, NULL, NULL,
+            NULL, NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+    return r;
+}
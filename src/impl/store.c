@@ -0,0 +1,161 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the content-addressed store from process.h. Every unique
+ * file body is kept once as
+ *
+ *      STORE/DIGEST/ab/cdef...
+ *
+ * where DIGEST is the name of the digest the store is keyed by, one no source
+ * can make two bodies share since only the size is checked when a copy is
+ * linked, and ab/cdef... is the file's digest in hex, split after the first
+ * byte so no directory grows too large. Objects are hard links to the first copy written with that
+ * content, and every later copy is a hard link to the object, so the store
+ * and the trees copied into it hold each body once however many snapshots
+ * share it.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../io/pack.h"
+#include "../logging.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * # of hex digits of the digest that name the object's directory
+ */
+#define STORE_FANOUT 2
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Write the object path of the digest of type `type` in `set` to `obj`, "ab"
+ * and "ab/cdef..." with the slash at obj[STORE_FANOUT].
+ *
+ * @param obj       at least 2 * MAX_DIGEST_LENGTH + 2 bytes
+ *
+ * @return          0 on success, -1 if `set` does not have the digest
+ */
+static int object_path(char *obj, digest_t type, digesterset_t *set);
+
+
+/* Public Impl ****************************************************************/
+
+
+int store_open(const char *path, digest_t type)
+{
+    int root;
+    int fd;
+
+    if (mkdir(path, 0777) != 0 && errno != EEXIST)
+    {
+        log_error("cannot create store '%s'", path);
+        return -1;
+    }
+
+    if ((root = open(path, O_RDONLY | O_DIRECTORY)) == -1)
+    {
+        log_error("cannot open store '%s'", path);
+        return -1;
+    }
+
+    /* a store can hold objects keyed by more than one digest side by side */
+    if ((mkdirat(root, digest_name(type), 0777) != 0 && errno != EEXIST) ||
+            (fd = openat(root, digest_name(type), O_RDONLY | O_DIRECTORY))
+            == -1)
+    {
+        log_error("cannot open '%s' in store '%s'", digest_name(type), path);
+        close(root);
+        return -1;
+    }
+
+    close(root);
+    return fd;
+}
+
+
+int store_link(int store, digest_t type, digesterset_t *set, off_t size,
+        int dirfd, const char *newpath)
+{
+    char obj[2 * MAX_DIGEST_LENGTH + 2];
+    struct stat st;
+
+    if (object_path(obj, type, set) != 0 ||
+            fstatat(store, obj, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        return -1;
+
+    /* an object that is not the file cannot be used, it is replaced */
+    if (!S_ISREG(st.st_mode) || st.st_size != size)
+    {
+        log_errorx("store object '%s' is damaged, replacing it", obj);
+        unlinkat(store, obj, 0);
+        return -1;
+    }
+
+    if (linkat(store, obj, dirfd, newpath, 0) != 0)
+    {
+        log_debug("cannot link '%s' to store object '%s'", newpath, obj);
+        return -1;
+    }
+    return 0;
+}
+
+
+int store_add(int store, digest_t type, digesterset_t *set, int dirfd,
+        const char *newpath)
+{
+    char obj[2 * MAX_DIGEST_LENGTH + 2];
+
+    if (object_path(obj, type, set) != 0)
+        return -1;
+
+    obj[STORE_FANOUT] = '\0';
+    if (mkdirat(store, obj, 0777) != 0 && errno != EEXIST)
+    {
+        log_error("cannot create store directory '%s'", obj);
+        return -1;
+    }
+    obj[STORE_FANOUT] = '/';
+
+    /* another copy of the body got there first, this one stays on its own */
+    if (linkat(dirfd, newpath, store, obj, 0) != 0 && errno != EEXIST)
+    {
+        log_error("cannot add '%s' to the store", newpath);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int object_path(char *obj, digest_t type, digesterset_t *set)
+{
+    char hex[2 * MAX_DIGEST_LENGTH + 1];
+    const void *value;
+
+    if ((value = digesterset_get_value(set, type)) == NULL)
+        return -1;
+
+    unpack(hex, value, DIGEST_LENGTH(type));
+    memcpy(obj, hex, STORE_FANOUT);
+    obj[STORE_FANOUT] = '/';
+    strcpy(obj + STORE_FANOUT + 1, hex + STORE_FANOUT);
+    return 0;
+}
@@ -0,0 +1,898 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of process_archive from process.h. A tar archive, ustar with
+ * the pax and GNU extensions for long names and sizes, is read once from
+ * start to end. Each member is handed to the process_* function for its type
+ * as it is reached, so the bytes of a regular file are digested and written
+ * while they are read and nothing is ever extracted twice.
+ *
+ * Members have no path of their own to be read from, they are reported with
+ * a NULL access path. They are copied like the sources the archive was made
+ * from: a first directory is copied to the destination itself, like a single
+ * source, and its name is left out of the paths, unless dcp marked the
+ * archive as one of several sources. A file may be followed by a pax global
+ * header of the digests it was sent with, @see archive_sums, the copy is
+ * checked against those it has in common with `opts->dgstset`.
+ *
+ * Member names are trusted no more than tar trusts them: a leading "/" is
+ * dropped, a name with a ".." in it is skipped, as is one that would be made
+ * through a symlink from the archive.
+ */
+
+ /* for asprintf and F_SETPIPE_SZ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../fd.h"
+#include "../io/pack.h"
+#include "../logging.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * size of a tar block, headers and every member's bytes are padded to it
+ */
+#define TAR_BLOCK 512
+
+
+/**
+ * largest pax or GNU long name header read, anything larger is damage
+ */
+#define TAR_MAX_EXTENDED (1024 * 1024)
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * a ustar header block
+ */
+struct ustar {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+
+/**
+ * a member of the archive, with the values of the extended headers before it
+ */
+struct member {
+    char type;                  /**< ustar typeflag */
+    char *path;                 /**< name of the member */
+    char *linkpath;             /**< target of a link, "" if it is not one */
+    struct stat st;             /**< made up from the header */
+    off_t size;                 /**< # of bytes after the header */
+};
+
+
+/**
+ * the archive being read
+ */
+struct reader {
+    int fd;                     /**< where the archive is read from */
+    const char *name;           /**< the archive's path, for messages */
+    char *parent;               /**< NULL or the last directory made */
+    char *top;                  /**< NULL or the first member, a directory
+                                     the archive is taken to hold, copied
+                                     to the destination itself */
+    int several;                /**< dcp archived several sources */
+    char **symlinks;            /**< symlinks made from the archive */
+    size_t symlinkc;            /**< # of `symlinks` */
+    ino_t ino;                  /**< # of members so far, each one's inode */
+    const char *file;           /**< dapath of the file being read */
+    off_t filesize;             /**< # of bytes of `file` in the archive */
+    int padded;                 /**< read past the padding of `file` */
+    int sent;                   /**< mask of the digests `file` was sent with */
+    unsigned char sums[8][MAX_DIGEST_LENGTH]; /**< their values, by the bit of
+                                     their digest_t */
+    size_t mismatched;          /**< # of files that do not match them */
+    int warned;                 /**< the sender's digests cannot be checked */
+    struct ustar peek;          /**< the header after `file`, if `peeked` */
+    int peeked;                 /**< `peek` was read but not used */
+    int peekr;                  /**< what read_header returned for `peek` */
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * Read the headers of the next member, the extended headers before it are
+ * applied to it.
+ *
+ * @return          1 if there is a member, 0 at the end of the archive, -1 if
+ *                  it is damaged
+ */
+static int next_member(struct reader *reader, struct member *m);
+
+
+/**
+ * Read the next header block, or take back the one peeked at.
+ *
+ * @return          1 if there is one, 0 at the end of the archive, -1 if it
+ *                  is damaged
+ */
+static int read_header(struct reader *reader, struct ustar *hdr);
+
+
+/**
+ * Read `size` bytes of an extended header and the padding after them.
+ *
+ * @return          the bytes NUL terminated, NULL on failure
+ */
+static char *read_extended(struct reader *reader, uintmax_t size);
+
+
+/**
+ * Apply the pax records "LEN key=value\n" in `records` to `m`, or if they
+ * are `global` take the digests a file was sent with from them, `m` is not
+ * used then.
+ *
+ * @return          0 on success, -1 if they are damaged
+ */
+static int apply_pax(struct reader *reader, struct member *m, char *records,
+        size_t len, int global);
+
+
+/**
+ * Read past the padding of `reader->file` and the pax global header of the
+ * digests it was sent with after it, if it has one, and compare `set` with
+ * them, @see stream_check_f. A header that holds no digests is kept for
+ * next_member.
+ *
+ * @param ctx       the reader
+ */
+static int check_sent(digesterset_t *set, void *ctx);
+
+
+/**
+ * Compare the digests `set` of `reader->file` with the ones it was sent with.
+ *
+ * @return          0 if they match or have none in common, -1 if not
+ */
+static int check_sums(struct reader *reader, digesterset_t *set);
+
+
+/**
+ * Read past `len` bytes of the archive.
+ *
+ * @return          0 on success, -1 if the archive ends first
+ */
+static int skip(struct reader *reader, uintmax_t len);
+
+
+/**
+ * @return          the value of a numeric field, octal or GNU base-256
+ */
+static uintmax_t number(const char *field, size_t len);
+
+
+/**
+ * Drop a leading "/" and "./" from the member's name, and `reader->top`, in
+ * place. The top itself becomes ".".
+ *
+ * @return          0 if the name may be created, -1 if it must be skipped
+ */
+static int sanitize(struct reader *reader, char *path);
+
+
+/**
+ * Make every directory `path` is in that does not exist yet.
+ */
+static void make_parents(struct reader *reader, file_t *newdir,
+        const char *path);
+
+
+/**
+ * Process a hard link to the member `m->linkpath`, made before it.
+ */
+static void process_hardlink(struct reader *reader, file_t *newdir,
+        const struct member *m, const char *dapath, const void *pathmd5,
+        const struct process_opts *opts);
+
+
+/**
+ * Process a directory like the walk does before going into it.
+ */
+static void process_dir(file_t *newdir, const struct member *m,
+        const char *dapath, const void *pathmd5,
+        const struct process_opts *opts);
+
+
+/* Public Impl ****************************************************************/
+
+
+int process_archive(file_t *newdir, const char *oldpath,
+        const struct process_opts *opts)
+{
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];
+    struct reader reader;
+    struct member m;
+    off_t consumed;
+    char *dapath;
+    size_t i;
+    int safe;
+    int r;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.name = oldpath;
+    if (strcmp(oldpath, "-") == 0)
+        reader.fd = STDIN_FILENO;
+    else if ((reader.fd = open(oldpath, O_RDONLY)) == -1)
+    {
+        log_error("cannot open archive '%s'", oldpath);
+        return -1;
+    }
+    posix_fadvise(reader.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    fcntl(reader.fd, F_SETPIPE_SZ, 1024 * 1024);
+
+    memset(&m, 0, sizeof(m));
+    while ((r = next_member(&reader, &m)) > 0)
+    {
+
+        /* an archive that starts with a directory holds it, it is copied to
+         * the destination like a single source and its name is left out of
+         * the paths. "." is the destination itself, like the top of a walk. */
+        safe = sanitize(&reader, m.path) == 0;
+        if (safe && m.st.st_ino == 1 && m.type == '5' && !reader.several &&
+                strcmp(m.path, ".") != 0 &&
+                (reader.top = strdup(m.path)) != NULL)
+            strcpy(m.path, ".");
+        if (asprintf(&dapath, "/%s", strcmp(m.path, ".") == 0? "" : m.path)
+                < 0)
+        {
+            r = -1;
+            break;
+        }
+        digest(DGST_MD5, pathmd5, dapath, strlen(dapath));
+
+        /* a member that cannot be created is still read past */
+        r = 0;
+        consumed = 0;
+        reader.padded = 0;
+        if (!safe)
+            opts->callback(DCP_FAILED, pathmd5, dapath, &m.st, NULL, NULL,
+                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, -1,
+                    opts->callback_ctx);
+        else
+        {
+            if (opts->mode == DCP_MODE_COPY && opts->archive == NULL)
+                make_parents(&reader, newdir, m.path);
+
+            switch (m.type)
+            {
+            case '1':
+                process_hardlink(&reader, newdir, &m, dapath, pathmd5, opts);
+                break;
+
+            case '2':
+                process_symlink_target(newdir, m.path, m.linkpath, NULL,
+                        &m.st, dapath, pathmd5, opts);
+                if ((reader.symlinks = realloc(reader.symlinks,
+                        (reader.symlinkc + 1) * sizeof(char *))) == NULL)
+                    r = -1;
+                else
+                    reader.symlinks[reader.symlinkc++] = strdup(m.path);
+                break;
+
+            case '3':
+            case '4':
+            case '6':
+                process_special(newdir, m.path, NULL, &m.st, dapath,
+                        pathmd5, opts);
+                break;
+
+            case '5':
+                process_dir(newdir, &m, dapath, pathmd5, opts);
+                break;
+
+            default:
+                /* the digests a file was sent with are after it, it is
+                 * reported once they are checked */
+                reader.file = dapath;
+                reader.filesize = m.size;
+                r = process_stream(newdir, m.path, reader.fd, &m.st, dapath,
+                        pathmd5, check_sent, &reader, opts);
+                consumed = m.st.st_size;
+                break;
+            }
+        }
+
+        /* the member's bytes are padded to a whole block, the check of a
+         * file may have read past them already */
+        if (r == 0 && !reader.padded)
+            r = skip(&reader, m.size - consumed +
+                    (TAR_BLOCK - m.size % TAR_BLOCK) % TAR_BLOCK);
+
+        if (opts->verifier != NULL)
+            verifier_drain(opts->verifier, 0);
+
+        free(dapath);
+        if (r != 0)
+            break;
+    }
+
+    if (r != 0)
+        log_errorx("cannot read archive '%s' to its end", oldpath);
+    if (reader.mismatched != 0)
+    {
+        log_errorx("%zu file(s) did not match the digests they were sent with",
+                reader.mismatched);
+        r = -1;
+    }
+
+    free(m.path);
+    free(m.linkpath);
+    free(reader.parent);
+    free(reader.top);
+    for (i = 0; i < reader.symlinkc; i++)
+        free(reader.symlinks[i]);
+    free(reader.symlinks);
+    if (reader.fd != STDIN_FILENO)
+        close(reader.fd);
+    return r == 0? 0 : -1;
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+int next_member(struct reader *reader, struct member *m)
+{
+    struct ustar hdr;
+    char *ext, *path, *linkpath;
+    uintmax_t size;
+    size_t i;
+    int r;
+
+    path = NULL;
+    linkpath = NULL;
+    free(m->path);
+    free(m->linkpath);
+    memset(m, 0, sizeof(*m));
+    m->st.st_size = -1;
+    for (;;)
+    {
+        if ((r = read_header(reader, &hdr)) == 0)
+            break;
+        if (r != 1)
+            goto failed;
+
+        size = number(hdr.size, sizeof(hdr.size));
+        if (hdr.typeflag == 'x' || hdr.typeflag == 'g' ||
+                hdr.typeflag == 'L' || hdr.typeflag == 'K')
+        {
+            if ((ext = read_extended(reader, size)) == NULL)
+                goto failed;
+
+            /* only the next member's values and the digests of the last
+             * file matter */
+            if ((hdr.typeflag == 'x' || hdr.typeflag == 'g') &&
+                    apply_pax(reader, m, ext, size, hdr.typeflag == 'g') != 0)
+            {
+                log_errorx("archive '%s' has a damaged pax header",
+                        reader->name);
+                free(ext);
+                goto failed;
+            }
+            if (hdr.typeflag == 'L')
+            {
+                free(path);
+                path = ext;
+            }
+            else if (hdr.typeflag == 'K')
+            {
+                free(linkpath);
+                linkpath = ext;
+            }
+            else
+                free(ext);
+            continue;
+        }
+
+        /* the extended headers' values win over the ustar header's */
+        if (m->path == NULL)
+            m->path = path;
+        else
+            free(path);
+        if (m->linkpath == NULL)
+            m->linkpath = linkpath;
+        else
+            free(linkpath);
+        if (m->path == NULL && asprintf(&m->path, "%.*s%s%.*s",
+                (int) strnlen(hdr.prefix, sizeof(hdr.prefix)), hdr.prefix,
+                hdr.prefix[0] == '\0'? "" : "/",
+                (int) strnlen(hdr.name, sizeof(hdr.name)), hdr.name) < 0)
+            m->path = NULL;
+        if (m->linkpath == NULL && asprintf(&m->linkpath, "%.*s",
+                (int) strnlen(hdr.linkname, sizeof(hdr.linkname)),
+                hdr.linkname) < 0)
+            m->linkpath = NULL;
+        if (m->path == NULL || m->linkpath == NULL)
+            return -1;
+
+        /* old archives tell directories apart by the trailing slash */
+        m->type = hdr.typeflag;
+        i = strlen(m->path);
+        if (m->type == '\0' && i > 0 && m->path[i - 1] == '/')
+            m->type = '5';
+        while (i > 1 && m->path[i - 1] == '/')
+            m->path[--i] = '\0';
+
+        switch (m->type)
+        {
+        case '2':   m->st.st_mode = S_IFLNK;    break;
+        case '3':   m->st.st_mode = S_IFCHR;    break;
+        case '4':   m->st.st_mode = S_IFBLK;    break;
+        case '5':   m->st.st_mode = S_IFDIR;    break;
+        case '6':   m->st.st_mode = S_IFIFO;    break;
+        case '\0':
+        case '0':
+        case '1':
+        case '7':   m->st.st_mode = S_IFREG;    break;
+        default:
+            log_errorx("archive '%s' has a member of unknown type '%c'",
+                    reader->name, m->type);
+            return -1;
+        }
+
+        m->st.st_mode |= number(hdr.mode, sizeof(hdr.mode)) & 07777;
+        if (m->st.st_size == -1)
+            m->st.st_size = size;
+        m->size = m->type == '0' || m->type == '\0' || m->type == '7' ||
+                m->type == '1'? m->st.st_size : 0;
+        if (!S_ISREG(m->st.st_mode) || m->type == '1')
+            m->st.st_size = 0;
+        if (m->st.st_uid == 0)
+            m->st.st_uid = number(hdr.uid, sizeof(hdr.uid));
+        if (m->st.st_gid == 0)
+            m->st.st_gid = number(hdr.gid, sizeof(hdr.gid));
+        if (m->st.st_mtime == 0)
+            m->st.st_mtime = number(hdr.mtime, sizeof(hdr.mtime));
+        m->st.st_atim = m->st.st_ctim = m->st.st_mtim;
+        m->st.st_rdev = makedev(number(hdr.devmajor, sizeof(hdr.devmajor)),
+                number(hdr.devminor, sizeof(hdr.devminor)));
+        m->st.st_nlink = 1;
+        m->st.st_ino = ++reader->ino;
+        m->st.st_blksize = TAR_BLOCK;
+        m->st.st_blocks = (m->st.st_size + TAR_BLOCK - 1) / TAR_BLOCK;
+        return 1;
+    }
+
+    free(path);
+    free(linkpath);
+    return 0;
+
+failed:
+    free(path);
+    free(linkpath);
+    return -1;
+}
+
+
+char *read_extended(struct reader *reader, uintmax_t size)
+{
+    char *ext;
+
+    if (size >= TAR_MAX_EXTENDED || (ext = malloc(size + 1)) == NULL)
+    {
+        log_errorx("archive '%s' has an extended header of %ju bytes",
+                reader->name, size);
+        return NULL;
+    }
+
+    if (fd_read_full(reader->fd, ext, size) != (ssize_t) size ||
+            skip(reader, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK) != 0)
+    {
+        log_errorx("archive '%s' ends inside a header", reader->name);
+        free(ext);
+        return NULL;
+    }
+
+    /* a GNU long name counts its NUL, a pax header does not have one */
+    ext[size] = '\0';
+    return ext;
+}
+
+
+int apply_pax(struct reader *reader, struct member *m, char *records,
+        size_t len, int global)
+{
+    char *record, *key, *value, *end;
+    digest_t type;
+    size_t rlen;
+    int digits;
+    int bit;
+
+    for (record = records; record < records + len; record += rlen)
+    {
+        rlen = strtoul(record, &key, 10);
+        if (rlen == 0 || rlen > (size_t) (records + len - record) ||
+                *key != ' ' || record[rlen - 1] != '\n' ||
+                (value = memchr(key, '=', record + rlen - key)) == NULL)
+            return -1;
+
+        key++;
+        *value++ = '\0';
+        record[rlen - 1] = '\0';
+        if (global)
+        {
+            /* other keys are for tar, dcp sends digests and the number of
+             * sources it archived */
+            if (strncmp(key, "DCP.", 4) != 0)
+                continue;
+            if (strcmp(key + 4, "sources") == 0)
+                reader->several = strtoul(value, &end, 10) > 1;
+            for (bit = 0, type = 1; type <= DGST_BLAKE3; bit++, type <<= 1)
+            {
+                if (strcmp(key + 4, digest_name(type)) != 0)
+                    continue;
+                if (strlen(value) != 2 * DIGEST_LENGTH(type) ||
+                        pack(reader->sums[bit], value, 0) != 0)
+                    return -1;
+                reader->sent |= type;
+            }
+        }
+        else if (strcmp(key, "path") == 0)
+        {
+            free(m->path);
+            m->path = strdup(value);
+        }
+        else if (strcmp(key, "linkpath") == 0)
+        {
+            free(m->linkpath);
+            m->linkpath = strdup(value);
+        }
+        else if (strcmp(key, "size") == 0)
+            m->st.st_size = strtoll(value, &end, 10);
+        else if (strcmp(key, "uid") == 0)
+            m->st.st_uid = strtoul(value, &end, 10);
+        else if (strcmp(key, "gid") == 0)
+            m->st.st_gid = strtoul(value, &end, 10);
+        else if (strcmp(key, "mtime") == 0)
+        {
+            m->st.st_mtime = strtoll(value, &end, 10);
+            for (digits = 0; *end == '.' && digits < 9; digits++)
+                m->st.st_mtim.tv_nsec = m->st.st_mtim.tv_nsec * 10 +
+                        (end[digits + 1] >= '0' && end[digits + 1] <= '9'?
+                        end[digits + 1] - '0' : 0);
+        }
+    }
+    return 0;
+}
+
+
+int read_header(struct reader *reader, struct ustar *hdr)
+{
+    const unsigned char *bytes;
+    uintmax_t sum;
+    size_t zeros;
+    ssize_t n;
+    size_t i;
+
+    if (reader->peeked)
+    {
+        reader->peeked = 0;
+        *hdr = reader->peek;
+        return reader->peekr;
+    }
+
+    if ((n = fd_read_full(reader->fd, hdr, sizeof(*hdr))) == 0)
+        return 0;
+    if (n != sizeof(*hdr))
+    {
+        log_errorx("archive '%s' ends inside a header", reader->name);
+        return -1;
+    }
+
+    /* the checksum is taken with its own field as spaces */
+    bytes = (const unsigned char *) hdr;
+    for (zeros = 0, sum = 0, i = 0; i < sizeof(*hdr); i++)
+    {
+        zeros += bytes[i] == 0;
+        if (i >= offsetof(struct ustar, chksum) &&
+                i < offsetof(struct ustar, typeflag))
+            sum += ' ';
+        else
+            sum += bytes[i];
+    }
+
+    /* a zero block ends the archive, the second one is not needed */
+    if (zeros == sizeof(*hdr))
+        return 0;
+    if (sum != number(hdr->chksum, sizeof(hdr->chksum)))
+    {
+        log_errorx("archive '%s' has a damaged header", reader->name);
+        return -1;
+    }
+    return 1;
+}
+
+
+int check_sent(digesterset_t *set, void *ctx)
+{
+    struct reader *reader;
+    uintmax_t size;
+    char *ext;
+
+    reader = ctx;
+    reader->sent = 0;
+    if (skip(reader, (TAR_BLOCK - reader->filesize % TAR_BLOCK) % TAR_BLOCK)
+            != 0)
+        return 0;
+    reader->padded = 1;
+
+    /* anything else is the next member's */
+    reader->peekr = read_header(reader, &reader->peek);
+    reader->peeked = 1;
+    if (reader->peekr != 1 || reader->peek.typeflag != 'g')
+        return 0;
+
+    size = number(reader->peek.size, sizeof(reader->peek.size));
+    if ((ext = read_extended(reader, size)) == NULL ||
+            apply_pax(reader, NULL, ext, size, 1) != 0)
+    {
+        if (ext != NULL)
+            log_errorx("archive '%s' has a damaged pax header", reader->name);
+        free(ext);
+        reader->peekr = -1;
+        return 0;
+    }
+    free(ext);
+    reader->peeked = 0;
+
+    if (reader->sent == 0 || check_sums(reader, set) == 0)
+        return 0;
+    reader->mismatched++;
+    return -1;
+}
+
+
+int check_sums(struct reader *reader, digesterset_t *set)
+{
+    const void *value;
+    digest_t type;
+    int common;
+    int bit;
+
+    common = 0;
+    for (bit = 0, type = 1; type <= DGST_BLAKE3; bit++, type <<= 1)
+    {
+        if (!(reader->sent & type) ||
+                (value = digesterset_get_value(set, type)) == NULL)
+            continue;
+
+        common = 1;
+        if (memcmp(value, reader->sums[bit], DIGEST_LENGTH(type)) != 0)
+        {
+            log_errorx("'%s' does not match its %s when it was sent",
+                    reader->file, digest_name(type));
+            return -1;
+        }
+    }
+
+    /* only worth saying if digests were asked for */
+    if (!common && set->valid != 0 && !reader->warned)
+    {
+        log_errorx("no digest in common with the sender, files from '%s' "
+                "are not checked", reader->name);
+        reader->warned = 1;
+    }
+    return 0;
+}
+
+
+
+int skip(struct reader *reader, uintmax_t len)
+{
+    char buf[8 * TAR_BLOCK];
+    ssize_t n;
+
+    /* a file is sought past, a pipe has to be read */
+    if (len >= sizeof(buf) && lseek(reader->fd, len, SEEK_CUR) != -1)
+        return 0;
+
+    for (; len > 0; len -= n)
+        if ((n = fd_read_full(reader->fd, buf, len < sizeof(buf)? len :
+                sizeof(buf))) <= 0)
+            return -1;
+    return 0;
+}
+
+
+uintmax_t number(const char *field, size_t len)
+{
+    uintmax_t value;
+    size_t i;
+
+    /* GNU tar writes values too large for octal in base-256 */
+    if (field[0] & 0x80)
+    {
+        value = field[0] & 0x3f;
+        for (i = 1; i < len; i++)
+            value = (value << 8) | (unsigned char) field[i];
+        return value;
+    }
+
+    value = 0;
+    for (i = 0; i < len && field[i] == ' '; i++) {}
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+        value = (value << 3) | (field[i] - '0');
+    return value;
+}
+
+
+int sanitize(struct reader *reader, char *path)
+{
+    const char *c;
+    size_t len;
+    size_t i;
+
+    while (path[0] == '/' || (path[0] == '.' && path[1] == '/'))
+        memmove(path, path + 1, strlen(path));
+
+    len = reader->top == NULL? 0 : strlen(reader->top);
+    if (len > 0 && strncmp(path, reader->top, len) == 0)
+    {
+        if (path[len] == '\0')
+            strcpy(path, ".");
+        else if (path[len] == '/')
+            memmove(path, path + len + 1, strlen(path + len + 1) + 1);
+    }
+
+    if (path[0] == '\0')
+    {
+        log_errorx("skipping a member of '%s' with no name", reader->name);
+        return -1;
+    }
+
+    for (c = path; c != NULL; c = strchr(c, '/'))
+    {
+        c += *c == '/';
+        if (c[0] == '.' && c[1] == '.' && (c[2] == '/' || c[2] == '\0'))
+        {
+            log_errorx("skipping '%s', it is outside of the archive", path);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < reader->symlinkc; i++)
+    {
+        len = strlen(reader->symlinks[i]);
+        if (strncmp(path, reader->symlinks[i], len) == 0 && path[len] == '/')
+        {
+            log_errorx("skipping '%s', it is through the symlink '%s'", path,
+                    reader->symlinks[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+void make_parents(struct reader *reader, file_t *newdir, const char *path)
+{
+    char *dir, *slash;
+
+    if ((slash = strrchr(path, '/')) == NULL)
+        return;
+    if ((dir = strndup(path, slash - path)) == NULL)
+        return;
+
+    /* members are usually together with their siblings */
+    if (reader->parent != NULL && strcmp(reader->parent, dir) == 0)
+    {
+        free(dir);
+        return;
+    }
+
+    for (slash = strchr(dir, '/'); ; slash = strchr(slash + 1, '/'))
+    {
+        if (slash != NULL)
+            *slash = '\0';
+        if (mkdirat(newdir->fd, dir, 0777) != 0 && errno != EEXIST)
+            log_debug("cannot create dir '%s/%s'", newdir->path, dir);
+        if (slash == NULL)
+            break;
+        *slash = '/';
+    }
+
+    free(reader->parent);
+    reader->parent = dir;
+}
+
+
+void process_hardlink(struct reader *reader, file_t *newdir,
+        const struct member *m, const char *dapath, const void *pathmd5,
+        const struct process_opts *opts)
+{
+    dcp_state_t state;
+    char *target;
+    int r;
+
+    target = strdup(m->linkpath);
+    state = DCP_PROFILED;
+    if (opts->mode == DCP_MODE_COPY)
+    {
+        /* the link's target is named the same way as the member, one kept
+         * out by what is in the way is not reported */
+        state = DCP_LINK_CREATED;
+        r = target == NULL || sanitize(reader, target) != 0? -1 :
+                dest_create(newdir, m->path, target, &m->st, opts);
+        if (r == DEST_REFUSED)
+        {
+            free(target);
+            return;
+        }
+        if (r != 0)
+        {
+            log_errorx("cannot link '%s' to '%s'", m->path, m->linkpath);
+            state = DCP_FAILED;
+        }
+    }
+
+    /* its bytes were digested with the target */
+    opts->callback(state, pathmd5, dapath, &m->st, NULL, NULL, NULL, NULL,
+            NULL, NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+    free(target);
+}
+
+
+void process_dir(file_t *newdir, const struct member *m, const char *dapath,
+        const void *pathmd5, const struct process_opts *opts)
+{
+    dcp_state_t state;
+    int r;
+
+    state = DCP_PROFILED;
+    if (opts->mode == DCP_MODE_COPY)
+    {
+        state = DCP_DIR_CREATED;
+        /* members can come in any order, its metadata is set once the
+         * archive ends. One kept out by what is in the way is not reported */
+        if ((r = dest_create(newdir, m->path, NULL, &m->st, opts)) ==
+                DEST_REFUSED)
+            return;
+        if (r != 0)
+            state = DCP_DIR_FAILED;
+    }
+
+    opts->callback(state, pathmd5, dapath, &m->st, NULL, NULL, NULL, NULL,
+            NULL, NULL, NULL, NULL, NULL, -1, opts->callback_ctx);
+}
@@ -0,0 +1,392 @@
+/**
+ * @file
+ *
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the verifier from process.h. Copied files are queued by
+ * the walk and a single thread rereads them behind it, so verifying overlaps
+ * with copying instead of being a second pass. The reread must come from the
+ * disk, not the pages just written, so files are opened with O_DIRECT or, if
+ * the file system does not support it, written back and dropped from the page
+ * cache first.
+ *
+ * Only the walk's thread calls the callback, entries of verified files are
+ * handed back to it by verifier_drain.
+ */
+
+/* for O_DIRECT */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#undef _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "../digest.h"
+#include "../fd.h"
+#include "../logging.h"
+#include "dcp.h"
+
+
+/* MACROS *********************************************************************/
+
+
+/**
+ * max number of copied files waiting to be verified or drained
+ */
+#define VERIFY_QUEUE 64
+
+
+/**
+ * alignment of the read buffer and each request for O_DIRECT
+ */
+#define VERIFY_ALIGN 4096
+
+
+/**
+ * number of digest types, each has a slot in job.values
+ */
+#define VERIFY_DIGESTS 7
+
+
+/* Type Defs ******************************************************************/
+
+
+/**
+ * a copied file waiting to be verified
+ */
+struct job {
+    int dirfd;                              /**< parent of `newpath` */
+    char *newpath;                          /**< the copy to reread */
+    char *oldpath;                          /**< where the bytes came from, NULL
+                                                 for a stream */
+    char *dapath;                           /**< @see dcp.h DEFINITIONS */
+    unsigned char pathmd5[MD5_DIGEST_LENGTH];/**< md5 of `dapath` */
+    struct stat st;                         /**< the source's stat struct */
+    int valid;                              /**< mask of digests in `values` */
+    unsigned char values[VERIFY_DIGESTS][MAX_DIGEST_LENGTH]; /**< by type bit */
+    unsigned long ms;                       /**< time to copy and verify */
+    dcp_state_t state;                      /**< set once verified */
+};
+
+
+/**
+ * jobs are a ring, the counters only grow and are taken modulo VERIFY_QUEUE.
+ * [head, next) are verified and waiting to be drained, [next, tail) are
+ * waiting for the thread.
+ */
+struct verifier {
+    digesterset_t set;                      /**< digest of the file reread */
+    digest_t type;                          /**< digest that is compared */
+    void *buffer;                           /**< aligned buffer for reads */
+    size_t buffer_size;                     /**< # of bytes in `buffer` */
+    dcp_callback_f callback;                /**< where verified files go */
+    void *callback_ctx;                     /**< provided to `callback` */
+
+    pthread_t thread;                       /**< rereads the copies */
+    pthread_mutex_t lock;                   /**< protects the counters */
+    pthread_cond_t changed;                 /**< a counter or `stop` changed */
+    int stop;                               /**< thread exits when idle */
+    size_t head;                            /**< next job to drain */
+    size_t next;                            /**< next job to verify */
+    size_t tail;                            /**< next free job */
+    size_t failed;                          /**< # drained that did not match */
+    struct job jobs[VERIFY_QUEUE];
+};
+
+
+/* Private API ****************************************************************/
+
+
+/**
+ * verify queued jobs until stopped
+ */
+static void *verify_thread(void *verifier);
+
+
+/**
+ * reread the copy described by `job` and compare its digest
+ *
+ * @return          0 if it matches, -1 if it does not or cannot be read
+ */
+static int verify(struct verifier *verifier, struct job *job);
+
+
+/**
+ * @return          `job`'s value of the `type` digest, NULL if not calculated
+ */
+static const void *job_value(const struct job *job, digest_t type);
+
+
+/* Public Impl ****************************************************************/
+
+
+struct verifier *verifier_create(digest_t type, size_t bufsize,
+        dcp_callback_f callback, void *ctx)
+{
+    struct verifier *verifier;
+
+    /* the digester set holds an over aligned XXH3 state */
+    if (posix_memalign((void **) &verifier, __alignof__(struct verifier),
+            sizeof(*verifier)) != 0)
+        return NULL;
+
+    /* O_DIRECT needs whole aligned blocks */
+    verifier->buffer_size = (bufsize + VERIFY_ALIGN - 1) & ~(VERIFY_ALIGN - 1);
+    if (posix_memalign(&verifier->buffer, VERIFY_ALIGN,
+            verifier->buffer_size) != 0)
+    {
+        free(verifier);
+        return NULL;
+    }
+
+    digesterset_create(&verifier->set, type);
+    verifier->type         = type;
+    verifier->callback     = callback;
+    verifier->callback_ctx = ctx;
+    verifier->stop         = 0;
+    verifier->head         = 0;
+    verifier->next         = 0;
+    verifier->tail         = 0;
+    verifier->failed       = 0;
+    pthread_mutex_init(&verifier->lock, NULL);
+    pthread_cond_init(&verifier->changed, NULL);
+
+    if (pthread_create(&verifier->thread, NULL, verify_thread, verifier) != 0)
+    {
+        log_errorx("cannot start the verify thread");
+        pthread_cond_destroy(&verifier->changed);
+        pthread_mutex_destroy(&verifier->lock);
+        digesterset_free(&verifier->set);
+        free(verifier->buffer);
+        free(verifier);
+        return NULL;
+    }
+
+    return verifier;
+}
+
+
+int verifier_submit(struct verifier *verifier, const file_t *newdir,
+        const char *newpath, const char *oldpath, const struct stat *oldst,
+        const char *dapath, const void *pathmd5, digesterset_t *set,
+        unsigned long ms)
+{
+    struct job *job;
+    const void *value;
+    int type;
+
+    /* queue is full, wait for the oldest to be verified and report it */
+    if (verifier->tail - verifier->head == VERIFY_QUEUE)
+    {
+        pthread_mutex_lock(&verifier->lock);
+        while (verifier->next == verifier->head)
+            pthread_cond_wait(&verifier->changed, &verifier->lock);
+        pthread_mutex_unlock(&verifier->lock);
+        verifier_drain(verifier, 0);
+    }
+
+    /* the thread does not look at the job until tail moves past it */
+    job = &verifier->jobs[verifier->tail % VERIFY_QUEUE];
+    job->dirfd   = newdir->fd;
+    job->newpath = strdup(newpath);
+    job->oldpath = oldpath == NULL? NULL : strdup(oldpath);
+    job->dapath  = strdup(dapath);
+    if (job->newpath == NULL || (oldpath != NULL && job->oldpath == NULL) ||
+            job->dapath == NULL)
+    {
+        free(job->newpath);
+        free(job->oldpath);
+        free(job->dapath);
+        return -1;
+    }
+
+    memcpy(job->pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+    memcpy(&job->st, oldst, sizeof(job->st));
+    job->ms = ms;
+    job->valid = 0;
+    for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+    {
+        if ((value = digesterset_get_value(set, type)) == NULL)
+            continue;
+        memcpy(job->values[__builtin_ctz(type)], value, DIGEST_LENGTH(type));
+        job->valid |= type;
+    }
+
+    pthread_mutex_lock(&verifier->lock);
+    verifier->tail++;
+    pthread_cond_broadcast(&verifier->changed);
+    pthread_mutex_unlock(&verifier->lock);
+    return 0;
+}
+
+
+size_t verifier_drain(struct verifier *verifier, int wait)
+{
+    struct job *job;
+    size_t done;
+
+    pthread_mutex_lock(&verifier->lock);
+    while (wait && verifier->next != verifier->tail)
+        pthread_cond_wait(&verifier->changed, &verifier->lock);
+    done = verifier->next;
+    pthread_mutex_unlock(&verifier->lock);
+
+    /* the thread is done with every job before `done` */
+    for (; verifier->head != done; verifier->head++)
+    {
+        job = &verifier->jobs[verifier->head % VERIFY_QUEUE];
+        verifier->callback(job->state, job->pathmd5, job->dapath, &job->st,
+                job->oldpath, NULL,
+                job_value(job, DGST_MD5),
+                job_value(job, DGST_SHA1),
+                job_value(job, DGST_SHA256),
+                job_value(job, DGST_SHA512),
+                job_value(job, DGST_XXH3),
+                job_value(job, DGST_CRC32C),
+                job_value(job, DGST_BLAKE3),
+                job->ms, verifier->callback_ctx);
+
+        if (job->state != DCP_FILE_VERIFIED)
+            verifier->failed++;
+
+        free(job->newpath);
+        free(job->oldpath);
+        free(job->dapath);
+    }
+
+    return verifier->failed;
+}
+
+
+void verifier_free(struct verifier *verifier)
+{
+    if (verifier == NULL)
+        return;
+
+    pthread_mutex_lock(&verifier->lock);
+    verifier->stop = 1;
+    pthread_cond_broadcast(&verifier->changed);
+    pthread_mutex_unlock(&verifier->lock);
+    pthread_join(verifier->thread, NULL);
+
+    pthread_cond_destroy(&verifier->changed);
+    pthread_mutex_destroy(&verifier->lock);
+    digesterset_free(&verifier->set);
+    free(verifier->buffer);
+    free(verifier);
+}
+
+
+/* Private Impl ***************************************************************/
+
+
+void *verify_thread(void *arg)
+{
+    struct verifier *verifier;
+    struct job *job;
+
+    verifier = arg;
+
+    pthread_mutex_lock(&verifier->lock);
+    for (;;)
+    {
+        while (!verifier->stop && verifier->next == verifier->tail)
+            pthread_cond_wait(&verifier->changed, &verifier->lock);
+
+        if (verifier->next == verifier->tail)
+            break;
+
+        /* the job is ours until next moves past it */
+        job = &verifier->jobs[verifier->next % VERIFY_QUEUE];
+        pthread_mutex_unlock(&verifier->lock);
+
+        job->state = verify(verifier, job) == 0?
+                DCP_FILE_VERIFIED : DCP_VERIFY_FAILED;
+
+        pthread_mutex_lock(&verifier->lock);
+        verifier->next++;
+        pthread_cond_broadcast(&verifier->changed);
+    }
+    pthread_mutex_unlock(&verifier->lock);
+
+    return NULL;
+}
+
+
+int verify(struct verifier *verifier, struct job *job)
+{
+    struct timespec start, end;
+    ssize_t count;
+    int direct;
+    int fd;
+    int r;
+
+    /* clock() would count the walk's thread too */
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+    direct = 1;
+    if ((fd = openat(job->dirfd, job->newpath, O_RDONLY | O_DIRECT)) == -1 &&
+            errno == EINVAL)
+    {
+        /* no direct io on this file system, make sure the pages are on disk
+         * and drop them so the read cannot be served from memory */
+        direct = 0;
+        if ((fd = openat(job->dirfd, job->newpath, O_RDONLY)) != -1 &&
+                (fdatasync(fd) == -1 ||
+                 posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0))
+            log_debug("cannot drop cached pages of '%s'", job->newpath);
+    }
+
+    if (fd == -1)
+    {
+        log_error("cannot open '%s' to verify", job->newpath);
+        return -1;
+    }
+
+    digesterset_reset(&verifier->set);
+    while ((count = fd_read(fd, verifier->buffer, verifier->buffer_size)) > 0)
+    {
+        digesterset_update(&verifier->set, verifier->buffer, count);
+
+        /* a short direct read is the end of the file, the next request would
+         * not be aligned */
+        if (direct && (size_t) count < verifier->buffer_size)
+            break;
+    }
+    digesterset_finalize(&verifier->set);
+    close(fd);
+
+    r = 0;
+    if (count == -1)
+    {
+        log_error("cannot reread '%s' to verify", job->newpath);
+        r = -1;
+    }
+    else if (memcmp(digesterset_get_value(&verifier->set, verifier->type),
+            job_value(job, verifier->type), DIGEST_LENGTH(verifier->type)) != 0)
+    {
+        log_errorx("'%s' does not match '%s' when reread", job->newpath,
+                job->oldpath != NULL? job->oldpath : job->dapath);
+        r = -1;
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    job->ms += (end.tv_sec - start.tv_sec) * 1000 +
+            (end.tv_nsec - start.tv_nsec) / 1000000;
+    return r;
+}
+
+
+const void *job_value(const struct job *job, digest_t type)
+{
+    return (job->valid & type)? job->values[__builtin_ctz(type)] : NULL;
+}
@@ -8,6 +8,7 @@
  * Implementation of the index.h api using an in-memory Berkeley DB B-Tree.
  */
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,9 +32,11 @@
  * @param key_digest_length the # of bytes of our digest used for search
  * @param key_digest        given a ptr to an entry retrieve a pointer to the
  *                          digest used for searching
+ * @param content           NULL or a btree of struct content_key to paths
  */
 struct index {
     DB *dbh;
+    DB *content;
     digest_t key_digest_type;
     size_t key_digest_length;
 };
@@ -51,6 +54,16 @@ struct key {
 } __attribute__((packed));
 
 
+/**
+ * Key for the content btree, the hash of the file and its size. Zeroed before
+ * use like struct key.
+ */
+struct content_key {
+    unsigned char digest[MAX_DIGEST_LENGTH];
+    int64_t size;
+} __attribute__((packed));
+
+
 /* Private API ****************************************************************/
 
 
@@ -86,18 +99,44 @@ static int key_cmp(DB *db, const DBT *dbt1, const DBT *dbt2);
 static int init_db(struct index *idx);
 
 
+/**
+ * create and open an in-memory btree in *dbh
+ *
+ * @param cachesize # of bytes of cache to give the btree
+ * @param cmp       NULL or the key comparison function, bdb's byte order
+ *                  by default
+ *
+ * @return      0 on success.
+ */
+static int open_db(DB **dbh, u_int32_t cachesize,
+        int (*cmp)(DB *, const DBT *, const DBT *));
+
+
+/**
+ * find the first key in the index with the path `pathmd5`
+ *
+ * @param k         where to copy the key found
+ *
+ * @return          INDEX_SUCCESS, INDEX_NO_ENTRY or INDEX_FAILED
+ */
+static index_return_t first_key(index_t *idx, const void *pathmd5,
+        struct key *k);
+
+
 /* Public Impl ****************************************************************/
 
 
 index_return_t index_create(index_t **idx, digest_t digest_type)
 {
-    if (idx == NULL)
+    /* any single digest type can key the index, xxh3 and crc32c included */
+    if (idx == NULL || DIGEST_LENGTH(digest_type) == 0)
         return INDEX_FAILED;
 
     *idx = malloc(sizeof(struct index));
 
     (*idx)->key_digest_type = digest_type;
     (*idx)->key_digest_length = DIGEST_LENGTH(digest_type);
+    (*idx)->content = NULL;
     init_db(*idx);
 
     return INDEX_SUCCESS;
@@ -109,6 +148,8 @@ index_return_t index_free(index_t *idx)
     if (idx != NULL)
     {
         idx->dbh->close(idx->dbh, 0);
+        if (idx->content != NULL)
+            idx->content->close(idx->content, 0);
         free(idx);
     }
     return INDEX_SUCCESS;
@@ -184,10 +225,204 @@ index_return_t index_lookup(index_t *idx, const void *pathmd5,
 }
 
 
+index_return_t index_lookup_path(index_t *idx, const void *pathmd5,
+        void *digest)
+{
+    struct key k;
+
+    assert(pathmd5 != NULL);
+
+    switch (first_key(idx, pathmd5, &k))
+    {
+    case INDEX_SUCCESS:
+        if (digest != NULL)
+            memcpy(digest, k.digest, idx->key_digest_length);
+        return INDEX_SUCCESS;
+
+    case INDEX_NO_ENTRY:
+        return INDEX_NO_ENTRY;
+
+    default:
+        return INDEX_FAILED;
+    }
+}
+
+
+index_return_t index_remove_path(index_t *idx, const void *pathmd5)
+{
+    DBT key;
+    int r;
+    struct key k;
+    index_return_t ret;
+
+    assert(pathmd5 != NULL);
+
+    /* the cursor is closed before each delete so it is never invalidated */
+    ret = INDEX_NO_ENTRY;
+    while ((r = first_key(idx, pathmd5, &k)) == INDEX_SUCCESS)
+    {
+        memset(&key, 0, sizeof(key));
+        key.data = &k;
+        key.size = sizeof(k);
+
+        if ((r = idx->dbh->del(idx->dbh, NULL, &key, 0)) != 0)
+        {
+            idx->dbh->err(idx->dbh, r, "failed index delete");
+            return INDEX_FAILED;
+        }
+        ret = INDEX_SUCCESS;
+    }
+
+    return r == INDEX_FAILED? INDEX_FAILED : ret;
+}
+
+
+index_return_t index_track_content(index_t *idx)
+{
+    if (idx->content != NULL)
+        return INDEX_SUCCESS;
+
+    return open_db(&idx->content, 64 * 1024 * 1024, NULL) == 0?
+            INDEX_SUCCESS : INDEX_FAILED;
+}
+
+
+index_return_t index_insert_content(index_t *idx, const void *digest,
+        off_t size, const char *dapath)
+{
+    DBT key;
+    DBT val;
+    int r;
+    struct content_key k;
+
+    if (idx->content == NULL)
+        return INDEX_SUCCESS;
+
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    memset(&k, 0, sizeof(k));
+    memcpy(&k.digest, digest, idx->key_digest_length);
+    k.size = size;
+
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = (void *) dapath;
+    val.size = strlen(dapath) + 1;
+
+    /* duplicates of a file are all as good, keep the first */
+    switch (r = idx->content->put(idx->content, NULL, &key, &val,
+            DB_NOOVERWRITE))
+    {
+    case 0:
+    case DB_KEYEXIST:
+        return INDEX_SUCCESS;
+
+    default:
+        idx->content->err(idx->content, r, "failed to write a content entry");
+        return INDEX_FAILED;
+    }
+}
+
+
+index_return_t index_lookup_content(index_t *idx, const void *digest,
+        off_t size, char *dapath, size_t len)
+{
+    DBT key;
+    DBT val;
+    int r;
+    struct content_key k;
+
+    assert(digest != NULL && dapath != NULL && len > 0);
+
+    if (idx->content == NULL)
+        return INDEX_NO_ENTRY;
+
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    memset(&k, 0, sizeof(k));
+    memcpy(&k.digest, digest, idx->key_digest_length);
+    k.size = size;
+
+    key.data = &k;
+    key.size = sizeof(k);
+
+    switch (r = idx->content->get(idx->content, NULL, &key, &val, 0))
+    {
+    case 0:
+        snprintf(dapath, len, "%.*s", (int) val.size, (char *) val.data);
+        return INDEX_SUCCESS;
+
+    case DB_NOTFOUND:
+        return INDEX_NO_ENTRY;
+
+    default:
+        idx->content->err(idx->content, r, "failed content lookup");
+        return INDEX_FAILED;
+    }
+}
+
+
 /* Private Impl ***************************************************************/
 
 
+index_return_t first_key(index_t *idx, const void *pathmd5, struct key *k)
+{
+    DBC *cursor;
+    DBT key;
+    DBT val;
+    int r;
+
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    /* the smallest key of the path has an all zero digest */
+    memset(k, 0, sizeof(*k));
+    memcpy(&k->pathmd5, pathmd5, MD5_DIGEST_LENGTH);
+
+    key.data = k;
+    key.size = sizeof(*k);
+
+    if ((r = idx->dbh->cursor(idx->dbh, NULL, &cursor, 0)) != 0)
+    {
+        idx->dbh->err(idx->dbh, r, "cannot open index cursor");
+        return INDEX_FAILED;
+    }
+
+    /* position at the first key >= k, it is the path's if it has any */
+    switch (r = cursor->get(cursor, &key, &val, DB_SET_RANGE))
+    {
+    case 0:
+        r = memcmp(key.data, pathmd5, MD5_DIGEST_LENGTH) == 0?
+                INDEX_SUCCESS : INDEX_NO_ENTRY;
+        if (r == INDEX_SUCCESS)
+            memcpy(k, key.data, sizeof(*k));
+        break;
+
+    case DB_NOTFOUND:
+        r = INDEX_NO_ENTRY;
+        break;
+
+    default:
+        idx->dbh->err(idx->dbh, r, "failed index cursor");
+        r = INDEX_FAILED;
+    }
+
+    cursor->close(cursor);
+    return r;
+}
+
+
 inline int init_db(struct index *idx)
+{
+    /* increase the cachesize of bdb so that the database respides in memory
+     * instead of on disk. The default db inmem size is 256KB, that won't work!
+     * TODO profile output files to see what size they are, smaller is faster.
+     * On test db was 115MB */
+    return open_db(&idx->dbh, 256 * 1024 * 1024, &key_cmp);
+}
+
+
+int open_db(DB **dbhp, u_int32_t cachesize,
+        int (*cmp)(DB *, const DBT *, const DBT *))
 {
     int r;
     DB *dbh;
@@ -199,14 +434,11 @@ inline int init_db(struct index *idx)
         return -1;
     }
 
-    /* increase the cachesize of bdb so that the database respides in memory
-     * instead of on disk. The default db inmem size is 256KB, that won't work!
-     * TODO profile output files to see what size they are, smaller is faster.
-     * On test db was 115MB */
-    dbh->set_cachesize(dbh, 0, 256 * 1024 * 1024 , 1);
+    dbh->set_cachesize(dbh, 0, cachesize, 1);
 
     /* set the btree comparison function */
-    dbh->set_bt_compare(dbh, &key_cmp);
+    if (cmp != NULL)
+        dbh->set_bt_compare(dbh, cmp);
 
     /* get the env to register a debug logging func with our log system */
     dbe = dbh->get_env(dbh);
@@ -219,7 +451,7 @@ inline int init_db(struct index *idx)
         return -1;
     }
 
-    idx->dbh = dbh;
+    *dbhp = dbh;
 
     return 0;
 }
@@ -17,6 +17,7 @@
 
 
 #include <stddef.h>
+#include <sys/types.h>
 #include <linux/limits.h>
 
 #include "../digest.h"
@@ -90,4 +91,71 @@ index_return_t index_lookup(index_t *idx, const void *pathmd5,
         const void *digest);
 
 
+/**
+ * Lookup a file by its path alone, whatever its digest.
+ *
+ * @param idx           index to search
+ * @param pathmd5       md5 of the file's path
+ * @param digest        NULL or where to copy the digest of the entry found
+ *
+ * @return              INDEX_SUCCESS, INDEX_NO_ENTRY or INDEX_FAILED
+ */
+index_return_t index_lookup_path(index_t *idx, const void *pathmd5,
+        void *digest);
+
+
+/**
+ * Remove every entry of a path from the index.
+ *
+ * @param idx           index to remove from
+ * @param pathmd5       md5 of the file's path
+ *
+ * @return              INDEX_SUCCESS, INDEX_NO_ENTRY if there were none or
+ *                      INDEX_FAILED
+ */
+index_return_t index_remove_path(index_t *idx, const void *pathmd5);
+
+
+/**
+ * Keep a second index keyed by content alone, the digest and size of a file,
+ * mapped to the path it had. Only entries inserted after this call are in it.
+ *
+ * @param idx           index to track the contents of
+ *
+ * @return              INDEX_SUCCESS or INDEX_FAILED
+ */
+index_return_t index_track_content(index_t *idx);
+
+
+/**
+ * Add the content of an entry to the index, if its content is tracked and not
+ * already there. The first path found with a content is kept.
+ *
+ * @param idx           the index to insert into
+ * @param digest        the digest of the file, of the index's digest type
+ * @param size          the size of the file
+ * @param dapath        the path of the file
+ *
+ * @return              INDEX_SUCCESS or INDEX_FAILED
+ */
+index_return_t index_insert_content(index_t *idx, const void *digest,
+        off_t size, const char *dapath);
+
+
+/**
+ * Lookup a file by its content alone, whatever its path.
+ *
+ * @param idx           index to search
+ * @param digest        the digest of the file, of the index's digest type
+ * @param size          the size of the file
+ * @param dapath        where to copy the path of the entry found
+ * @param len           # of bytes in `dapath`
+ *
+ * @return              INDEX_SUCCESS, INDEX_NO_ENTRY if there is none or the
+ *                      content is not tracked, or INDEX_FAILED
+ */
+index_return_t index_lookup_content(index_t *idx, const void *digest,
+        off_t size, char *dapath, size_t len);
+
+
 #endif
@@ -93,6 +93,13 @@ static int pack_digest(void *dest, size_t digest_length, const json_t *str,
 
 
 int io_entry_read(entry_t *entry, FILE *in, size_t *line)
+{
+    return io_entry_read_path(entry, NULL, 0, in, line);
+}
+
+
+int io_entry_read_path(entry_t *entry, char *path, size_t plen, FILE *in,
+        size_t *line)
 {
     char *buf;
     size_t blen;
@@ -101,9 +108,11 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
     void *it;
     const char *key;
     const json_t *val;
+    ssize_t count;
 
     int has_pathmd5;
 
+next:
     /* read the next line skipping any metadata lines */
     buf = NULL;
     do {
@@ -128,7 +137,20 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
 
     free(buf);
 
+    /* and the copies of items at other destinations, they only tell what
+     * became of an item of the manifest's, and copies that failed their
+     * verification, their digests are not those of what is at their path */
+    if ((val = json_object_get(obj, "state")) != NULL && json_is_string(val) &&
+            (strncmp(json_string_value(val), "MIRROR_", 7) == 0 ||
+            strcmp(json_string_value(val), "VERIFY_FAILED") == 0))
+    {
+        json_decref(obj);
+        goto next;
+    }
+
     memset(entry, 0, sizeof(*entry)); /* 0/NULL out every thing in the struct */
+    if (path != NULL && plen > 0)
+        path[0] = '\0';
 
     for (   it = json_object_iter(obj);
             it != NULL ;
@@ -185,6 +207,42 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
             entry->sha512 = entry->_digest_bytes.sha512;
         }
 
+        else if (strcmp(key, "xxh3") == 0)
+        {
+            if (pack_digest(entry->_digest_bytes.xxh3, XXH3_DIGEST_LENGTH,
+                    val, *line, "xxh3") == -1)
+            {
+                LOG_NONHEX(*line, "xxh3");
+                json_decref(obj);
+                return -1;
+            }
+            entry->xxh3 = entry->_digest_bytes.xxh3;
+        }
+
+        else if (strcmp(key, "crc32c") == 0)
+        {
+            if (pack_digest(entry->_digest_bytes.crc32c, CRC32C_DIGEST_LENGTH,
+                    val, *line, "crc32c") == -1)
+            {
+                LOG_NONHEX(*line, "crc32c");
+                json_decref(obj);
+                return -1;
+            }
+            entry->crc32c = entry->_digest_bytes.crc32c;
+        }
+
+        else if (strcmp(key, "blake3") == 0)
+        {
+            if (pack_digest(entry->_digest_bytes.blake3, BLAKE3_DIGEST_LENGTH,
+                    val, *line, "blake3") == -1)
+            {
+                LOG_NONHEX(*line, "blake3");
+                json_decref(obj);
+                return -1;
+            }
+            entry->blake3 = entry->_digest_bytes.blake3;
+        }
+
         else if (strcmp(key, "pathmd5") == 0)
         {
             if (pack_digest(entry->pathmd5, MD5_DIGEST_LENGTH, val, *line,
@@ -285,16 +343,31 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
             entry->ctime.tv_nsec = json_integer_value(val);
         }
 
+        /* the path is only kept if asked for, it is not part of the entry
+         * since bdb will copy the entry struct but not manage the dynamically
+         * allocated memory the structs point to */
+        else if (strcmp(key, "path")     == 0)
+        {
+            if (path != NULL && json_is_string(val))
+                snprintf(path, plen, "%s", json_string_value(val));
+        }
+
+        /* paths that are not utf-8 are hex encoded */
+        else if (strcmp(key, "pathhex")  == 0)
+        {
+            if (path != NULL && plen > 0 && (count =
+                    decode_hexjsonstr(path, plen - 1, val, *line)) >= 0)
+                path[count] = '\0';
+        }
+
         /* fields we will ignore */
-        /* ignoring since bdb will copy the entry struct but not manage the
-         * dynamically allocated memory the structs point to */
-        else if (strcmp(key, "path")     == 0) {}
         else if (strcmp(key, "state")    == 0) {}
         else if (strcmp(key, "uid")      == 0) {}
         else if (strcmp(key, "gid")      == 0) {}
         else if (strcmp(key, "type")     == 0) {}
         else if (strcmp(key, "elapsed")  == 0) {}
-        else if (strcmp(key, "pathhex")  == 0) {}
+        else if (strcmp(key, "destination")    == 0) {}
+        else if (strcmp(key, "destinationHex") == 0) {}
 
         else
             log_warnx("ignoring unknown key '%s' on line %zu", key, *line);
@@ -318,8 +391,9 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line)
  */
 int io_entry_write_fields(const char *state, const char *path,
         const struct stat *st, const void *pathmd5, const char *symlinkpath,
-        const void *md5, const void *sha1, const void *sha256,
-        const void *sha512, long elapsed, FILE *stream)
+        const char *destination, const void *md5, const void *sha1, const void *sha256,
+        const void *sha512, const void *xxh3, const void *crc32c,
+        const void *blake3, long elapsed, FILE *stream)
 {
     enum { MAX_LENGTH = PATH_MAX * 4 };
 
@@ -364,6 +438,24 @@ int io_entry_write_fields(const char *state, const char *path,
         fprintf(stream, "\"sha512\":\"%s\",", buf);
     }
 
+    if (xxh3 != NULL)
+    {
+        unpack(buf, xxh3, XXH3_DIGEST_LENGTH);
+        fprintf(stream, "\"xxh3\":\"%s\",", buf);
+    }
+
+    if (crc32c != NULL)
+    {
+        unpack(buf, crc32c, CRC32C_DIGEST_LENGTH);
+        fprintf(stream, "\"crc32c\":\"%s\",", buf);
+    }
+
+    if (blake3 != NULL)
+    {
+        unpack(buf, blake3, BLAKE3_DIGEST_LENGTH);
+        fprintf(stream, "\"blake3\":\"%s\",", buf);
+    }
+
     /*
      * up till this point we have been appending commas to the end of the
      * entries, this is because we don't know which hashes are going to be
@@ -442,6 +534,35 @@ int io_entry_write_fields(const char *state, const char *path,
         }
     }
 
+    /* if entry is of a copy at another destination we include which */
+    if (destination != NULL)
+    {
+        /*
+         * destination      valid utf-8 JSON escaped destination
+         * destinationHex   hex encoding of it if jansson cannot encode
+         */
+        if ((escaped = json_string(destination)) != NULL)
+        {
+            fputs(",\"destination\":", stream);
+            json_dumpf(escaped, stream, JSON_ENCODE_ANY);
+            json_decref(escaped);
+        }
+        else /* jansson was unable to handle the string */
+        {
+            len = strlen(destination);
+            if ((len * 2 + 1) > MAX_LENGTH)
+            {
+                log_errorx("buffer too small, expected string with length < %d,"
+                        " for non valid utf-8 string: '%s'", MAX_LENGTH,
+                        destination);
+                ret = -1;
+                goto cleanup;
+            }
+            unpack(buf, destination, len);
+            fprintf(stream, ",\"destinationHex\":\"%s\"", buf);
+        }
+    }
+
     /*
      * path     valid utf-8 JSON escaped path to the file
      * pathHex  hex encoding of the path, provided if jansson cannot encode
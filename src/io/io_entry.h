@@ -25,7 +25,9 @@
 
 
 /**
- * Read the next entry from the stream ignoring any metadata lines. Keeps track
+ * Read the next entry from the stream ignoring any metadata lines, the
+ * entries of copies at other destinations, in a MIRROR_ state, and of copies
+ * that failed their verification, in the VERIFY_FAILED state. Keeps track
  * of what line # we are on from the stream and uses it for logging when an
  * error occurs. When -1 is returned there was an error or EOF was hit, use
  * feof() to determine if EOF.
@@ -39,6 +41,18 @@
 int io_entry_read(entry_t *entry, FILE *in, size_t *line);
 
 
+/**
+ * Same as io_entry_read also copying the entry's path to `path`.
+ *
+ * @param path          where to store the path, empty if the entry has none
+ * @param plen          # of bytes in `path`, longer paths are truncated
+ *
+ * @return              0 on success, -1 on error/EOF
+ */
+int io_entry_read_path(entry_t *entry, char *path, size_t plen, FILE *in,
+        size_t *line);
+
+
 /**
  * write the following fields as a JSON object to the stream
  *
@@ -47,10 +61,15 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line);
  * @param st            pointer to the source file's stat struct
  * @param pathmd5       16 byte md5 of the path
  * @param symlinkpath   if entry is symlink where it's pointing, NULL otherwise
+ * @param destination   the other destination an entry of a copy there is of,
+ *                      NULL otherwise
  * @param md5           the md5 of the file's contents or NULL if not applicable
  * @param sha1          sha1 of the file's contents or NULL if not applicable
  * @param sha256        sha256 of the file's contents or NULL if not applicable
  * @param sha512        sha512 of the file's contents or NULL if not applicable
+ * @param xxh3          xxh3 of the file's contents or NULL if not applicable
+ * @param crc32c        crc32c of the file's contents or NULL if not applicable
+ * @param blake3        blake3 of the file's contents or NULL if not applicable
  * @param process_time  # of milliseconds it took to process the file
  * @param stream        where to write the json object
  *
@@ -58,8 +77,10 @@ int io_entry_read(entry_t *entry, FILE *in, size_t *line);
  */
 int io_entry_write_fields(const char *state, const char *path,
         const struct stat *st, const void *pathmd5, const char *symlinkpath,
-        const void *md5, const void *sha1, const void *sha256,
-        const void *sha512, long process_time, FILE *stream);
+        const char *destination, const void *md5, const void *sha1,
+        const void *sha256, const void *sha512, const void *xxh3,
+        const void *crc32c, const void *blake3, long process_time,
+        FILE *stream);
 
 
 #endif
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/stat.h>
@@ -49,6 +50,8 @@ int io_index_read(index_t *idx, const char *path)
     int expected;
     entry_t entry;
     digest_t type;
+    const void *digest;
+    char dapath[PATH_MAX];
 
     if ((stream = fopen(path, "r")) == NULL)
     {
@@ -59,7 +62,8 @@ int io_index_read(index_t *idx, const char *path)
     type = index_get_digest_type(idx);
     linenum = 0;
     expected = 0;
-    while (io_entry_read(&entry, stream, &linenum) == 0)
+    while (io_entry_read_path(&entry, dapath, sizeof(dapath), stream,
+            &linenum) == 0)
     {
         /* the index is only regular files, ignore everything else */
         if (!S_ISREG(entry.mode))
@@ -85,22 +89,22 @@ int io_index_read(index_t *idx, const char *path)
 
        switch (type)
        {
-       case DGST_MD5:
-           add_or_warn(idx, entry.pathmd5, entry.md5, path, linenum);
-           break;
-
-       case DGST_SHA1:
-           add_or_warn(idx, entry.pathmd5, entry.sha1, path, linenum);
-           break;
+       case DGST_MD5:       digest = entry.md5;     break;
+       case DGST_SHA1:      digest = entry.sha1;    break;
+       case DGST_SHA256:    digest = entry.sha256;  break;
+       case DGST_SHA512:    digest = entry.sha512;  break;
+       case DGST_XXH3:      digest = entry.xxh3;    break;
+       case DGST_CRC32C:    digest = entry.crc32c;  break;
+       case DGST_BLAKE3:    digest = entry.blake3;  break;
+       default:             continue;
+       }
 
-       case DGST_SHA256:
-           add_or_warn(idx, entry.pathmd5, entry.sha256, path, linenum);
-           break;
+       add_or_warn(idx, entry.pathmd5, digest, path, linenum);
 
-       case DGST_SHA512:
-           add_or_warn(idx, entry.pathmd5, entry.sha512, path, linenum);
-           break;
-       }
+       /* renamed files are found by their content at the path they had */
+       if (dapath[0] != '\0' &&
+               index_insert_content(idx, digest, entry.size, dapath) != 0)
+           log_warnx("cannot index the content of '%s:%zd'", path, linenum);
     }
     fclose(stream);
     return 0;
@@ -162,5 +166,8 @@ int valid_digests(const entry_t *entry)
     if (entry->sha1   != NULL) dgsts |= DGST_SHA1;
     if (entry->sha256 != NULL) dgsts |= DGST_SHA256;
     if (entry->sha512 != NULL) dgsts |= DGST_SHA512;
+    if (entry->xxh3   != NULL) dgsts |= DGST_XXH3;
+    if (entry->crc32c != NULL) dgsts |= DGST_CRC32C;
+    if (entry->blake3 != NULL) dgsts |= DGST_BLAKE3;
     return dgsts;
 }
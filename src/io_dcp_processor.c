@@ -46,14 +46,24 @@ static int process_xattrs(const void *pathmd5, const char *filepath, FILE *out);
 int io_dcp_processor(dcp_state_t state, const void *pathmd5,
         const char *dapath, const struct stat *st, const char *accesspath,
         const char *symlinkpath, const void *md5, const void *sha1,
-        const void *sha256, const void *sha512, unsigned long process_time,
+        const void *sha256, const void *sha512, const void *xxh3,
+        const void *crc32c, const void *blake3, unsigned long process_time,
         void *context)
 {
     struct io_dcp_processor_ctx *ctx = context;
+
+    /* the xattrs were written with the item, copies at other destinations
+     * only tell which destination they are at */
+    if (state == DCP_MIRROR_COPIED || state == DCP_MIRROR_FAILED)
+        return io_entry_write_fields(dcp_strstate(state), dapath, st,
+                pathmd5, symlinkpath, accesspath, NULL, NULL, NULL, NULL,
+                NULL, NULL, NULL, process_time, ctx->out);
+
     process_xattrs(pathmd5, accesspath, ctx->xattrout);
 
     return io_entry_write_fields(dcp_strstate(state), dapath, st, pathmd5,
-            symlinkpath, md5, sha1, sha256, sha512, process_time, ctx->out);
+            symlinkpath, NULL, md5, sha1, sha256, sha512, xxh3, crc32c,
+            blake3, process_time, ctx->out);
 }
 
 
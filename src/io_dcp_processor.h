@@ -38,12 +38,16 @@ typedef struct io_dcp_processor_ctx io_dcp_processor_ctx_t;
  * @param pathmd5           the md5 sum of the file's dapath
  * @param dapath            mount relative path to the file to be copied
  * @param st                stat struct for the source file
- * @param accesspath        path to the original file
+ * @param accesspath        path to the original file, or the destination of
+ *                          a MIRROR_ entry, written as its destination
  * @param symlinkpath       if file is a symbolic link, where is it pointing
  * @param md5               md5 digest of the file
  * @param sha1              sha1 digest of the file
  * @param sha256            sha256 digest of the file
  * @param sha512            sha512 digest of the file
+ * @param xxh3              xxh3 digest of the file
+ * @param crc32c            crc32c of the file
+ * @param blake3            blake3 digest of the file
  * @param elapsed           secs to process the entry, ignored if NULL
  * @param context           pointer to an initialized io_digest_output_context_t
  *                          instance
@@ -53,7 +57,8 @@ typedef struct io_dcp_processor_ctx io_dcp_processor_ctx_t;
 int io_dcp_processor(dcp_state_t state, const void *pathmd5,
         const char *dapath, const struct stat *st, const char *accesspath,
         const char *symlinkpath, const void *md5, const void *sha1,
-        const void *sha256, const void *sha512, unsigned long process_time,
+        const void *sha256, const void *sha512, const void *xxh3,
+        const void *crc32c, const void *blake3, unsigned long process_time,
         void *context);
 
 
@@ -47,6 +47,7 @@
 #define ENV_OWNER           "DCP_OWNER"
 #define ENV_GROUP           "DCP_GROUP"
 #define ENV_CACHE_SIZE      "DCP_CACHE_SIZE"
+#define ENV_BUFFER_SIZE     "DCP_BUFFER_SIZE"
 
 
 /* Type Defs ******************************************************************/
@@ -74,8 +75,28 @@ struct mainopts {
     char *groupname;        /**< what group will own the copies               */
 
     size_t cache_size;      /**< how much memory to set aside for caching     */
+    size_t buffer_size;     /**< how many bytes to read/write per request     */
 
     int verbose_mode;       /**< should we output what is being done          */
+    dcp_mode_t mode;        /**< copy, or only profile the sources            */
+    int verify;             /**< reread copies and compare their digests      */
+    const char *manifest;   /**< NULL or output to check the source against   */
+    size_t threads;         /**< # of files to check at once, 0 for # of cpus */
+    dcp_xattr_t digest_xattr;/**< where to cache digests between runs         */
+    int hardlinks;          /**< link later links of a file to its first copy */
+    const char *linkdest;   /**< NULL or a previous destination to link from  */
+    int renames;            /**< find files in the inputs by content as well  */
+    dcp_dedup_t dedup;      /**< how identical files in the run are copied    */
+    const char *store;      /**< NULL or where each unique body is kept once  */
+    const char *chunks;     /**< NULL or where chunks of the copies are kept  */
+    int unchunk;            /**< restore the recipes in SRC from `chunks`     */
+    const char **mirrors;   /**< other destinations to write every copy to    */
+    size_t mirrorc;         /**< # of `mirrors`                               */
+    const char *tar;        /**< NULL or where to write the copy as a tar     */
+    int send;               /**< the tar is for a receiving dcp               */
+    int untar;              /**< the source is a tar to copy the members of   */
+    int preserve;           /**< copies keep the mode and times of the source */
+    int fresh;              /**< create items without looking for them first  */
 };
 
 
@@ -95,6 +116,7 @@ static int print_metadata(FILE *out, const char *version, int argc,
  * or the command line to usable values
  */
 static int    parse_digests(const struct cmdline_info *info);
+static void   parse_digest_backends(const struct cmdline_info *info);
 static FILE  *parse_outputstream(const struct cmdline_info *info,
         char **outfilename);
 static FILE  *parse_xattroutputstream(const struct cmdline_info *info,
@@ -102,14 +124,40 @@ static FILE  *parse_xattroutputstream(const struct cmdline_info *info,
 static gid_t  parse_group(const struct cmdline_info *info, char **name);
 static uid_t  parse_owner(const struct cmdline_info *info, char **name);
 static size_t parse_cache_size(const struct cmdline_info *info);
+static size_t parse_buffer_size(const struct cmdline_info *info);
+static dcp_mode_t parse_mode(const struct cmdline_info *info);
+static dcp_xattr_t parse_digest_xattr(const struct cmdline_info *info,
+        dcp_mode_t mode);
+static const char *parse_link_dest(const struct cmdline_info *info,
+        dcp_mode_t mode);
+static dcp_dedup_t parse_dedup(const struct cmdline_info *info,
+        dcp_mode_t mode);
+static const char *parse_chunk_store(const struct cmdline_info *info,
+        dcp_mode_t mode);
+static size_t parse_also_to(const struct cmdline_info *info, dcp_mode_t mode);
+static const char *parse_tar(const struct cmdline_info *info, dcp_mode_t mode);
+static int parse_untar(const struct cmdline_info *info, dcp_mode_t mode);
+static int parse_preserve(const struct cmdline_info *info, dcp_mode_t mode);
 
-static index_t *build_index(int digests, const char *paths[], size_t count);
+/**
+ * convert a size string with an optional k, m or g suffix to a number of bytes
+ */
+static size_t parse_size(const char *val, const char *what);
+
+static index_t *build_index(int digests, const char *paths[], size_t count,
+        int content);
 
 static int mainopts_parse(struct mainopts *opts,const struct cmdline_info*info);
 static void mainopts_cleanup(struct mainopts *opts);
 
 static int dcp_main(const struct mainopts *opts, int argc, const char *argv[]);
 
+
+/**
+ * run the digest self-test and/or benchmark instead of a copy
+ */
+static int digest_main(const struct cmdline_info *info);
+
 /**
  * for dcp we want `dcp src dest` to be the same as `dcp src dest/src` where
  * dest exists in both. To make this happen before we call dcp we will create
@@ -132,6 +180,16 @@ int main(int argc, const char *argv[])
     /* use the gengetopts code to parse the command line input, then convert to
      * a dcp_options struct */
     cmdline_parser(argc, (char **) argv, &info);
+    parse_digest_backends(&info);
+
+    /* these only exercise the digests, there is no SRC or DEST */
+    if (info.digest_selftest_flag || info.digest_benchmark_flag)
+    {
+        r = digest_main(&info);
+        cmdline_parser_free(&info);
+        return r;
+    }
+
     mainopts_parse(&opts, &info);
     r = dcp_main(&opts, argc, argv);
     mainopts_cleanup(&opts);
@@ -145,22 +203,44 @@ int main(int argc, const char *argv[])
 
 size_t parse_cache_size(const struct cmdline_info *info)
 {
-    size_t size;
     const char *val;
-    char *end;
-
-    size = 32768; /* default if not specified */
 
     val = getenv(ENV_CACHE_SIZE);
     if (info->cache_size_given)
         val = info->cache_size_arg;
 
+    /* default if not specified, room for many small files */
+    if (val == NULL)
+        return 2 * 1024 * 1024;
+
+    return parse_size(val, "cache");
+}
+
+
+size_t parse_buffer_size(const struct cmdline_info *info)
+{
+    const char *val;
+
+    val = getenv(ENV_BUFFER_SIZE);
+    if (info->buffer_size_given)
+        val = info->buffer_size_arg;
+
+    /* default if not specified */
     if (val == NULL)
-        return size;
+        return 32768;
+
+    return parse_size(val, "buffer");
+}
+
+
+size_t parse_size(const char *val, const char *what)
+{
+    size_t size;
+    char *end;
 
     size = strtol(val, &end, 0);
     if (val == end)
-        log_critx(EXIT_FAILURE, "invalid cache size: '%s'", val);
+        log_critx(EXIT_FAILURE, "invalid %s size: '%s'", what, val);
 
     switch (*end)
     {
@@ -169,30 +249,291 @@ size_t parse_cache_size(const struct cmdline_info *info)
     case 'm':  case 'M':    size *= (1024 * 1024);          break;
     case 'g':  case 'G':    size *= (1024 * 1024 * 1024);   break;
     default:
-        log_critx(EXIT_FAILURE, "invalid cache suffix: '%s'", val);
+        log_critx(EXIT_FAILURE, "invalid %s suffix: '%s'", what, val);
     }
 
     return size;
 }
 
 
+dcp_mode_t parse_mode(const struct cmdline_info *info)
+{
+    /* checking never writes, like profiling the path */
+    if (info->check_given)
+    {
+        if (info->input_given)
+            log_critx(EXIT_FAILURE, "--check cannot be used with --input");
+        if (info->inputs_num > 1)
+            log_critx(EXIT_FAILURE, "--check takes a single PATH");
+        if (info->compare_flag)
+            log_critx(EXIT_FAILURE, "--check cannot be used with --compare");
+        return DCP_MODE_PROFILE;
+    }
+
+    /* comparing maps SRC to DEST like a copy but only reads both */
+    if (info->compare_flag)
+    {
+        if (info->input_given)
+            log_critx(EXIT_FAILURE, "--compare cannot be used with --input");
+        if (info->no_copy_flag || info->stat_only_flag || info->verify_flag)
+            log_critx(EXIT_FAILURE, "--compare cannot be used with --no-copy, "
+                    "--stat-only or --verify");
+        return DCP_MODE_COMPARE;
+    }
+
+    if (info->stat_only_flag)
+    {
+        /* the index is keyed by digest, without them nothing can be found */
+        if (info->input_given)
+            log_critx(EXIT_FAILURE, "--stat-only cannot be used with --input");
+        return DCP_MODE_STAT;
+    }
+
+    return info->no_copy_flag? DCP_MODE_PROFILE : DCP_MODE_COPY;
+}
+
+
+dcp_xattr_t parse_digest_xattr(const struct cmdline_info *info,
+        dcp_mode_t mode)
+{
+    if (!info->digest_xattr_given)
+        return DCP_XATTR_NONE;
+
+    if (strcmp(info->digest_xattr_arg, "source") == 0)
+        return DCP_XATTR_SOURCE;
+
+    if (strcmp(info->digest_xattr_arg, "dest") != 0)
+        log_critx(EXIT_FAILURE, "--digest-xattr must be 'source' or 'dest'");
+    if (mode != DCP_MODE_COPY)
+        log_critx(EXIT_FAILURE, "--digest-xattr=dest needs a copy");
+    return DCP_XATTR_DEST;
+}
+
+
+const char *parse_link_dest(const struct cmdline_info *info, dcp_mode_t mode)
+{
+    struct stat st;
+
+    if (!info->link_dest_given)
+        return NULL;
+
+    /* only files found in the index are linked, the rest are copied */
+    if (mode != DCP_MODE_COPY || !info->input_given)
+        log_critx(EXIT_FAILURE, "--link-dest needs a copy with --input");
+    if (stat(info->link_dest_arg, &st) != 0 || !S_ISDIR(st.st_mode))
+        log_critx(EXIT_FAILURE, "--link-dest '%s' is not a directory",
+                info->link_dest_arg);
+    return info->link_dest_arg;
+}
+
+
+dcp_dedup_t parse_dedup(const struct cmdline_info *info, dcp_mode_t mode)
+{
+    dcp_dedup_t dedup;
+
+    if (!info->dedup_given)
+        return DCP_DEDUP_NONE;
+
+    if (strcmp(info->dedup_arg, "reflink") == 0)
+        dedup = DCP_DEDUP_REFLINK;
+    else if (strcmp(info->dedup_arg, "hardlink") == 0)
+        dedup = DCP_DEDUP_HARDLINK;
+    else
+        log_critx(EXIT_FAILURE, "--dedup must be 'reflink' or 'hardlink'");
+
+    if (mode != DCP_MODE_COPY)
+        log_critx(EXIT_FAILURE, "--dedup needs a copy");
+
+    /* files are only linked in place of one another by a digest that cannot
+     * be made to collide */
+    if (!info->blake3_flag && !info->sha256_flag && !info->sha512_flag)
+        log_critx(EXIT_FAILURE, "--dedup needs --blake3, --sha256 or "
+                "--sha512");
+    return dedup;
+}
+
+
+const char *parse_chunk_store(const struct cmdline_info *info,
+        dcp_mode_t mode)
+{
+    if (!info->chunk_store_given)
+    {
+        if (info->unchunk_flag)
+            log_critx(EXIT_FAILURE, "--unchunk needs --chunk-store");
+        return NULL;
+    }
+
+    if (mode != DCP_MODE_COPY)
+        log_critx(EXIT_FAILURE, "--chunk-store needs a copy");
+
+    /* every other way of making a copy writes the whole file */
+    if (info->input_given || info->dedup_given || info->store_given ||
+            info->verify_flag || info->digest_xattr_given)
+        log_critx(EXIT_FAILURE, "--chunk-store cannot be used with --input, "
+                "--dedup, --store, --verify or --digest-xattr");
+    return info->chunk_store_arg;
+}
+
+
+size_t parse_also_to(const struct cmdline_info *info, dcp_mode_t mode)
+{
+    if (!info->also_to_given)
+        return 0;
+
+    if (mode != DCP_MODE_COPY)
+        log_critx(EXIT_FAILURE, "--also-to needs a copy");
+
+    /* only items written in full or linked to one are created at the others */
+    if (info->link_dest_given || info->dedup_given || info->store_given ||
+            info->chunk_store_given)
+        log_critx(EXIT_FAILURE, "--also-to cannot be used with --link-dest, "
+                "--dedup, --store or --chunk-store");
+    return info->also_to_given;
+}
+
+
+const char *parse_tar(const struct cmdline_info *info, dcp_mode_t mode)
+{
+    const char *name;
+    const char *path;
+
+    /* sending is writing an archive to stdout for a receiving dcp */
+    if (!info->tar_given && !info->send_flag)
+        return NULL;
+    if (info->tar_given && info->send_flag)
+        log_critx(EXIT_FAILURE, "--send cannot be used with --tar");
+    name = info->send_flag? "--send" : "--tar";
+    path = info->send_flag? "-" : info->tar_arg;
+
+    if (mode != DCP_MODE_COPY)
+        log_critx(EXIT_FAILURE, "%s needs a copy", name);
+
+    /* nothing is written but the stream, there is no tree to link or reread */
+    if (info->link_dest_given || info->dedup_given || info->store_given ||
+            info->chunk_store_given || info->also_to_given ||
+            info->verify_flag || parse_digest_xattr(info, mode) ==
+            DCP_XATTR_DEST)
+        log_critx(EXIT_FAILURE, "%s cannot be used with --link-dest, "
+                "--dedup, --store, --chunk-store, --also-to, --verify or "
+                "--digest-xattr=dest", name);
+
+    if (strcmp(path, "-") == 0 && info->verbose_flag)
+        log_critx(EXIT_FAILURE, "%s cannot be used with --verbose when it "
+                "writes to stdout", name);
+    return path;
+}
+
+
+int parse_untar(const struct cmdline_info *info, dcp_mode_t mode)
+{
+    const char *name;
+
+    /* receiving is reading an archive from stdin sent by another dcp */
+    if (!info->untar_flag && !info->receive_flag)
+        return 0;
+    if (info->receive_flag && (info->untar_flag || info->send_flag))
+        log_critx(EXIT_FAILURE, "--receive cannot be used with --untar or "
+                "--send");
+    name = info->receive_flag? "--receive" : "--untar";
+
+    if (mode == DCP_MODE_COMPARE || info->check_given)
+        log_critx(EXIT_FAILURE, "%s cannot be used with --compare or "
+                "--check", name);
+    if (info->receive_flag && mode != DCP_MODE_COPY)
+        log_critx(EXIT_FAILURE, "--receive needs a copy");
+
+    /* members are only ever read once, in order, and have no path to go
+     * back to */
+    if (info->input_given || info->link_dest_given || info->dedup_given ||
+            info->store_given || info->chunk_store_given ||
+            info->also_to_given || info->digest_xattr_given)
+        log_critx(EXIT_FAILURE, "%s cannot be used with --input, "
+                "--link-dest, --dedup, --store, --chunk-store, --also-to or "
+                "--digest-xattr", name);
+    return 1;
+}
+
+
+int parse_preserve(const struct cmdline_info *info, dcp_mode_t mode)
+{
+    if (!info->preserve_flag)
+        return 0;
+
+    if (mode != DCP_MODE_COPY)
+        log_critx(EXIT_FAILURE, "--preserve needs a copy");
+
+    /* copies sharing an inode cannot each keep their own, the other
+     * destinations are only ever given an owner */
+    if (info->store_given || info->also_to_given || (info->dedup_given &&
+            strcmp(info->dedup_arg, "hardlink") == 0))
+        log_critx(EXIT_FAILURE, "--preserve cannot be used with --store, "
+                "--dedup=hardlink or --also-to");
+
+    /* the record is written with the copy's times, setting them afterwards
+     * would leave it stale */
+    if (parse_digest_xattr(info, mode) == DCP_XATTR_DEST)
+        log_critx(EXIT_FAILURE, "--preserve cannot be used with "
+                "--digest-xattr=dest");
+    return 1;
+}
+
+
 int parse_digests(const struct cmdline_info *info)
 {
     int digests;
 
     digests = 0;
      /* create digest mask */
-    if (info->all_flag)     return DGST_ALL;
+    if (info->all_flag)     return DGST_CRYPTO;
     if (info->md5_flag)     digests  |=  DGST_MD5;
     if (info->sha1_flag)    digests  |=  DGST_SHA1;
     if (info->sha256_flag)  digests  |=  DGST_SHA256;
     if (info->sha512_flag)  digests  |=  DGST_SHA512;
+    if (info->xxh3_flag)    digests  |=  DGST_XXH3;
+    if (info->crc32c_flag)  digests  |=  DGST_CRC32C;
+    if (info->blake3_flag)  digests  |=  DGST_BLAKE3;
     if (digests == 0)
         digests = DGST_MD5;
     return digests;
 }
 
 
+void parse_digest_backends(const struct cmdline_info *info)
+{
+    const char *names[8];
+    const char *name;
+    size_t i, n, len;
+    int type;
+
+    for (i = 0; i < info->digest_backend_given; i++)
+    {
+        /* DIGEST:BACKEND */
+        if ((name = strchr(info->digest_backend_arg[i], ':')) == NULL)
+            log_critx(EXIT_FAILURE, "invalid digest backend '%s', expected "
+                    "DIGEST:BACKEND", info->digest_backend_arg[i]);
+
+        len = name++ - info->digest_backend_arg[i];
+        for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+            if (strlen(digest_name(type)) == len && strncmp(digest_name(type),
+                    info->digest_backend_arg[i], len) == 0)
+                break;
+
+        if (!(type & DGST_ALL))
+            log_critx(EXIT_FAILURE, "unknown digest in '%s'",
+                    info->digest_backend_arg[i]);
+
+        if (digest_backend_select(type, name) != 0)
+        {
+            n = digest_backend_list(type, names, 8);
+            log_critx(EXIT_FAILURE, "%s has no backend '%s' on this CPU, it "
+                    "has %s%s%s%s", digest_name(type), name, names[0],
+                    n > 1? ", " : "", n > 1? names[1] : "",
+                    n > 2? ", ..." : "");
+        }
+    }
+}
+
+
 FILE *parse_outputstream(const struct cmdline_info *info, char **outfilename)
 {
     int fd;
@@ -321,27 +662,88 @@ gid_t parse_group(const struct cmdline_info *info, char **name)
 
 int mainopts_parse(struct mainopts *opts, const struct cmdline_info *info)
 {
+    static const char *received[2];
+    int hasdest;
+
     /* initialize logging */
     logging_debug_mode = info->debug_flag;
 
-    /* setup input files and output dir */
-    opts->filecount     = ((signed) info->inputs_num) - 1;
-    if (opts->filecount < 0)
+    /* setup input files and output dir, when profiling every operand is a
+     * source */
+    opts->mode          = parse_mode(info);
+    hasdest             = (opts->mode == DCP_MODE_COPY && !info->tar_given &&
+            !info->send_flag) || opts->mode == DCP_MODE_COMPARE;
+    opts->filecount     = ((signed) info->inputs_num) - hasdest;
+    opts->files         = (const char **) info->inputs;
+
+    /* a receiver's only operand is DEST, the source is stdin */
+    if (info->receive_flag && info->inputs_num == 1)
+    {
+        received[0]     = "-";
+        received[1]     = info->inputs[0];
+        opts->files     = received;
+        opts->filecount = 1;
+    }
+    else if (info->receive_flag)
+        log_critx(EXIT_FAILURE, "--receive takes DEST as its only operand");
+    if (opts->filecount < 0 || info->inputs_num == 0)
         log_critx(EXIT_FAILURE, "missing file operand");
     if (opts->filecount == 0)
         log_critx(EXIT_FAILURE,
                 "missing destination file operand after '%s'", info->inputs[0]);
-    opts->files          = (const char **) info->inputs;
-    opts->dest           = opts->files[opts->filecount];
-    opts->digests        = parse_digests(info);
+    opts->dest           = hasdest? opts->files[opts->filecount] : NULL;
+    opts->digests        = opts->mode == DCP_MODE_STAT? 0 : parse_digests(info);
     opts->outputstream   = parse_outputstream(info, &opts->outfilename);
     opts->xattroutputstream = parse_xattroutputstream(info, &opts->xattroutfilename);
     opts->inputs         = (const char **) info->input_arg;
     opts->inputcount     = info->input_given;
     opts->uid            = parse_owner(info, &opts->username);
     opts->gid            = parse_group(info, &opts->groupname);
+    opts->preserve       = parse_preserve(info, opts->mode);
+    /* a preserved copy is owned like its source unless an owner is given */
+    if (opts->preserve && opts->username == NULL)
+        opts->uid = (uid_t) -1;
+    if (opts->preserve && opts->groupname == NULL)
+        opts->gid = (gid_t) -1;
     opts->cache_size     = parse_cache_size(info);
+    opts->buffer_size    = parse_buffer_size(info);
     opts->verbose_mode   = info->verbose_flag;
+    opts->verify         = info->verify_flag;
+    opts->manifest       = info->check_given? info->check_arg : NULL;
+    opts->digest_xattr   = parse_digest_xattr(info, opts->mode);
+    opts->hardlinks      = !info->no_hardlinks_flag;
+    opts->linkdest       = parse_link_dest(info, opts->mode);
+    opts->renames        = info->renames_flag;
+    opts->dedup          = parse_dedup(info, opts->mode);
+    opts->store          = info->store_given? info->store_arg : NULL;
+    if (opts->store != NULL && opts->mode != DCP_MODE_COPY)
+        log_critx(EXIT_FAILURE, "--store needs a copy");
+    if (opts->store != NULL && !info->blake3_flag && !info->sha256_flag &&
+            !info->sha512_flag)
+        log_critx(EXIT_FAILURE, "--store needs --blake3, --sha256 or "
+                "--sha512");
+    opts->chunks         = parse_chunk_store(info, opts->mode);
+    opts->unchunk        = info->unchunk_flag;
+    opts->mirrors        = (const char **) info->also_to_arg;
+    opts->mirrorc        = parse_also_to(info, opts->mode);
+    opts->tar            = parse_tar(info, opts->mode);
+    opts->untar          = parse_untar(info, opts->mode);
+    opts->send           = info->send_flag;
+    opts->fresh          = info->fresh_flag;
+    if (opts->fresh && (opts->mode != DCP_MODE_COPY || opts->tar != NULL))
+        log_critx(EXIT_FAILURE, "--fresh needs a copy to a destination");
+    if (opts->untar && opts->filecount != 1)
+        log_critx(EXIT_FAILURE, "--untar takes a single archive");
+    if (opts->renames && !info->input_given)
+        log_critx(EXIT_FAILURE, "--renames needs --input");
+    opts->threads        = 0;
+    if (info->threads_given)
+    {
+        if (info->threads_arg < 1)
+            log_critx(EXIT_FAILURE, "invalid # of threads: %d",
+                    info->threads_arg);
+        opts->threads = info->threads_arg;
+    }
     return 0;
 }
 
@@ -357,6 +759,24 @@ void mainopts_cleanup(struct mainopts *opts)
 }
 
 
+int digest_main(const struct cmdline_info *info)
+{
+    int r;
+
+    r = 0;
+    if (info->digest_selftest_flag && digest_selftest(stdout) != 0)
+    {
+        log_errorx("digest self-test failed");
+        r = EXIT_FAILURE;
+    }
+
+    if (info->digest_benchmark_flag)
+        digest_benchmark(stdout, parse_buffer_size(info));
+
+    return r;
+}
+
+
 int dcp_main(const struct mainopts *opts, int argc, const char *argv[])
 {
     int r;
@@ -365,18 +785,33 @@ int dcp_main(const struct mainopts *opts, int argc, const char *argv[])
     io_dcp_processor_ctx_t *ctx;
     struct dcp_options dcpopts;
     char *dest;
+    char **mirrors;
+    size_t i;
+    const char *manifest;
 
     /* initilaize the index */
     idx = NULL;
+    mirrors = NULL;
     digests = opts->digests;
-    if (opts->inputs != NULL)
+    if (opts->manifest != NULL)
+    {
+        /* only the digest the manifest is keyed by is recalculated */
+        manifest = opts->manifest;
+        if (io_index_digest_peek(&manifest, 1, &digests) != 0)
+            log_critx(EXIT_FAILURE,
+                    "cannot determine digest types from '%s'", manifest);
+        idx = build_index(digests, &manifest, 1, 0);
+        digests = index_get_digest_type(idx);
+    }
+    else if (opts->inputs != NULL)
     {
         /* when inputs are given generate their digests instead of relying on
          * the command line args */
         if (io_index_digest_peek(opts->inputs, opts->inputcount, &digests) != 0)
             log_critx(EXIT_FAILURE,
                     "cannot determine digest types from input file(s)");
-        idx = build_index(digests, opts->inputs, opts->inputcount);
+        idx = build_index(digests, opts->inputs, opts->inputcount,
+                opts->renames);
     }
 
     /* output information about this run of dcp */
@@ -388,29 +823,75 @@ int dcp_main(const struct mainopts *opts, int argc, const char *argv[])
         log_critx(EXIT_FAILURE, "cannot instantiate output context");
 
     /* set the options struct */
-    dcpopts.bufsize           = opts->cache_size;
-    dcpopts.digests           = opts->digests;
+    dcpopts.bufsize           = opts->buffer_size;
+    dcpopts.cachesize         = opts->cache_size;
+    dcpopts.digests           = digests;
     dcpopts.uid               = opts->uid;
     dcpopts.gid               = opts->gid;
     dcpopts.index             = idx;
     dcpopts.verbose           = opts->verbose_mode;
+    dcpopts.mode              = opts->mode;
+    dcpopts.verify            = opts->verify;
+    dcpopts.threads           = opts->threads;
+    dcpopts.digest_xattr      = opts->digest_xattr;
+    dcpopts.hardlinks         = opts->hardlinks;
+    dcpopts.linkdest          = opts->linkdest;
+    dcpopts.dedup             = opts->dedup;
+    dcpopts.store             = opts->store;
+    dcpopts.chunks            = opts->chunks;
+    dcpopts.unchunk           = opts->unchunk;
+    dcpopts.mirrors           = NULL;
+    dcpopts.mirrorc           = 0;
+    dcpopts.tar               = opts->tar;
+    dcpopts.untar             = opts->untar;
+    dcpopts.send              = opts->send;
+    dcpopts.preserve          = opts->preserve;
+    dcpopts.fresh             = opts->fresh;
 
     /* quick check and dir creation if needed, will provide an updated dest
-     * path if needed */
-    if (prepare(opts->files, opts->filecount, opts->dest, &dest) != 0)
+     * path if needed. A comparison is with the copy that was made, DEST is
+     * never a directory to copy into. */
+    dest = NULL;
+    if (opts->dest != NULL && opts->mode == DCP_MODE_COPY && !opts->untar &&
+            prepare(opts->files, opts->filecount, opts->dest, &dest) != 0)
         log_critx(EXIT_FAILURE, "cannot prepare destination");
 
     /* if prepare was successful and didn't need to alter dest it sets dest to
      * NULL, point it to the original dest and continue */
-    if (dest == NULL)
+    if (dest == NULL && opts->dest != NULL)
         dest = strdup(opts->dest);
 
-    /* Start the copy */
-    r = dcp(dest, opts->files, opts->filecount, &dcpopts,
-            &io_dcp_processor, ctx);
+    /* the other destinations are prepared the same way */
+    if (opts->mirrorc != 0)
+    {
+        if ((mirrors = calloc(opts->mirrorc, sizeof(char *))) == NULL)
+            log_critx(EXIT_FAILURE, "cannot prepare destinations");
+        for (i = 0; i < opts->mirrorc; i++)
+        {
+            if (prepare(opts->files, opts->filecount, opts->mirrors[i],
+                    &mirrors[i]) != 0)
+                log_critx(EXIT_FAILURE, "cannot prepare destination '%s'",
+                        opts->mirrors[i]);
+            if (mirrors[i] == NULL)
+                mirrors[i] = strdup(opts->mirrors[i]);
+        }
+        dcpopts.mirrors = (const char **) mirrors;
+        dcpopts.mirrorc = opts->mirrorc;
+    }
+
+    /* Start the copy, or the check */
+    if (opts->manifest != NULL)
+        r = dcp_check(opts->files[0], opts->manifest, &dcpopts,
+                &io_dcp_processor, ctx);
+    else
+        r = dcp(dest, opts->files, opts->filecount, &dcpopts,
+                &io_dcp_processor, ctx);
 
     /* cleanup */
     free(dest);
+    for (i = 0; i < dcpopts.mirrorc; i++)
+        free(mirrors[i]);
+    free(mirrors);
     if (idx   != NULL) index_free(idx);
 
     io_dcp_processor_ctx_free(ctx);
@@ -419,20 +900,32 @@ int dcp_main(const struct mainopts *opts, int argc, const char *argv[])
 }
 
 
-index_t *build_index(int digests, const char *paths[], size_t count)
+index_t *build_index(int digests, const char *paths[], size_t count,
+        int content)
 {
     index_t *idx;
     digest_t type;
     size_t i;
 
-    /* assign type to the first valid one we find, checking md5 then sha1 ... */
-    if (  !(type = digests & DGST_MD5)    && !(type = digests & DGST_SHA1) &&
-          !(type = digests & DGST_SHA256) && !(type = digests & DGST_SHA512))
+    /* assign type to the first valid one we find, xxh3 and blake3 are the
+     * fastest so check them first, then md5, sha1 ... and lastly the 32 bit
+     * crc32c */
+    if (  !(type = digests & DGST_XXH3)   && !(type = digests & DGST_BLAKE3) &&
+          !(type = digests & DGST_MD5)    && !(type = digests & DGST_SHA1)   &&
+          !(type = digests & DGST_SHA256) && !(type = digests & DGST_SHA512) &&
+          !(type = digests & DGST_CRC32C))
         log_critx(EXIT_FAILURE, "corrput parsing of digest types from inputs");
 
     if (index_create(&idx, type) != 0)
         log_critx(EXIT_FAILURE, "cannot create index");
 
+    /* a file found by its content alone is not copied, 32 bits is too few */
+    if (content && type == DGST_CRC32C)
+        log_critx(EXIT_FAILURE, "--renames needs inputs with a digest other "
+                "than crc32c");
+    if (content && index_track_content(idx) != 0)
+        log_critx(EXIT_FAILURE, "cannot create content index");
+
     for (i = 0; i < count; i++)
         if (io_index_read(idx, paths[i]) != 0)
             log_critx(EXIT_FAILURE,
@@ -512,8 +1005,9 @@ int print_metadata(FILE *out, const char *version, int argc,
 {
     time_t t;
     char *timestamp;
-    char *dgsts[4];
-    int dsize;
+    char *dgsts[7];
+    char *backends[7];
+    int dsize, bsize, type;
     char *cwd;
     char hostname[HOST_NAME_MAX + 1];
 
@@ -531,6 +1025,16 @@ int print_metadata(FILE *out, const char *version, int argc,
     if (HAS_SHA1(digests))   dgsts[dsize++] = "sha1";
     if (HAS_SHA256(digests)) dgsts[dsize++] = "sha256";
     if (HAS_SHA512(digests)) dgsts[dsize++] = "sha512";
+    if (HAS_XXH3(digests))   dgsts[dsize++] = "xxh3";
+    if (HAS_CRC32C(digests)) dgsts[dsize++] = "crc32c";
+    if (HAS_BLAKE3(digests)) dgsts[dsize++] = "blake3";
+
+    /* and which implementation calculates them */
+    bsize = 0;
+    for (type = DGST_MD5; type & DGST_ALL; type <<= 1)
+        if ((digests & type) && asprintf(&backends[bsize], "%s=%s",
+                digest_name(type), digest_backend_name(type)) >= 0)
+            bsize++;
 
     /* current working directory */
     if ((cwd = getcwd(NULL, 0)) == NULL)
@@ -545,6 +1049,10 @@ int print_metadata(FILE *out, const char *version, int argc,
     io_metadata_put(     "timestamp  ", timestamp, out);
     io_metadata_put_strs("command    ", argc, argv, " ", out);
     io_metadata_put_strs("digests    ", dsize, (const char **) dgsts, ", ",out);
+    io_metadata_put_strs("backends   ", bsize, (const char **) backends, ", ",
+            out);
+    while (bsize > 0)
+        free(backends[--bsize]);
     io_metadata_put(     "host       ", hostname, out);
 
     if (cwd != NULL)
@@ -554,7 +1062,8 @@ int print_metadata(FILE *out, const char *version, int argc,
     }
 
     io_metadata_put_json("sources    ", opts->filecount, opts->files, out);
-    io_metadata_put_json("destination",1,(const char **) &opts->dest, out);
+    if (opts->dest != NULL)
+        io_metadata_put_json("destination",1,(const char **)&opts->dest, out);
     io_metadata_put_json("output     ",1,(const char**)&opts->outfilename,out);
 
     if (opts->username != NULL)